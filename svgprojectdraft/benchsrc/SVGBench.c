@@ -0,0 +1,976 @@
+/**
+ * @file SVGBench.c
+ * @brief Throughput benchmarks for the SVG library.
+ *
+ * Compares the library number formatter and element emitters against
+ * the snprintf("%lf") path they replaced.
+ */
+#define _GNU_SOURCE
+#include "svg.h"
+#include "svg_arena.h"
+#include "svg_list.h"
+#include "svg_sinks.h"
+#include "svg_tiles.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#define BENCH_VALUE_COUNT       1000000
+#define BENCH_ELEMENT_COUNT     1000000
+#define BENCH_PLAIN_PATH        "./benchbin/bench_plain.svg"
+#define BENCH_SVGZ_PATH         "./benchbin/bench_stream.svgz"
+#define BENCH_FILE_PATH         "./benchbin/bench_file.svg"
+#define BENCH_LIST_PATH         "./benchbin/bench_list.svgl"
+#define BENCH_FRAME_SCENE       100000
+#define BENCH_FRAME_CHANGES     100
+#define BENCH_FRAME_COUNT       100
+#define BENCH_DOCUMENT_COUNT    100000
+#define BENCH_DOCUMENT_ELEMENTS 50
+#define BENCH_TILES_CANVAS      100000
+#define BENCH_TILES_TILE        4096
+
+static const char *BENCH_STYLE = "fill:none; stroke:green; stroke-width:2";
+
+// Totals collected by the null sink.
+typedef struct{
+    size_t DBytes;
+    size_t DWrites;
+} SBenchSink;
+
+// Returns a monotonic timestamp in seconds.
+static double bench_now(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+// Write callback that only counts what it is given.
+static svg_return_t bench_null_write(svg_user_context_ptr user, const char *text){
+    SBenchSink *Sink = (SBenchSink *)user;
+    Sink->DBytes += strlen(text);
+    Sink->DWrites++;
+    return SVG_OK;
+}
+
+// Length-aware write callback that only counts what it is given.
+static svg_return_t bench_null_write_n(svg_user_context_ptr user, const char *data, size_t length){
+    SBenchSink *Sink = (SBenchSink *)user;
+    (void)data;
+    Sink->DBytes += length;
+    Sink->DWrites++;
+    return SVG_OK;
+}
+
+// Scatter-gather write callback that only counts what it is given.
+static svg_return_t bench_null_writev(svg_user_context_ptr user, const svg_span_t *spans, size_t count){
+    SBenchSink *Sink = (SBenchSink *)user;
+    for(size_t Index = 0; Index < count; Index++){
+        Sink->DBytes += spans[Index].length;
+    }
+    Sink->DWrites++;
+    return SVG_OK;
+}
+
+// Write callback that appends to a stdio file.
+static svg_return_t bench_file_write(svg_user_context_ptr user, const char *text){
+    return fputs(text, (FILE *)user) < 0 ? SVG_ERR_IO : SVG_OK;
+}
+
+// Cleanup callback that closes a stdio file.
+static svg_return_t bench_file_cleanup(svg_user_context_ptr user){
+    return fclose((FILE *)user) ? SVG_ERR_IO : SVG_OK;
+}
+
+// Fragments collected one allocation each, like STestOutput in the tests.
+typedef struct{
+    char **DFragments;
+    size_t DCount;
+    size_t DCapacity;
+} SBenchFragments;
+
+// Write callback that copies each fragment into its own allocation.
+static svg_return_t bench_fragment_write(svg_user_context_ptr user, const char *text){
+    SBenchFragments *Fragments = (SBenchFragments *)user;
+    if(Fragments->DCount == Fragments->DCapacity){
+        size_t Capacity = Fragments->DCapacity ? 2 * Fragments->DCapacity : 64;
+        char **Grown = realloc(Fragments->DFragments, Capacity * sizeof(char *));
+        if(!Grown){
+            return SVG_ERR_IO;
+        }
+        Fragments->DFragments = Grown;
+        Fragments->DCapacity = Capacity;
+    }
+    Fragments->DFragments[Fragments->DCount] = strdup(text);
+    return Fragments->DFragments[Fragments->DCount++] ? SVG_OK : SVG_ERR_IO;
+}
+
+// Write callback that stands in for slow storage: 50 us per write.
+static svg_return_t bench_slow_write(svg_user_context_ptr user, const char *text){
+    struct timespec Delay = {0, 50000};
+    nanosleep(&Delay, NULL);
+    return bench_null_write(user, text);
+}
+
+// Scatter-gather callback that stands in for slow storage: 50 us per call.
+static svg_return_t bench_slow_writev(svg_user_context_ptr user, const svg_span_t *spans, size_t count){
+    struct timespec Delay = {0, 50000};
+    nanosleep(&Delay, NULL);
+    return bench_null_writev(user, spans, count);
+}
+
+// Tile write callback that stands in for slow storage: 50 us per write.
+// Writer threads call it at once, so the totals are atomic.
+static svg_return_t bench_slow_tile_write(svg_user_context_ptr user, size_t column, size_t row, const char *data, size_t length){
+    SBenchSink *Sink = (SBenchSink *)user;
+    struct timespec Delay = {0, 50000};
+    (void)column;
+    (void)row;
+    (void)data;
+    nanosleep(&Delay, NULL);
+    __atomic_fetch_add(&Sink->DBytes, length, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&Sink->DWrites, 1, __ATOMIC_RELAXED);
+    return SVG_OK;
+}
+
+// Creates a context writing to Sink through write_fn (0), write_n_fn (1)
+// or writev_fn (2), slow storage when slow is set.
+static svg_context_ptr bench_create_callback(int callback, int slow, SBenchSink *sink){
+    svg_create_options_t Options = {0};
+    if(callback == 0){
+        Options.write_fn = slow ? bench_slow_write : bench_null_write;
+    }
+    else if(callback == 1){
+        Options.write_n_fn = bench_null_write_n;
+    }
+    else{
+        Options.writev_fn = slow ? bench_slow_writev : bench_null_writev;
+    }
+    Options.user = sink;
+    Options.width = 1000;
+    Options.height = 1000;
+    return svg_create_ex(&Options);
+}
+
+// Returns the size of a file in bytes.
+static size_t bench_file_size(const char *path){
+    FILE *File = fopen(path, "rb");
+    long Size = 0;
+    if(File){
+        fseek(File, 0, SEEK_END);
+        Size = ftell(File);
+        fclose(File);
+    }
+    return Size > 0 ? (size_t)Size : 0;
+}
+
+// Fills values with plot-like coordinates: pixels with a few decimals.
+static void bench_fill_values(svg_real_t *values, size_t count){
+    srand(36);
+    for(size_t Index = 0; Index < count; Index++){
+        values[Index] = (rand() % 1000000) / 1000.0;
+    }
+}
+
+// Prints one result line.
+static void bench_report(const char *name, size_t count, double seconds, size_t bytes){
+    printf("%-32s %10.1f ns/op %10.2f Mop/s %12zu bytes\n",
+        name, seconds * 1e9 / (double)count, (double)count / seconds * 1e-6, bytes);
+}
+
+// Formats every value with snprintf("%lf"), sizing first as the old emitters did.
+static void bench_format_printf(const svg_real_t *values, size_t count){
+    char Buffer[SVG_REAL_BUFFER_SIZE];
+    size_t Bytes = 0;
+    double Start = bench_now();
+    for(size_t Index = 0; Index < count; Index++){
+        int Size = snprintf(NULL, 0, "%lf", values[Index]);
+        Bytes += (size_t)snprintf(Buffer, (size_t)Size + 1, "%lf", values[Index]);
+    }
+    bench_report("format snprintf %lf", count, bench_now() - Start, Bytes);
+}
+
+// Formats every value with svg_format_real.
+static void bench_format_real(const char *name, const svg_real_t *values, size_t count, int precision){
+    char Buffer[SVG_REAL_BUFFER_SIZE];
+    size_t Bytes = 0;
+    double Start = bench_now();
+    for(size_t Index = 0; Index < count; Index++){
+        Bytes += svg_format_real(Buffer, values[Index], precision);
+    }
+    bench_report(name, count, bench_now() - Start, Bytes);
+}
+
+// Emits circles the way svg_circle did before output buffering and svg_format_real.
+static void bench_circles_legacy(const svg_real_t *values, size_t count){
+    SBenchSink Sink = {0, 0};
+    double Start = bench_now();
+    for(size_t Index = 0; Index + 2 < count; Index++){
+        int Size = snprintf(NULL, 0,
+            "<circle cx=\"%lf\" cy=\"%lf\" r=\"%lf\" style=\"%s\"/>\n",
+            values[Index], values[Index + 1], values[Index + 2], BENCH_STYLE);
+        char *Buffer = malloc((size_t)Size + 1);
+        snprintf(Buffer, (size_t)Size + 1,
+            "<circle cx=\"%lf\" cy=\"%lf\" r=\"%lf\" style=\"%s\"/>\n",
+            values[Index], values[Index + 1], values[Index + 2], BENCH_STYLE);
+        bench_null_write(&Sink, Buffer);
+        free(Buffer);
+    }
+    bench_report("svg_circle legacy %lf path", count - 2, bench_now() - Start, Sink.DBytes);
+}
+
+// Emits circles through svg_circle with the given precision.
+static void bench_circles(const char *name, const svg_real_t *values, size_t count, int precision){
+    SBenchSink Sink = {0, 0};
+    svg_context_ptr Context = svg_create(bench_null_write, NULL, &Sink, 1000, 1000);
+    svg_set_precision(Context, precision);
+    double Start = bench_now();
+    for(size_t Index = 0; Index + 2 < count; Index++){
+        svg_point_t Center = {values[Index], values[Index + 1]};
+        svg_circle(Context, &Center, values[Index + 2] + 1, BENCH_STYLE);
+    }
+    svg_destroy(Context);
+    bench_report(name, count - 2, bench_now() - Start, Sink.DBytes);
+}
+
+// Emits circles through svg_circle with automatic style interning.
+static void bench_circles_interned(const char *name, const svg_real_t *values, size_t count, int precision){
+    SBenchSink Sink = {0, 0};
+    svg_context_ptr Context = svg_create(bench_null_write, NULL, &Sink, 1000, 1000);
+    svg_set_precision(Context, precision);
+    svg_set_style_interning(Context, 1);
+    double Start = bench_now();
+    for(size_t Index = 0; Index + 2 < count; Index++){
+        svg_point_t Center = {values[Index], values[Index + 1]};
+        svg_circle(Context, &Center, values[Index + 2] + 1, BENCH_STYLE);
+    }
+    svg_destroy(Context);
+    bench_report(name, count - 2, bench_now() - Start, Sink.DBytes);
+}
+
+// Emits circles through svg_circles in one run.
+static void bench_circles_batch(const char *name, const svg_real_t *values, size_t count, int precision){
+    SBenchSink Sink = {0, 0};
+    svg_real_t *Radii = malloc(sizeof(svg_real_t) * count);
+    svg_context_ptr Context = svg_create(bench_null_write, NULL, &Sink, 1000, 1000);
+    svg_set_precision(Context, precision);
+    for(size_t Index = 0; Index + 2 < count; Index++){
+        Radii[Index] = values[Index + 2] + 1;
+    }
+    double Start = bench_now();
+    svg_circles(Context, values, values + 1, Radii, count - 2, BENCH_STYLE);
+    svg_destroy(Context);
+    bench_report(name, count - 2, bench_now() - Start, Sink.DBytes);
+    free(Radii);
+}
+
+// Draws a polyline through consecutive value pairs as chained svg_line calls.
+static void bench_polyline_lines(const svg_real_t *values, size_t count){
+    SBenchSink Sink = {0, 0};
+    svg_context_ptr Context = svg_create(bench_null_write, NULL, &Sink, 1000, 1000);
+    svg_set_precision(Context, 2);
+    double Start = bench_now();
+    for(size_t Index = 0; Index + 3 < count; Index += 2){
+        svg_point_t From = {values[Index], values[Index + 1]};
+        svg_point_t To = {values[Index + 2], values[Index + 3]};
+        svg_line(Context, &From, &To, BENCH_STYLE);
+    }
+    svg_destroy(Context);
+    bench_report("polyline svg_line chain", count / 2, bench_now() - Start, Sink.DBytes);
+}
+
+// Draws the same polyline as one streamed path.
+static void bench_polyline_path(const svg_real_t *values, size_t count){
+    SBenchSink Sink = {0, 0};
+    svg_context_ptr Context = svg_create(bench_null_write, NULL, &Sink, 1000, 1000);
+    svg_set_precision(Context, 2);
+    double Start = bench_now();
+    svg_path_begin(Context, BENCH_STYLE);
+    svg_path_points(Context, (const svg_point_t *)values, count / 2);
+    svg_path_end(Context);
+    svg_destroy(Context);
+    bench_report("polyline svg_path_points", count / 2, bench_now() - Start, Sink.DBytes);
+}
+
+// Streams a dense series through a path with level of detail on.
+static void bench_polyline_lod(size_t samples){
+    SBenchSink Sink = {0, 0};
+    svg_context_ptr Context = svg_create(bench_null_write, NULL, &Sink, 1000, 1000);
+    svg_set_precision(Context, 2);
+    svg_set_lod(Context, 1);
+    double Start = bench_now();
+    svg_path_begin(Context, BENCH_STYLE);
+    for(size_t Index = 0; Index < samples; Index++){
+        svg_point_t Point = {Index * 1000.0 / (double)samples, (double)(rand() % 1000)};
+        svg_path_point(Context, &Point);
+    }
+    svg_path_end(Context);
+    svg_destroy(Context);
+    bench_report("polyline lod 1px 1000px canvas", samples, bench_now() - Start, Sink.DBytes);
+}
+
+// Draws circles into a context for the sink benchmarks.
+static void bench_draw_circles(svg_context_ptr context, const svg_real_t *values, size_t count){
+    svg_set_precision(context, 2);
+    for(size_t Index = 0; Index + 2 < count; Index++){
+        svg_point_t Center = {values[Index], values[Index + 1]};
+        svg_circle(context, &Center, values[Index + 2] + 1, BENCH_STYLE);
+    }
+}
+
+// Writes plain text and compresses it afterwards with the gzip tool.
+static void bench_gzip_two_pass(const svg_real_t *values, size_t count){
+    double Start = bench_now();
+    FILE *File = fopen(BENCH_PLAIN_PATH, "w");
+    if(!File){
+        return;
+    }
+    svg_context_ptr Context = svg_create(bench_file_write, bench_file_cleanup, File, 1000, 1000);
+    bench_draw_circles(Context, values, count);
+    svg_destroy(Context);
+    if(system("gzip -6 -f " BENCH_PLAIN_PATH) != 0){
+        return;
+    }
+    bench_report("svgz plain file + gzip -6", count - 2, bench_now() - Start, bench_file_size(BENCH_PLAIN_PATH ".gz"));
+    remove(BENCH_PLAIN_PATH ".gz");
+}
+
+// Writes through the streaming gzip sink.
+static void bench_gzip_stream(const svg_real_t *values, size_t count){
+    double Start = bench_now();
+    svg_context_ptr Context = svg_create_svgz(BENCH_SVGZ_PATH, 1000, 1000, 6);
+    if(!Context){
+        return;
+    }
+    bench_draw_circles(Context, values, count);
+    svg_destroy(Context);
+    bench_report("svgz streaming sink level 6", count - 2, bench_now() - Start, bench_file_size(BENCH_SVGZ_PATH));
+    remove(BENCH_SVGZ_PATH);
+}
+
+// Writes through stdio the way src/main.c does.
+static void bench_file_stdio(const svg_real_t *values, size_t count){
+    double Start = bench_now();
+    FILE *File = fopen(BENCH_FILE_PATH, "w");
+    if(!File){
+        return;
+    }
+    svg_context_ptr Context = svg_create(bench_file_write, bench_file_cleanup, File, 1000, 1000);
+    bench_draw_circles(Context, values, count);
+    svg_destroy(Context);
+    bench_report("file stdio fputs", count - 2, bench_now() - Start, bench_file_size(BENCH_FILE_PATH));
+    remove(BENCH_FILE_PATH);
+}
+
+// Writes through the file descriptor sink with the given options.
+static void bench_file_sink(const char *name, const svg_real_t *values, size_t count, const svg_file_options_t *options){
+    double Start = bench_now();
+    svg_context_ptr Context = svg_create_file(BENCH_FILE_PATH, 1000, 1000, options);
+    if(!Context){
+        return;
+    }
+    bench_draw_circles(Context, values, count);
+    svg_destroy(Context);
+    bench_report(name, count - 2, bench_now() - Start, bench_file_size(BENCH_FILE_PATH));
+    remove(BENCH_FILE_PATH);
+}
+
+// Collects fragments and concatenates them into one document afterwards.
+static void bench_memory_fragments(size_t flush_threshold, const char *name, const svg_real_t *values, size_t count){
+    SBenchFragments Fragments = {NULL, 0, 0};
+    double Start = bench_now();
+    svg_context_ptr Context = svg_create(bench_fragment_write, NULL, &Fragments, 1000, 1000);
+    svg_set_flush_threshold(Context, flush_threshold);
+    bench_draw_circles(Context, values, count);
+    svg_destroy(Context);
+    size_t Length = 0;
+    for(size_t Index = 0; Index < Fragments.DCount; Index++){
+        Length += strlen(Fragments.DFragments[Index]);
+    }
+    char *Document = malloc(Length + 1);
+    char *Out = Document;
+    for(size_t Index = 0; Index < Fragments.DCount; Index++){
+        size_t Size = strlen(Fragments.DFragments[Index]);
+        memcpy(Out, Fragments.DFragments[Index], Size);
+        Out += Size;
+        free(Fragments.DFragments[Index]);
+    }
+    *Out = '\0';
+    bench_report(name, count - 2, bench_now() - Start, Length);
+    free(Fragments.DFragments);
+    free(Document);
+}
+
+// Builds the document with the memory sink and takes it.
+static void bench_memory_sink(const svg_real_t *values, size_t count){
+    char *Document = NULL;
+    size_t Length = 0;
+    double Start = bench_now();
+    svg_context_ptr Context = svg_create_memory(1000, 1000);
+    bench_draw_circles(Context, values, count);
+    svg_detach_buffer(Context, &Document, &Length);
+    bench_report("memory svg_detach_buffer", count - 2, bench_now() - Start, Length);
+    free(Document);
+}
+
+// Measures the document length without keeping the output.
+static void bench_memory_measure(const svg_real_t *values, size_t count){
+    size_t Length = 0;
+    double Start = bench_now();
+    svg_context_ptr Context = svg_create_measure(1000, 1000);
+    bench_draw_circles(Context, values, count);
+    svg_measure(Context, &Length);
+    bench_report("memory svg_measure", count - 2, bench_now() - Start, Length);
+}
+
+// Draws into a slow sink, synchronously or with a writer thread, and
+// reports the producer's time per element and its worst single call.
+static void bench_async(const char *name, size_t buffers, const svg_real_t *values, size_t count){
+    SBenchSink Sink = {0, 0};
+    double Worst = 0;
+    double Start = bench_now();
+    svg_context_ptr Context = svg_create(bench_slow_write, NULL, &Sink, 1000, 1000);
+    svg_set_async(Context, buffers);
+    svg_set_precision(Context, 2);
+    for(size_t Index = 0; Index + 2 < count; Index++){
+        svg_point_t Center = {values[Index], values[Index + 1]};
+        double Before = bench_now();
+        svg_circle(Context, &Center, values[Index + 2] + 1, BENCH_STYLE);
+        double Elapsed = bench_now() - Before;
+        Worst = Elapsed > Worst ? Elapsed : Worst;
+    }
+    double Produced = bench_now() - Start;
+    svg_destroy(Context);
+    bench_report(name, count - 2, Produced, Sink.DBytes);
+    printf("%-32s %10.1f us worst svg_circle\n", name, Worst * 1e6);
+}
+
+// Draws circles through one kind of write callback, optionally into a
+// slow sink behind a writer thread, and reports the calls it took.
+static void bench_callback(int callback, int slow, const char *name, const svg_real_t *values, size_t count){
+    SBenchSink Sink = {0, 0};
+    double Start = bench_now();
+    svg_context_ptr Context = bench_create_callback(callback, slow, &Sink);
+    svg_set_precision(Context, 2);
+    if(slow){
+        svg_set_flush_threshold(Context, 4096);
+        svg_set_async(Context, 16);
+    }
+    bench_draw_circles(Context, values, count);
+    svg_destroy(Context);
+    bench_report(name, count - 2, bench_now() - Start, Sink.DBytes);
+    printf("%-32s %10zu write calls\n", name, Sink.DWrites);
+}
+
+// One thread's share of the sharded benchmark.
+typedef struct{
+    svg_context_ptr DShard;
+    const svg_real_t *DValues;
+    size_t DFirst;
+    size_t DLast;
+} SBenchShard;
+
+// Thread body that draws a slice of circles into a shard.
+static void *bench_shard_main(void *argument){
+    SBenchShard *Shard = (SBenchShard *)argument;
+    for(size_t Index = Shard->DFirst; Index < Shard->DLast; Index++){
+        svg_point_t Center = {Shard->DValues[Index], Shard->DValues[Index + 1]};
+        svg_circle(Shard->DShard, &Center, Shard->DValues[Index + 2] + 1, BENCH_STYLE);
+    }
+    return NULL;
+}
+
+// Formats circles in the given number of shards on as many threads and
+// commits them in order; reports the formatting and commit stages.
+static void bench_shards(size_t threads, const svg_real_t *values, size_t count){
+    SBenchSink Sink = {0, 0};
+    SBenchShard Shards[64];
+    pthread_t Threads[64];
+    char Name[64];
+    svg_context_ptr Context = svg_create(bench_null_write, NULL, &Sink, 1000, 1000);
+    svg_set_precision(Context, 2);
+    double Start = bench_now();
+    for(size_t Index = 0; Index < threads; Index++){
+        Shards[Index].DShard = svg_shard_create(Context);
+        Shards[Index].DValues = values;
+        Shards[Index].DFirst = Index * (count - 2) / threads;
+        Shards[Index].DLast = (Index + 1) * (count - 2) / threads;
+        pthread_create(&Threads[Index], NULL, bench_shard_main, &Shards[Index]);
+    }
+    for(size_t Index = 0; Index < threads; Index++){
+        pthread_join(Threads[Index], NULL);
+    }
+    double Formatted = bench_now();
+    for(size_t Index = 0; Index < threads; Index++){
+        svg_shard_commit(Context, Shards[Index].DShard);
+    }
+    svg_destroy(Context);
+    snprintf(Name, sizeof(Name), "shards %zu threads format", threads);
+    bench_report(Name, count - 2, Formatted - Start, Sink.DBytes);
+    snprintf(Name, sizeof(Name), "shards %zu threads commit", threads);
+    bench_report(Name, count - 2, bench_now() - Formatted, Sink.DBytes);
+}
+
+// One thread of the multi-producer benchmarks.
+typedef struct{
+    svg_context_ptr DContext;
+    pthread_mutex_t *DLock;     // held around every call when not NULL
+    const svg_real_t *DValues;
+    size_t DFirst;
+    size_t DLast;
+} SBenchProducer;
+
+// Thread body that draws a slice of circles, optionally under a lock.
+static void *bench_producer_main(void *argument){
+    SBenchProducer *Producer = (SBenchProducer *)argument;
+    for(size_t Index = Producer->DFirst; Index < Producer->DLast; Index++){
+        svg_point_t Center = {Producer->DValues[Index], Producer->DValues[Index + 1]};
+        if(Producer->DLock){
+            pthread_mutex_lock(Producer->DLock);
+        }
+        svg_circle(Producer->DContext, &Center, Producer->DValues[Index + 2] + 1, BENCH_STYLE);
+        if(Producer->DLock){
+            pthread_mutex_unlock(Producer->DLock);
+        }
+    }
+    if(!Producer->DLock){
+        svg_destroy(Producer->DContext);
+    }
+    return NULL;
+}
+
+// Draws from several threads into one context, serialized on a mutex or
+// through producers drained by this thread.
+static void bench_producers(int use_queue, size_t threads, const svg_real_t *values, size_t count){
+    SBenchSink Sink = {0, 0};
+    SBenchProducer Producers[64];
+    pthread_t Threads[64];
+    pthread_mutex_t Lock = PTHREAD_MUTEX_INITIALIZER;
+    char Name[64];
+    svg_context_ptr Context = svg_create(bench_null_write, NULL, &Sink, 1000, 1000);
+    svg_set_precision(Context, 2);
+    double Start = bench_now();
+    for(size_t Index = 0; Index < threads; Index++){
+        Producers[Index].DContext = use_queue ? svg_producer_create(Context) : Context;
+        Producers[Index].DLock = use_queue ? NULL : &Lock;
+        Producers[Index].DValues = values;
+        Producers[Index].DFirst = Index * (count - 2) / threads;
+        Producers[Index].DLast = (Index + 1) * (count - 2) / threads;
+        pthread_create(&Threads[Index], NULL, bench_producer_main, &Producers[Index]);
+    }
+    for(size_t Index = 0; Index < threads; Index++){
+        // the consumer keeps draining until each producer is done
+        while(use_queue && pthread_tryjoin_np(Threads[Index], NULL) != 0){
+            svg_flush(Context);
+            sched_yield();
+        }
+        if(!use_queue){
+            pthread_join(Threads[Index], NULL);
+        }
+    }
+    svg_destroy(Context);
+    snprintf(Name, sizeof(Name), "%s %zu threads", use_queue ? "producers queue" : "producers mutex", threads);
+    bench_report(Name, count - 2, bench_now() - Start, Sink.DBytes);
+}
+
+// Records circles once, then compares replaying the list, replaying it
+// after a save and mmap load, and drawing directly.
+static void bench_list(const svg_real_t *values, size_t count){
+    SBenchSink Sink = {0, 0};
+    svg_list_ptr List = svg_list_create();
+    double Start = bench_now();
+    svg_context_ptr Context = svg_create_recording(List, 1000, 1000);
+    for(size_t Index = 0; Index + 2 < count; Index++){
+        svg_point_t Center = {values[Index], values[Index + 1]};
+        svg_circle(Context, &Center, values[Index + 2] + 1, BENCH_STYLE);
+    }
+    svg_destroy(Context);
+    bench_report("list record", count - 2, bench_now() - Start, 0);
+
+    Start = bench_now();
+    svg_list_save(List, BENCH_LIST_PATH);
+    bench_report("list save", count - 2, bench_now() - Start, bench_file_size(BENCH_LIST_PATH));
+    svg_list_destroy(List);
+    Start = bench_now();
+    List = svg_list_load(BENCH_LIST_PATH);
+    bench_report("list mmap load", count - 2, bench_now() - Start, bench_file_size(BENCH_LIST_PATH));
+
+    Start = bench_now();
+    Context = svg_create(bench_null_write, NULL, &Sink, 1000, 1000);
+    svg_set_precision(Context, 2);
+    svg_list_replay(List, Context);
+    svg_destroy(Context);
+    bench_report("list replay precision 2", count - 2, bench_now() - Start, Sink.DBytes);
+    svg_list_destroy(List);
+    remove(BENCH_LIST_PATH);
+}
+
+// Records an overlay of circles drawn twice and partly hidden by opaque
+// tiles drawn over it, then removes what cannot be seen. The reported
+// bytes are those saved at precision 2.
+static void bench_list_optimize(const svg_real_t *values, size_t count){
+    svg_list_ptr List = svg_list_create();
+    size_t Points = count / 2;
+    svg_real_t Radius = 2, Tile = 50;
+    for(int Pass = 0; Pass < 2; Pass++){
+        for(size_t Index = 0; Index < Points; Index++){
+            svg_list_circles(List, &values[2 * Index], &values[2 * Index + 1], &Radius, 1, "fill:blue");
+        }
+    }
+    for(int Row = 0; Row < 10; Row++){
+        for(int Column = 0; Column < 10; Column++){
+            svg_coord_t X = Column * Tile, Y = Row * Tile;
+            svg_list_rects(List, &X, &Y, &Tile, &Tile, 1, "fill:#eee");
+        }
+    }
+    svg_list_savings_t Savings;
+    double Start = bench_now();
+    svg_list_optimize(List, 2, &Savings);
+    bench_report("list optimize with savings", 2 * Points + 100, bench_now() - Start, Savings.bytes);
+    printf("    %zu duplicates, %zu occluded\n", Savings.duplicates, Savings.occluded);
+    svg_list_destroy(List);
+}
+
+// Draws the values as circles and as one long path, quantized to a grid
+// of the given digits or formatted with that precision.
+static void bench_quantized(int quantized, const char *circles_name, const char *path_name,
+                            const svg_real_t *values, size_t count){
+    SBenchSink Sink = {0, 0};
+    double Start = bench_now();
+    svg_context_ptr Context = svg_create(bench_null_write, NULL, &Sink, 1000, 1000);
+    if(quantized){
+        svg_set_quantization(Context, 1, 2);
+    }
+    else{
+        svg_set_precision(Context, 2);
+    }
+    for(size_t Index = 0; Index + 2 < count; Index++){
+        svg_point_t Center = {values[Index], values[Index + 1]};
+        svg_circle(Context, &Center, values[Index + 2] + 1, BENCH_STYLE);
+    }
+    svg_destroy(Context);
+    bench_report(circles_name, count - 2, bench_now() - Start, Sink.DBytes);
+
+    Sink.DBytes = 0;
+    Start = bench_now();
+    Context = svg_create(bench_null_write, NULL, &Sink, 1000, 1000);
+    if(quantized){
+        svg_set_quantization(Context, 1, 2);
+    }
+    else{
+        svg_set_precision(Context, 2);
+    }
+    svg_path_begin(Context, BENCH_STYLE);
+    for(size_t Index = 0; Index < count; Index++){
+        // a time series: x advances steadily, y drifts with some noise
+        svg_point_t Point = {(svg_coord_t)Index * 0.01, 500 + 300 * sin((double)Index * 1e-4) + values[Index] * 1e-3};
+        svg_path_point(Context, &Point);
+    }
+    svg_path_end(Context);
+    svg_destroy(Context);
+    bench_report(path_name, count, bench_now() - Start, Sink.DBytes);
+}
+
+// Times the bulk transform kernel on its own.
+static void bench_transform_kernel(const svg_real_t *values, size_t count){
+    size_t Points = count / 2;
+    svg_point_t *Result = malloc(sizeof(svg_point_t) * Points);
+    svg_matrix_t Matrix = {2, 0, 0, -3, 10, 500};
+    double Start = bench_now();
+    for(int Pass = 0; Pass < 10; Pass++){
+        svg_transform_points(&Matrix, (const svg_point_t *)values, Result, Points);
+    }
+    double Seconds = bench_now() - Start;
+    bench_report("transform kernel", Points * 10, Seconds, Points * 10 * 2 * sizeof(svg_point_t));
+    free(Result);
+}
+
+// Plots data space points as circles, mapped by the caller one at a time
+// or by the context transform in bulk.
+static void bench_transform_circles(int use_transform, const char *name, const svg_real_t *values, size_t count){
+    SBenchSink Sink = {0, 0};
+    svg_matrix_t Matrix = {2, 0, 0, -3, 10, 500};
+    size_t Points = count / 2;
+    svg_coord_t *Xs = malloc(sizeof(svg_coord_t) * Points);
+    svg_coord_t *Ys = malloc(sizeof(svg_coord_t) * Points);
+    svg_real_t *Radii = malloc(sizeof(svg_real_t) * Points);
+    for(size_t Index = 0; Index < Points; Index++){
+        Xs[Index] = values[2 * Index];
+        Ys[Index] = values[2 * Index + 1];
+        Radii[Index] = 2;
+    }
+    double Start = bench_now();
+    svg_context_ptr Context = svg_create(bench_null_write, NULL, &Sink, 1000, 1000);
+    svg_set_precision(Context, 2);
+    if(use_transform){
+        svg_transform_push(Context, &Matrix);
+        svg_circles(Context, Xs, Ys, Radii, Points, BENCH_STYLE);
+    }
+    else{
+        for(size_t Index = 0; Index < Points; Index++){
+            svg_point_t Center = {Matrix.a * Xs[Index] + Matrix.e, Matrix.d * Ys[Index] + Matrix.f};
+            svg_circle(Context, &Center, Radii[Index], BENCH_STYLE);
+        }
+    }
+    svg_destroy(Context);
+    bench_report(name, Points, bench_now() - Start, Sink.DBytes);
+    free(Xs);
+    free(Ys);
+    free(Radii);
+}
+
+// Draws a scatter plot of every point, either as circles or binned into
+// a density map of 4 pixel cells.
+static void bench_density(int use_density, const char *name, const svg_real_t *values, size_t count){
+    SBenchSink Sink = {0, 0};
+    size_t Points = count / 2;
+    svg_coord_t *Xs = malloc(sizeof(svg_coord_t) * Points);
+    svg_coord_t *Ys = malloc(sizeof(svg_coord_t) * Points);
+    svg_real_t *Radii = malloc(sizeof(svg_real_t) * Points);
+    for(size_t Index = 0; Index < Points; Index++){
+        Xs[Index] = values[2 * Index];
+        Ys[Index] = values[2 * Index + 1];
+        Radii[Index] = 2;
+    }
+    double Start = bench_now();
+    svg_context_ptr Context = svg_create(bench_null_write, NULL, &Sink, 1000, 1000);
+    svg_set_precision(Context, 2);
+    if(use_density){
+        svg_density_begin(Context, 4);
+    }
+    svg_circles(Context, Xs, Ys, Radii, Points, BENCH_STYLE);
+    if(use_density){
+        svg_density_end(Context, NULL);
+    }
+    svg_destroy(Context);
+    bench_report(name, Points, bench_now() - Start, Sink.DBytes);
+    free(Xs);
+    free(Ys);
+    free(Radii);
+}
+
+// Draws a cross and ring marker at every point, either spelled out or
+// as instances of one symbol.
+static void bench_markers(int use_symbol, const char *name, const svg_real_t *values, size_t count){
+    SBenchSink Sink = {0, 0};
+    double Start = bench_now();
+    svg_context_ptr Context = svg_create(bench_null_write, NULL, &Sink, 1000, 1000);
+    svg_set_precision(Context, 2);
+    size_t Marker = 0;
+    if(use_symbol){
+        svg_point_t Points[4] = {{-3, 0}, {3, 0}, {0, -3}, {0, 3}};
+        svg_point_t Origin = {0, 0};
+        svg_symbol_begin(Context, &Marker);
+        svg_line(Context, &Points[0], &Points[1], BENCH_STYLE);
+        svg_line(Context, &Points[2], &Points[3], BENCH_STYLE);
+        svg_circle(Context, &Origin, 2, BENCH_STYLE);
+        svg_symbol_end(Context);
+    }
+    for(size_t Index = 0; Index + 1 < count; Index++){
+        svg_point_t At = {values[Index], values[Index + 1]};
+        if(use_symbol){
+            svg_use(Context, Marker, &At);
+            continue;
+        }
+        svg_point_t Points[4] = {{At.x - 3, At.y}, {At.x + 3, At.y}, {At.x, At.y - 3}, {At.x, At.y + 3}};
+        svg_group_begin(Context, NULL);
+        svg_line(Context, &Points[0], &Points[1], BENCH_STYLE);
+        svg_line(Context, &Points[2], &Points[3], BENCH_STYLE);
+        svg_circle(Context, &At, 2, BENCH_STYLE);
+        svg_group_end(Context);
+    }
+    svg_destroy(Context);
+    bench_report(name, count - 1, bench_now() - Start, Sink.DBytes);
+}
+
+// Draws a scene once, then times frames that move a few of its circles.
+static void bench_frames(int mode, int callback, const char *name, const svg_real_t *values, size_t count){
+    SBenchSink Sink = {0, 0};
+    svg_context_ptr Context = bench_create_callback(callback, 0, &Sink);
+    char Id[32];
+    svg_set_precision(Context, 2);
+    svg_frame_begin(Context);
+    for(size_t Index = 0; Index < BENCH_FRAME_SCENE; Index++){
+        svg_point_t Center = {values[Index % count], values[(Index + 1) % count]};
+        snprintf(Id, sizeof(Id), "e%zu", Index);
+        svg_frame_id(Context, Id);
+        svg_circle(Context, &Center, 2, BENCH_STYLE);
+    }
+    svg_frame_end(Context, SVG_FRAME_FULL);
+    Sink.DBytes = 0;
+
+    double Start = bench_now();
+    for(size_t Frame = 1; Frame <= BENCH_FRAME_COUNT; Frame++){
+        svg_frame_begin(Context);
+        for(size_t Change = 0; Change < BENCH_FRAME_CHANGES; Change++){
+            size_t Index = (Frame * 7919 + Change * 104729) % BENCH_FRAME_SCENE;
+            svg_point_t Center = {values[(Index + Frame) % count], values[Index % count]};
+            snprintf(Id, sizeof(Id), "e%zu", Index);
+            svg_frame_id(Context, Id);
+            svg_circle(Context, &Center, 2, BENCH_STYLE);
+        }
+        svg_frame_end(Context, mode);
+    }
+    bench_report(name, BENCH_FRAME_COUNT, bench_now() - Start, Sink.DBytes / BENCH_FRAME_COUNT);
+    svg_destroy(Context);
+}
+
+// Draws circles with statistics off or on, to show what collecting them
+// costs.
+static void bench_stats(int enabled, const char *name, const svg_real_t *values, size_t count){
+    SBenchSink Sink = {0, 0};
+    svg_context_ptr Context = svg_create(bench_null_write, NULL, &Sink, 1000, 1000);
+    svg_set_precision(Context, 2);
+    svg_set_stats(Context, enabled);
+    double Start = bench_now();
+    bench_draw_circles(Context, values, count);
+    svg_stats_t Stats;
+    svg_get_stats(Context, &Stats);
+    svg_destroy(Context);
+    bench_report(name, count - 2, bench_now() - Start, Sink.DBytes);
+    if(enabled){
+        printf("%-32s %10.1f us mean write_fn\n", name, Stats.writes ? Stats.write_ns / 1e3 / Stats.writes : 0.0);
+    }
+}
+
+// Writes many small documents, one context each, from the C heap or from
+// an arena reset between documents, like a service answering requests.
+static void bench_documents(int arena, const char *name, const svg_real_t *values, size_t count){
+    SBenchSink Sink = {0, 0};
+    svg_arena_ptr Arena = arena ? svg_arena_create(0) : NULL;
+    svg_create_options_t Options = {0};
+    Options.write_n_fn = bench_null_write_n;
+    Options.user = &Sink;
+    Options.width = 1000;
+    Options.height = 1000;
+    if(Arena){
+        svg_arena_allocator(Arena, &Options.allocator);
+    }
+    double Start = bench_now();
+    for(size_t Document = 0; Document < BENCH_DOCUMENT_COUNT; Document++){
+        svg_context_ptr Context = svg_create_ex(&Options);
+        svg_set_precision(Context, 2);
+        svg_set_style_interning(Context, 1);
+        size_t First = (Document * BENCH_DOCUMENT_ELEMENTS) % (count - BENCH_DOCUMENT_ELEMENTS);
+        bench_draw_circles(Context, values + First, BENCH_DOCUMENT_ELEMENTS);
+        svg_destroy(Context);
+        if(Arena){
+            svg_arena_reset(Arena);
+        }
+    }
+    bench_report(name, BENCH_DOCUMENT_COUNT, bench_now() - Start, Sink.DBytes);
+    if(Arena){
+        svg_arena_destroy(Arena);
+    }
+}
+
+// Draws circles over a wall-sized canvas split into tiles on slow
+// storage, written on the drawing thread or by writer threads.
+static void bench_tiles(int threads, const char *name, const svg_real_t *values, size_t count){
+    SBenchSink Sink = {0, 0};
+    svg_tiles_options_t Options = {0};
+    Options.width = BENCH_TILES_CANVAS;
+    Options.height = BENCH_TILES_CANVAS;
+    Options.tile_width = BENCH_TILES_TILE;
+    Options.tile_height = BENCH_TILES_TILE;
+    Options.margin = 2;
+    Options.write_fn = bench_slow_tile_write;
+    Options.user = &Sink;
+    Options.threads = threads;
+    double Start = bench_now();
+    svg_tiles_ptr Tiles = svg_tiles_create(&Options);
+    svg_context_ptr Context = svg_create_tiling(Tiles);
+    double Scale = (double)BENCH_TILES_CANVAS / 1000;
+    for(size_t Index = 0; Index + 2 < count; Index++){
+        svg_point_t Center = {values[Index] * Scale, values[Index + 1] * Scale};
+        svg_circle(Context, &Center, values[Index + 2] + 1, BENCH_STYLE);
+    }
+    svg_destroy(Context);
+    svg_tiles_destroy(Tiles);
+    bench_report(name, count - 2, bench_now() - Start, Sink.DBytes);
+}
+
+int main(int argc, char *argv[]){
+    svg_real_t *Values = malloc(sizeof(svg_real_t) * BENCH_VALUE_COUNT);
+    if(!Values){
+        return 1;
+    }
+    bench_fill_values(Values, BENCH_VALUE_COUNT);
+
+    bench_format_printf(Values, BENCH_VALUE_COUNT);
+    bench_format_real("format default", Values, BENCH_VALUE_COUNT, SVG_PRECISION_DEFAULT);
+    bench_format_real("format precision 2", Values, BENCH_VALUE_COUNT, 2);
+    bench_format_real("format shortest", Values, BENCH_VALUE_COUNT, SVG_PRECISION_SHORTEST);
+
+    bench_circles_legacy(Values, BENCH_ELEMENT_COUNT);
+    bench_circles("svg_circle default", Values, BENCH_ELEMENT_COUNT, SVG_PRECISION_DEFAULT);
+    bench_circles("svg_circle precision 2", Values, BENCH_ELEMENT_COUNT, 2);
+    bench_circles("svg_circle shortest", Values, BENCH_ELEMENT_COUNT, SVG_PRECISION_SHORTEST);
+    bench_circles_interned("svg_circle interned precision 2", Values, BENCH_ELEMENT_COUNT, 2);
+    bench_circles_batch("svg_circles default", Values, BENCH_ELEMENT_COUNT, SVG_PRECISION_DEFAULT);
+    bench_circles_batch("svg_circles precision 2", Values, BENCH_ELEMENT_COUNT, 2);
+
+    bench_polyline_lines(Values, BENCH_VALUE_COUNT);
+    bench_polyline_path(Values, BENCH_VALUE_COUNT);
+    bench_polyline_lod(10 * BENCH_VALUE_COUNT);
+
+    bench_gzip_two_pass(Values, BENCH_ELEMENT_COUNT);
+    bench_gzip_stream(Values, BENCH_ELEMENT_COUNT);
+
+    svg_file_options_t Writev = {0, 1, 0, 0, 0};
+    svg_file_options_t Direct = {0, 0, 1, 1, 1};
+    bench_file_stdio(Values, BENCH_ELEMENT_COUNT);
+    bench_file_sink("file fd 1 MiB chunks", Values, BENCH_ELEMENT_COUNT, NULL);
+    bench_file_sink("file fd writev", Values, BENCH_ELEMENT_COUNT, &Writev);
+    bench_file_sink("file fd direct advise fsync", Values, BENCH_ELEMENT_COUNT, &Direct);
+
+    bench_memory_fragments(0, "memory fragments per element", Values, BENCH_ELEMENT_COUNT);
+    bench_memory_fragments(65536, "memory fragments per 64 KiB", Values, BENCH_ELEMENT_COUNT);
+    bench_memory_sink(Values, BENCH_ELEMENT_COUNT);
+    bench_memory_measure(Values, BENCH_ELEMENT_COUNT);
+
+    bench_async("slow sink synchronous", 0, Values, BENCH_ELEMENT_COUNT);
+    bench_async("slow sink async 2 buffers", 2, Values, BENCH_ELEMENT_COUNT);
+    bench_async("slow sink async 8 buffers", 8, Values, BENCH_ELEMENT_COUNT);
+    bench_callback(0, 0, "callback write_fn strlen", Values, BENCH_ELEMENT_COUNT);
+    bench_callback(1, 0, "callback write_n_fn", Values, BENCH_ELEMENT_COUNT);
+    bench_callback(2, 0, "callback writev_fn", Values, BENCH_ELEMENT_COUNT);
+    bench_callback(0, 1, "slow async write_fn 4 KiB", Values, BENCH_ELEMENT_COUNT);
+    bench_callback(2, 1, "slow async writev_fn 4 KiB", Values, BENCH_ELEMENT_COUNT);
+    bench_stats(0, "svg_circle stats off", Values, BENCH_ELEMENT_COUNT);
+    bench_stats(1, "svg_circle stats on", Values, BENCH_ELEMENT_COUNT);
+    bench_documents(0, "documents from the heap", Values, BENCH_VALUE_COUNT);
+    bench_documents(1, "documents from an arena", Values, BENCH_VALUE_COUNT);
+    bench_tiles(0, "tiles slow storage", Values, BENCH_ELEMENT_COUNT);
+    bench_tiles(1, "tiles slow storage 1 writer", Values, BENCH_ELEMENT_COUNT);
+    bench_tiles(4, "tiles slow storage 4 writers", Values, BENCH_ELEMENT_COUNT);
+
+    for(size_t Threads = 1; Threads <= 16; Threads *= 2){
+        bench_shards(Threads, Values, BENCH_ELEMENT_COUNT);
+    }
+    bench_list(Values, BENCH_ELEMENT_COUNT);
+    bench_list_optimize(Values, BENCH_ELEMENT_COUNT);
+    bench_quantized(0, "circles precision 2", "path precision 2", Values, BENCH_VALUE_COUNT);
+    bench_quantized(1, "circles quantized 2", "path quantized 2 deltas", Values, BENCH_VALUE_COUNT);
+    bench_transform_kernel(Values, BENCH_VALUE_COUNT);
+    bench_transform_circles(0, "circles mapped by caller", Values, BENCH_VALUE_COUNT);
+    bench_transform_circles(1, "circles mapped by transform", Values, BENCH_VALUE_COUNT);
+    bench_density(0, "scatter as circles", Values, BENCH_VALUE_COUNT);
+    bench_density(1, "scatter as density map", Values, BENCH_VALUE_COUNT);
+    bench_markers(0, "markers as groups", Values, BENCH_ELEMENT_COUNT);
+    bench_markers(1, "markers as symbol instances", Values, BENCH_ELEMENT_COUNT);
+    bench_frames(SVG_FRAME_FULL, 0, "frame 100 of 100000 full", Values, BENCH_VALUE_COUNT);
+    bench_frames(SVG_FRAME_FULL, 2, "frame 100 of 100000 full writev", Values, BENCH_VALUE_COUNT);
+    bench_frames(SVG_FRAME_DIFF, 0, "frame 100 of 100000 diff", Values, BENCH_VALUE_COUNT);
+
+    for(size_t Threads = 1; Threads <= 16; Threads *= 4){
+        bench_producers(0, Threads, Values, BENCH_ELEMENT_COUNT);
+        bench_producers(1, Threads, Values, BENCH_ELEMENT_COUNT);
+    }
+
+    free(Values);
+    return 0;
+}
@@ -0,0 +1,358 @@
+/**
+ * @file SVGSuite.c
+ * @brief Benchmark suite for the SVG library with machine-readable results.
+ *
+ * Runs a fixed matrix of cases: each primitive, group nesting depths,
+ * every sink, and document sizes from 1K elements up to a limit. Each
+ * case reports elements/s, bytes/s, heap allocations per element and
+ * peak RSS, and all of them are written as one JSON document so runs of
+ * different commits can be compared.
+ *
+ * Usage: benchsuite [--label NAME] [--elements N] [--max-elements N] [--json PATH]
+ */
+#define _GNU_SOURCE
+#include "svg.h"
+#include "svg_sinks.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#define SUITE_DEFAULT_ELEMENTS      1000000
+#define SUITE_DEFAULT_MAX_ELEMENTS  100000000
+#define SUITE_MIN_SIZE              1000
+// Small cases repeat until they have drawn at least this many elements.
+#define SUITE_MIN_WORK              1000000
+// Elements per run of the batched calls and between nested groups.
+#define SUITE_BATCH                 256
+#define SUITE_GROUP_RUN             16
+#define SUITE_FILE_PATH             "./benchbin/bench_suite.svg"
+#define SUITE_STYLE                 "fill:none; stroke:green; stroke-width:2"
+
+// The suite is linked with --wrap for the C heap functions, so every
+// allocation made while a case runs is counted here.
+static size_t SuiteAllocations;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *pointer, size_t size);
+
+void *__wrap_malloc(size_t size){
+    SuiteAllocations++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size){
+    SuiteAllocations++;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *pointer, size_t size){
+    SuiteAllocations++;
+    return __real_realloc(pointer, size);
+}
+
+typedef enum{
+    SUITE_CIRCLE = 0,
+    SUITE_RECT,
+    SUITE_LINE,
+    SUITE_CIRCLES_BATCH
+} ESuitePrimitive;
+
+typedef enum{
+    SUITE_SINK_NULL = 0,
+    SUITE_SINK_MEMORY,
+    SUITE_SINK_MEASURE,
+    SUITE_SINK_FILE
+} ESuiteSink;
+
+static const char *SUITE_PRIMITIVE_NAMES[] = {"svg_circle", "svg_rect", "svg_line", "svg_circles"};
+static const char *SUITE_SINK_NAMES[] = {"null", "memory", "measure", "file"};
+
+// Result of one case.
+typedef struct{
+    char DName[64];
+    const char *DPrimitive;
+    const char *DSink;
+    int DDepth;
+    size_t DElements;       // per run
+    size_t DRuns;
+    double DSeconds;        // all runs
+    size_t DBytes;          // per run
+    size_t DAllocations;    // all runs
+    long DPeakRssKiB;
+} SSuiteResult;
+
+// Output of the null sink.
+typedef struct{
+    size_t DBytes;
+} SSuiteSink;
+
+// Returns a monotonic timestamp in seconds.
+static double suite_now(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+// Write callback that only counts what it is given.
+static svg_return_t suite_null_write(svg_user_context_ptr user, const char *data, size_t length){
+    (void)data;
+    ((SSuiteSink *)user)->DBytes += length;
+    return SVG_OK;
+}
+
+// Resets the peak RSS the kernel reports, where it can.
+static void suite_reset_peak_rss(void){
+    FILE *File = fopen("/proc/self/clear_refs", "w");
+    if(File){
+        fputs("5", File);
+        fclose(File);
+    }
+}
+
+// Returns the peak RSS in KiB since the last reset, or since the start
+// where resetting is not supported.
+static long suite_peak_rss(void){
+    FILE *File = fopen("/proc/self/status", "r");
+    char Line[256];
+    long Peak = -1;
+    while(File && fgets(Line, sizeof(Line), File)){
+        if(strncmp(Line, "VmHWM:", 6) == 0){
+            Peak = strtol(Line + 6, NULL, 10);
+            break;
+        }
+    }
+    if(File){
+        fclose(File);
+    }
+    if(Peak < 0){
+        struct rusage Usage;
+        getrusage(RUSAGE_SELF, &Usage);
+        Peak = Usage.ru_maxrss;
+    }
+    return Peak;
+}
+
+// Returns the size of a file in bytes.
+static size_t suite_file_size(const char *path){
+    FILE *File = fopen(path, "rb");
+    if(!File){
+        return 0;
+    }
+    fseek(File, 0, SEEK_END);
+    long Size = ftell(File);
+    fclose(File);
+    return Size > 0 ? (size_t)Size : 0;
+}
+
+// Draws count elements of one primitive, opening depth nested groups
+// around every SUITE_GROUP_RUN of them.
+static void suite_draw(svg_context_ptr context, ESuitePrimitive primitive, int depth, size_t count){
+    svg_coord_t Xs[SUITE_BATCH], Ys[SUITE_BATCH];
+    svg_real_t Radii[SUITE_BATCH];
+    size_t Run = primitive == SUITE_CIRCLES_BATCH ? SUITE_BATCH : 1;
+    for(size_t Index = 0; Index < count; Index += Run){
+        if(depth && Index % SUITE_GROUP_RUN == 0){
+            for(int Level = 0; Index && Level < depth; Level++){
+                svg_group_end(context);
+            }
+            for(int Level = 0; Level < depth; Level++){
+                svg_group_begin(context, "class=\"level\"");
+            }
+        }
+        // coordinates spread over the canvas with a few decimals each
+        svg_point_t Start = {(svg_coord_t)((Index * 7919) % 100000) / 100, (svg_coord_t)((Index * 104729) % 100000) / 100};
+        svg_point_t End = {Start.y, Start.x};
+        svg_size_t Size = {(svg_coord_t)(Index % 50) + 0.5, (svg_coord_t)(Index % 30) + 0.25};
+        switch(primitive){
+            case SUITE_CIRCLE:
+                svg_circle(context, &Start, (svg_real_t)(Index % 20) + 1.5, SUITE_STYLE);
+                break;
+            case SUITE_RECT:
+                svg_rect(context, &Start, &Size, SUITE_STYLE);
+                break;
+            case SUITE_LINE:
+                svg_line(context, &Start, &End, SUITE_STYLE);
+                break;
+            case SUITE_CIRCLES_BATCH:
+                Run = count - Index < SUITE_BATCH ? count - Index : SUITE_BATCH;
+                for(size_t Offset = 0; Offset < Run; Offset++){
+                    size_t Element = Index + Offset;
+                    Xs[Offset] = (svg_coord_t)((Element * 7919) % 100000) / 100;
+                    Ys[Offset] = (svg_coord_t)((Element * 104729) % 100000) / 100;
+                    Radii[Offset] = (svg_real_t)(Element % 20) + 1.5;
+                }
+                svg_circles(context, Xs, Ys, Radii, Run, SUITE_STYLE);
+                break;
+        }
+    }
+    for(int Level = 0; count && Level < depth; Level++){
+        svg_group_end(context);
+    }
+}
+
+// Draws one document into a sink and returns its length in bytes.
+static size_t suite_document(ESuiteSink sink, ESuitePrimitive primitive, int depth, size_t count){
+    SSuiteSink Null = {0};
+    svg_context_ptr Context = NULL;
+    if(sink == SUITE_SINK_NULL){
+        svg_create_options_t Options = {0};
+        Options.write_n_fn = suite_null_write;
+        Options.user = &Null;
+        Options.width = 1000;
+        Options.height = 1000;
+        Context = svg_create_ex(&Options);
+    }
+    else if(sink == SUITE_SINK_MEMORY){
+        Context = svg_create_memory(1000, 1000);
+    }
+    else if(sink == SUITE_SINK_MEASURE){
+        Context = svg_create_measure(1000, 1000);
+    }
+    else{
+        Context = svg_create_file(SUITE_FILE_PATH, 1000, 1000, NULL);
+    }
+    if(!Context){
+        return 0;
+    }
+    svg_set_precision(Context, 2);
+    suite_draw(Context, primitive, depth, count);
+    size_t Length = 0;
+    if(sink == SUITE_SINK_MEMORY){
+        char *Document = NULL;
+        svg_detach_buffer(Context, &Document, &Length);
+        free(Document);
+    }
+    else if(sink == SUITE_SINK_MEASURE){
+        svg_measure(Context, &Length);
+    }
+    else{
+        svg_destroy(Context);
+        Length = sink == SUITE_SINK_NULL ? Null.DBytes : suite_file_size(SUITE_FILE_PATH);
+    }
+    if(sink == SUITE_SINK_FILE){
+        remove(SUITE_FILE_PATH);
+    }
+    return Length;
+}
+
+// Runs one case, repeating small documents, and prints its result.
+static void suite_case(SSuiteResult *result, const char *name, ESuiteSink sink,
+                       ESuitePrimitive primitive, int depth, size_t count){
+    size_t Runs = count < SUITE_MIN_WORK ? SUITE_MIN_WORK / count : 1;
+    memset(result, 0, sizeof(*result));
+    snprintf(result->DName, sizeof(result->DName), "%s", name);
+    result->DPrimitive = SUITE_PRIMITIVE_NAMES[primitive];
+    result->DSink = SUITE_SINK_NAMES[sink];
+    result->DDepth = depth;
+    result->DElements = count;
+    result->DRuns = Runs;
+
+    suite_reset_peak_rss();
+    SuiteAllocations = 0;
+    double Start = suite_now();
+    for(size_t Run = 0; Run < Runs; Run++){
+        result->DBytes = suite_document(sink, primitive, depth, count);
+    }
+    result->DSeconds = suite_now() - Start;
+    result->DAllocations = SuiteAllocations;
+    result->DPeakRssKiB = suite_peak_rss();
+
+    double Elements = (double)count * (double)Runs;
+    printf("%-28s %12zu %10.2f Melem/s %9.1f MB/s %9.4f alloc/elem %9ld KiB\n",
+        result->DName, count, Elements / result->DSeconds * 1e-6,
+        (double)result->DBytes * (double)Runs / result->DSeconds * 1e-6,
+        (double)result->DAllocations / Elements, result->DPeakRssKiB);
+    fflush(stdout);
+}
+
+// Writes every result as one JSON document.
+static int suite_write_json(const char *path, const char *label, const SSuiteResult *results, size_t count){
+    FILE *File = fopen(path, "w");
+    if(!File){
+        return -1;
+    }
+    fprintf(File, "{\n  \"label\": \"%s\",\n  \"results\": [\n", label);
+    for(size_t Index = 0; Index < count; Index++){
+        const SSuiteResult *Result = &results[Index];
+        double Elements = (double)Result->DElements * (double)Result->DRuns;
+        fprintf(File,
+            "    {\"name\": \"%s\", \"primitive\": \"%s\", \"sink\": \"%s\", \"depth\": %d, "
+            "\"elements\": %zu, \"runs\": %zu, \"seconds\": %.6f, \"bytes\": %zu, "
+            "\"elements_per_s\": %.1f, \"bytes_per_s\": %.1f, \"allocs_per_element\": %.6f, "
+            "\"peak_rss_kib\": %ld}%s\n",
+            Result->DName, Result->DPrimitive, Result->DSink, Result->DDepth,
+            Result->DElements, Result->DRuns, Result->DSeconds, Result->DBytes,
+            Elements / Result->DSeconds, (double)Result->DBytes * (double)Result->DRuns / Result->DSeconds,
+            (double)Result->DAllocations / Elements, Result->DPeakRssKiB,
+            Index + 1 < count ? "," : "");
+    }
+    fprintf(File, "  ]\n}\n");
+    return fclose(File) == 0 ? 0 : -1;
+}
+
+int main(int argc, char *argv[]){
+    const char *Label = "local";
+    const char *JsonPath = "./benchbin/bench_results.json";
+    size_t ElementCount = SUITE_DEFAULT_ELEMENTS;
+    size_t MaxElements = SUITE_DEFAULT_MAX_ELEMENTS;
+    for(int Index = 1; Index + 1 < argc; Index += 2){
+        if(strcmp(argv[Index], "--label") == 0){
+            Label = argv[Index + 1];
+        }
+        else if(strcmp(argv[Index], "--json") == 0){
+            JsonPath = argv[Index + 1];
+        }
+        else if(strcmp(argv[Index], "--elements") == 0){
+            ElementCount = strtoull(argv[Index + 1], NULL, 10);
+        }
+        else if(strcmp(argv[Index], "--max-elements") == 0){
+            MaxElements = strtoull(argv[Index + 1], NULL, 10);
+        }
+        else{
+            fprintf(stderr, "usage: %s [--label NAME] [--elements N] [--max-elements N] [--json PATH]\n", argv[0]);
+            return 1;
+        }
+    }
+    if(ElementCount < 1){
+        ElementCount = 1;
+    }
+
+    SSuiteResult Results[64];
+    size_t Count = 0;
+    char Name[64];
+    // one unrecorded document brings the caches and the heap up to speed
+    suite_document(SUITE_SINK_NULL, SUITE_CIRCLE, 0, ElementCount);
+    printf("%-28s %12s %18s %12s %16s %13s\n", "case", "elements", "throughput", "bandwidth", "allocations", "peak RSS");
+
+    // each primitive into the null sink
+    for(int Primitive = SUITE_CIRCLE; Primitive <= SUITE_CIRCLES_BATCH; Primitive++){
+        snprintf(Name, sizeof(Name), "primitive %s", SUITE_PRIMITIVE_NAMES[Primitive]);
+        suite_case(&Results[Count++], Name, SUITE_SINK_NULL, (ESuitePrimitive)Primitive, 0, ElementCount);
+    }
+    // group nesting around every run of 16 circles
+    const int Depths[] = {1, 8, 64};
+    for(size_t Index = 0; Index < sizeof(Depths) / sizeof(Depths[0]); Index++){
+        snprintf(Name, sizeof(Name), "nesting depth %d", Depths[Index]);
+        suite_case(&Results[Count++], Name, SUITE_SINK_NULL, SUITE_CIRCLE, Depths[Index], ElementCount);
+    }
+    // every sink
+    for(int Sink = SUITE_SINK_NULL; Sink <= SUITE_SINK_FILE; Sink++){
+        snprintf(Name, sizeof(Name), "sink %s", SUITE_SINK_NAMES[Sink]);
+        suite_case(&Results[Count++], Name, (ESuiteSink)Sink, SUITE_CIRCLE, 0, ElementCount);
+    }
+    // document sizes into the null sink, whose memory use does not grow
+    for(size_t Size = SUITE_MIN_SIZE; Size <= MaxElements; Size *= 10){
+        snprintf(Name, sizeof(Name), "size %zu", Size);
+        suite_case(&Results[Count++], Name, SUITE_SINK_NULL, SUITE_CIRCLE, 0, Size);
+    }
+
+    if(suite_write_json(JsonPath, Label, Results, Count) != 0){
+        fprintf(stderr, "cannot write %s\n", JsonPath);
+        return 1;
+    }
+    printf("results written to %s\n", JsonPath);
+    return 0;
+}
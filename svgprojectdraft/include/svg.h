@@ -8,6 +8,9 @@
 #ifndef SVG_H
 #define SVG_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C"{
 #endif
@@ -37,9 +40,20 @@ typedef enum {
     SVG_ERR_NULL,          /**< NULL pointer passed */
     SVG_ERR_IO,            /**< Write callback failed */
     SVG_ERR_INVALID_ARG,   /**< Invalid parameter value */
-    SVG_ERR_STATE          /**< Invalid context state */
+    SVG_ERR_STATE,         /**< Invalid context state */
+    SVG_ERR_NO_MEM         /**< Memory allocation failed */
 } svg_return_t;
 
+/**
+ * @brief Retained display list, see svg_list.h.
+ */
+typedef struct SVG_LIST svg_list_t;
+
+/**
+ * @brief Pointer to a retained display list.
+ */
+typedef svg_list_t *svg_list_ptr;
+
 /**
  * @brief User-defined context pointer.
  *
@@ -61,6 +75,32 @@ typedef int svg_px_t;
  */
 typedef double svg_real_t;
 
+/**
+ * @brief Precision value selecting the default number format.
+ *
+ * Numbers are written like printf("%lf"): six decimal places with
+ * trailing zeros kept. This is the format of a newly created context.
+ */
+#define SVG_PRECISION_DEFAULT   (-2)
+
+/**
+ * @brief Precision value selecting the shortest round-trip format.
+ *
+ * Numbers are written with the fewest digits that read back as
+ * exactly the same double.
+ */
+#define SVG_PRECISION_SHORTEST  (-1)
+
+/**
+ * @brief Largest number of decimal places accepted as a precision.
+ */
+#define SVG_PRECISION_MAX       17
+
+/**
+ * @brief Buffer size that always holds a number written by svg_format_real().
+ */
+#define SVG_REAL_BUFFER_SIZE    352
+
 /**
  * @brief Coordinate type in SVG space.
  *
@@ -84,6 +124,76 @@ typedef struct{
     svg_coord_t height; /**< Y length */
 } svg_size_t;
 
+/**
+ * @brief Affine transform in SVG matrix order.
+ *
+ * Maps (x, y) to (a * x + c * y + e, b * x + d * y + f).
+ */
+typedef struct{
+    svg_real_t a;   /**< X scale */
+    svg_real_t b;   /**< Y shear */
+    svg_real_t c;   /**< X shear */
+    svg_real_t d;   /**< Y scale */
+    svg_real_t e;   /**< X translation */
+    svg_real_t f;   /**< Y translation */
+} svg_matrix_t;
+
+/**
+ * @brief Number of primitives dropped by viewport culling.
+ */
+typedef struct{
+    size_t circles; /**< Culled circles */
+    size_t rects;   /**< Culled rectangles */
+    size_t lines;   /**< Culled line segments */
+} svg_cull_counts_t;
+
+/**
+ * @brief Number of buckets in svg_stats_t::write_latency.
+ */
+#define SVG_STATS_LATENCY_BUCKETS   32
+
+/**
+ * @brief What a context has done since statistics were turned on.
+ *
+ * Element counts are of elements written, after culling, level of detail
+ * and density maps have dropped theirs. Shards add their counts to the
+ * parent's on commit; producers are not counted.
+ */
+typedef struct{
+    uint64_t circles;       /**< <circle> elements written */
+    uint64_t rects;         /**< <rect> elements written, density cells included */
+    uint64_t lines;         /**< <line> elements written */
+    uint64_t paths;         /**< Paths ended */
+    uint64_t path_points;   /**< Vertices written to those paths */
+    uint64_t groups;        /**< Groups begun */
+    uint64_t symbols;       /**< Symbols defined */
+    uint64_t uses;          /**< Symbol instances placed */
+    uint64_t flushes;       /**< Buffers flushed or queued for the writer thread */
+    uint64_t writes;        /**< Calls of the write callback */
+    uint64_t bytes_out;     /**< Bytes handed to the write callback */
+    uint64_t write_ns;      /**< Nanoseconds spent in the write callback */
+    uint64_t write_errors;  /**< Calls of the write callback that failed */
+    uint64_t alloc_errors;  /**< Allocations that failed */
+    uint64_t write_latency[SVG_STATS_LATENCY_BUCKETS];
+                            /**< Write callback calls by duration: bucket i
+                                 holds those of 2^i to 2^(i+1) - 1 ns, the
+                                 last one everything longer */
+} svg_stats_t;
+
+/**
+ * @brief Styles a density map colors its cells with.
+ *
+ * A cell holding count points out of the densest cell's max gets
+ * styles[level], where level grows with count / max, or with
+ * log(1 + count) / log(1 + max) when logarithmic is set, so the densest
+ * cells get styles[count - 1].
+ */
+typedef struct{
+    const char *const *styles;  /**< Cell styles from sparsest to densest */
+    size_t count;               /**< Number of styles, at least one */
+    int logarithmic;            /**< Nonzero to scale counts logarithmically */
+} svg_colormap_t;
+
 /**
  * 
  * @brief Callback used to write SVG output.
@@ -98,6 +208,47 @@ typedef struct{
 typedef svg_return_t (*svg_write_fn)(svg_user_context_ptr user,
                                     const char *text);
 
+/**
+ * @brief Length-aware callback used to write SVG output.
+ *
+ * Receives output straight from the context's buffers. The text is not
+ * NUL-terminated in general and is only valid during the call.
+ *
+ * @param user   User-defined context pointer
+ * @param data   SVG text
+ * @param length Number of bytes in data
+ *
+ * @return Status code indicating success or failure
+ */
+typedef svg_return_t (*svg_write_n_fn)(svg_user_context_ptr user,
+                                       const char *data,
+                                       size_t length);
+
+/**
+ * @brief A slice of output handed to an svg_writev_fn.
+ */
+typedef struct{
+    const char *data;   /**< First byte of the slice */
+    size_t length;      /**< Number of bytes in the slice */
+} svg_span_t;
+
+/**
+ * @brief Scatter-gather callback used to write SVG output.
+ *
+ * Receives several slices of output at once, to be written in order.
+ * The slices point into memory owned by the context and are only valid
+ * during the call.
+ *
+ * @param user  User-defined context pointer
+ * @param spans Slices of SVG text
+ * @param count Number of slices, at least one
+ *
+ * @return Status code indicating success or failure
+ */
+typedef svg_return_t (*svg_writev_fn)(svg_user_context_ptr user,
+                                      const svg_span_t *spans,
+                                      size_t count);
+
 /**
  * @brief Callback used to clean up user resources.
  *
@@ -129,11 +280,66 @@ svg_context_ptr svg_create(svg_write_fn write_fn,
                            svg_px_t width, 
                            svg_px_t height);
 
+/**
+ * @brief Memory hooks of a context created by svg_create_ex().
+ *
+ * Every allocation the context makes goes through these, with the same
+ * meaning as malloc(), realloc() and free(). realloc_fn is given NULL to
+ * allocate; free_fn is never given NULL. Shards and producers take the
+ * hooks of their parent and call them from their own threads, so they
+ * can only be created when thread_safe is set. The C heap selected by
+ * NULL hooks is thread-safe.
+ */
+typedef struct{
+    void *(*alloc_fn)(void *user, size_t size);                 /**< Allocates size bytes */
+    void *(*realloc_fn)(void *user, void *pointer, size_t size); /**< Resizes an allocation */
+    void (*free_fn)(void *user, void *pointer);                 /**< Releases an allocation */
+    void *user;                                                 /**< Passed to every hook */
+    int thread_safe;                                            /**< Nonzero if the hooks may run on several threads at once */
+} svg_allocator_t;
+
+/**
+ * @brief Settings of a context created by svg_create_ex().
+ *
+ * Exactly one of write_fn, write_n_fn and writev_fn is set; the others
+ * are NULL. The allocator hooks are either all set or all NULL, which
+ * selects the C heap. A zeroed structure with a callback and a size is
+ * valid.
+ */
+typedef struct{
+    svg_write_fn write_fn;          /**< Callback taking NUL-terminated text */
+    svg_write_n_fn write_n_fn;      /**< Callback taking text and its length */
+    svg_writev_fn writev_fn;        /**< Callback taking several slices at once */
+    svg_cleanup_fn cleanup_fn;      /**< Callback used to clean up user resources, may be NULL */
+    svg_user_context_ptr user;      /**< User-defined context passed to callbacks */
+    svg_px_t width;                 /**< Canvas width in pixels */
+    svg_px_t height;                /**< Canvas height in pixels */
+    svg_allocator_t allocator;      /**< Memory hooks, see svg_arena_allocator() */
+} svg_create_options_t;
+
+/**
+ * @brief Creates a new SVG drawing context from a set of options.
+ *
+ * Like svg_create(), but the output callback may also take text with
+ * its length, or several slices at once. Those callbacks are handed the
+ * context's buffers directly, with no copying and no NUL to search for.
+ * A scatter-gather callback gets every buffer queued for the writer
+ * thread of svg_set_async() in one call, and a whole frame written by
+ * svg_frame_end() with SVG_FRAME_FULL as slices of the retained
+ * elements.
+ *
+ * @param options Context settings
+ *
+ * @return Pointer to a newly created SVG context, or NULL on failure
+ */
+svg_context_ptr svg_create_ex(const svg_create_options_t *options);
+
 /**
  * @brief Destroys an SVG context.
  *
  * Finalizes the SVG output and releases all resources associated
- * with the context.
+ * with the context. An open path and any open groups are closed, and
+ * all buffered output is flushed before the cleanup callback is called.
  *
  * @param context SVG context to destroy
  *
@@ -141,6 +347,458 @@ svg_context_ptr svg_create(svg_write_fn write_fn,
  */
 svg_return_t svg_destroy(svg_context_ptr context);
 
+/**
+ * @brief Creates an SVG context that keeps the document in memory.
+ *
+ * Output accumulates in one contiguous buffer owned by the context and
+ * is never written anywhere. svg_detach_buffer() hands the finished
+ * document to the caller; svg_destroy() discards it.
+ *
+ * @param width  Canvas width in pixels
+ * @param height Canvas height in pixels
+ *
+ * @return Pointer to a newly created SVG context, or NULL on failure
+ */
+svg_context_ptr svg_create_memory(svg_px_t width,
+                                  svg_px_t height);
+
+/**
+ * @brief Finishes a memory context and takes its document.
+ *
+ * Closes the document like svg_destroy() and destroys the context. The
+ * caller owns the returned NUL-terminated buffer and releases it with
+ * free(). On failure the context is still destroyed and *buffer is NULL.
+ *
+ * @param context SVG context created by svg_create_memory()
+ * @param buffer  Receives the document
+ * @param length  Receives the document length in bytes, may be NULL
+ *
+ * @return Status code indicating success or failure; SVG_ERR_STATE
+ *         leaves a context that was not created by svg_create_memory()
+ *         untouched
+ */
+svg_return_t svg_detach_buffer(svg_context_ptr context,
+                               char **buffer,
+                               size_t *length);
+
+/**
+ * @brief Creates an SVG context that only measures its output.
+ *
+ * The drawing functions format their output as usual so it can be
+ * counted exactly, but nothing is written or kept.
+ *
+ * @param width  Canvas width in pixels
+ * @param height Canvas height in pixels
+ *
+ * @return Pointer to a newly created SVG context, or NULL on failure
+ */
+svg_context_ptr svg_create_measure(svg_px_t width,
+                                   svg_px_t height);
+
+/**
+ * @brief Creates an SVG context that records into a display list.
+ *
+ * svg_circle(), svg_rect(), svg_line(), their batch forms and the group
+ * functions append to list instead of producing output, before any
+ * culling or level-of-detail settings apply. Paths cannot be recorded
+ * and return SVG_ERR_STATE. The list is not destroyed with the context.
+ *
+ * @param list   Display list to record into
+ * @param width  Canvas width in pixels
+ * @param height Canvas height in pixels
+ *
+ * @return Pointer to a newly created SVG context, or NULL on failure
+ */
+svg_context_ptr svg_create_recording(svg_list_ptr list,
+                                     svg_px_t width,
+                                     svg_px_t height);
+
+/**
+ * @brief Destroys an SVG context and reports the document length.
+ *
+ * Behaves like svg_destroy() and stores the number of bytes in the
+ * complete document, including the closing tags it adds. Used with
+ * svg_create_measure() this gives the exact size the same drawing calls
+ * produce on any other context.
+ *
+ * @param context SVG context to destroy
+ * @param length  Receives the document length in bytes
+ *
+ * @return Status code indicating success or failure
+ */
+svg_return_t svg_measure(svg_context_ptr context,
+                         size_t *length);
+
+/**
+ * @brief Writes all buffered output.
+ *
+ * Drawing functions format their output into a buffer owned by the
+ * context. The write callback is only called when that buffer reaches
+ * the flush threshold, when this function is called, or when the
+ * context is destroyed. A context created by svg_create_memory() keeps
+ * its output, so flushing it has no effect.
+ *
+ * @param context SVG context to flush
+ *
+ * @return Status code indicating success or failure
+ */
+svg_return_t svg_flush(svg_context_ptr context);
+
+/**
+ * @brief Sets the flush threshold of the output buffer.
+ *
+ * Once at least threshold bytes are buffered, the next drawing call
+ * flushes them through the write callback. A threshold of zero flushes
+ * after every element. If more than threshold bytes are already
+ * buffered they are flushed immediately.
+ *
+ * @param context   SVG context to configure
+ * @param threshold Number of buffered bytes that triggers a flush
+ *
+ * @return Status code indicating success or failure
+ */
+svg_return_t svg_set_flush_threshold(svg_context_ptr context,
+                                     size_t threshold);
+
+/**
+ * @brief Moves calls to the write callback onto a background thread.
+ *
+ * The context fills one buffer while a writer thread passes the others
+ * to the write callback, in order. buffers is the most output buffers
+ * the context may hold at once: 2 double buffers, blocking a flush while
+ * the writer is still busy with the previous buffer, and larger values
+ * let output queue up before drawing calls block. Zero returns to
+ * synchronous writing.
+ *
+ * The write callback is then called from the writer thread. A failure
+ * is reported by a later flush, drawing call or svg_destroy(), and the
+ * rest of the document is not written. svg_flush() waits until the
+ * writer thread has written everything.
+ *
+ * @param context SVG context to configure
+ * @param buffers Maximum number of output buffers, 0 or at least 2
+ *
+ * @return Status code indicating success or failure; SVG_ERR_STATE for
+ *         memory and measuring contexts
+ */
+svg_return_t svg_set_async(svg_context_ptr context,
+                           size_t buffers);
+
+/**
+ * @brief Creates a shard that formats output for a parent context.
+ *
+ * A shard is a context of its own that copies the parent's number
+ * format, culling settings, viewport and group nesting, and keeps its
+ * output in memory. Shards share nothing with the parent or each other
+ * while drawing, so each one can be used by a different thread. Style
+ * handles registered on the parent may be used in any shard.
+ *
+ * Committing the shards with svg_shard_commit() in drawing order gives
+ * the same bytes as drawing everything into the parent. A shard cannot
+ * be created while the parent interns style strings, decimates with
+ * svg_set_lod() or has a path open, because those depend on what was
+ * drawn before, nor when the parent's allocator is not thread-safe,
+ * such as an arena's.
+ *
+ * @param parent SVG context the shard is committed to
+ *
+ * @return Pointer to a newly created shard, or NULL on failure
+ */
+svg_context_ptr svg_shard_create(svg_context_ptr parent);
+
+/**
+ * @brief Appends a shard's output to its parent and destroys the shard.
+ *
+ * Must not run at the same time as drawing into the parent. Output at
+ * least as large as the parent's flush threshold is flushed straight
+ * from the shard's buffer without being copied. Culling counts are
+ * added to the parent's. The shard is left untouched on SVG_ERR_NULL,
+ * SVG_ERR_INVALID_ARG and SVG_ERR_STATE and destroyed otherwise.
+ *
+ * @param parent SVG context the shard was created from
+ * @param shard  Shard with no open path or group of its own
+ *
+ * @return Status code indicating success or failure
+ */
+svg_return_t svg_shard_commit(svg_context_ptr parent,
+                              svg_context_ptr shard);
+
+/**
+ * @brief Creates a producer that submits output to a parent context.
+ *
+ * A producer is created like a shard (see svg_shard_create()), but its
+ * output goes to the parent as it is drawn. Whenever the producer's
+ * buffer reaches the parent's flush threshold, or the producer is
+ * flushed or destroyed, the buffered elements are submitted as one
+ * record to a lock-free queue. Many producers can run on different
+ * threads at once.
+ *
+ * The parent is the single consumer. svg_flush() and svg_destroy() on
+ * the parent append every record submitted so far, and those calls,
+ * along with svg_producer_create() itself, belong on the thread that
+ * owns the parent.
+ *
+ * Ordering contract:
+ * - Records from one producer appear in the order they were drawn.
+ * - Records from different producers interleave only between elements
+ *   drawn outside any group the producer opened. A group, or layer,
+ *   opened in a producer is submitted whole when it is closed, so it
+ *   holds only that producer's elements.
+ *
+ * Every producer must be destroyed before its parent. Culling counts
+ * stay with the producer.
+ *
+ * @param parent SVG context the producer submits to
+ *
+ * @return Pointer to a newly created producer, or NULL on failure
+ */
+svg_context_ptr svg_producer_create(svg_context_ptr parent);
+
+/**
+ * @brief Formats a real number as SVG text.
+ *
+ * Writes value followed by a terminating NUL. A precision between 0 and
+ * SVG_PRECISION_MAX rounds to that many decimal places and drops trailing
+ * zeros, so 50.0 is written as "50". SVG_PRECISION_SHORTEST and
+ * SVG_PRECISION_DEFAULT select the formats described at their definitions.
+ *
+ * @param buffer    Output buffer of at least SVG_REAL_BUFFER_SIZE bytes
+ * @param value     Number to format
+ * @param precision Decimal places, SVG_PRECISION_SHORTEST or SVG_PRECISION_DEFAULT
+ *
+ * @return Number of characters written, excluding the NUL
+ */
+size_t svg_format_real(char *buffer,
+                       svg_real_t value,
+                       int precision);
+
+/**
+ * @brief Sets the number format used by the drawing functions.
+ *
+ * Applies svg_format_real() with the given precision to every coordinate
+ * and length written afterwards.
+ *
+ * @param context   SVG context to configure
+ * @param precision Decimal places, SVG_PRECISION_SHORTEST or SVG_PRECISION_DEFAULT
+ *
+ * @return Status code indicating success or failure
+ */
+svg_return_t svg_set_precision(svg_context_ptr context,
+                               int precision);
+
+/**
+ * @brief Turns snapping of coordinates and lengths to a decimal grid on or off.
+ *
+ * While enabled, every coordinate and length is rounded to the nearest
+ * multiple of 10^-digits, with the rounding decided exactly, and printed
+ * from the resulting integer without trailing zeros. Each written number
+ * is therefore within half a grid step of the value drawn; numbers too
+ * large for the grid are written by svg_format_real() with digits, which
+ * keeps the same bound. Path vertices after the first are written as
+ * relative linetos between grid positions, so the bound holds for every
+ * vertex however long the path is, and a vertex on the same grid
+ * position as the one before is left out. Quantization takes the place
+ * of the precision set by svg_set_precision() until it is turned off.
+ *
+ * @param context SVG context to configure
+ * @param enabled Nonzero to snap to the grid, zero to format normally
+ * @param digits  Decimal places of a grid step, 0 to SVG_PRECISION_MAX
+ *
+ * @return Status code indicating success or failure; SVG_ERR_STATE while
+ *         a path is open
+ */
+svg_return_t svg_set_quantization(svg_context_ptr context,
+                                  int enabled,
+                                  int digits);
+
+/**
+ * @brief Registers a style and returns a handle for it.
+ *
+ * The style is written once, as a CSS class in a <style> element. The
+ * returned handle can be passed to any drawing function in place of a
+ * style string, and elements drawn with it carry only class="sN".
+ * Registering the same style again returns the same handle.
+ *
+ * The rule goes into a <style> element directly after the <svg> header
+ * while the header has not been flushed yet. After that it is written
+ * at the current position, which CSS still applies to the whole
+ * document. Handles stay valid until the context is destroyed and must
+ * only be used with the context that returned them.
+ *
+ * @param context SVG context to register the style with
+ * @param style   SVG style declarations, e.g. "fill:none; stroke:green"
+ * @param handle  Receives the style handle
+ *
+ * @return Status code indicating success or failure
+ */
+svg_return_t svg_style_register(svg_context_ptr context,
+                                const char *style,
+                                const char **handle);
+
+/**
+ * @brief Returns the style declarations a style handle stands for.
+ *
+ * Lets a style be passed on to something that does not know the context
+ * the handle came from, such as a display list. The result stays valid
+ * as long as the handle.
+ *
+ * @param style Style handle from svg_style_register(), a raw style
+ *              string or NULL
+ *
+ * @return The handle's declarations, or style itself when it is not a
+ *         handle
+ */
+const char *svg_style_text(const char *style);
+
+/**
+ * @brief Turns automatic style interning on or off.
+ *
+ * While interning is on, every raw style string passed to a drawing
+ * function is looked up in a hash table and registered on first use, as
+ * if by svg_style_register(). Elements then carry a class instead of
+ * repeating the style. Interning is off by default.
+ *
+ * @param context SVG context to configure
+ * @param enabled Nonzero to intern style strings
+ *
+ * @return Status code indicating success or failure
+ */
+svg_return_t svg_set_style_interning(svg_context_ptr context,
+                                     int enabled);
+
+/**
+ * @brief Sets the level-of-detail tolerance.
+ *
+ * With a positive tolerance the context drops geometry that would not
+ * be visible at the canvas resolution. The canvas is divided into
+ * square cells tolerance pixels wide.
+ *
+ * - Paths keep only the first, last, lowest and highest vertex of each
+ *   cell column. A dense series comes out as at most four vertices per
+ *   column while keeping its drawn envelope.
+ * - A circle is dropped when a circle with the same style and radius
+ *   (to within one cell) was already written with its center in the
+ *   same cell. Circles centered off the canvas are always written.
+ * - A line is dropped when a line with the same style was already
+ *   written with both endpoints in the same cells, in either direction.
+ *
+ * Written cells are remembered per style for the whole document, so
+ * series drawn interleaved are decimated as well as series drawn one
+ * after the other. At most one key per canvas cell, and no more than
+ * 2^20 keys, are remembered; past that, and for styles beyond the
+ * first 4096, elements are written without being compared.
+ *
+ * A tolerance of zero, the default, writes everything. The tolerance
+ * cannot be changed while a path is open.
+ *
+ * @param context   SVG context to configure
+ * @param tolerance Cell size in pixels, or 0 to turn decimation off
+ *
+ * @return Status code indicating success or failure
+ */
+svg_return_t svg_set_lod(svg_context_ptr context,
+                         svg_real_t tolerance);
+
+/**
+ * @brief Turns viewport culling on or off.
+ *
+ * While culling is on, circles, rectangles and line segments whose
+ * bounding box misses the viewport are dropped before they are
+ * formatted. The box is first grown by margin on every side, which
+ * should cover the widest stroke in use. Culling is off by default.
+ *
+ * @param context SVG context to configure
+ * @param enabled Nonzero to cull, zero to write everything
+ * @param margin  Non-negative room kept around each bounding box
+ *
+ * @return Status code indicating success or failure
+ */
+svg_return_t svg_set_culling(svg_context_ptr context,
+                             int enabled,
+                             svg_real_t margin);
+
+/**
+ * @brief Sets the visible area used for culling.
+ *
+ * The viewport is given in the same coordinates as the drawing calls.
+ * This allows culling under a zooming or panning transform that the
+ * caller applies through a group. It defaults to the canvas passed to
+ * svg_create(). Passing NULL for both top_left and size restores that
+ * default.
+ *
+ * @param context  SVG context to configure
+ * @param top_left Top-left corner of the visible area
+ * @param size     Non-negative size of the visible area
+ *
+ * @return Status code indicating success or failure
+ */
+svg_return_t svg_set_viewport(svg_context_ptr context,
+                              const svg_point_t *top_left,
+                              const svg_size_t *size);
+
+/**
+ * @brief Reports how many primitives culling has dropped.
+ *
+ * @param context SVG context to query
+ * @param counts  Receives the counts since the context was created
+ *
+ * @return Status code indicating success or failure
+ */
+svg_return_t svg_get_cull_counts(svg_context_ptr context,
+                                 svg_cull_counts_t *counts);
+
+/**
+ * @brief Turns statistics on or off.
+ *
+ * Statistics are off by default, and then cost one predictable branch
+ * per element. Turning them on clears them. Timing the write callback
+ * reads the monotonic clock twice per call. Building the library with
+ * SVG_NO_STATS defined compiles all of it out, and turning statistics
+ * on then fails with SVG_ERR_STATE.
+ *
+ * @param context SVG context to configure
+ * @param enabled Nonzero to collect statistics
+ *
+ * @return Status code indicating success or failure
+ */
+svg_return_t svg_set_stats(svg_context_ptr context,
+                           int enabled);
+
+/**
+ * @brief Reports the statistics of a context.
+ *
+ * Waits for the writer thread of svg_set_async(), if any, to finish the
+ * buffers queued so far.
+ *
+ * @param context SVG context to query
+ * @param stats   Receives the statistics, all zero while they are off
+ *
+ * @return Status code indicating success or failure
+ */
+svg_return_t svg_get_stats(svg_context_ptr context,
+                           svg_stats_t *stats);
+
+/**
+ * @brief Sends group begin and end events to a trace callback.
+ *
+ * Each event is a Chrome trace-event object followed by ",\n", and the
+ * first one is preceded by "[\n", so the text passed to trace_fn is a
+ * trace file that chrome://tracing and Perfetto load as it is. Begin
+ * events carry the group's attributes. Timestamps are microseconds
+ * since the call that set the callback. The callback's return value is
+ * ignored, and shards do not trace. Fails with SVG_ERR_STATE when the
+ * library is built with SVG_NO_STATS.
+ *
+ * @param context  SVG context to configure
+ * @param trace_fn Callback receiving the trace text, or NULL to stop
+ * @param user     User-defined context passed to trace_fn
+ *
+ * @return Status code indicating success or failure
+ */
+svg_return_t svg_set_trace(svg_context_ptr context,
+                           svg_write_fn trace_fn,
+                           svg_user_context_ptr user);
+
 /**
  * @brief Draws a circle.
  *
@@ -148,16 +806,42 @@ svg_return_t svg_destroy(svg_context_ptr context);
  *
  * @param context SVG context to draw into
  * @param center  Center point of the circle
- * @param radius  Circle radius
+ * @param radius  Circle radius, which must be greater than zero
  * @param style   SVG style string (may be NULL)
  *
- * @return Status code indicating success or failure
+ * @return Status code indicating success or failure; SVG_ERR_INVALID_ARG
+ *         if radius is zero, negative or NaN, or center is NULL
  */
 svg_return_t svg_circle(svg_context_ptr context,
                         const svg_point_t *center,
                         svg_real_t radius,
                         const char* style);
 
+/**
+ * @brief Draws a run of circles.
+ *
+ * Writes count <circle> elements sharing one style string. Element i
+ * is centered at (xs[i], ys[i]) with radius radii[i]. The output is the
+ * same as calling svg_circle() for each element in order. Every radius
+ * is checked before anything is written, so an invalid radius leaves
+ * the output unchanged.
+ *
+ * @param context SVG context to draw into
+ * @param xs      Center x coordinates
+ * @param ys      Center y coordinates
+ * @param radii   Circle radii, each greater than zero
+ * @param count   Number of circles
+ * @param style   SVG style string (may be NULL)
+ *
+ * @return Status code indicating success or failure
+ */
+svg_return_t svg_circles(svg_context_ptr context,
+                         const svg_coord_t *xs,
+                         const svg_coord_t *ys,
+                         const svg_real_t *radii,
+                         size_t count,
+                         const char *style);
+
 /**
  * @brief Draws a rectangle.
  *
@@ -176,6 +860,31 @@ svg_return_t svg_rect(svg_context_ptr context,
                       const svg_size_t *size,
                       const char *style);
 
+/**
+ * @brief Draws a run of rectangles.
+ *
+ * Writes count <rect> elements sharing one style string. Element i has
+ * its top-left corner at (xs[i], ys[i]) and size widths[i] by heights[i].
+ * The output is the same as calling svg_rect() for each element in order.
+ *
+ * @param context SVG context to draw into
+ * @param xs      Top-left x coordinates
+ * @param ys      Top-left y coordinates
+ * @param widths  Rectangle widths
+ * @param heights Rectangle heights
+ * @param count   Number of rectangles
+ * @param style   SVG style string (may be NULL)
+ *
+ * @return Status code indicating success or failure
+ */
+svg_return_t svg_rects(svg_context_ptr context,
+                       const svg_coord_t *xs,
+                       const svg_coord_t *ys,
+                       const svg_coord_t *widths,
+                       const svg_coord_t *heights,
+                       size_t count,
+                       const char *style);
+
 /**
  * @brief Draws a line segment.
  *
@@ -193,6 +902,86 @@ svg_return_t svg_line(svg_context_ptr context,
                       const svg_point_t *end,
                       const char *style);
 
+/**
+ * @brief Draws a run of line segments.
+ *
+ * Writes count <line> elements sharing one style string. Element i runs
+ * from (x1s[i], y1s[i]) to (x2s[i], y2s[i]). The output is the same as
+ * calling svg_line() for each element in order.
+ *
+ * @param context SVG context to draw into
+ * @param x1s     Start x coordinates
+ * @param y1s     Start y coordinates
+ * @param x2s     End x coordinates
+ * @param y2s     End y coordinates
+ * @param count   Number of line segments
+ * @param style   SVG style string (may be NULL)
+ *
+ * @return Status code indicating success or failure
+ */
+svg_return_t svg_lines(svg_context_ptr context,
+                       const svg_coord_t *x1s,
+                       const svg_coord_t *y1s,
+                       const svg_coord_t *x2s,
+                       const svg_coord_t *y2s,
+                       size_t count,
+                       const char *style);
+
+/**
+ * @brief Begins a streamed path.
+ *
+ * Writes the start of a <path> element whose vertices are added with
+ * svg_path_point() or svg_path_points() and which is closed by
+ * svg_path_end(). Vertices are written as they arrive, so a path of any
+ * length needs no extra memory. The first vertex is a moveto and every
+ * later vertex is a lineto, so the path draws one polyline. Until the
+ * path ends, all other drawing and group calls return SVG_ERR_STATE.
+ *
+ * @param context SVG context to draw into
+ * @param style   SVG style string (may be NULL)
+ *
+ * @return Status code indicating success or failure
+ */
+svg_return_t svg_path_begin(svg_context_ptr context,
+                            const char *style);
+
+/**
+ * @brief Adds a vertex to the open path.
+ *
+ * @param context SVG context to draw into
+ * @param point   Vertex to add
+ *
+ * @return Status code indicating success or failure
+ */
+svg_return_t svg_path_point(svg_context_ptr context,
+                            const svg_point_t *point);
+
+/**
+ * @brief Adds a run of vertices to the open path.
+ *
+ * Equivalent to calling svg_path_point() for each vertex in order.
+ *
+ * @param context SVG context to draw into
+ * @param points  Vertices to add
+ * @param count   Number of vertices
+ *
+ * @return Status code indicating success or failure
+ */
+svg_return_t svg_path_points(svg_context_ptr context,
+                             const svg_point_t *points,
+                             size_t count);
+
+/**
+ * @brief Ends the open path.
+ *
+ * Writes the end of the <path> element started by svg_path_begin().
+ *
+ * @param context SVG context to draw into
+ *
+ * @return Status code indicating success or failure
+ */
+svg_return_t svg_path_end(svg_context_ptr context);
+
 /**
  * @brief Begins an SVG group.
  *
@@ -211,7 +1000,7 @@ svg_return_t svg_group_begin(svg_context_ptr context,
 /**
  * @brief Ends the current SVG group.
  *
- * Writes a closing </g> tag.
+ * Writes a closing </g> tag. Returns SVG_ERR_STATE if no group is open.
  *
  * @param context SVG context to draw into
  *
@@ -219,6 +1008,242 @@ svg_return_t svg_group_begin(svg_context_ptr context,
  */
 svg_return_t svg_group_end(svg_context_ptr context);
 
+/**
+ * @brief Applies a transform to everything drawn until it is popped.
+ *
+ * The context keeps a current transform, initially the identity, that
+ * maps the coordinates given to drawing calls to canvas coordinates
+ * before they are written, culled or decimated. Pushing composes matrix
+ * with the current transform, so matrix applies first. Points, line
+ * endpoints, path vertices, circle centers and symbol placements are
+ * mapped; symbol content keeps its size. Circle radii are scaled by the
+ * square root of the transform's absolute determinant, so a circle keeps
+ * its area and stays a circle under non-uniform scale. Rectangles are
+ * mapped corner to corner while the transform has no rotation or shear,
+ * and are written as a <polygon> through their four mapped corners
+ * otherwise. Batch calls map their coordinates in bulk with the same
+ * kernel as svg_transform_points().
+ *
+ * @param context SVG context to draw into
+ * @param matrix  Transform to apply, with finite entries
+ *
+ * @return Status code indicating success or failure; SVG_ERR_STATE if a
+ *         path is open or the context records into a display list
+ */
+svg_return_t svg_transform_push(svg_context_ptr context,
+                                const svg_matrix_t *matrix);
+
+/**
+ * @brief Restores the transform in effect before the last push.
+ *
+ * @param context SVG context to draw into
+ *
+ * @return Status code indicating success or failure; SVG_ERR_STATE if
+ *         nothing was pushed or a path is open
+ */
+svg_return_t svg_transform_pop(svg_context_ptr context);
+
+/**
+ * @brief Transforms an array of points.
+ *
+ * Uses AVX or SSE2 where the machine has them, with results identical
+ * to the plain expression a * x + c * y + e, b * x + d * y + f.
+ *
+ * @param matrix Transform to apply
+ * @param points Points to transform
+ * @param result Receives the transformed points; may equal points
+ * @param count  Number of points
+ *
+ * @return Status code indicating success or failure
+ */
+svg_return_t svg_transform_points(const svg_matrix_t *matrix,
+                                  const svg_point_t *points,
+                                  svg_point_t *result,
+                                  size_t count);
+
+/**
+ * @brief Begins the definition of a reusable symbol.
+ *
+ * Writes a <defs> element holding a group whose content is drawn with
+ * the usual drawing calls until svg_symbol_end(). Nothing defined is
+ * shown until it is placed with svg_use(). Symbols cannot be nested and
+ * cannot be defined in a shard, a producer or a recording context.
+ *
+ * @param context SVG context to draw into
+ * @param id      Receives the id to pass to svg_use()
+ *
+ * @return Status code indicating success or failure; SVG_ERR_STATE if a
+ *         symbol, path or density map is open
+ */
+svg_return_t svg_symbol_begin(svg_context_ptr context,
+                              size_t *id);
+
+/**
+ * @brief Ends the definition of the open symbol.
+ *
+ * @param context SVG context to draw into
+ *
+ * @return Status code indicating success or failure; SVG_ERR_STATE if no
+ *         symbol is open or a path or group opened inside it still is
+ */
+svg_return_t svg_symbol_end(svg_context_ptr context);
+
+/**
+ * @brief Places an instance of a symbol.
+ *
+ * Writes a <use> element that draws the symbol translated by at, so
+ * each instance costs a few bytes whatever the symbol holds. Instances
+ * are not culled. Shards can place the symbols their parent had defined
+ * when they were created.
+ *
+ * @param context SVG context to draw into
+ * @param id      Symbol id from svg_symbol_begin()
+ * @param at      Offset of the instance
+ *
+ * @return Status code indicating success or failure; SVG_ERR_INVALID_ARG
+ *         if id is not a symbol whose definition has ended
+ */
+svg_return_t svg_use(svg_context_ptr context,
+                     size_t id,
+                     const svg_point_t *at);
+
+/**
+ * @brief Begins aggregating points into a density map.
+ *
+ * The canvas is divided into square cells cell_px pixels wide, and
+ * until svg_density_end() every point given to svg_density_points() and
+ * every circle center drawn is counted in the cell it falls into
+ * instead of being written. Points are mapped by the current transform
+ * and those outside the canvas are dropped, so the map costs memory and
+ * output in proportion to the canvas resolution, not the number of
+ * points. Other drawing calls write as usual.
+ *
+ * Shards created while the map is open count into a map of their own,
+ * which svg_shard_commit() adds to the parent's, so points can be binned
+ * on many threads. Producers cannot be created while the map is open. A
+ * map still open when the context is destroyed is discarded.
+ *
+ * @param context SVG context to draw into
+ * @param cell_px Positive cell size in pixels
+ *
+ * @return Status code indicating success or failure; SVG_ERR_STATE if a
+ *         map, path or symbol is open, or the context is a shard, records
+ *         into a display list or renders frames
+ */
+svg_return_t svg_density_begin(svg_context_ptr context,
+                               svg_px_t cell_px);
+
+/**
+ * @brief Counts a run of points in the open density map.
+ *
+ * @param context SVG context to draw into
+ * @param points  Points to count
+ * @param count   Number of points
+ *
+ * @return Status code indicating success or failure; SVG_ERR_STATE if no
+ *         density map is open
+ */
+svg_return_t svg_density_points(svg_context_ptr context,
+                                const svg_point_t *points,
+                                size_t count);
+
+/**
+ * @brief Ends the open density map and draws it.
+ *
+ * Writes one <rect> per cell holding at least one point, in row order,
+ * styled by colormap. Cells are in canvas coordinates and are not
+ * transformed; those in the last row and column are cut to the canvas.
+ * The map is released even if writing fails.
+ *
+ * @param context  SVG context to draw into
+ * @param colormap Cell styles, or NULL for a built-in logarithmic ramp
+ *
+ * @return Status code indicating success or failure; SVG_ERR_STATE if no
+ *         density map is open, a path is or the context is a shard,
+ *         SVG_ERR_INVALID_ARG if the colormap has no styles
+ */
+svg_return_t svg_density_end(svg_context_ptr context,
+                             const svg_colormap_t *colormap);
+
+/**
+ * @brief Frame mode of svg_frame_end() writing only what changed.
+ */
+#define SVG_FRAME_DIFF          0
+
+/**
+ * @brief Frame mode of svg_frame_end() writing the whole document.
+ */
+#define SVG_FRAME_FULL          1
+
+/**
+ * @brief Begins a frame.
+ *
+ * The first frame turns the context into a retained scene: elements are
+ * kept by id between frames and each frame is written as a document of
+ * its own by svg_frame_end(), so the context must not have drawn
+ * anything yet. Within a frame, every top-level element is preceded by
+ * svg_frame_id(); drawing it again under the same id replaces it, and
+ * elements that are not drawn again stay as they are. A group counts as
+ * one element, so a batch call like svg_circles() belongs inside a
+ * group. Culling, level of detail and style interning cannot be used
+ * with frames, and drawing outside a frame fails with SVG_ERR_STATE.
+ *
+ * @param context SVG context to draw into
+ *
+ * @return Status code indicating success or failure; SVG_ERR_STATE if a
+ *         frame is already open or the context cannot render frames
+ */
+svg_return_t svg_frame_begin(svg_context_ptr context);
+
+/**
+ * @brief Sets the id of the next top-level element of a frame.
+ *
+ * The id is written as the element's id attribute.
+ *
+ * @param context SVG context to draw into
+ * @param id      Element id, without quotes, '<', '>' or '&'
+ *
+ * @return Status code indicating success or failure; SVG_ERR_STATE if no
+ *         frame is open or a path or group is
+ */
+svg_return_t svg_frame_id(svg_context_ptr context,
+                          const char *id);
+
+/**
+ * @brief Removes an element from the scene.
+ *
+ * @param context SVG context to draw into
+ * @param id      Id the element was drawn under
+ *
+ * @return Status code indicating success or failure; SVG_ERR_INVALID_ARG
+ *         if no element has the id, SVG_ERR_STATE if no frame is open
+ */
+svg_return_t svg_frame_remove(svg_context_ptr context,
+                              const char *id);
+
+/**
+ * @brief Ends a frame and writes it.
+ *
+ * SVG_FRAME_FULL writes the whole scene as an SVG document, elements in
+ * the order their ids were first drawn. SVG_FRAME_DIFF writes an
+ * <svg-diff> document with one <remove id="..."/>, <replace id="...">
+ * or <add> entry per element changed since the previous frame, so its
+ * cost follows the number of changes rather than the size of the
+ * scene. Applying the entries to the previous frame, with added
+ * elements appended to the root, gives the current one. Redrawing an
+ * element with identical output is not a change. The frame is handed to
+ * the sink before returning. The scene moves on even if writing fails,
+ * so a client that missed a frame needs an SVG_FRAME_FULL one.
+ *
+ * @param context SVG context to draw into
+ * @param mode    SVG_FRAME_DIFF or SVG_FRAME_FULL
+ *
+ * @return Status code indicating success or failure; SVG_ERR_STATE if no
+ *         frame is open or a path or group is
+ */
+svg_return_t svg_frame_end(svg_context_ptr context,
+                           int mode);
+
 #ifdef __cplusplus
 }
 #endif
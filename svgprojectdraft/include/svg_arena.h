@@ -0,0 +1,101 @@
+/**
+ * @file svg_arena.h
+ * @brief Bump arena for SVG contexts.
+ *
+ * An arena hands out memory from a few large chunks and takes it all back
+ * at once. A context created with svg_create_ex() and the arena's
+ * allocator makes no calls to the C heap of its own, so a service that
+ * writes one document per request can reuse a single arena and reset it
+ * between documents.
+ */
+
+#ifndef SVG_ARENA_H
+#define SVG_ARENA_H
+
+#include "svg.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/**
+ * @brief Opaque bump arena.
+ */
+typedef struct SVG_ARENA svg_arena_t, *svg_arena_ptr;
+
+/**
+ * @brief Memory use of an arena.
+ */
+typedef struct{
+    size_t used;        /**< Bytes handed out since the last reset, headers included */
+    size_t peak;        /**< Most bytes in use at once since the arena was created */
+    size_t reserved;    /**< Bytes held in chunks */
+    size_t heap_calls;  /**< Chunks allocated from or returned to the C heap */
+} svg_arena_usage_t;
+
+/**
+ * @brief Creates an empty arena.
+ *
+ * Chunks are allocated from the C heap when an allocation does not fit
+ * the current one. svg_arena_reset() merges them into a single chunk
+ * large enough for everything allocated before, so a run of similar
+ * documents stops touching the heap after the first one.
+ *
+ * @param chunk_size Bytes per chunk, 0 selects 256 KiB
+ *
+ * @return Pointer to a newly created arena, or NULL on failure
+ */
+svg_arena_ptr svg_arena_create(size_t chunk_size);
+
+/**
+ * @brief Fills in allocator hooks that allocate from an arena.
+ *
+ * Freeing or growing the most recent allocation happens in place; other
+ * memory is only reclaimed by svg_arena_reset(). The arena is not
+ * thread-safe, so the hooks leave thread_safe clear and contexts using
+ * them refuse to create shards or producers.
+ *
+ * @param arena     Arena to allocate from
+ * @param allocator Receives the hooks, for svg_create_options_t
+ *
+ * @return Status code indicating success or failure
+ */
+svg_return_t svg_arena_allocator(svg_arena_ptr arena,
+                                 svg_allocator_t *allocator);
+
+/**
+ * @brief Takes back everything allocated from an arena.
+ *
+ * Every context using the arena must have been destroyed.
+ *
+ * @param arena Arena to reset
+ *
+ * @return Status code indicating success or failure
+ */
+svg_return_t svg_arena_reset(svg_arena_ptr arena);
+
+/**
+ * @brief Reports the memory use of an arena.
+ *
+ * @param arena Arena to inspect
+ * @param usage Receives the usage
+ *
+ * @return Status code indicating success or failure
+ */
+svg_return_t svg_arena_get_usage(svg_arena_ptr arena,
+                                 svg_arena_usage_t *usage);
+
+/**
+ * @brief Destroys an arena and returns its chunks to the C heap.
+ *
+ * @param arena Arena to destroy
+ *
+ * @return Status code indicating success or failure
+ */
+svg_return_t svg_arena_destroy(svg_arena_ptr arena);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,236 @@
+/**
+ * @file svg_list.h
+ * @brief Retained display lists.
+ *
+ * A display list records drawing calls once and replays them into any
+ * number of SVG contexts, with whatever precision, culling or sink those
+ * contexts use.
+ */
+
+#ifndef SVG_LIST_H
+#define SVG_LIST_H
+
+#include "svg.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/**
+ * @brief What svg_list_optimize() removed from a display list.
+ */
+typedef struct{
+    size_t duplicates;  /**< Elements dropped as exact duplicates */
+    size_t occluded;    /**< Elements dropped under opaque rectangles */
+    size_t bytes;       /**< Output bytes saved at the given precision */
+} svg_list_savings_t;
+
+/**
+ * @brief Creates an empty display list.
+ *
+ * Coordinates are stored in one array per attribute and element kind.
+ * Style and group attribute strings are interned in a string arena.
+ * Consecutive elements of one kind with the same style are kept as a
+ * single run.
+ *
+ * @return Pointer to a newly created display list, or NULL on failure
+ */
+svg_list_ptr svg_list_create(void);
+
+/**
+ * @brief Creates an empty display list that allocates with the given hooks.
+ *
+ * Like svg_list_create(), but the list, its arrays and the scratch memory
+ * of svg_list_optimize() come from allocator, which has the same meaning
+ * as in svg_create_options_t. A loaded list maps its file instead.
+ *
+ * @param allocator Memory hooks, all set or all NULL; NULL selects the C heap
+ *
+ * @return Pointer to a newly created display list, or NULL on failure
+ */
+svg_list_ptr svg_list_create_ex(const svg_allocator_t *allocator);
+
+/**
+ * @brief Destroys a display list.
+ *
+ * Releases the list's memory, or unmaps the file of a loaded list.
+ *
+ * @param list Display list to destroy
+ *
+ * @return Status code indicating success or failure
+ */
+svg_return_t svg_list_destroy(svg_list_ptr list);
+
+/**
+ * @brief Records a run of circles.
+ *
+ * Takes the same arguments as svg_circles(). Style handles from
+ * svg_style_register() are recorded as the declarations they stand
+ * for, so the list replays the same into any context.
+ *
+ * @param list  Display list to record into
+ * @param xs    X coordinates of the centers
+ * @param ys    Y coordinates of the centers
+ * @param radii Radii, each greater than zero
+ * @param count Number of circles
+ * @param style CSS style string (may be NULL)
+ *
+ * @return Status code indicating success or failure; SVG_ERR_STATE for a
+ *         loaded list
+ */
+svg_return_t svg_list_circles(svg_list_ptr list,
+                              const svg_coord_t *xs,
+                              const svg_coord_t *ys,
+                              const svg_real_t *radii,
+                              size_t count,
+                              const char *style);
+
+/**
+ * @brief Records a run of rectangles.
+ *
+ * Takes the same arguments as svg_rects().
+ *
+ * @param list    Display list to record into
+ * @param xs      X coordinates of the top-left corners
+ * @param ys      Y coordinates of the top-left corners
+ * @param widths  Widths
+ * @param heights Heights
+ * @param count   Number of rectangles
+ * @param style   CSS style string (may be NULL)
+ *
+ * @return Status code indicating success or failure; SVG_ERR_STATE for a
+ *         loaded list
+ */
+svg_return_t svg_list_rects(svg_list_ptr list,
+                            const svg_coord_t *xs,
+                            const svg_coord_t *ys,
+                            const svg_coord_t *widths,
+                            const svg_coord_t *heights,
+                            size_t count,
+                            const char *style);
+
+/**
+ * @brief Records a run of line segments.
+ *
+ * Takes the same arguments as svg_lines().
+ *
+ * @param list  Display list to record into
+ * @param x1s   X coordinates of the start points
+ * @param y1s   Y coordinates of the start points
+ * @param x2s   X coordinates of the end points
+ * @param y2s   Y coordinates of the end points
+ * @param count Number of line segments
+ * @param style CSS style string (may be NULL)
+ *
+ * @return Status code indicating success or failure; SVG_ERR_STATE for a
+ *         loaded list
+ */
+svg_return_t svg_list_lines(svg_list_ptr list,
+                            const svg_coord_t *x1s,
+                            const svg_coord_t *y1s,
+                            const svg_coord_t *x2s,
+                            const svg_coord_t *y2s,
+                            size_t count,
+                            const char *style);
+
+/**
+ * @brief Records the start of a group.
+ *
+ * @param list  Display list to record into
+ * @param attrs SVG attribute string for the group (may be NULL)
+ *
+ * @return Status code indicating success or failure; SVG_ERR_STATE for a
+ *         loaded list
+ */
+svg_return_t svg_list_group_begin(svg_list_ptr list,
+                                  const char *attrs);
+
+/**
+ * @brief Records the end of the current group.
+ *
+ * @param list Display list to record into
+ *
+ * @return Status code indicating success or failure; SVG_ERR_STATE if no
+ *         recorded group is open or the list was loaded
+ */
+svg_return_t svg_list_group_end(svg_list_ptr list);
+
+/**
+ * @brief Replays a display list into a context.
+ *
+ * Each run is drawn with one call to svg_circles(), svg_rects() or
+ * svg_lines(), so the output is the same as making the recorded calls
+ * on the context directly. Groups left open by the list stay open.
+ *
+ * @param list    Display list to replay
+ * @param context SVG context to draw into
+ *
+ * @return Status code of the first drawing call that failed, or SVG_OK
+ */
+svg_return_t svg_list_replay(svg_list_ptr list,
+                             svg_context_ptr context);
+
+/**
+ * @brief Removes elements that cannot change the drawing.
+ *
+ * Two kinds of elements are dropped, comparing only elements directly
+ * inside the same group:
+ * - An element identical to a later one, with the same kind, style and
+ *   coordinates, is dropped and the later copy kept, so stacking order
+ *   is unchanged.
+ * - An element whose bounding box, grown by its stroke, lies inside a
+ *   later rectangle with a solid fill and no transparency is dropped.
+ *   Only styles made of known fill and stroke declarations count: an
+ *   inherited fill or a group attribute other than id, transform,
+ *   opacity or clip-path keeps everything in that group.
+ *
+ * Duplicates are found through a hash table and covering rectangles
+ * through a grid of power-of-two cells per rectangle size, so the pass
+ * takes time close to linear in the number of elements.
+ *
+ * @param list      Display list to optimize
+ * @param precision Number format the saved bytes are measured with, as
+ *                  for svg_set_precision()
+ * @param savings   Receives what was removed, may be NULL to skip
+ *                  measuring
+ *
+ * @return Status code indicating success or failure; SVG_ERR_STATE for a
+ *         loaded list. SVG_ERR_INVALID_ARG and SVG_ERR_STATE leave the
+ *         list unchanged.
+ */
+svg_return_t svg_list_optimize(svg_list_ptr list,
+                               int precision,
+                               svg_list_savings_t *savings);
+
+/**
+ * @brief Saves a display list to a file.
+ *
+ * The file holds the list's arrays as they are in memory, in the byte
+ * order of the machine that wrote it, so svg_list_load() can map it.
+ *
+ * @param list Display list to save
+ * @param path File to create or truncate
+ *
+ * @return Status code indicating success or failure
+ */
+svg_return_t svg_list_save(svg_list_ptr list,
+                           const char *path);
+
+/**
+ * @brief Loads a display list saved by svg_list_save().
+ *
+ * The file is memory mapped and validated, not copied. A loaded list
+ * can be replayed and saved but not recorded into.
+ *
+ * @param path File to load
+ *
+ * @return Pointer to the loaded display list, or NULL if the file cannot
+ *         be mapped or is not a valid display list for this machine
+ */
+svg_list_ptr svg_list_load(const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
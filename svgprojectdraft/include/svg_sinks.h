@@ -0,0 +1,190 @@
+/**
+ * @file svg_sinks.h
+ * @brief Output sinks provided by the SVG library.
+ *
+ * Each sink is a set of write/cleanup callbacks for svg_create() or
+ * svg_create_ex() together with a convenience function that creates a
+ * context writing through it.
+ */
+
+#ifndef SVG_SINKS_H
+#define SVG_SINKS_H
+
+#include "svg.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/**
+ * @brief Compression level selecting the zlib default.
+ */
+#define SVG_GZIP_DEFAULT_LEVEL  (-1)
+
+/**
+ * @brief Opens a gzip compressing sink.
+ *
+ * Output passed to svg_gzip_write() is deflated incrementally through a
+ * fixed-size window and written to path in gzip (.svgz) format. Memory
+ * use is bounded regardless of the document size.
+ *
+ * @param path  File to create or truncate
+ * @param level zlib compression level 0-9, or SVG_GZIP_DEFAULT_LEVEL
+ *
+ * @return User context for svg_gzip_write()/svg_gzip_cleanup(), or NULL
+ *         on failure
+ */
+svg_user_context_ptr svg_gzip_open(const char *path,
+                                   int level);
+
+/**
+ * @brief Write callback of the gzip sink.
+ *
+ * @param user Sink returned by svg_gzip_open()
+ * @param text Null-terminated SVG text
+ *
+ * @return Status code indicating success or failure
+ */
+svg_return_t svg_gzip_write(svg_user_context_ptr user,
+                            const char *text);
+
+/**
+ * @brief Length-aware write callback of the gzip sink.
+ *
+ * @param user   Sink returned by svg_gzip_open()
+ * @param text   SVG text
+ * @param length Bytes of text to write
+ *
+ * @return Status code indicating success or failure
+ */
+svg_return_t svg_gzip_write_n(svg_user_context_ptr user,
+                              const char *text,
+                              size_t length);
+
+/**
+ * @brief Cleanup callback of the gzip sink.
+ *
+ * Finishes the gzip stream, closes the file and frees the sink.
+ *
+ * @param user Sink returned by svg_gzip_open()
+ *
+ * @return Status code indicating success or failure
+ */
+svg_return_t svg_gzip_cleanup(svg_user_context_ptr user);
+
+/**
+ * @brief Creates an SVG context that writes a gzip compressed file.
+ *
+ * @param path   File to create or truncate
+ * @param width  Canvas width in pixels
+ * @param height Canvas height in pixels
+ * @param level  zlib compression level 0-9, or SVG_GZIP_DEFAULT_LEVEL
+ *
+ * @return Pointer to a newly created SVG context, or NULL on failure
+ */
+svg_context_ptr svg_create_svgz(const char *path,
+                                svg_px_t width,
+                                svg_px_t height,
+                                int level);
+
+/**
+ * @brief Options of the file descriptor sink.
+ *
+ * A zeroed structure selects the defaults.
+ */
+typedef struct{
+    size_t chunk_size;  /**< Bytes per write(), rounded up to 4096; 0 selects 1 MiB */
+    int use_writev;     /**< Write staged data and large fragments together with writev() instead of copying */
+    int direct_io;      /**< Open with O_DIRECT where supported, bypassing the page cache */
+    int advise;         /**< Advise the kernel of sequential access and drop written pages once written back */
+    int sync_on_close;  /**< fsync() the file before closing it */
+} svg_file_options_t;
+
+/**
+ * @brief Opens a file descriptor sink.
+ *
+ * Output passed to svg_file_write() is staged in an aligned buffer and
+ * written to a raw file descriptor in chunk_size pieces. This avoids
+ * the stdio layer.
+ *
+ * @param path    File to create or truncate
+ * @param options Sink options, or NULL for the defaults
+ *
+ * @return User context for svg_file_write()/svg_file_cleanup(), or NULL
+ *         on failure
+ */
+svg_user_context_ptr svg_file_open(const char *path,
+                                   const svg_file_options_t *options);
+
+/**
+ * @brief Write callback of the file descriptor sink.
+ *
+ * @param user Sink returned by svg_file_open()
+ * @param text Null-terminated SVG text
+ *
+ * @return Status code indicating success or failure
+ */
+svg_return_t svg_file_write(svg_user_context_ptr user,
+                            const char *text);
+
+/**
+ * @brief Length-aware write callback of the file descriptor sink.
+ *
+ * @param user   Sink returned by svg_file_open()
+ * @param text   SVG text
+ * @param length Bytes of text to write
+ *
+ * @return Status code indicating success or failure
+ */
+svg_return_t svg_file_write_n(svg_user_context_ptr user,
+                              const char *text,
+                              size_t length);
+
+/**
+ * @brief Scatter-gather write callback of the file descriptor sink.
+ *
+ * With use_writev set, spans that overflow the staging buffer are
+ * written together with the staged data in one writev() call.
+ *
+ * @param user  Sink returned by svg_file_open()
+ * @param spans Pieces of SVG text, in order
+ * @param count Number of spans
+ *
+ * @return Status code indicating success or failure
+ */
+svg_return_t svg_file_writev(svg_user_context_ptr user,
+                             const svg_span_t *spans,
+                             size_t count);
+
+/**
+ * @brief Cleanup callback of the file descriptor sink.
+ *
+ * Writes any staged data, optionally syncs, closes the file and frees
+ * the sink.
+ *
+ * @param user Sink returned by svg_file_open()
+ *
+ * @return Status code indicating success or failure
+ */
+svg_return_t svg_file_cleanup(svg_user_context_ptr user);
+
+/**
+ * @brief Creates an SVG context that writes a file through a raw descriptor.
+ *
+ * @param path    File to create or truncate
+ * @param width   Canvas width in pixels
+ * @param height  Canvas height in pixels
+ * @param options Sink options, or NULL for the defaults
+ *
+ * @return Pointer to a newly created SVG context, or NULL on failure
+ */
+svg_context_ptr svg_create_file(const char *path,
+                                svg_px_t width,
+                                svg_px_t height,
+                                const svg_file_options_t *options);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,265 @@
+/**
+ * @file svg_tiles.h
+ * @brief Tiled output for very large canvases.
+ *
+ * A tile set splits a canvas into a grid of tiles and writes each tile as
+ * a document of its own. Drawing calls are routed to every tile that a
+ * primitive's bounding box touches; rectangles and lines are clipped to
+ * each tile, circles are repeated whole and cut by the tile's canvas. An
+ * index document places the tiles on the full canvas so a viewer only
+ * loads the tiles it shows.
+ */
+
+#ifndef SVG_TILES_H
+#define SVG_TILES_H
+
+#include "svg.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/**
+ * @brief Opaque tile set.
+ */
+typedef struct SVG_TILES svg_tiles_t, *svg_tiles_ptr;
+
+/**
+ * @brief Callback receiving the output of one tile.
+ *
+ * Each tile's output arrives in order. With writer threads the callback
+ * runs on those threads, on several of them at once for different tiles,
+ * so it must be thread-safe: any state it shares between tiles, such as
+ * a map of outputs or a counter, needs its own locking. Calls for one
+ * tile never overlap, so state kept per tile needs none. Without writer
+ * threads every call happens on the drawing thread.
+ *
+ * @param user   User context from svg_tiles_options_t
+ * @param column Tile column, from 0 at the left
+ * @param row    Tile row, from 0 at the top
+ * @param data   Output bytes (not NUL terminated)
+ * @param length Number of bytes in data
+ *
+ * @return SVG_OK on success, or an error code to abort the tile
+ */
+typedef svg_return_t (*svg_tile_write_fn)(svg_user_context_ptr user,
+                                          size_t column,
+                                          size_t row,
+                                          const char *data,
+                                          size_t length);
+
+/**
+ * @brief Default number of bytes a tile buffers before writing.
+ */
+#define SVG_TILES_DEFAULT_BUFFER    16384
+
+/**
+ * @brief Options for svg_tiles_create().
+ *
+ * Exactly one of write_fn and directory must be set.
+ */
+typedef struct{
+    svg_px_t width;             /**< Canvas width */
+    svg_px_t height;            /**< Canvas height */
+    svg_px_t tile_width;        /**< Tile width; tiles in the last column may be narrower */
+    svg_px_t tile_height;       /**< Tile height; tiles in the last row may be shorter */
+    svg_real_t margin;          /**< Room around primitives for strokes, in drawing units */
+    svg_tile_write_fn write_fn; /**< Receives each tile's output; must be thread-safe when threads is nonzero */
+    svg_user_context_ptr user;  /**< Passed to write_fn */
+    const char *directory;      /**< Directory for tile_<column>_<row>.svg files and index.svg */
+    size_t tile_buffer;         /**< Bytes a tile buffers before writing, 0 for SVG_TILES_DEFAULT_BUFFER */
+    int threads;                /**< Writer threads, 0 to write on the drawing thread */
+    svg_allocator_t allocator;  /**< Memory hooks of the tile set and its tiles, all NULL for the C heap */
+} svg_tiles_options_t;
+
+/**
+ * @brief Creates a tile set.
+ *
+ * A tile's document is created when the first primitive reaches it, so
+ * empty tiles are never written. Each tile keeps at most tile_buffer
+ * bytes plus one element before passing them on. With writer threads,
+ * output is handed to the thread that owns the tile and a small number of
+ * buffers per thread may be in flight; the drawing thread waits rather
+ * than queue more. The directory sink keeps a bounded number of files
+ * open and reopens others for appending. Writer threads release the
+ * buffers handed to them, so with threads the allocator hooks, if set,
+ * must be marked thread-safe.
+ *
+ * @param options Canvas, tile size and destination
+ *
+ * @return Pointer to a newly created tile set, or NULL on failure
+ */
+svg_tiles_ptr svg_tiles_create(const svg_tiles_options_t *options);
+
+/**
+ * @brief Finishes every tile and destroys a tile set.
+ *
+ * Closes the open groups and documents of all tiles, waits for the writer
+ * threads, and with the directory sink writes index.svg.
+ *
+ * @param tiles Tile set to destroy
+ *
+ * @return Status code indicating success or failure; the first write
+ *         failure of any tile is reported here, if a drawing call has not
+ *         reported it already
+ */
+svg_return_t svg_tiles_destroy(svg_tiles_ptr tiles);
+
+/**
+ * @brief Creates an SVG context that draws into a tile set.
+ *
+ * Circles, rectangles, lines and groups drawn into the context are
+ * routed to the tiles. Paths, transforms, symbols, density maps and
+ * frames are refused with SVG_ERR_STATE. Destroying the context leaves
+ * the tile set open.
+ *
+ * @param tiles Tile set to draw into
+ *
+ * @return Pointer to a newly created SVG context, or NULL on failure
+ */
+svg_context_ptr svg_create_tiling(svg_tiles_ptr tiles);
+
+/**
+ * @brief Draws a run of circles into the tiles they touch.
+ *
+ * Takes the same arguments as svg_circles().
+ *
+ * @param tiles Tile set to draw into
+ * @param xs    X coordinates of the centers
+ * @param ys    Y coordinates of the centers
+ * @param radii Radii, each greater than zero
+ * @param count Number of circles
+ * @param style CSS style string (may be NULL)
+ *
+ * @return Status code indicating success or failure
+ */
+svg_return_t svg_tiles_circles(svg_tiles_ptr tiles,
+                               const svg_coord_t *xs,
+                               const svg_coord_t *ys,
+                               const svg_real_t *radii,
+                               size_t count,
+                               const char *style);
+
+/**
+ * @brief Draws a run of rectangles, clipped to each tile they touch.
+ *
+ * Takes the same arguments as svg_rects(). Each tile receives the part
+ * of a rectangle that lies within the tile grown by the margin, so cut
+ * edges stay outside the tile's canvas.
+ *
+ * @param tiles   Tile set to draw into
+ * @param xs      X coordinates of the top-left corners
+ * @param ys      Y coordinates of the top-left corners
+ * @param widths  Widths, each zero or more
+ * @param heights Heights, each zero or more
+ * @param count   Number of rectangles
+ * @param style   CSS style string (may be NULL)
+ *
+ * @return Status code indicating success or failure; SVG_ERR_INVALID_ARG
+ *         before anything is drawn if a size is negative or NaN
+ */
+svg_return_t svg_tiles_rects(svg_tiles_ptr tiles,
+                             const svg_coord_t *xs,
+                             const svg_coord_t *ys,
+                             const svg_coord_t *widths,
+                             const svg_coord_t *heights,
+                             size_t count,
+                             const char *style);
+
+/**
+ * @brief Draws a run of line segments, clipped to each tile they cross.
+ *
+ * Takes the same arguments as svg_lines(). Each tile receives the part
+ * of a segment that lies within the tile grown by the margin.
+ *
+ * @param tiles Tile set to draw into
+ * @param x1s   X coordinates of the start points
+ * @param y1s   Y coordinates of the start points
+ * @param x2s   X coordinates of the end points
+ * @param y2s   Y coordinates of the end points
+ * @param count Number of segments
+ * @param style CSS style string (may be NULL)
+ *
+ * @return Status code indicating success or failure
+ */
+svg_return_t svg_tiles_lines(svg_tiles_ptr tiles,
+                             const svg_coord_t *x1s,
+                             const svg_coord_t *y1s,
+                             const svg_coord_t *x2s,
+                             const svg_coord_t *y2s,
+                             size_t count,
+                             const char *style);
+
+/**
+ * @brief Begins a group in every tile.
+ *
+ * A tile only opens the group once something is drawn into it while the
+ * group is open.
+ *
+ * @param tiles Tile set to draw into
+ * @param attrs Attribute string for the <g> element (may be NULL)
+ *
+ * @return Status code indicating success or failure
+ */
+svg_return_t svg_tiles_group_begin(svg_tiles_ptr tiles,
+                                   const char *attrs);
+
+/**
+ * @brief Ends the current group in every tile that opened it.
+ *
+ * @param tiles Tile set to draw into
+ *
+ * @return Status code indicating success or failure; SVG_ERR_STATE when
+ *         no group is open
+ */
+svg_return_t svg_tiles_group_end(svg_tiles_ptr tiles);
+
+/**
+ * @brief Writes an index document that places the tiles on the canvas.
+ *
+ * The index is an SVG document of the full canvas with one <image>
+ * referencing tile_<column>_<row>.svg for every tile drawn into so far.
+ *
+ * @param tiles    Tile set to describe
+ * @param write_fn Receives the index
+ * @param user     Passed to write_fn
+ *
+ * @return Status code indicating success or failure
+ */
+svg_return_t svg_tiles_index(svg_tiles_ptr tiles,
+                             svg_write_fn write_fn,
+                             svg_user_context_ptr user);
+
+/**
+ * @brief Reports the size of the tile grid and how many tiles were drawn.
+ *
+ * @param tiles   Tile set to inspect
+ * @param columns Receives the number of tile columns (may be NULL)
+ * @param rows    Receives the number of tile rows (may be NULL)
+ * @param used    Receives the number of tiles drawn into (may be NULL)
+ *
+ * @return Status code indicating success or failure
+ */
+svg_return_t svg_tiles_get_grid(svg_tiles_ptr tiles,
+                                size_t *columns,
+                                size_t *rows,
+                                size_t *used);
+
+/**
+ * @brief Reports the canvas size of a tile set.
+ *
+ * @param tiles  Tile set to inspect
+ * @param width  Receives the canvas width
+ * @param height Receives the canvas height
+ *
+ * @return Status code indicating success or failure
+ */
+svg_return_t svg_tiles_get_canvas(svg_tiles_ptr tiles,
+                                  svg_px_t *width,
+                                  svg_px_t *height);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -4,7 +4,7 @@
 // this function will write strings to our SVG File
 svg_return_t write_fn(svg_user_context_ptr user, const char *text){
     FILE *fp = (FILE *)user;
-    if(0 >= fprintf(fp,text)){
+    if(EOF == fputs(text,fp)){
         return SVG_ERR_IO;
     }
     return SVG_OK;
@@ -5,9 +5,176 @@
  * Implements the basic functions for creating SVG documents.
  */
 #include "svg.h"
+#include "svg_list.h"
+#include "svg_tiles.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+// AVX kernels are compiled for the target on their own and picked at run time.
+#define SVG_AVX_KERNELS                 1
+#endif
 
+// Where a context sends its output.
+enum{
+    SVG_SINK_CALLBACK = 0,  // through write_fn, write_n_fn or writev_fn
+    SVG_SINK_MEMORY,        // kept in the buffer for svg_detach_buffer
+    SVG_SINK_MEASURE,       // counted and discarded
+    SVG_SINK_PRODUCER       // submitted to the parent's record queue
+};
+
+// A run of formatted elements a producer submitted to its parent.
+typedef struct svg_record svg_record_t;
+struct svg_record{
+    _Atomic(svg_record_t *) next;
+    char *data;
+    size_t length;
+    size_t capacity;        // usable bytes in data, excluding the NUL
+};
+
+// Intrusive multi-producer single-consumer queue of records. Producers
+// only exchange head; the consumer alone follows tail.
+typedef struct{
+    _Atomic(svg_record_t *) head;   // most recently pushed record
+    svg_record_t *tail;             // next record to pop
+    svg_record_t stub;              // keeps the queue non-empty
+} svg_queue_t;
+
+// An output buffer handed between the context and its writer thread.
+typedef struct{
+    char *data;
+    size_t length;
+    size_t capacity;        // usable bytes in data, excluding the NUL
+} svg_async_buffer_t;
+
+// Background writer state of a context in asynchronous mode.
+typedef struct{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t queued;          // signalled when a buffer is queued or stop is set
+    pthread_cond_t written;         // signalled when the writer finishes a buffer
+    svg_async_buffer_t *queue;      // ring of buffers waiting to be written
+    size_t queue_head;
+    size_t queue_count;
+    size_t in_flight_limit;         // queued plus writing buffers before the producer blocks
+    svg_async_buffer_t *spares;     // written buffers ready for reuse
+    size_t spare_count;
+    svg_async_buffer_t *batch;      // buffers taken by the writer, in order
+    svg_span_t *spans;              // batch as handed to the write callback
+    int busy;                       // buffers being written, 0 while idle
+    int stop;                       // nonzero once the writer should exit when idle
+    svg_return_t error;             // first write_fn failure
+} svg_async_t;
+
+// Initial size of the output buffer owned by each context.
+#define SVG_INITIAL_BUFFER_CAPACITY     4096
+// Default number of buffered bytes that triggers a write_fn call.
+#define SVG_DEFAULT_FLUSH_THRESHOLD     65536
+// Deepest group nesting that still gets its own indentation level.
+#define SVG_MAX_INDENT_DEPTH            16
+
+static const char SVG_INDENT[] = "                                  ";
+
+// First character of a style handle returned by svg_style_register.
+#define SVG_STYLE_HANDLE_MARK           '\x1f'
+// Initial number of slots in the style hash table.
+#define SVG_STYLE_INITIAL_SLOTS         64
+
+// An interned style.
+typedef struct{
+    uint64_t hash;
+    size_t length;          // length of text
+    char *handle;           // SVG_STYLE_HANDLE_MARK and the class name; owns text
+    const char *text;       // the style's declarations
+} svg_style_entry_t;
+
+// Most occupied cells the level-of-detail set remembers; later elements in
+// new cells are written without being remembered.
+#define SVG_LOD_MAX_KEYS                ((size_t)1 << 20)
+// Most distinct styles level-of-detail decimation tells apart; elements
+// with further styles are always written.
+#define SVG_LOD_MAX_STYLES              4096
+// Initial number of slots in the level-of-detail tables.
+#define SVG_LOD_INITIAL_SLOTS           64
+
+// Largest density map in cells.
+#define SVG_DENSITY_MAX_CELLS           ((size_t)1 << 28)
+
+// Indices of the vertices kept for each column of a decimated path.
+enum{
+    SVG_LOD_FIRST = 0,
+    SVG_LOD_LOWEST,
+    SVG_LOD_HIGHEST,
+    SVG_LOD_LAST,
+    SVG_LOD_KEPT
+};
+
+// A path vertex held back by level-of-detail decimation.
+typedef struct{
+    svg_point_t point;
+    size_t order;
+} svg_lod_vertex_t;
+
+// Copy of a style that decimated elements were drawn with.
+typedef struct{
+    uint64_t hash;
+    size_t length;
+    char *text;
+} svg_lod_style_t;
+
+// Kinds of level-of-detail keys; an empty slot has kind zero.
+enum{
+    SVG_LOD_KEY_EMPTY = 0,
+    SVG_LOD_KEY_CIRCLE,
+    SVG_LOD_KEY_LINE
+};
+
+// A cell occupied by a written element: the center cell and radius cell
+// of a circle, or both endpoint cells of a line, with the element's style.
+typedef struct{
+    double cells[4];
+    uint32_t style;         // style number + 1, 0 for NULL
+    uint32_t kind;
+} svg_lod_key_t;
+
+// Initial number of slots in the frame id table.
+#define SVG_FRAME_INITIAL_SLOTS         64
+
+// An element retained between frames.
+typedef struct{
+    char *id;
+    uint64_t hash;          // svg_hash of id
+    char *text;             // the element with its id attribute, NULL once removed
+    size_t length;          // length of text
+    int committed;          // nonzero when the last frame written holds the element
+    int dirty;              // nonzero while listed in the frame's dirty list
+} svg_frame_entry_t;
+
+// Retained scene of a context that renders frames.
+typedef struct{
+    svg_frame_entry_t *entries;     // in the order ids were first drawn
+    size_t entry_count;
+    size_t entry_capacity;
+    size_t live;                    // entries with text
+    uint32_t *slots;                // open addressing table of entry index + 1
+    size_t slot_count;
+    size_t *dirty;                  // entries changed by the open frame
+    size_t dirty_count;
+    size_t dirty_capacity;
+    char *pending;                  // id of the next top-level element
+    svg_span_t *spans;              // slices of a full frame for writev_fn
+    size_t span_capacity;
+    size_t base;                    // buffer offset elements are formatted at
+    int open;                       // nonzero between svg_frame_begin and svg_frame_end
+    uint64_t number;                // frames written so far
+} svg_frame_t;
 
 /**
  * @brief Opaque SVG drawing context.
@@ -16,8 +183,89 @@
  */
 struct SVG_CONTEXT{
     svg_write_fn write_fn;
+    svg_write_n_fn write_n_fn;
+    svg_writev_fn writev_fn;
     svg_cleanup_fn cleanup_fn;
     svg_user_context_ptr user;
+    svg_allocator_t allocator;  // source of all memory the context owns
+    int sink;               // SVG_SINK_* destination of flushed output
+    size_t flushed;         // bytes flushed out of buffer so far
+    svg_async_t *async;     // background writer, NULL when writing synchronously
+    char *buffer;           // pending output, always NUL terminated
+    size_t length;          // bytes currently pending in buffer
+    size_t capacity;        // usable bytes in buffer, excluding the NUL
+    size_t flush_threshold; // pending bytes that trigger a flush
+    int group_depth;        // number of currently open <g> elements
+    int group_base;         // groups a shard inherited, which it cannot close
+    int symbol_depth;       // group depth inside the open symbol, 0 if none
+    size_t symbol_count;    // symbols begun so far
+    svg_context_ptr shard_parent; // context a shard is committed to, NULL otherwise
+    svg_queue_t *queue;     // records from producers, NULL until the first one
+    svg_list_ptr list;      // display list drawing calls are recorded into, if any
+    svg_tiles_ptr tiles;    // tile set drawing calls are routed to, if any
+    svg_frame_t *frame;     // retained scene once frames are used, NULL otherwise
+    int precision;          // number format passed to svg_format_real
+    int quantized;          // nonzero when numbers are snapped to a grid
+    int quantize_digits;    // decimal places of a grid step
+    double quantize_scale;  // grid steps per unit, 10^quantize_digits
+    int header_buffered;    // nonzero until the header has been flushed
+    size_t header_end;      // end of the header while it is buffered
+    size_t style_insert;    // where the next rule goes in the buffered <style>, 0 if none
+    int style_interning;    // nonzero when raw style strings are interned
+    svg_style_entry_t *styles;
+    size_t style_count;
+    size_t style_capacity;
+    uint32_t *style_slots;  // open addressing table of style index + 1
+    size_t style_slot_count;
+    size_t style_last;      // index + 1 of the style looked up last, 0 if none
+    int path_open;          // nonzero between svg_path_begin and svg_path_end
+    size_t path_points;     // vertices written to the open path
+    int path_on_grid;       // nonzero when path_grid holds the last vertex written
+    int path_relative;      // nonzero after an 'l' command in the open path
+    int64_t path_grid_x;    // grid position of the last vertex in quantized mode
+    int64_t path_grid_y;
+    svg_px_t width;         // canvas width given to svg_create
+    svg_px_t height;        // canvas height given to svg_create
+
+    svg_real_t lod_tolerance;                   // decimation cell size, 0 when off
+    int lod_column_open;                        // nonzero while path vertices are held back
+    double lod_column;                          // cell column of the held back vertices
+    size_t lod_order;                           // vertices seen by the open path
+    svg_lod_vertex_t lod_vertices[SVG_LOD_KEPT];
+    svg_lod_key_t *lod_keys;                    // open addressing set of cells written into
+    size_t lod_key_count;
+    size_t lod_key_slot_count;
+    size_t lod_key_limit;                       // keys kept at most, from the canvas size
+    svg_lod_style_t *lod_styles;                // styles of the elements in lod_keys
+    size_t lod_style_count;
+    uint32_t *lod_style_slots;                  // open addressing table of style number + 1
+    size_t lod_style_slot_count;
+
+    int cull_enabled;                           // nonzero when primitives are culled
+    svg_real_t cull_margin;                     // extra room around primitives for strokes
+    svg_real_t viewport_left;                   // visible area in drawing coordinates
+    svg_real_t viewport_top;
+    svg_real_t viewport_right;
+    svg_real_t viewport_bottom;
+    svg_cull_counts_t culled;                   // primitives dropped by culling
+
+    svg_matrix_t matrix;                        // current transform
+    int transformed;                            // nonzero unless matrix is the identity
+    svg_matrix_t *transforms;                   // transforms saved by svg_transform_push
+    size_t transform_depth;
+    size_t transform_capacity;
+
+    uint32_t *density_counts;                   // points per cell of the open density map, NULL if none
+    svg_px_t density_cell;                      // density map cell size in pixels
+    size_t density_columns;
+    size_t density_rows;
+
+    int stats_enabled;                          // nonzero while stats are collected
+    svg_stats_t stats;
+    svg_write_fn trace_fn;                      // receives group spans, NULL if none
+    svg_user_context_ptr trace_user;
+    uint64_t trace_origin;                      // clock reading trace timestamps start at
+    int trace_started;                          // nonzero once the opening bracket is out
 };
 
 
@@ -29,257 +277,3521 @@ const char *text);
 typedef svg_return_t (*svg_cleanup_fn)(svg_user_context_ptr user);
 
 
-// Creates a new SVG drawing context.
-svg_context_ptr svg_create(svg_write_fn write_fn, 
-                           svg_cleanup_fn cleanup_fn, 
-                           svg_user_context_ptr user, 
-                           svg_px_t width, 
-                           svg_px_t height){
-    if (write_fn == NULL || width <= 0 || height <= 0) {
+static svg_return_t svg_flush_buffer(svg_context_ptr context);
+static svg_return_t svg_queue_drain(svg_context_ptr context);
+static svg_return_t svg_frame_capture(svg_context_ptr context);
+static char *svg_put_quantized(svg_context_ptr context, char *out, svg_real_t value);
+
+#ifdef SVG_NO_STATS
+#define SVG_STATS_ON(context)   0
+#else
+#define SVG_STATS_ON(context)   ((context)->stats_enabled)
+#endif
+
+// Adds amount to a statistics counter while statistics are on.
+#define SVG_STAT_ADD(context, field, amount)                \
+    do{                                                     \
+        if(SVG_STATS_ON(context)){                          \
+            (context)->stats.field += (amount);             \
+        }                                                   \
+    } while(0)
+
+// Returns a monotonic timestamp in nanoseconds.
+static uint64_t svg_now_ns(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+// Allocator of contexts created without one: the C heap.
+static void *svg_heap_alloc(void *user, size_t size){
+    (void)user;
+    return malloc(size);
+}
+
+static void *svg_heap_realloc(void *user, void *pointer, size_t size){
+    (void)user;
+    return realloc(pointer, size);
+}
+
+static void svg_heap_free(void *user, void *pointer){
+    (void)user;
+    free(pointer);
+}
+
+static const svg_allocator_t svg_heap_allocator = {svg_heap_alloc, svg_heap_realloc, svg_heap_free, NULL, 1};
+
+// Allocates size bytes from the context's allocator.
+static void *svg_mem_alloc(svg_context_ptr context, size_t size){
+    void *pointer = context->allocator.alloc_fn(context->allocator.user, size);
+    if(!pointer){
+        SVG_STAT_ADD(context, alloc_errors, 1);
+    }
+    return pointer;
+}
+
+// Allocates count zeroed elements of size bytes from the context's allocator.
+static void *svg_mem_calloc(svg_context_ptr context, size_t count, size_t size){
+    if(size && count > SIZE_MAX / size){
         return NULL;
-    } else {
-// initializing svg context
-    svg_context_ptr context = (svg_context_ptr)malloc(sizeof(svg_context_t));
-    context->write_fn = write_fn;
-    context->cleanup_fn = cleanup_fn;
-    context->user = user;
+    }
+    void *pointer = svg_mem_alloc(context, count * size);
+    if(pointer){
+        memset(pointer, 0, count * size);
+    }
+    return pointer;
+}
 
-// C snprintf(str, size, format, ...); 
-// writing out xml code
-    int size = snprintf(NULL, 0, 
-        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<svg width=\"%d\" heights=\"%d\" xmlns=\"http://www.w3.org/2000/svg\">",
-        width, height);
-    char* buffer = malloc(size + 1);
-    snprintf(buffer, size, 
-        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<svg width=\"%d\" heights=\"%d\" xmlns=\"http://www.w3.org/2000/svg\">",
-        width, height);
-    context->write_fn(context->user, buffer); // actually writing in the svg context
-    free(buffer);
-    return context;
+// Resizes memory from the context's allocator; NULL allocates.
+static void *svg_mem_realloc(svg_context_ptr context, void *pointer, size_t size){
+    void *resized = context->allocator.realloc_fn(context->allocator.user, pointer, size);
+    if(!resized){
+        SVG_STAT_ADD(context, alloc_errors, 1);
     }
-/*
-on top of initializing our context, 
-we want to write two lines of xml to our file here:
-<?xml version="1.0" encoding="UTF-8"?>
-<svg width="100" height="100" xmlns="http://www.w3.org/2000/svg">   
-*/
+    return resized;
 }
 
-// Destroys an SVG context.
-svg_return_t svg_destroy(svg_context_ptr context){
-    // Enter code here
-    // for if context is not NULL 
-    if(context){ 
-    // will generate </svg>
-    context->write_fn(context->user, "</svg>\n");
-    if (context->cleanup_fn) {
-        context->cleanup_fn(context->user);
-    } // cleanup used here? idfk
-        free(context);
-        return SVG_OK;
-    } else {
-    return SVG_ERR_NULL;
+// Returns memory to the context's allocator; NULL is ignored.
+static void svg_mem_free(svg_context_ptr context, void *pointer){
+    if(pointer){
+        context->allocator.free_fn(context->allocator.user, pointer);
     }
 }
 
-// Draws a circle.
-svg_return_t svg_circle(svg_context_ptr context,
-                        const svg_point_t *center,
-                        svg_real_t radius,
-                        const char *style){
-    // Enter code here
-
-/*
-    context->write_fn("<circle cx=\"%lf\" ", center->x);
-    context->write_fn("cy=\"%lf\" ", center->y);
-    context->write_fn("r=\"%lf\" ", *radius);
-    // The "%s" format specifier for printf always expects a char* argument.
-    context->write_fn("style=\"%s\"/>", style); 
-*/  
-    // C snprintf(str, size, format, ...);
-    if (!(context)) {
-        return SVG_ERR_NULL;
-    } 
-    else if (radius == 0) {
-        return SVG_ERR_INVALID_ARG;
+// Hands spans of output to whichever write callback the context has, in
+// order. Each span must be followed by a NUL, which lets svg_write_fn
+// take it as it is.
+static svg_return_t svg_call_write(svg_context_ptr context, const svg_span_t *spans, size_t count){
+    if(context->writev_fn){
+        return context->writev_fn(context->user, spans, count);
     }
-    else if (center == NULL) {
-        return SVG_ERR_INVALID_ARG;
+    svg_return_t result = SVG_OK;
+    for(size_t index = 0; index < count && result == SVG_OK; index++){
+        result = context->write_n_fn ? context->write_n_fn(context->user, spans[index].data, spans[index].length)
+                                     : context->write_fn(context->user, spans[index].data);
     }
-    // for if style is NULL 
-    else if(style != NULL){ 
-    int circle_size = snprintf(NULL, 0, 
-        "<circle cx=\"%lf\" cy=\"%lf\" r=\"%lf\" style=\"%s\"/>\n",
-        center->x, center->y, radius, style);
-    char* circle_buffer = malloc(circle_size + 1);
-    snprintf(circle_buffer, circle_size, 
-        "<circle cx=\"%lf\" cy=\"%lf\" r=\"%lf\" style=\"%s\"/>\n",
-        center->x, center->y, radius, style);
-    context->write_fn(context->user, circle_buffer); // actually writing in the svg context
-    free(circle_buffer);
+    return result;
+}
+
+// Writes spans through svg_call_write, timing the call when statistics
+// are on. Only one thread writes at a time, the writer thread while
+// there is one.
+static svg_return_t svg_write_spans(svg_context_ptr context, const svg_span_t *spans, size_t count){
+    if(!SVG_STATS_ON(context)){
+        return svg_call_write(context, spans, count);
+    }
+    uint64_t start = svg_now_ns();
+    svg_return_t result = svg_call_write(context, spans, count);
+    uint64_t elapsed = svg_now_ns() - start;
+    svg_stats_t *stats = &context->stats;
+    // only a scatter-gather callback is handed more than one span
+    stats->writes += context->writev_fn ? 1 : count;
+    for(size_t index = 0; index < count; index++){
+        stats->bytes_out += spans[index].length;
+    }
+    stats->write_ns += elapsed;
+    stats->write_errors += result != SVG_OK;
+    size_t bucket = 0;
+    while((elapsed >>= 1) != 0 && bucket < SVG_STATS_LATENCY_BUCKETS - 1){
+        bucket++;
+    }
+    stats->write_latency[bucket]++;
+    return result;
+}
+
+// Makes room for at least extra more bytes in the output buffer.
+static svg_return_t svg_reserve(svg_context_ptr context, size_t extra){
+    size_t required = context->length + extra;
+    if(required <= context->capacity){
+        return SVG_OK;
+    }
+    size_t capacity = context->capacity ? context->capacity : SVG_INITIAL_BUFFER_CAPACITY;
+    while(capacity < required){
+        capacity *= 2;
+    }
+    char *buffer = (char *)svg_mem_realloc(context, context->buffer, capacity + 1);
+    if(!buffer){
+        return SVG_ERR_NO_MEM;
+    }
+    context->buffer = buffer;
+    context->capacity = capacity;
     return SVG_OK;
-    } else {
-    int circle_size = snprintf(NULL, 0, 
-        "<circle cx=\"%lf\" cy=\"%lf\" r=\"%lf\"\n",
-        center->x, center->y, radius);
-    char* circle_buffer = malloc(circle_size + 1);
-    snprintf(circle_buffer, circle_size, 
-        "<circle cx=\"%lf\" cy=\"%lf\" r=\"%lf\"\n",
-        center->x, center->y, radius);
-    context->write_fn(context->user, circle_buffer); // actually writing in the svg context
-    free(circle_buffer);
+}
+
+// Appends length bytes of text to the output buffer.
+static svg_return_t svg_append(svg_context_ptr context, const char *text, size_t length){
+    svg_return_t result = svg_reserve(context, length);
+    if(result != SVG_OK){
+        return result;
+    }
+    memcpy(context->buffer + context->length, text, length);
+    context->length += length;
+    context->buffer[context->length] = '\0';
     return SVG_OK;
+}
+
+// Formats directly into the free space at the end of the output buffer.
+static svg_return_t svg_appendf(svg_context_ptr context, const char *format, ...){
+    va_list args;
+    size_t available = context->capacity - context->length;
+    va_start(args, format);
+    int size = vsnprintf(context->buffer + context->length, available + 1, format, args);
+    va_end(args);
+    if(size < 0){
+        context->buffer[context->length] = '\0';
+        return SVG_ERR_INVALID_ARG;
     }
-    // returns 0 indicating circle was drawn sucessfully
+    if((size_t)size > available){
+        // only reached when a single element outgrows the buffer
+        svg_return_t result = svg_reserve(context, (size_t)size);
+        if(result != SVG_OK){
+            context->buffer[context->length] = '\0';
+            return result;
+        }
+        va_start(args, format);
+        vsnprintf(context->buffer + context->length, (size_t)size + 1, format, args);
+        va_end(args);
     }
+    context->length += (size_t)size;
+    return SVG_OK;
+}
 
-/*
-thing in main.c
-svg_return_t return_value = 
-svg_circle(context,&center,45,"fill:none; stroke:green; stroke-width:2");
+// Appends the indentation for an element at the current group depth.
+static svg_return_t svg_indent(svg_context_ptr context){
+    int depth = context->group_depth < SVG_MAX_INDENT_DEPTH ? context->group_depth : SVG_MAX_INDENT_DEPTH;
+    return svg_append(context, SVG_INDENT, 2 * (size_t)(depth + 1));
+}
 
-for this function we want to write the following xml code to our SVG file:
+// Copies length bytes of text to out and returns the new end.
+static inline char *svg_put(char *out, const char *text, size_t length){
+    memcpy(out, text, length);
+    return out + length;
+}
 
-<circle cx="50.000000" cy="50.000000" r="45.000000" style="fill:none; stroke:green; stroke-width:2"/>
-*/
+#define SVG_PUT_LITERAL(out, literal) svg_put((out), (literal), sizeof(literal) - 1)
 
+// Writes a number in the context's format and returns the new end.
+static inline char *svg_put_real(svg_context_ptr context, char *out, svg_real_t value){
+    if(context->quantized){
+        return svg_put_quantized(context, out, value);
+    }
+    return out + svg_format_real(out, value, context->precision);
+}
 
-// Draws a rectangle.
-svg_return_t svg_rect(svg_context_ptr context,
-                      const svg_point_t *top_left,
-                      const svg_size_t *size,
-                      const char* style){
-    // Enter code here
-    // for if style is NULL 
-    if (!(context)) {
-        return SVG_ERR_NULL;
-    } 
-    else if (top_left == NULL) {
-        return SVG_ERR_INVALID_ARG;
+// Writes a style attribute, or a class attribute for a style handle.
+static inline char *svg_put_style_attribute(char *out, const char *style, size_t style_length){
+    if(style[0] == SVG_STYLE_HANDLE_MARK){
+        out = SVG_PUT_LITERAL(out, " class=\"");
+        out = svg_put(out, style + 1, style_length - 1);
+    }
+    else{
+        out = SVG_PUT_LITERAL(out, " style=\"");
+        out = svg_put(out, style, style_length);
+    }
+    *out++ = '"';
+    return out;
+}
+
+// Closes the last number attribute, writes the optional style and ends
+// the empty element tag.
+static inline char *svg_put_style(char *out, const char *style, size_t style_length){
+    *out++ = '"';
+    if(style){
+        out = svg_put_style_attribute(out, style, style_length);
+    }
+    return SVG_PUT_LITERAL(out, "/>\n");
+}
+
+// Upper bound on an element with the given count of numbers and style length.
+#define SVG_ELEMENT_MAX_LENGTH(numbers, style_length) \
+    ((numbers) * SVG_REAL_BUFFER_SIZE + (style_length) + 64)
+
+// Reserves room for an element of at most max_length bytes, writes its
+// indentation, and returns where the element text starts.
+static char *svg_element_begin(svg_context_ptr context, size_t max_length){
+    int depth = context->group_depth < SVG_MAX_INDENT_DEPTH ? context->group_depth : SVG_MAX_INDENT_DEPTH;
+    size_t indent = 2 * (size_t)(depth + 1);
+    if(svg_reserve(context, indent + max_length) != SVG_OK){
+        return NULL;
+    }
+    return svg_put(context->buffer + context->length, SVG_INDENT, indent);
+}
+
+// Completes an element written after svg_element_begin.
+static svg_return_t svg_element_end(svg_context_ptr context, char *end){
+    context->length = (size_t)(end - context->buffer);
+    context->buffer[context->length] = '\0';
+    if(context->frame){
+        return svg_frame_capture(context);
+    }
+    else if(context->length >= context->flush_threshold){
+        return svg_flush_buffer(context);
     }
-    else if(style == NULL){ 
-    int rect_size = snprintf(NULL, 0, 
-        "<rect x=\"%lf\" y=\"%lf\" width=\"%lf\" height=\"%lf\"\n",
-        top_left->x, top_left->y, size->width, size->height);
-    char* rect_buffer = malloc(rect_size + 1);
-    snprintf(rect_buffer, rect_size, 
-        "<rect x=\"%lf\" y=\"%lf\" width=\"%lf\" height=\"%lf\"\n",
-        top_left->x, top_left->y, size->width, size->height);
-    context->write_fn(context->user, rect_buffer); // actually writing in the svg context
-    free(rect_buffer);
     return SVG_OK;
-    } else {
-    int rect_size = snprintf(NULL, 0, 
-        "<rect x=\"%lf\" y=\"%lf\" width=\"%lf\" height=\"%lf\" style=\"%s\"/>\n",
-        top_left->x, top_left->y, size->width, size->height, style);
-    char* rect_buffer = malloc(rect_size + 1);
-    snprintf(rect_buffer, rect_size, 
-        "<rect x=\"%lf\" y=\"%lf\" width=\"%lf\" height=\"%lf\" style=\"%s\"/>\n",
-        top_left->x, top_left->y, size->width, size->height, style);
-    context->write_fn(context->user, rect_buffer); // actually writing in the svg context
-    free(rect_buffer);
+}
+
+// Finishes an element started at mark, discarding it if formatting failed
+// and flushing once the buffer has grown past the flush threshold. In frame
+// mode finished elements go to the frame instead.
+static svg_return_t svg_commit(svg_context_ptr context, size_t mark, svg_return_t result){
+    if(result != SVG_OK){
+        context->length = mark;
+        context->buffer[mark] = '\0';
+        return result;
+    }
+    if(context->frame){
+        return svg_frame_capture(context);
+    }
+    else if(context->length >= context->flush_threshold){
+        return svg_flush_buffer(context);
+    }
     return SVG_OK;
+}
+
+// Two character decimal representations of 0 through 99.
+static const char SVG_DIGIT_PAIRS[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static const double SVG_REAL_POWERS_OF_TEN[SVG_PRECISION_MAX + 1] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8,
+    1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17
+};
+
+static const uint64_t SVG_INT_POWERS_OF_TEN[SVG_PRECISION_MAX + 1] = {
+    1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull,
+    100000000ull, 1000000000ull, 10000000000ull, 100000000000ull, 1000000000000ull,
+    10000000000000ull, 100000000000000ull, 1000000000000000ull,
+    10000000000000000ull, 100000000000000000ull
+};
+
+// Decimal places used by the "%lf" compatible default format.
+#define SVG_LEGACY_DIGITS           6
+// Decimal places tried by the shortest round-trip fast path.
+#define SVG_SHORTEST_FAST_DIGITS    9
+// Largest magnitude for which every 9 decimal number maps to its own double.
+#define SVG_SHORTEST_FAST_LIMIT     1e6
+// Largest scaled value the integer path handles.
+#define SVG_SCALED_LIMIT            1e15
+// Largest grid position in quantized mode, 2^51.
+#define SVG_QUANTIZE_LIMIT          2251799813685248.0
+// 1.5 * 2^52, which leaves no fraction bits in sums of magnitude below 2^51.
+#define SVG_QUANTIZE_ROUNDER        6755399441055744.0
+
+// Writes the decimal digits of value and returns the new end.
+static char *svg_put_uint(char *out, uint64_t value){
+    char digits[20];
+    char *start = digits + sizeof(digits);
+    while(value >= 100){
+        start -= 2;
+        memcpy(start, SVG_DIGIT_PAIRS + 2 * (value % 100), 2);
+        value /= 100;
+    }
+    if(value >= 10){
+        start -= 2;
+        memcpy(start, SVG_DIGIT_PAIRS + 2 * value, 2);
+    }
+    else{
+        *--start = (char)('0' + value);
+    }
+    return svg_put(out, start, (size_t)(digits + sizeof(digits) - start));
+}
+
+// Rounds magnitude * 10^digits to the nearest integer, breaking exact ties
+// to even like printf. Fails when the result is too large for the integer path.
+static int svg_scale_real(double magnitude, int digits, uint64_t *scaled){
+    double product = magnitude * SVG_REAL_POWERS_OF_TEN[digits];
+    if(!(product < SVG_SCALED_LIMIT)){
+        return 0;
+    }
+    double whole = floor(product);
+    double distance = (product - whole) - 0.5;
+    if(fabs(distance) <= product * 2.3e-16){
+        // too close to a tie to trust the rounded product, so include
+        // its exact rounding error; the sign of the sum is always exact
+        distance += fma(magnitude, SVG_REAL_POWERS_OF_TEN[digits], -product);
+        if(distance == 0){
+            distance = fmod(whole, 2.0) == 0 ? -1 : 1;
+        }
+    }
+    *scaled = (uint64_t)whole + (distance > 0);
+    return 1;
+}
+
+// Writes scaled / 10^digits in fixed notation, optionally without trailing
+// fraction zeros, and returns the number of characters written.
+static size_t svg_format_scaled(char *buffer, int negative, uint64_t scaled, int digits, int trim){
+    char *out = buffer;
+    uint64_t fraction = scaled % SVG_INT_POWERS_OF_TEN[digits];
+    if(negative){
+        *out++ = '-';
+    }
+    out = svg_put_uint(out, scaled / SVG_INT_POWERS_OF_TEN[digits]);
+    if(trim){
+        while(digits > 0 && fraction % 10 == 0){
+            fraction /= 10;
+            digits--;
+        }
+    }
+    if(digits > 0){
+        *out++ = '.';
+        for(char *digit = out + digits - 1; digit >= out; digit--){
+            *digit = (char)('0' + fraction % 10);
+            fraction /= 10;
+        }
+        out += digits;
     }
+    *out = '\0';
+    return (size_t)(out - buffer);
+}
 
-    // returns 0 indicating rectangle was drawn sucessfully
-/* 
-<rect x="50.000000" y="50.000000" width="30.000000" height="40.000000" style="fill:none; stroke:green; stroke-width:2"/>
+// Removes trailing fraction zeros and a negative sign on zero from printf output.
+static size_t svg_trim_number(char *buffer, size_t length){
+    if(memchr(buffer, '.', length) && !memchr(buffer, 'e', length)){
+        while(buffer[length - 1] == '0'){
+            length--;
+        }
+        if(buffer[length - 1] == '.'){
+            length--;
+        }
+    }
+    if(length == 2 && buffer[0] == '-' && buffer[1] == '0'){
+        buffer[0] = '0';
+        length = 1;
+    }
+    buffer[length] = '\0';
+    return length;
+}
 
-we are given our x and y as a svg_point_t, width and height as a svg_size_t, and want to use those
-*/
+// Writes the shortest decimal string that reads back as exactly value.
+static size_t svg_format_shortest(char *buffer, svg_real_t value){
+    double magnitude = fabs(value);
+    uint64_t scaled;
+    if(value == 0){
+        return svg_format_scaled(buffer, 0, 0, 0, 1);
+    }
+    if(magnitude < SVG_SHORTEST_FAST_LIMIT
+        && svg_scale_real(magnitude, SVG_SHORTEST_FAST_DIGITS, &scaled)
+        && (double)scaled / SVG_REAL_POWERS_OF_TEN[SVG_SHORTEST_FAST_DIGITS] == magnitude){
+        return svg_format_scaled(buffer, value < 0, scaled, SVG_SHORTEST_FAST_DIGITS, 1);
+    }
+    int length = 0;
+    for(int digits = 15; digits <= 17; digits++){
+        length = snprintf(buffer, SVG_REAL_BUFFER_SIZE, "%.*g", digits, value);
+        if(strtod(buffer, NULL) == value){
+            break;
+        }
+    }
+    return (size_t)length;
 }
 
-// Draws a line segment.
-svg_return_t svg_line(svg_context_ptr context,
-                      const svg_point_t *start,
-                      const svg_point_t *end,
-                      const char* style){
-    // Enter code here
-/*
-    context->write_fn("<line x1=\"%lf\" ", start->x);
-    context->write_fn("y1=\"%lf\" ", start->y);
-    context->write_fn("x2=\"%lf\" ", end->x);
-    context->write_fn("y2=\"%lf\" ", end->y);
-    context->write_fn("style=\"%s\"/>", style); 
-*/
-    if (!(context)) {
+// Formats a real number for output.
+size_t svg_format_real(char *buffer, svg_real_t value, int precision){
+    uint64_t scaled;
+    if(precision == SVG_PRECISION_SHORTEST){
+        return svg_format_shortest(buffer, value);
+    }
+    if(precision < 0 || precision > SVG_PRECISION_MAX){
+        // "%lf" compatible: six places, zeros and the sign of zero kept
+        if(svg_scale_real(fabs(value), SVG_LEGACY_DIGITS, &scaled)){
+            return svg_format_scaled(buffer, signbit(value) != 0, scaled, SVG_LEGACY_DIGITS, 0);
+        }
+        return (size_t)snprintf(buffer, SVG_REAL_BUFFER_SIZE, "%lf", value);
+    }
+    if(svg_scale_real(fabs(value), precision, &scaled)){
+        return svg_format_scaled(buffer, value < 0 && scaled != 0, scaled, precision, 1);
+    }
+    int length = snprintf(buffer, SVG_REAL_BUFFER_SIZE, "%.*f", precision, value);
+    return svg_trim_number(buffer, (size_t)length);
+}
+
+// Snaps value * scale to the nearest integer, which is then at most half
+// a grid step from the exact product. Fails for products too large for
+// the rounding trick below and for NaN.
+static inline int svg_quantize(svg_real_t value, double scale, int64_t *grid){
+    double product = value * scale;
+    if(!(fabs(product) < SVG_QUANTIZE_LIMIT)){
+        return 0;
+    }
+    // adding and removing 1.5 * 2^52 rounds to the nearest integer, ties to even
+    double nearest = (product + SVG_QUANTIZE_ROUNDER) - SVG_QUANTIZE_ROUNDER;
+    double distance = product - nearest;
+    if(fabs(distance) >= 0.5 - fabs(product) * 2.3e-16){
+        // the rounded product may sit on the wrong side of a tie, so
+        // compare with its exact rounding error; distance - 0.5 and
+        // distance + 0.5 are exact here and the sign of each sum is too
+        double error = fma(value, scale, -product);
+        if((distance - 0.5) + error > 0){
+            nearest += 1;
+        }
+        else if((distance + 0.5) + error < 0){
+            nearest -= 1;
+        }
+    }
+    *grid = (int64_t)nearest;
+    return 1;
+}
+
+// Writes a grid position, a whole number of steps, in fixed notation
+// without trailing zeros and returns the new end.
+static inline char *svg_put_grid(char *out, int64_t grid, int digits){
+    uint64_t magnitude = grid < 0 ? 0 - (uint64_t)grid : (uint64_t)grid;
+    return out + svg_format_scaled(out, grid < 0, magnitude, digits, 1);
+}
+
+// Writes value snapped to the context's grid and returns the new end.
+static char *svg_put_quantized(svg_context_ptr context, char *out, svg_real_t value){
+    int64_t grid;
+    if(svg_quantize(value, context->quantize_scale, &grid)){
+        return svg_put_grid(out, grid, context->quantize_digits);
+    }
+    // beyond the grid, fixed notation rounds just as closely
+    return out + svg_format_real(out, value, context->quantize_digits);
+}
+
+
+// Allocates a context writing to the given sink and buffers the header.
+static svg_context_ptr svg_context_new(int sink,
+                                       const svg_allocator_t *allocator,
+                                       svg_write_fn write_fn,
+                                       svg_cleanup_fn cleanup_fn,
+                                       svg_user_context_ptr user,
+                                       svg_px_t width,
+                                       svg_px_t height){
+    if (width <= 0 || height <= 0) {
+        return NULL;
+    }
+    // initializing svg context
+    svg_context_ptr context = (svg_context_ptr)allocator->alloc_fn(allocator->user, sizeof(svg_context_t));
+    if(!context){
+        return NULL;
+    }
+    memset(context, 0, sizeof(svg_context_t));
+    context->allocator = *allocator;
+    context->sink = sink;
+    context->write_fn = write_fn;
+    context->cleanup_fn = cleanup_fn;
+    context->user = user;
+    context->flush_threshold = SVG_DEFAULT_FLUSH_THRESHOLD;
+    context->precision = SVG_PRECISION_DEFAULT;
+    context->width = width;
+    context->height = height;
+    context->viewport_right = width;
+    context->viewport_bottom = height;
+    context->matrix.a = 1;
+    context->matrix.d = 1;
+    if(svg_reserve(context, SVG_INITIAL_BUFFER_CAPACITY) != SVG_OK){
+        svg_mem_free(context, context);
+        return NULL;
+    }
+    context->buffer[0] = '\0';
+
+    // the header stays buffered until the first flush
+    if(svg_appendf(context,
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<svg width=\"%d\" height=\"%d\" xmlns=\"http://www.w3.org/2000/svg\">\n",
+        width, height) != SVG_OK){
+        svg_mem_free(context, context->buffer);
+        svg_mem_free(context, context);
+        return NULL;
+    }
+    context->header_buffered = 1;
+    context->header_end = context->length;
+    return context;
+}
+
+// Creates a new SVG drawing context.
+svg_context_ptr svg_create(svg_write_fn write_fn,
+                           svg_cleanup_fn cleanup_fn,
+                           svg_user_context_ptr user,
+                           svg_px_t width,
+                           svg_px_t height){
+    if (write_fn == NULL) {
+        return NULL;
+    }
+    return svg_context_new(SVG_SINK_CALLBACK, &svg_heap_allocator, write_fn, cleanup_fn, user, width, height);
+}
+
+// Creates a new SVG drawing context from a set of options.
+svg_context_ptr svg_create_ex(const svg_create_options_t *options){
+    if(!options){
+        return NULL;
+    }
+    int callbacks = (options->write_fn != NULL) + (options->write_n_fn != NULL) + (options->writev_fn != NULL);
+    int hooks = (options->allocator.alloc_fn != NULL) + (options->allocator.realloc_fn != NULL)
+              + (options->allocator.free_fn != NULL);
+    if(callbacks != 1 || (hooks != 0 && hooks != 3)){
+        return NULL;
+    }
+    const svg_allocator_t *allocator = hooks ? &options->allocator : &svg_heap_allocator;
+    svg_context_ptr context = svg_context_new(SVG_SINK_CALLBACK, allocator, options->write_fn, options->cleanup_fn,
+                                              options->user, options->width, options->height);
+    if(context){
+        context->write_n_fn = options->write_n_fn;
+        context->writev_fn = options->writev_fn;
+    }
+    return context;
+}
+
+// Creates an SVG context that keeps the document in memory.
+svg_context_ptr svg_create_memory(svg_px_t width, svg_px_t height){
+    return svg_context_new(SVG_SINK_MEMORY, &svg_heap_allocator, NULL, NULL, NULL, width, height);
+}
+
+// Creates an SVG context that only measures its output.
+svg_context_ptr svg_create_measure(svg_px_t width, svg_px_t height){
+    return svg_context_new(SVG_SINK_MEASURE, &svg_heap_allocator, NULL, NULL, NULL, width, height);
+}
+
+// Creates an SVG context that records into a display list.
+svg_context_ptr svg_create_recording(svg_list_ptr list, svg_px_t width, svg_px_t height){
+    if(!list){
+        return NULL;
+    }
+    svg_context_ptr context = svg_context_new(SVG_SINK_MEASURE, &svg_heap_allocator, NULL, NULL, NULL, width, height);
+    if(context){
+        context->list = list;
+    }
+    return context;
+}
+
+// Creates an SVG context that draws into a tile set.
+svg_context_ptr svg_create_tiling(svg_tiles_ptr tiles){
+    svg_px_t width, height;
+    if(svg_tiles_get_canvas(tiles, &width, &height) != SVG_OK){
+        return NULL;
+    }
+    // the tiles write their own headers, so the context's is never output
+    svg_context_ptr context = svg_context_new(SVG_SINK_MEASURE, &svg_heap_allocator, NULL, NULL, NULL, width, height);
+    if(context){
+        context->tiles = tiles;
+    }
+    return context;
+}
+
+// Body of the writer thread: writes queued buffers in order until stopped.
+static void *svg_async_main(void *argument){
+    svg_context_ptr context = (svg_context_ptr)argument;
+    svg_async_t *async = context->async;
+    pthread_mutex_lock(&async->lock);
+    for(;;){
+        while(!async->queue_count && !async->stop){
+            pthread_cond_wait(&async->queued, &async->lock);
+        }
+        if(!async->queue_count){
+            break;
+        }
+        // a scatter-gather callback takes everything queued in one call
+        size_t taken = context->writev_fn ? async->queue_count : 1;
+        for(size_t index = 0; index < taken; index++){
+            async->batch[index] = async->queue[async->queue_head];
+            async->queue_head = (async->queue_head + 1) % async->in_flight_limit;
+        }
+        async->queue_count -= taken;
+        async->busy = (int)taken;
+        int failed = async->error != SVG_OK;
+        pthread_mutex_unlock(&async->lock);
+
+        // after a failure the rest of the document is dropped
+        svg_return_t result = SVG_OK;
+        if(!failed){
+            for(size_t index = 0; index < taken; index++){
+                async->spans[index].data = async->batch[index].data;
+                async->spans[index].length = async->batch[index].length;
+            }
+            result = svg_write_spans(context, async->spans, taken);
+        }
+
+        pthread_mutex_lock(&async->lock);
+        if(result != SVG_OK){
+            async->error = SVG_ERR_IO;
+        }
+        for(size_t index = 0; index < taken; index++){
+            async->spares[async->spare_count++] = async->batch[index];
+        }
+        async->busy = 0;
+        pthread_cond_broadcast(&async->written);
+    }
+    pthread_mutex_unlock(&async->lock);
+    return NULL;
+}
+
+// Starts a writer thread allowing the given number of buffers in flight.
+static svg_return_t svg_async_start(svg_context_ptr context, size_t in_flight_limit){
+    svg_async_t *async = (svg_async_t *)svg_mem_calloc(context, 1, sizeof(svg_async_t));
+    if(!async){
+        return SVG_ERR_NO_MEM;
+    }
+    async->in_flight_limit = in_flight_limit;
+    async->queue = (svg_async_buffer_t *)svg_mem_calloc(context, in_flight_limit, sizeof(svg_async_buffer_t));
+    async->spares = (svg_async_buffer_t *)svg_mem_calloc(context, in_flight_limit, sizeof(svg_async_buffer_t));
+    async->batch = (svg_async_buffer_t *)svg_mem_calloc(context, in_flight_limit, sizeof(svg_async_buffer_t));
+    async->spans = (svg_span_t *)svg_mem_calloc(context, in_flight_limit, sizeof(svg_span_t));
+    if(!async->queue || !async->spares || !async->batch || !async->spans){
+        svg_mem_free(context, async->queue);
+        svg_mem_free(context, async->spares);
+        svg_mem_free(context, async->batch);
+        svg_mem_free(context, async->spans);
+        svg_mem_free(context, async);
+        return SVG_ERR_NO_MEM;
+    }
+    pthread_mutex_init(&async->lock, NULL);
+    pthread_cond_init(&async->queued, NULL);
+    pthread_cond_init(&async->written, NULL);
+    context->async = async;
+    if(pthread_create(&async->thread, NULL, svg_async_main, context) != 0){
+        context->async = NULL;
+        pthread_cond_destroy(&async->written);
+        pthread_cond_destroy(&async->queued);
+        pthread_mutex_destroy(&async->lock);
+        svg_mem_free(context, async->queue);
+        svg_mem_free(context, async->spares);
+        svg_mem_free(context, async->batch);
+        svg_mem_free(context, async->spans);
+        svg_mem_free(context, async);
+        return SVG_ERR_NO_MEM;
+    }
+    return SVG_OK;
+}
+
+// Lets the writer thread finish the queued buffers, joins it and returns
+// its first failure.
+static svg_return_t svg_async_stop(svg_context_ptr context){
+    svg_async_t *async = context->async;
+    pthread_mutex_lock(&async->lock);
+    async->stop = 1;
+    pthread_cond_signal(&async->queued);
+    pthread_mutex_unlock(&async->lock);
+    pthread_join(async->thread, NULL);
+
+    svg_return_t result = async->error;
+    for(size_t index = 0; index < async->spare_count; index++){
+        svg_mem_free(context, async->spares[index].data);
+    }
+    pthread_cond_destroy(&async->written);
+    pthread_cond_destroy(&async->queued);
+    pthread_mutex_destroy(&async->lock);
+    svg_mem_free(context, async->queue);
+    svg_mem_free(context, async->spares);
+    svg_mem_free(context, async->batch);
+    svg_mem_free(context, async->spans);
+    svg_mem_free(context, async);
+    context->async = NULL;
+    return result;
+}
+
+// Turns asynchronous writing on or off.
+svg_return_t svg_set_async(svg_context_ptr context, size_t buffers){
+    if(!context){
         return SVG_ERR_NULL;
-    } 
-    else if (start == NULL || end == NULL) {
+    }
+    else if(buffers == 1){
         return SVG_ERR_INVALID_ARG;
     }
-    else if(style == NULL){ 
-    int line_size = snprintf(NULL, 0, 
-        "<line x1=\"%lf\" y1=\"%lf\" x2=\"%lf\" y2=\"%lf\"\n",
-        start->x, start->y, end->x, end->y);
-    char* line_buffer = malloc(line_size + 1);
-    snprintf(line_buffer, line_size, 
-        "<line x1=\"%lf\" y1=\"%lf\" x2=\"%lf\" y2=\"%lf\"\n",
-        start->x, start->y, end->x, end->y);
-    context->write_fn(context->user, line_buffer); // actually writing in the svg context
-    free(line_buffer);
-    return SVG_OK;
-    } else {
-    int line_size = snprintf(NULL, 0, 
-        "<line x1=\"%lf\" y1=\"%lf\" x2=\"%lf\" y2=\"%lf\" style=\"%s\"/>\n",
-        start->x, start->y, end->x, end->y, style);
-    char* line_buffer = malloc(line_size + 1);
-    snprintf(line_buffer, line_size, 
-        "<line x1=\"%lf\" y1=\"%lf\" x2=\"%lf\" y2=\"%lf\" style=\"%s\"/>\n",
-        start->x, start->y, end->x, end->y, style);
-    context->write_fn(context->user, line_buffer); // actually writing in the svg context
-    free(line_buffer);
-    return SVG_OK;
-    }
-    // returns 0 indicating line segment was drawn sucessfully
-/*
-write
-<line x1="10.000000" y1="10.000000" x2="90.000000" y2="90.000000" style="stroke:green; stroke-width:2"/>
-we are given our x1 and y1 as a svg_point_t, x2 and y2 as a svg_point_t, and want to use those
-
-*/
+    else if(context->sink != SVG_SINK_CALLBACK){
+        return SVG_ERR_STATE;
+    }
+    svg_return_t result = SVG_OK;
+    if(context->async){
+        // queued output is written before the mode changes, keeping order
+        result = svg_async_stop(context);
+    }
+    if(buffers){
+        svg_return_t start_result = svg_async_start(context, buffers - 1);
+        if(result == SVG_OK){
+            result = start_result;
+        }
+    }
+    return result;
 }
 
-// Begins an SVG group.
-svg_return_t svg_group_begin(svg_context_ptr context, 
-                             const char* attrs){
-    // Enter code here
-    // context->write_fn("<g %s>", attrs);
-    if (!(context)) {
-        return SVG_ERR_NULL;
-    }    else if (attrs != NULL) {
-    int size = snprintf(NULL, 0, "<g %s>", attrs);
-    char* buffer = malloc(size + 1);
-    snprintf(buffer, size, "<g %s>", attrs);
-    context->write_fn(context->user, buffer); // actually writing in the svg context
-    free(buffer);
+// Adds a record to the queue; safe to call from any number of threads.
+static void svg_queue_push(svg_queue_t *queue, svg_record_t *record){
+    atomic_store_explicit(&record->next, NULL, memory_order_relaxed);
+    svg_record_t *previous = atomic_exchange_explicit(&queue->head, record, memory_order_acq_rel);
+    atomic_store_explicit(&previous->next, record, memory_order_release);
+}
+
+// Removes the oldest record, or returns NULL when none is ready. Only the
+// consumer calls this. A record whose push has not finished linking is
+// not ready yet, and neither is anything pushed after it.
+static svg_record_t *svg_queue_pop(svg_queue_t *queue){
+    svg_record_t *tail = queue->tail;
+    svg_record_t *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if(tail == &queue->stub){
+        if(!next){
+            return NULL;
+        }
+        queue->tail = next;
+        tail = next;
+        next = atomic_load_explicit(&next->next, memory_order_acquire);
+    }
+    if(next){
+        queue->tail = next;
+        return tail;
+    }
+    if(tail != atomic_load_explicit(&queue->head, memory_order_acquire)){
+        return NULL;
+    }
+    // tail is the last record; push the stub behind it so it can be taken
+    svg_queue_push(queue, &queue->stub);
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if(next){
+        queue->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+// Hands a producer's buffered output to its parent's queue.
+static svg_return_t svg_queue_submit(svg_context_ptr producer){
+    svg_record_t *record = (svg_record_t *)svg_mem_alloc(producer, sizeof(svg_record_t));
+    char *buffer = (char *)svg_mem_alloc(producer, producer->capacity + 1);
+    if(!record || !buffer){
+        svg_mem_free(producer, record);
+        svg_mem_free(producer, buffer);
+        return SVG_ERR_NO_MEM;
+    }
+    record->data = producer->buffer;
+    record->length = producer->length;
+    record->capacity = producer->capacity;
+    svg_queue_push(producer->shard_parent->queue, record);
+    producer->buffer = buffer;
+    producer->flushed += producer->length;
+    producer->length = 0;
+    buffer[0] = '\0';
     return SVG_OK;
-    } else {
-        return SVG_ERR_IO;
+}
+
+// Closes any open path and groups and ends the document.
+static svg_return_t svg_finish(svg_context_ptr context){
+    svg_return_t result = SVG_OK;
+    if(context->frame){
+        // every frame written is a document of its own, so an unfinished
+        // frame is dropped
+        context->length = context->frame->base;
+        context->buffer[context->length] = '\0';
+        return result;
+    }
+    // an unfinished density map is dropped like an unfinished frame
+    svg_mem_free(context, context->density_counts);
+    context->density_counts = NULL;
+    // close any path or groups left open so the document stays well formed
+    if(context->path_open){
+        result = svg_path_end(context);
+    }
+    if(context->queue && result == SVG_OK){
+        result = svg_queue_drain(context);
+    }
+    while(context->group_depth > context->group_base && result == SVG_OK){
+        if(context->group_depth == context->symbol_depth){
+            result = svg_symbol_end(context);
+        }
+        else{
+            result = svg_group_end(context);
+        }
     }
+    if(result == SVG_OK && !context->shard_parent){
+        result = svg_append(context, "</svg>\n", 7);
+    }
+    return result;
+}
 
-/*
-for this function,
-write following xml code to our SVG file:
-<g stroke:blue; stroke-width:2>
-*/
+// Forgets every cell and style that level-of-detail decimation remembers.
+static void svg_lod_reset(svg_context_ptr context){
+    for(size_t index = 0; index < context->lod_style_count; index++){
+        svg_mem_free(context, context->lod_styles[index].text);
+    }
+    svg_mem_free(context, context->lod_styles);
+    svg_mem_free(context, context->lod_style_slots);
+    svg_mem_free(context, context->lod_keys);
+    context->lod_styles = NULL;
+    context->lod_style_count = 0;
+    context->lod_style_slots = NULL;
+    context->lod_style_slot_count = 0;
+    context->lod_keys = NULL;
+    context->lod_key_count = 0;
+    context->lod_key_slot_count = 0;
 }
 
-// Ends the current SVG group.
-svg_return_t svg_group_end(svg_context_ptr context){
-    // Enter code here
-    if (!(context)) {
-        return SVG_ERR_NULL;
-    } else {
-    int size = snprintf(NULL, 0, "<g>");
-    char* buffer = malloc(size + 1);
-    snprintf(buffer, size, "<g>");
-    context->write_fn(context->user, buffer); // actually writing in the svg context
-    free(buffer);   
+// Releases everything the context owns, including its buffer.
+static void svg_free(svg_context_ptr context){
+    if(context->queue){
+        svg_record_t *record;
+        while((record = svg_queue_pop(context->queue)) != NULL){
+            svg_mem_free(context, record->data);
+            svg_mem_free(context, record);
+        }
+        svg_mem_free(context, context->queue);
     }
-    return 0;
-/*
-for this function,
-simply write a closing </g> tag to our SVG file
-*/
+    for(size_t index = 0; index < context->style_count; index++){
+        svg_mem_free(context, context->styles[index].handle);
+    }
+    if(context->frame){
+        for(size_t index = 0; index < context->frame->entry_count; index++){
+            svg_mem_free(context, context->frame->entries[index].id);
+            svg_mem_free(context, context->frame->entries[index].text);
+        }
+        svg_mem_free(context, context->frame->entries);
+        svg_mem_free(context, context->frame->slots);
+        svg_mem_free(context, context->frame->dirty);
+        svg_mem_free(context, context->frame->pending);
+        svg_mem_free(context, context->frame->spans);
+        svg_mem_free(context, context->frame);
+    }
+    svg_mem_free(context, context->styles);
+    svg_mem_free(context, context->style_slots);
+    svg_mem_free(context, context->transforms);
+    svg_lod_reset(context);
+    svg_mem_free(context, context->density_counts);
+    svg_mem_free(context, context->buffer);
+    // the context holds its own allocator, so free it from a copy
+    svg_allocator_t allocator = context->allocator;
+    allocator.free_fn(allocator.user, context);
+}
+
+// Destroys an SVG context.
+svg_return_t svg_destroy(svg_context_ptr context){
+    size_t length;
+    return svg_measure(context, &length);
+}
+
+// Destroys an SVG context and reports the document length.
+svg_return_t svg_measure(svg_context_ptr context, size_t *length){
+    if(!context || !length){
+        return SVG_ERR_NULL;
+    }
+    svg_return_t result = svg_finish(context);
+    if(result == SVG_OK){
+        result = svg_flush_buffer(context);
+    }
+    if(context->async){
+        svg_return_t async_result = svg_async_stop(context);
+        if(result == SVG_OK){
+            result = async_result;
+        }
+    }
+    if(context->cleanup_fn){
+        svg_return_t cleanup_result = context->cleanup_fn(context->user);
+        if(result == SVG_OK && cleanup_result != SVG_OK){
+            result = cleanup_result;
+        }
+    }
+    *length = context->flushed + context->length;
+    svg_free(context);
+    return result;
+}
+
+// Finishes a memory context and takes its document.
+svg_return_t svg_detach_buffer(svg_context_ptr context, char **buffer, size_t *length){
+    if(!context || !buffer){
+        return SVG_ERR_NULL;
+    }
+    else if(context->sink != SVG_SINK_MEMORY || context->shard_parent){
+        return SVG_ERR_STATE;
+    }
+    svg_return_t result = svg_finish(context);
+    *buffer = NULL;
+    if(result == SVG_OK){
+        *buffer = context->buffer;
+        if(length){
+            *length = context->length;
+        }
+        context->buffer = NULL;
+    }
+    svg_free(context);
+    return result;
+}
+
+// Hands the buffered output to the writer thread, waiting while too many
+// buffers are in flight, and continues in a spare or new buffer.
+static svg_return_t svg_async_enqueue(svg_context_ptr context){
+    svg_async_t *async = context->async;
+    svg_async_buffer_t next = {NULL, 0, 0};
+    pthread_mutex_lock(&async->lock);
+    while(async->queue_count + (size_t)async->busy >= async->in_flight_limit){
+        pthread_cond_wait(&async->written, &async->lock);
+    }
+    if(async->spare_count){
+        next = async->spares[--async->spare_count];
+    }
+    pthread_mutex_unlock(&async->lock);
+    if(!next.data){
+        // only the producer queues buffers, so the room found above stays free
+        next.capacity = context->capacity;
+        next.data = (char *)svg_mem_alloc(context, next.capacity + 1);
+        if(!next.data){
+            return SVG_ERR_NO_MEM;
+        }
+    }
+
+    pthread_mutex_lock(&async->lock);
+    svg_async_buffer_t *slot = &async->queue[(async->queue_head + async->queue_count) % async->in_flight_limit];
+    slot->data = context->buffer;
+    slot->length = context->length;
+    slot->capacity = context->capacity;
+    async->queue_count++;
+    svg_return_t result = async->error;
+    pthread_cond_signal(&async->queued);
+    pthread_mutex_unlock(&async->lock);
+
+    context->buffer = next.data;
+    context->capacity = next.capacity;
+    return result;
+}
+
+// Waits until the writer thread has written every queued buffer and
+// returns its first failure.
+static svg_return_t svg_async_wait(svg_async_t *async){
+    pthread_mutex_lock(&async->lock);
+    while(async->queue_count || async->busy){
+        pthread_cond_wait(&async->written, &async->lock);
+    }
+    svg_return_t result = async->error;
+    pthread_mutex_unlock(&async->lock);
+    return result;
+}
+
+// Writes all buffered output through the write callback, or queues it
+// for the writer thread.
+static svg_return_t svg_flush_buffer(svg_context_ptr context){
+    if(context->length == 0 || context->sink == SVG_SINK_MEMORY){
+        return SVG_OK;
+    }
+    else if(context->frame && context->frame->open){
+        // only finished frames are written
+        return SVG_OK;
+    }
+    else if(context->sink == SVG_SINK_PRODUCER){
+        // a group is submitted whole so other producers cannot end up inside it
+        return context->group_depth == context->group_base ? svg_queue_submit(context) : SVG_OK;
+    }
+    SVG_STAT_ADD(context, flushes, 1);
+    svg_return_t result = SVG_OK;
+    if(context->async){
+        result = svg_async_enqueue(context);
+        if(result == SVG_ERR_NO_MEM){
+            return result;
+        }
+    }
+    else if(context->sink == SVG_SINK_CALLBACK){
+        svg_span_t span = {context->buffer, context->length};
+        result = svg_write_spans(context, &span, 1);
+    }
+    context->flushed += context->length;
+    context->length = 0;
+    context->buffer[0] = '\0';
+    context->header_buffered = 0;
+    context->style_insert = 0;
+    return result == SVG_OK ? SVG_OK : SVG_ERR_IO;
+}
+
+// Appends length bytes of output held in a buffer of the given capacity.
+// Output as large as the flush threshold is flushed from that buffer
+// instead of copied, handing back the context's old buffer in its place.
+static svg_return_t svg_append_owned(svg_context_ptr context, char **buffer, size_t *capacity, size_t length){
+    if(context->sink == SVG_SINK_MEMORY || context->frame || length < context->flush_threshold){
+        return svg_commit(context, context->length, svg_append(context, *buffer, length));
+    }
+    svg_return_t result = svg_flush_buffer(context);
+    if(result == SVG_OK){
+        char *previous = context->buffer;
+        size_t previous_capacity = context->capacity;
+        context->buffer = *buffer;
+        context->capacity = *capacity;
+        context->length = length;
+        *buffer = previous;
+        *capacity = previous_capacity;
+        result = svg_flush_buffer(context);
+    }
+    return result;
+}
+
+// Creates a headerless context for a parent with the given sink, copying
+// the parent's settings.
+static svg_context_ptr svg_shard_new(svg_context_ptr parent, int sink){
+    // interning and level-of-detail decisions depend on everything drawn
+    // before, so a shard could not reproduce them on its own; the shard
+    // allocates with the parent's hooks from its own thread
+    if(!parent || parent->path_open || parent->style_interning || parent->lod_tolerance > 0 || parent->frame
+        || parent->symbol_depth || parent->tiles || !parent->allocator.thread_safe){
+        return NULL;
+    }
+    svg_context_ptr shard = svg_context_new(sink, &parent->allocator, NULL, NULL, NULL, parent->width, parent->height);
+    if(!shard){
+        return NULL;
+    }
+    // a shard holds elements only, not the header
+    shard->length = 0;
+    shard->buffer[0] = '\0';
+    shard->header_buffered = 0;
+    shard->header_end = 0;
+    shard->shard_parent = parent;
+    shard->group_depth = parent->group_depth;
+    shard->group_base = parent->group_depth;
+    shard->precision = parent->precision;
+    shard->quantized = parent->quantized;
+    shard->quantize_digits = parent->quantize_digits;
+    shard->quantize_scale = parent->quantize_scale;
+    shard->symbol_count = parent->symbol_count;
+    // the parent's transform stays in effect but cannot be popped
+    shard->matrix = parent->matrix;
+    shard->transformed = parent->transformed;
+    shard->stats_enabled = parent->stats_enabled;
+    shard->cull_enabled = parent->cull_enabled;
+    shard->cull_margin = parent->cull_margin;
+    shard->viewport_left = parent->viewport_left;
+    shard->viewport_top = parent->viewport_top;
+    shard->viewport_right = parent->viewport_right;
+    shard->viewport_bottom = parent->viewport_bottom;
+    if(parent->density_counts){
+        // each shard counts into a map of its own that is added up on commit
+        shard->density_counts = (uint32_t *)svg_mem_calloc(shard, parent->density_columns * parent->density_rows, sizeof(uint32_t));
+        if(!shard->density_counts){
+            svg_free(shard);
+            return NULL;
+        }
+        shard->density_cell = parent->density_cell;
+        shard->density_columns = parent->density_columns;
+        shard->density_rows = parent->density_rows;
+    }
+    return shard;
+}
+
+// Creates a shard that formats output for a parent context.
+svg_context_ptr svg_shard_create(svg_context_ptr parent){
+    return svg_shard_new(parent, SVG_SINK_MEMORY);
+}
+
+// Creates a producer that submits output to a parent context.
+svg_context_ptr svg_producer_create(svg_context_ptr parent){
+    // producers finish on their own threads, so they would have no safe
+    // point to add their density counts to the parent's
+    if(!parent || parent->shard_parent || parent->frame || parent->density_counts){
+        return NULL;
+    }
+    if(!parent->queue){
+        parent->queue = (svg_queue_t *)svg_mem_calloc(parent, 1, sizeof(svg_queue_t));
+        if(!parent->queue){
+            return NULL;
+        }
+        atomic_init(&parent->queue->stub.next, NULL);
+        atomic_init(&parent->queue->head, &parent->queue->stub);
+        parent->queue->tail = &parent->queue->stub;
+    }
+    svg_context_ptr producer = svg_shard_new(parent, SVG_SINK_PRODUCER);
+    if(producer){
+        // the flush threshold sets the size of submitted records
+        producer->flush_threshold = parent->flush_threshold;
+    }
+    return producer;
+}
+
+// Appends every record producers have submitted so far to the output.
+static svg_return_t svg_queue_drain(svg_context_ptr context){
+    svg_record_t *record;
+    svg_return_t result = SVG_OK;
+    // records cannot go inside an open path
+    while(result == SVG_OK && !context->path_open && (record = svg_queue_pop(context->queue)) != NULL){
+        result = svg_append_owned(context, &record->data, &record->capacity, record->length);
+        svg_mem_free(context, record->data);
+        svg_mem_free(context, record);
+    }
+    return result;
+}
+
+// Appends a shard's output to its parent and destroys the shard.
+svg_return_t svg_shard_commit(svg_context_ptr parent, svg_context_ptr shard){
+    if(!parent || !shard){
+        return SVG_ERR_NULL;
+    }
+    else if(shard->shard_parent != parent || shard->sink != SVG_SINK_MEMORY){
+        return SVG_ERR_INVALID_ARG;
+    }
+    else if(parent->path_open || shard->path_open || shard->group_depth != shard->group_base){
+        return SVG_ERR_STATE;
+    }
+    else if(shard->density_counts && (!parent->density_counts || parent->density_cell != shard->density_cell)){
+        // the map the shard counted for has already ended
+        return SVG_ERR_STATE;
+    }
+    svg_return_t result = svg_append_owned(parent, &shard->buffer, &shard->capacity, shard->length);
+    shard->length = 0;
+    parent->culled.circles += shard->culled.circles;
+    parent->culled.rects += shard->culled.rects;
+    parent->culled.lines += shard->culled.lines;
+    if(SVG_STATS_ON(parent)){
+        svg_stats_t *stats = &parent->stats;
+        stats->circles += shard->stats.circles;
+        stats->rects += shard->stats.rects;
+        stats->lines += shard->stats.lines;
+        stats->paths += shard->stats.paths;
+        stats->path_points += shard->stats.path_points;
+        stats->groups += shard->stats.groups;
+        stats->uses += shard->stats.uses;
+        stats->alloc_errors += shard->stats.alloc_errors;
+    }
+    if(shard->density_counts){
+        size_t cells = shard->density_columns * shard->density_rows;
+        for(size_t index = 0; index < cells; index++){
+            uint32_t sum = parent->density_counts[index] + shard->density_counts[index];
+            parent->density_counts[index] = sum < shard->density_counts[index] ? UINT32_MAX : sum;
+        }
+    }
+    svg_free(shard);
+    return result;
+}
+
+// Writes all buffered output through the write callback.
+svg_return_t svg_flush(svg_context_ptr context){
+    if(!context){
+        return SVG_ERR_NULL;
+    }
+    svg_return_t result = context->queue ? svg_queue_drain(context) : SVG_OK;
+    if(result == SVG_OK){
+        result = svg_flush_buffer(context);
+    }
+    if(context->async && result == SVG_OK){
+        result = svg_async_wait(context->async);
+    }
+    return result;
+}
+
+// Sets the number of buffered bytes that triggers a flush.
+svg_return_t svg_set_flush_threshold(svg_context_ptr context, size_t threshold){
+    if(!context){
+        return SVG_ERR_NULL;
+    }
+    context->flush_threshold = threshold;
+    return svg_commit(context, context->length, SVG_OK);
+}
+
+// Sets the number format used for coordinates and lengths.
+svg_return_t svg_set_precision(svg_context_ptr context, int precision){
+    if(!context){
+        return SVG_ERR_NULL;
+    }
+    else if(precision < SVG_PRECISION_DEFAULT || precision > SVG_PRECISION_MAX){
+        return SVG_ERR_INVALID_ARG;
+    }
+    context->precision = precision;
+    return SVG_OK;
+}
+
+// Turns snapping of coordinates and lengths to a decimal grid on or off.
+svg_return_t svg_set_quantization(svg_context_ptr context, int enabled, int digits){
+    if(!context){
+        return SVG_ERR_NULL;
+    }
+    else if(digits < 0 || digits > SVG_PRECISION_MAX){
+        return SVG_ERR_INVALID_ARG;
+    }
+    else if(context->path_open){
+        return SVG_ERR_STATE;
+    }
+    context->quantized = enabled != 0;
+    context->quantize_digits = digits;
+    context->quantize_scale = SVG_REAL_POWERS_OF_TEN[digits];
+    return SVG_OK;
+}
+
+// Returns the 64-bit FNV-1a hash of length bytes of text.
+static uint64_t svg_hash(const char *text, size_t length){
+    uint64_t hash = 14695981039346656037ull;
+    for(size_t index = 0; index < length; index++){
+        hash ^= (unsigned char)text[index];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Inserts the given pieces of text into the buffer at offset.
+static svg_return_t svg_insert(svg_context_ptr context, size_t offset,
+                               const char *const *pieces, const size_t *lengths, size_t count){
+    size_t total = 0;
+    for(size_t index = 0; index < count; index++){
+        total += lengths[index];
+    }
+    if(svg_reserve(context, total) != SVG_OK){
+        return SVG_ERR_NO_MEM;
+    }
+    char *out = context->buffer + offset;
+    memmove(out + total, out, context->length - offset + 1);
+    for(size_t index = 0; index < count; index++){
+        out = svg_put(out, pieces[index], lengths[index]);
+    }
+    context->length += total;
+    return SVG_OK;
+}
+
+// Writes the CSS rule for a new style. While the header is still buffered
+// the rule joins the <style> element directly after it, otherwise it gets
+// a <style> element of its own at the current position.
+static svg_return_t svg_style_write_rule(svg_context_ptr context, const svg_style_entry_t *entry){
+    const char *name = entry->handle + 1;
+    size_t name_length = strlen(name);
+    if(context->header_buffered){
+        if(!context->style_insert){
+            static const char block[] = "  <style>\n  </style>\n";
+            const char *pieces[] = {block};
+            const size_t lengths[] = {sizeof(block) - 1};
+            if(svg_insert(context, context->header_end, pieces, lengths, 1) != SVG_OK){
+                return SVG_ERR_NO_MEM;
+            }
+            context->style_insert = context->header_end + 10;
+        }
+        const char *pieces[] = {"    .", name, "{", entry->text, "}\n"};
+        const size_t lengths[] = {5, name_length, 1, entry->length, 2};
+        if(svg_insert(context, context->style_insert, pieces, lengths, 5) != SVG_OK){
+            return SVG_ERR_NO_MEM;
+        }
+        context->style_insert += 8 + name_length + entry->length;
+        return SVG_OK;
+    }
+    else if(context->path_open){
+        return SVG_ERR_STATE;
+    }
+    char *out = svg_element_begin(context, name_length + entry->length + 32);
+    if(!out){
+        return SVG_ERR_NO_MEM;
+    }
+    out = SVG_PUT_LITERAL(out, "<style>.");
+    out = svg_put(out, name, name_length);
+    *out++ = '{';
+    out = svg_put(out, entry->text, entry->length);
+    out = SVG_PUT_LITERAL(out, "}</style>\n");
+    return svg_element_end(context, out);
+}
+
+// Doubles the style hash table and reinserts every style.
+static svg_return_t svg_style_grow_slots(svg_context_ptr context){
+    size_t slot_count = context->style_slot_count ? 2 * context->style_slot_count : SVG_STYLE_INITIAL_SLOTS;
+    uint32_t *slots = (uint32_t *)svg_mem_calloc(context, slot_count, sizeof(uint32_t));
+    if(!slots){
+        return SVG_ERR_NO_MEM;
+    }
+    for(size_t index = 0; index < context->style_count; index++){
+        size_t slot = (size_t)context->styles[index].hash & (slot_count - 1);
+        while(slots[slot]){
+            slot = (slot + 1) & (slot_count - 1);
+        }
+        slots[slot] = (uint32_t)(index + 1);
+    }
+    svg_mem_free(context, context->style_slots);
+    context->style_slots = slots;
+    context->style_slot_count = slot_count;
+    return SVG_OK;
+}
+
+// Finds the handle of a style, registering it and writing its rule if new.
+static svg_return_t svg_style_lookup(svg_context_ptr context, const char *style,
+                                     size_t style_length, const char **handle){
+    uint64_t hash = svg_hash(style, style_length);
+    size_t mask = context->style_slot_count - 1;
+    size_t slot = (size_t)hash & mask;
+    if(context->style_slot_count){
+        while(context->style_slots[slot]){
+            svg_style_entry_t *entry = &context->styles[context->style_slots[slot] - 1];
+            if(entry->hash == hash && entry->length == style_length
+                && memcmp(entry->text, style, style_length) == 0){
+                context->style_last = context->style_slots[slot];
+                *handle = entry->handle;
+                return SVG_OK;
+            }
+            slot = (slot + 1) & mask;
+        }
+    }
+
+    // a new style: make room in the table before anything is written
+    if(context->style_count >= UINT32_MAX - 1){
+        return SVG_ERR_STATE;
+    }
+    if(2 * (context->style_count + 1) > context->style_slot_count){
+        if(svg_style_grow_slots(context) != SVG_OK){
+            return SVG_ERR_NO_MEM;
+        }
+        mask = context->style_slot_count - 1;
+        slot = (size_t)hash & mask;
+        while(context->style_slots[slot]){
+            slot = (slot + 1) & mask;
+        }
+    }
+    if(context->style_count == context->style_capacity){
+        size_t capacity = context->style_capacity ? 2 * context->style_capacity : 16;
+        svg_style_entry_t *styles = (svg_style_entry_t *)svg_mem_realloc(context, context->styles, capacity * sizeof(svg_style_entry_t));
+        if(!styles){
+            return SVG_ERR_NO_MEM;
+        }
+        context->styles = styles;
+        context->style_capacity = capacity;
+    }
+
+    char name[24];
+    int name_length = snprintf(name, sizeof(name), "s%zu", context->style_count);
+    char *storage = (char *)svg_mem_alloc(context, (size_t)name_length + style_length + 3);
+    if(!storage){
+        return SVG_ERR_NO_MEM;
+    }
+    storage[0] = SVG_STYLE_HANDLE_MARK;
+    memcpy(storage + 1, name, (size_t)name_length + 1);
+    char *text = storage + name_length + 2;
+    memcpy(text, style, style_length);
+    text[style_length] = '\0';
+
+    svg_style_entry_t entry = {hash, style_length, storage, text};
+    svg_return_t result = svg_style_write_rule(context, &entry);
+    if(result != SVG_OK){
+        svg_mem_free(context, storage);
+        return result;
+    }
+    context->styles[context->style_count++] = entry;
+    context->style_slots[slot] = (uint32_t)context->style_count;
+    context->style_last = context->style_count;
+    *handle = storage;
+    return SVG_OK;
+}
+
+// Returns the handle for a raw style string, or the string itself when it
+// is NULL, already a handle, or cannot be interned.
+static const char *svg_style_auto(svg_context_ptr context, const char *style){
+    const char *handle;
+    if(style == NULL || style[0] == SVG_STYLE_HANDLE_MARK){
+        return style;
+    }
+    size_t style_length = strlen(style);
+    if(context->style_last){
+        // runs of elements usually share a style, so try the last one before hashing
+        const svg_style_entry_t *last = &context->styles[context->style_last - 1];
+        if(last->length == style_length && memcmp(last->text, style, style_length) == 0){
+            return last->handle;
+        }
+    }
+    if(svg_style_lookup(context, style, style_length, &handle) != SVG_OK){
+        return style;
+    }
+    return handle;
+}
+
+// Interns the style of a run once its first element survives culling, so
+// a run drawn entirely outside the viewport registers no style, just as
+// the same elements drawn one at a time would not.
+static inline void svg_style_run(svg_context_ptr context, const char **style,
+                                 size_t *style_length, int *pending){
+    if(*pending){
+        *style = svg_style_auto(context, *style);
+        *style_length = *style ? strlen(*style) : 0;
+        *pending = 0;
+    }
+}
+
+// Registers a style and returns its handle.
+svg_return_t svg_style_register(svg_context_ptr context,
+                                const char *style,
+                                const char **handle){
+    if(!context){
+        return SVG_ERR_NULL;
+    }
+    else if(style == NULL || handle == NULL || style[0] == SVG_STYLE_HANDLE_MARK){
+        return SVG_ERR_INVALID_ARG;
+    }
+    else if(context->shard_parent){
+        return SVG_ERR_STATE;
+    }
+    return svg_style_lookup(context, style, strlen(style), handle);
+}
+
+// Returns the style declarations a style handle stands for.
+const char *svg_style_text(const char *style){
+    if(style == NULL || style[0] != SVG_STYLE_HANDLE_MARK){
+        return style;
+    }
+    // the declarations follow the handle's class name in the same storage
+    return style + strlen(style) + 1;
+}
+
+// Turns automatic interning of style strings on or off.
+svg_return_t svg_set_style_interning(svg_context_ptr context, int enabled){
+    if(!context){
+        return SVG_ERR_NULL;
+    }
+    else if(enabled && (context->shard_parent || context->frame)){
+        return SVG_ERR_STATE;
+    }
+    context->style_interning = enabled != 0;
+    return SVG_OK;
+}
+
+// Sets the level-of-detail tolerance.
+svg_return_t svg_set_lod(svg_context_ptr context, svg_real_t tolerance){
+    if(!context){
+        return SVG_ERR_NULL;
+    }
+    else if(context->path_open || (tolerance > 0 && context->frame)){
+        return SVG_ERR_STATE;
+    }
+    else if(!(tolerance >= 0) || isinf(tolerance)){
+        return SVG_ERR_INVALID_ARG;
+    }
+    svg_lod_reset(context);
+    context->lod_tolerance = tolerance;
+    if(tolerance > 0){
+        // circles of one style and size fill at most every cell once
+        double cells = ceil(context->width / tolerance) * ceil(context->height / tolerance);
+        context->lod_key_limit = cells < (double)SVG_LOD_MAX_KEYS ? (size_t)cells : SVG_LOD_MAX_KEYS;
+        if(context->lod_key_limit < SVG_LOD_INITIAL_SLOTS){
+            context->lod_key_limit = SVG_LOD_INITIAL_SLOTS;
+        }
+    }
+    return SVG_OK;
+}
+
+// Returns the hash of a level-of-detail key.
+static uint64_t svg_lod_key_hash(const svg_lod_key_t *key){
+    uint64_t hash = ((uint64_t)key->kind << 32 | key->style) * 0x9e3779b97f4a7c15ull;
+    for(int index = 0; index < 4; index++){
+        uint64_t bits;
+        memcpy(&bits, &key->cells[index], sizeof(bits));
+        hash = (hash ^ bits) * 0x9e3779b97f4a7c15ull;
+        hash ^= hash >> 29;
+    }
+    return hash;
+}
+
+// Doubles the level-of-detail key set and reinserts every key.
+static int svg_lod_grow_keys(svg_context_ptr context){
+    size_t slot_count = context->lod_key_slot_count ? 2 * context->lod_key_slot_count : SVG_LOD_INITIAL_SLOTS;
+    svg_lod_key_t *keys = (svg_lod_key_t *)svg_mem_calloc(context, slot_count, sizeof(svg_lod_key_t));
+    if(!keys){
+        return 0;
+    }
+    for(size_t index = 0; index < context->lod_key_slot_count; index++){
+        const svg_lod_key_t *key = &context->lod_keys[index];
+        if(key->kind == SVG_LOD_KEY_EMPTY){
+            continue;
+        }
+        size_t slot = (size_t)svg_lod_key_hash(key) & (slot_count - 1);
+        while(keys[slot].kind != SVG_LOD_KEY_EMPTY){
+            slot = (slot + 1) & (slot_count - 1);
+        }
+        keys[slot] = *key;
+    }
+    svg_mem_free(context, context->lod_keys);
+    context->lod_keys = keys;
+    context->lod_key_slot_count = slot_count;
+    return 1;
+}
+
+// Doubles the level-of-detail style table and reinserts every style.
+static int svg_lod_grow_styles(svg_context_ptr context){
+    size_t slot_count = context->lod_style_slot_count ? 2 * context->lod_style_slot_count : SVG_LOD_INITIAL_SLOTS;
+    uint32_t *slots = (uint32_t *)svg_mem_calloc(context, slot_count, sizeof(uint32_t));
+    svg_lod_style_t *styles = (svg_lod_style_t *)svg_mem_realloc(context, context->lod_styles,
+                                                                 slot_count / 2 * sizeof(svg_lod_style_t));
+    if(!slots || !styles){
+        svg_mem_free(context, slots);
+        if(styles){
+            context->lod_styles = styles;
+        }
+        return 0;
+    }
+    context->lod_styles = styles;
+    for(size_t index = 0; index < context->lod_style_count; index++){
+        size_t slot = (size_t)styles[index].hash & (slot_count - 1);
+        while(slots[slot]){
+            slot = (slot + 1) & (slot_count - 1);
+        }
+        slots[slot] = (uint32_t)(index + 1);
+    }
+    svg_mem_free(context, context->lod_style_slots);
+    context->lod_style_slots = slots;
+    context->lod_style_slot_count = slot_count;
+    return 1;
+}
+
+// Finds the number decimation knows a style by, 0 for NULL, adding the
+// style when it is new. Returns UINT32_MAX when the style cannot be added.
+static uint32_t svg_lod_style_number(svg_context_ptr context, const char *style, size_t style_length){
+    if(!style){
+        return 0;
+    }
+    uint64_t hash = svg_hash(style, style_length);
+    if(context->lod_style_slot_count){
+        size_t slot = (size_t)hash & (context->lod_style_slot_count - 1);
+        for(; context->lod_style_slots[slot]; slot = (slot + 1) & (context->lod_style_slot_count - 1)){
+            const svg_lod_style_t *entry = &context->lod_styles[context->lod_style_slots[slot] - 1];
+            if(entry->hash == hash && entry->length == style_length && memcmp(entry->text, style, style_length) == 0){
+                return context->lod_style_slots[slot];
+            }
+        }
+    }
+    if(context->lod_style_count == SVG_LOD_MAX_STYLES
+        || ((context->lod_style_count + 1) * 2 > context->lod_style_slot_count && !svg_lod_grow_styles(context))){
+        return UINT32_MAX;
+    }
+    char *text = (char *)svg_mem_alloc(context, style_length ? style_length : 1);
+    if(!text){
+        return UINT32_MAX;
+    }
+    memcpy(text, style, style_length);
+    svg_lod_style_t *entry = &context->lod_styles[context->lod_style_count];
+    entry->hash = hash;
+    entry->length = style_length;
+    entry->text = text;
+    size_t slot = (size_t)hash & (context->lod_style_slot_count - 1);
+    while(context->lod_style_slots[slot]){
+        slot = (slot + 1) & (context->lod_style_slot_count - 1);
+    }
+    context->lod_style_slots[slot] = (uint32_t)++context->lod_style_count;
+    return (uint32_t)context->lod_style_count;
+}
+
+// Returns nonzero when an element with the same key was written before,
+// otherwise remembers the key. The set holds every style at once, so
+// series drawn interleaved are decimated like series drawn one by one.
+// Keys that cannot be remembered are never matched.
+static int svg_lod_seen(svg_context_ptr context, svg_lod_key_t *key, const char *style, size_t style_length){
+    for(int index = 0; index < 4; index++){
+        if(!isfinite(key->cells[index])){
+            return 0;
+        }
+        // -0 and 0 are one cell
+        key->cells[index] += 0.0;
+    }
+    uint32_t style_number = svg_lod_style_number(context, style, style_length);
+    if(style_number == UINT32_MAX){
+        return 0;
+    }
+    key->style = style_number;
+    uint64_t hash = svg_lod_key_hash(key);
+    if(context->lod_key_slot_count){
+        size_t slot = (size_t)hash & (context->lod_key_slot_count - 1);
+        for(; context->lod_keys[slot].kind != SVG_LOD_KEY_EMPTY; slot = (slot + 1) & (context->lod_key_slot_count - 1)){
+            if(memcmp(&context->lod_keys[slot], key, sizeof(svg_lod_key_t)) == 0){
+                return 1;
+            }
+        }
+    }
+    if(context->lod_key_count == context->lod_key_limit
+        || ((context->lod_key_count + 1) * 2 > context->lod_key_slot_count && !svg_lod_grow_keys(context))){
+        return 0;
+    }
+    size_t slot = (size_t)hash & (context->lod_key_slot_count - 1);
+    while(context->lod_keys[slot].kind != SVG_LOD_KEY_EMPTY){
+        slot = (slot + 1) & (context->lod_key_slot_count - 1);
+    }
+    context->lod_keys[slot] = *key;
+    context->lod_key_count++;
+    return 0;
+}
+
+// Returns nonzero when a circle can be dropped because one with the same
+// style and radius (to within one cell) already has its center in the
+// same cell of the canvas.
+static int svg_lod_circle_covered(svg_context_ptr context,
+                                  svg_coord_t x, svg_coord_t y, svg_real_t radius,
+                                  const char *style, size_t style_length){
+    // symbol content is drawn wherever it is used, so the canvas says nothing about it
+    if(context->symbol_depth){
+        return 0;
+    }
+    // circles centered off the canvas may still reach into it, so they are kept
+    if(!(x >= 0 && y >= 0 && x < context->width && y < context->height)){
+        return 0;
+    }
+    svg_lod_key_t key;
+    memset(&key, 0, sizeof(key));
+    key.kind = SVG_LOD_KEY_CIRCLE;
+    key.cells[0] = floor(x / context->lod_tolerance);
+    key.cells[1] = floor(y / context->lod_tolerance);
+    key.cells[2] = floor(radius / context->lod_tolerance);
+    return svg_lod_seen(context, &key, style, style_length);
+}
+
+// Returns nonzero when a line can be dropped because one with the same
+// style already has its endpoints in the same cells, in either order.
+static int svg_lod_line_repeated(svg_context_ptr context,
+                                 svg_coord_t x1, svg_coord_t y1,
+                                 svg_coord_t x2, svg_coord_t y2,
+                                 const char *style, size_t style_length){
+    if(context->symbol_depth){
+        return 0;
+    }
+    double cells[4] = {
+        floor(x1 / context->lod_tolerance), floor(y1 / context->lod_tolerance),
+        floor(x2 / context->lod_tolerance), floor(y2 / context->lod_tolerance)
+    };
+    svg_lod_key_t key;
+    memset(&key, 0, sizeof(key));
+    key.kind = SVG_LOD_KEY_LINE;
+    // a line drawn backwards covers the same pixels
+    int swap = cells[2] < cells[0] || (cells[2] == cells[0] && cells[3] < cells[1]);
+    key.cells[0] = cells[swap ? 2 : 0];
+    key.cells[1] = cells[swap ? 3 : 1];
+    key.cells[2] = cells[swap ? 0 : 2];
+    key.cells[3] = cells[swap ? 1 : 3];
+    return svg_lod_seen(context, &key, style, style_length);
+}
+
+// Turns viewport culling on or off.
+svg_return_t svg_set_culling(svg_context_ptr context, int enabled, svg_real_t margin){
+    if(!context){
+        return SVG_ERR_NULL;
+    }
+    else if(!(margin >= 0) || isinf(margin)){
+        return SVG_ERR_INVALID_ARG;
+    }
+    else if(enabled && context->frame){
+        return SVG_ERR_STATE;
+    }
+    context->cull_enabled = enabled != 0;
+    context->cull_margin = margin;
+    return SVG_OK;
+}
+
+// Sets the visible area used for culling.
+svg_return_t svg_set_viewport(svg_context_ptr context,
+                              const svg_point_t *top_left,
+                              const svg_size_t *size){
+    if(!context){
+        return SVG_ERR_NULL;
+    }
+    if(top_left == NULL && size == NULL){
+        context->viewport_left = 0;
+        context->viewport_top = 0;
+        context->viewport_right = context->width;
+        context->viewport_bottom = context->height;
+        return SVG_OK;
+    }
+    else if(top_left == NULL || size == NULL || !(size->width >= 0) || !(size->height >= 0)){
+        return SVG_ERR_INVALID_ARG;
+    }
+    context->viewport_left = top_left->x;
+    context->viewport_top = top_left->y;
+    context->viewport_right = top_left->x + size->width;
+    context->viewport_bottom = top_left->y + size->height;
+    return SVG_OK;
+}
+
+// Reports how many primitives culling has dropped.
+svg_return_t svg_get_cull_counts(svg_context_ptr context, svg_cull_counts_t *counts){
+    if(!context){
+        return SVG_ERR_NULL;
+    }
+    else if(counts == NULL){
+        return SVG_ERR_INVALID_ARG;
+    }
+    *counts = context->culled;
+    return SVG_OK;
+}
+
+// Turns statistics on or off.
+svg_return_t svg_set_stats(svg_context_ptr context, int enabled){
+    if(!context){
+        return SVG_ERR_NULL;
+    }
+#ifdef SVG_NO_STATS
+    return enabled ? SVG_ERR_STATE : SVG_OK;
+#else
+    if(context->async){
+        // the writer thread updates the write statistics
+        svg_async_wait(context->async);
+    }
+    if(enabled && !context->stats_enabled){
+        memset(&context->stats, 0, sizeof(context->stats));
+    }
+    context->stats_enabled = enabled != 0;
+    return SVG_OK;
+#endif
+}
+
+// Reports the statistics of a context.
+svg_return_t svg_get_stats(svg_context_ptr context, svg_stats_t *stats){
+    if(!context){
+        return SVG_ERR_NULL;
+    }
+    else if(stats == NULL){
+        return SVG_ERR_INVALID_ARG;
+    }
+    if(context->async){
+        svg_async_wait(context->async);
+    }
+    if(SVG_STATS_ON(context)){
+        *stats = context->stats;
+    }
+    else{
+        memset(stats, 0, sizeof(*stats));
+    }
+    return SVG_OK;
+}
+
+// Sends group begin and end events to a trace callback.
+svg_return_t svg_set_trace(svg_context_ptr context, svg_write_fn trace_fn, svg_user_context_ptr user){
+    if(!context){
+        return SVG_ERR_NULL;
+    }
+#ifdef SVG_NO_STATS
+    (void)user;
+    return trace_fn ? SVG_ERR_STATE : SVG_OK;
+#else
+    context->trace_fn = trace_fn;
+    context->trace_user = user;
+    context->trace_origin = svg_now_ns();
+    context->trace_started = 0;
+    return SVG_OK;
+#endif
+}
+
+// Points transformed per kernel call by batch drawing calls.
+#define SVG_TRANSFORM_CHUNK             256
+
+// Every kernel computes a * x + c * y + e and b * x + d * y + f with
+// separate multiplies and adds in that order, so all of them give the
+// same bits.
+
+// Transforms points one at a time.
+static void svg_transform_points_scalar(const svg_matrix_t *matrix, const svg_point_t *points,
+                                        svg_point_t *result, size_t count){
+    for(size_t index = 0; index < count; index++){
+        svg_coord_t x = points[index].x;
+        svg_coord_t y = points[index].y;
+        result[index].x = matrix->a * x + matrix->c * y + matrix->e;
+        result[index].y = matrix->b * x + matrix->d * y + matrix->f;
+    }
+}
+
+// Transforms separate x and y columns one element at a time.
+static void svg_transform_columns_scalar(const svg_matrix_t *matrix,
+                                         const svg_coord_t *xs, const svg_coord_t *ys,
+                                         svg_coord_t *result_xs, svg_coord_t *result_ys, size_t count){
+    for(size_t index = 0; index < count; index++){
+        svg_coord_t x = xs[index];
+        svg_coord_t y = ys[index];
+        result_xs[index] = matrix->a * x + matrix->c * y + matrix->e;
+        result_ys[index] = matrix->b * x + matrix->d * y + matrix->f;
+    }
+}
+
+#ifdef __SSE2__
+// Transforms points one per SSE2 register, both coordinates at once.
+static void svg_transform_points_sse2(const svg_matrix_t *matrix, const svg_point_t *points,
+                                      svg_point_t *result, size_t count){
+    __m128d ab = _mm_setr_pd(matrix->a, matrix->b);
+    __m128d cd = _mm_setr_pd(matrix->c, matrix->d);
+    __m128d ef = _mm_setr_pd(matrix->e, matrix->f);
+    for(size_t index = 0; index < count; index++){
+        __m128d point = _mm_loadu_pd(&points[index].x);
+        __m128d xx = _mm_unpacklo_pd(point, point);
+        __m128d yy = _mm_unpackhi_pd(point, point);
+        _mm_storeu_pd(&result[index].x, _mm_add_pd(_mm_add_pd(_mm_mul_pd(ab, xx), _mm_mul_pd(cd, yy)), ef));
+    }
+}
+
+// Transforms x and y columns two elements per SSE2 register.
+static void svg_transform_columns_sse2(const svg_matrix_t *matrix,
+                                       const svg_coord_t *xs, const svg_coord_t *ys,
+                                       svg_coord_t *result_xs, svg_coord_t *result_ys, size_t count){
+    __m128d a = _mm_set1_pd(matrix->a), b = _mm_set1_pd(matrix->b), c = _mm_set1_pd(matrix->c);
+    __m128d d = _mm_set1_pd(matrix->d), e = _mm_set1_pd(matrix->e), f = _mm_set1_pd(matrix->f);
+    size_t index = 0;
+    for(; index + 2 <= count; index += 2){
+        __m128d x = _mm_loadu_pd(xs + index);
+        __m128d y = _mm_loadu_pd(ys + index);
+        _mm_storeu_pd(result_xs + index, _mm_add_pd(_mm_add_pd(_mm_mul_pd(a, x), _mm_mul_pd(c, y)), e));
+        _mm_storeu_pd(result_ys + index, _mm_add_pd(_mm_add_pd(_mm_mul_pd(b, x), _mm_mul_pd(d, y)), f));
+    }
+    svg_transform_columns_scalar(matrix, xs + index, ys + index, result_xs + index, result_ys + index, count - index);
+}
+#endif
+
+#ifdef SVG_AVX_KERNELS
+// Transforms points two per AVX register.
+__attribute__((target("avx")))
+static void svg_transform_points_avx(const svg_matrix_t *matrix, const svg_point_t *points,
+                                     svg_point_t *result, size_t count){
+    __m256d ab = _mm256_setr_pd(matrix->a, matrix->b, matrix->a, matrix->b);
+    __m256d cd = _mm256_setr_pd(matrix->c, matrix->d, matrix->c, matrix->d);
+    __m256d ef = _mm256_setr_pd(matrix->e, matrix->f, matrix->e, matrix->f);
+    size_t index = 0;
+    for(; index + 2 <= count; index += 2){
+        __m256d pair = _mm256_loadu_pd(&points[index].x);
+        __m256d xx = _mm256_movedup_pd(pair);
+        __m256d yy = _mm256_permute_pd(pair, 0xF);
+        _mm256_storeu_pd(&result[index].x, _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ab, xx), _mm256_mul_pd(cd, yy)), ef));
+    }
+    svg_transform_points_scalar(matrix, points + index, result + index, count - index);
+}
+
+// Transforms x and y columns four elements per AVX register.
+__attribute__((target("avx")))
+static void svg_transform_columns_avx(const svg_matrix_t *matrix,
+                                      const svg_coord_t *xs, const svg_coord_t *ys,
+                                      svg_coord_t *result_xs, svg_coord_t *result_ys, size_t count){
+    __m256d a = _mm256_set1_pd(matrix->a), b = _mm256_set1_pd(matrix->b), c = _mm256_set1_pd(matrix->c);
+    __m256d d = _mm256_set1_pd(matrix->d), e = _mm256_set1_pd(matrix->e), f = _mm256_set1_pd(matrix->f);
+    size_t index = 0;
+    for(; index + 4 <= count; index += 4){
+        __m256d x = _mm256_loadu_pd(xs + index);
+        __m256d y = _mm256_loadu_pd(ys + index);
+        _mm256_storeu_pd(result_xs + index, _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(a, x), _mm256_mul_pd(c, y)), e));
+        _mm256_storeu_pd(result_ys + index, _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(b, x), _mm256_mul_pd(d, y)), f));
+    }
+    svg_transform_columns_scalar(matrix, xs + index, ys + index, result_xs + index, result_ys + index, count - index);
+}
+#endif
+
+// Transforms points with the widest kernel the machine supports.
+static void svg_transform_points_kernel(const svg_matrix_t *matrix, const svg_point_t *points,
+                                        svg_point_t *result, size_t count){
+#ifdef SVG_AVX_KERNELS
+    if(__builtin_cpu_supports("avx")){
+        svg_transform_points_avx(matrix, points, result, count);
+        return;
+    }
+#endif
+#ifdef __SSE2__
+    svg_transform_points_sse2(matrix, points, result, count);
+#else
+    svg_transform_points_scalar(matrix, points, result, count);
+#endif
+}
+
+// Transforms x and y columns with the widest kernel the machine supports.
+static void svg_transform_columns(const svg_matrix_t *matrix,
+                                  const svg_coord_t *xs, const svg_coord_t *ys,
+                                  svg_coord_t *result_xs, svg_coord_t *result_ys, size_t count){
+#ifdef SVG_AVX_KERNELS
+    if(__builtin_cpu_supports("avx")){
+        svg_transform_columns_avx(matrix, xs, ys, result_xs, result_ys, count);
+        return;
+    }
+#endif
+#ifdef __SSE2__
+    svg_transform_columns_sse2(matrix, xs, ys, result_xs, result_ys, count);
+#else
+    svg_transform_columns_scalar(matrix, xs, ys, result_xs, result_ys, count);
+#endif
+}
+
+// Transforms an array of points.
+svg_return_t svg_transform_points(const svg_matrix_t *matrix,
+                                  const svg_point_t *points,
+                                  svg_point_t *result,
+                                  size_t count){
+    if(!matrix || (count && (!points || !result))){
+        return SVG_ERR_NULL;
+    }
+    svg_transform_points_kernel(matrix, points, result, count);
+    return SVG_OK;
+}
+
+// Applies a transform to everything drawn until it is popped.
+svg_return_t svg_transform_push(svg_context_ptr context, const svg_matrix_t *matrix){
+    if(!context){
+        return SVG_ERR_NULL;
+    }
+    else if(matrix == NULL || !isfinite(matrix->a) || !isfinite(matrix->b) || !isfinite(matrix->c)
+        || !isfinite(matrix->d) || !isfinite(matrix->e) || !isfinite(matrix->f)){
+        return SVG_ERR_INVALID_ARG;
+    }
+    else if(context->path_open || context->list || context->tiles){
+        return SVG_ERR_STATE;
+    }
+    if(context->transform_depth == context->transform_capacity){
+        size_t capacity = context->transform_capacity ? context->transform_capacity * 2 : 8;
+        svg_matrix_t *transforms = (svg_matrix_t *)svg_mem_realloc(context, context->transforms, capacity * sizeof(svg_matrix_t));
+        if(!transforms){
+            return SVG_ERR_NO_MEM;
+        }
+        context->transforms = transforms;
+        context->transform_capacity = capacity;
+    }
+    const svg_matrix_t current = context->matrix;
+    context->transforms[context->transform_depth++] = current;
+    context->matrix.a = current.a * matrix->a + current.c * matrix->b;
+    context->matrix.b = current.b * matrix->a + current.d * matrix->b;
+    context->matrix.c = current.a * matrix->c + current.c * matrix->d;
+    context->matrix.d = current.b * matrix->c + current.d * matrix->d;
+    context->matrix.e = current.a * matrix->e + current.c * matrix->f + current.e;
+    context->matrix.f = current.b * matrix->e + current.d * matrix->f + current.f;
+    context->transformed = !(context->matrix.a == 1 && context->matrix.b == 0 && context->matrix.c == 0
+        && context->matrix.d == 1 && context->matrix.e == 0 && context->matrix.f == 0);
+    return SVG_OK;
+}
+
+// Restores the transform in effect before the last push.
+svg_return_t svg_transform_pop(svg_context_ptr context){
+    if(!context){
+        return SVG_ERR_NULL;
+    }
+    else if(context->path_open || context->transform_depth == 0){
+        return SVG_ERR_STATE;
+    }
+    context->matrix = context->transforms[--context->transform_depth];
+    context->transformed = !(context->matrix.a == 1 && context->matrix.b == 0 && context->matrix.c == 0
+        && context->matrix.d == 1 && context->matrix.e == 0 && context->matrix.f == 0);
+    return SVG_OK;
+}
+
+// Maps one point through the current transform.
+static inline const svg_point_t *svg_map_point(svg_context_ptr context, const svg_point_t *point, svg_point_t *mapped){
+    const svg_matrix_t *matrix = &context->matrix;
+    mapped->x = matrix->a * point->x + matrix->c * point->y + matrix->e;
+    mapped->y = matrix->b * point->x + matrix->d * point->y + matrix->f;
+    return mapped;
+}
+
+// Returns the factor the current transform scales areas by, as a length;
+// circle radii are scaled by it so a circle keeps its area.
+static inline svg_real_t svg_map_radius_scale(svg_context_ptr context){
+    const svg_matrix_t *matrix = &context->matrix;
+    return sqrt(fabs(matrix->a * matrix->d - matrix->b * matrix->c));
+}
+
+// Maps the size of a rectangle whose corner was already mapped, moving
+// the corner so the size stays positive under a flipping transform.
+static inline void svg_map_rect_size(svg_context_ptr context, svg_coord_t *x, svg_coord_t *y,
+                                     svg_coord_t *width, svg_coord_t *height){
+    *width *= context->matrix.a;
+    *height *= context->matrix.d;
+    if(*width < 0){
+        *x += *width;
+        *width = -*width;
+    }
+    if(*height < 0){
+        *y += *height;
+        *height = -*height;
+    }
+}
+
+// Returns nonzero when the box from (left, top) to (right, bottom), grown by
+// the cull margin, lies entirely outside the viewport. Boxes with NaN
+// coordinates are never culled.
+static inline int svg_cull_box(svg_context_ptr context,
+                               svg_real_t left, svg_real_t top,
+                               svg_real_t right, svg_real_t bottom){
+    svg_real_t margin = context->cull_margin;
+    // symbols are placed by svg_use, so their content is never culled
+    return !context->symbol_depth
+        && (right + margin < context->viewport_left
+        || left - margin > context->viewport_right
+        || bottom + margin < context->viewport_top
+        || top - margin > context->viewport_bottom);
+}
+
+// Returns nonzero when a circle is culled.
+static inline int svg_cull_circle(svg_context_ptr context,
+                                  svg_coord_t x, svg_coord_t y, svg_real_t radius){
+    if(context->cull_enabled && svg_cull_box(context, x - radius, y - radius, x + radius, y + radius)){
+        context->culled.circles++;
+        return 1;
+    }
+    return 0;
+}
+
+// Returns nonzero when a rectangle is culled.
+static inline int svg_cull_rect(svg_context_ptr context,
+                                svg_coord_t x, svg_coord_t y,
+                                svg_coord_t width, svg_coord_t height){
+    if(context->cull_enabled
+        && svg_cull_box(context, fmin(x, x + width), fmin(y, y + height), fmax(x, x + width), fmax(y, y + height))){
+        context->culled.rects++;
+        return 1;
+    }
+    return 0;
+}
+
+// Returns nonzero when a line is culled.
+static inline int svg_cull_line(svg_context_ptr context,
+                                svg_coord_t x1, svg_coord_t y1,
+                                svg_coord_t x2, svg_coord_t y2){
+    if(context->cull_enabled && svg_cull_box(context, fmin(x1, x2), fmin(y1, y2), fmax(x1, x2), fmax(y1, y2))){
+        context->culled.lines++;
+        return 1;
+    }
+    return 0;
+}
+
+// Writes a <circle> element and returns the new end.
+static inline char *svg_put_circle(svg_context_ptr context, char *out,
+                                   svg_coord_t x, svg_coord_t y, svg_real_t radius,
+                                   const char *style, size_t style_length){
+    SVG_STAT_ADD(context, circles, 1);
+    out = SVG_PUT_LITERAL(out, "<circle cx=\"");
+    out = svg_put_real(context, out, x);
+    out = SVG_PUT_LITERAL(out, "\" cy=\"");
+    out = svg_put_real(context, out, y);
+    out = SVG_PUT_LITERAL(out, "\" r=\"");
+    out = svg_put_real(context, out, radius);
+    return svg_put_style(out, style, style_length);
+}
+
+// Writes a <rect> element and returns the new end.
+static inline char *svg_put_rect(svg_context_ptr context, char *out,
+                                 svg_coord_t x, svg_coord_t y,
+                                 svg_coord_t width, svg_coord_t height,
+                                 const char *style, size_t style_length){
+    SVG_STAT_ADD(context, rects, 1);
+    out = SVG_PUT_LITERAL(out, "<rect x=\"");
+    out = svg_put_real(context, out, x);
+    out = SVG_PUT_LITERAL(out, "\" y=\"");
+    out = svg_put_real(context, out, y);
+    out = SVG_PUT_LITERAL(out, "\" width=\"");
+    out = svg_put_real(context, out, width);
+    out = SVG_PUT_LITERAL(out, "\" height=\"");
+    out = svg_put_real(context, out, height);
+    return svg_put_style(out, style, style_length);
+}
+
+// Writes a <line> element and returns the new end.
+static inline char *svg_put_line(svg_context_ptr context, char *out,
+                                 svg_coord_t x1, svg_coord_t y1,
+                                 svg_coord_t x2, svg_coord_t y2,
+                                 const char *style, size_t style_length){
+    SVG_STAT_ADD(context, lines, 1);
+    out = SVG_PUT_LITERAL(out, "<line x1=\"");
+    out = svg_put_real(context, out, x1);
+    out = SVG_PUT_LITERAL(out, "\" y1=\"");
+    out = svg_put_real(context, out, y1);
+    out = SVG_PUT_LITERAL(out, "\" x2=\"");
+    out = svg_put_real(context, out, x2);
+    out = SVG_PUT_LITERAL(out, "\" y2=\"");
+    out = svg_put_real(context, out, y2);
+    return svg_put_style(out, style, style_length);
+}
+
+// Writes a rectangle whose corners were mapped through a rotating or
+// shearing transform as a <polygon> element and returns the new end.
+static inline char *svg_put_rect_polygon(svg_context_ptr context, char *out,
+                                         const svg_coord_t *xs, const svg_coord_t *ys,
+                                         const char *style, size_t style_length){
+    SVG_STAT_ADD(context, rects, 1);
+    out = SVG_PUT_LITERAL(out, "<polygon points=\"");
+    for(size_t index = 0; index < 4; index++){
+        if(index){
+            *out++ = ' ';
+        }
+        out = svg_put_real(context, out, xs[index]);
+        *out++ = ',';
+        out = svg_put_real(context, out, ys[index]);
+    }
+    return svg_put_style(out, style, style_length);
+}
+
+// Counts a point in canvas coordinates in the open density map. Points
+// outside the canvas, including NaN, are dropped.
+static inline void svg_density_count(svg_context_ptr context, svg_coord_t x, svg_coord_t y){
+    if(!(x >= 0 && x < context->width && y >= 0 && y < context->height)){
+        return;
+    }
+    size_t column = (size_t)(x / context->density_cell);
+    size_t row = (size_t)(y / context->density_cell);
+    // division can round a point just inside the canvas onto the next cell
+    column = column < context->density_columns ? column : context->density_columns - 1;
+    row = row < context->density_rows ? row : context->density_rows - 1;
+    uint32_t *cell = &context->density_counts[row * context->density_columns + column];
+    *cell += *cell != UINT32_MAX;
+}
+
+// Draws a run of circles through the current transform, mapping the
+// centers a chunk at a time.
+static svg_return_t svg_circles_mapped(svg_context_ptr context,
+                                       const svg_coord_t *xs, const svg_coord_t *ys,
+                                       const svg_real_t *radii, size_t count, const char *style){
+    svg_coord_t mapped_xs[SVG_TRANSFORM_CHUNK], mapped_ys[SVG_TRANSFORM_CHUNK];
+    svg_real_t mapped_radii[SVG_TRANSFORM_CHUNK];
+    svg_real_t scale = svg_map_radius_scale(context);
+    svg_return_t result = SVG_OK;
+    // density maps count only the centers, which even a singular transform maps
+    if(context->density_counts){
+        for(size_t first = 0; first < count; first += SVG_TRANSFORM_CHUNK){
+            size_t chunk = count - first < SVG_TRANSFORM_CHUNK ? count - first : SVG_TRANSFORM_CHUNK;
+            svg_transform_columns(&context->matrix, xs + first, ys + first, mapped_xs, mapped_ys, chunk);
+            for(size_t index = 0; index < chunk; index++){
+                svg_density_count(context, mapped_xs[index], mapped_ys[index]);
+            }
+        }
+        return SVG_OK;
+    }
+    // a singular transform flattens every circle to nothing
+    if(!(scale > 0)){
+        return SVG_OK;
+    }
+    // the chunks are drawn untransformed, as they are in canvas space already
+    context->transformed = 0;
+    for(size_t first = 0; first < count && result == SVG_OK; first += SVG_TRANSFORM_CHUNK){
+        size_t chunk = count - first < SVG_TRANSFORM_CHUNK ? count - first : SVG_TRANSFORM_CHUNK;
+        svg_transform_columns(&context->matrix, xs + first, ys + first, mapped_xs, mapped_ys, chunk);
+        for(size_t index = 0; index < chunk; index++){
+            mapped_radii[index] = radii[first + index] * scale;
+        }
+        result = svg_circles(context, mapped_xs, mapped_ys, mapped_radii, chunk, style);
+    }
+    context->transformed = 1;
+    return result;
+}
+
+// Draws a run of rectangles through the current transform.
+static svg_return_t svg_rects_mapped(svg_context_ptr context,
+                                     const svg_coord_t *xs, const svg_coord_t *ys,
+                                     const svg_coord_t *widths, const svg_coord_t *heights,
+                                     size_t count, const char *style){
+    svg_coord_t mapped_xs[SVG_TRANSFORM_CHUNK], mapped_ys[SVG_TRANSFORM_CHUNK];
+    svg_coord_t mapped_widths[SVG_TRANSFORM_CHUNK], mapped_heights[SVG_TRANSFORM_CHUNK];
+    svg_return_t result = SVG_OK;
+    context->transformed = 0;
+    for(size_t first = 0; first < count && result == SVG_OK; first += SVG_TRANSFORM_CHUNK){
+        size_t chunk = count - first < SVG_TRANSFORM_CHUNK ? count - first : SVG_TRANSFORM_CHUNK;
+        svg_transform_columns(&context->matrix, xs + first, ys + first, mapped_xs, mapped_ys, chunk);
+        for(size_t index = 0; index < chunk; index++){
+            mapped_widths[index] = widths[first + index];
+            mapped_heights[index] = heights[first + index];
+            svg_map_rect_size(context, &mapped_xs[index], &mapped_ys[index], &mapped_widths[index], &mapped_heights[index]);
+        }
+        result = svg_rects(context, mapped_xs, mapped_ys, mapped_widths, mapped_heights, chunk, style);
+    }
+    context->transformed = 1;
+    return result;
+}
+
+// Draws a run of rectangles through a rotating or shearing transform as
+// polygons through their mapped corners, culled by their bounding boxes.
+static svg_return_t svg_rects_rotated(svg_context_ptr context,
+                                      const svg_coord_t *xs, const svg_coord_t *ys,
+                                      const svg_coord_t *widths, const svg_coord_t *heights,
+                                      size_t count, const char *style){
+    int pending = context->style_interning;
+    size_t style_length = style ? strlen(style) : 0;
+    svg_return_t result = SVG_OK;
+    for(size_t index = 0; index < count && result == SVG_OK; index++){
+        svg_coord_t corner_xs[4] = {xs[index], xs[index] + widths[index], xs[index] + widths[index], xs[index]};
+        svg_coord_t corner_ys[4] = {ys[index], ys[index], ys[index] + heights[index], ys[index] + heights[index]};
+        svg_coord_t mapped_xs[4], mapped_ys[4];
+        svg_transform_columns(&context->matrix, corner_xs, corner_ys, mapped_xs, mapped_ys, 4);
+        svg_coord_t left = fmin(fmin(mapped_xs[0], mapped_xs[1]), fmin(mapped_xs[2], mapped_xs[3]));
+        svg_coord_t top = fmin(fmin(mapped_ys[0], mapped_ys[1]), fmin(mapped_ys[2], mapped_ys[3]));
+        svg_coord_t right = fmax(fmax(mapped_xs[0], mapped_xs[1]), fmax(mapped_xs[2], mapped_xs[3]));
+        svg_coord_t bottom = fmax(fmax(mapped_ys[0], mapped_ys[1]), fmax(mapped_ys[2], mapped_ys[3]));
+        if(svg_cull_rect(context, left, top, right - left, bottom - top)){
+            continue;
+        }
+        svg_style_run(context, &style, &style_length, &pending);
+        char *out = svg_element_begin(context, SVG_ELEMENT_MAX_LENGTH(8, style_length));
+        if(!out){
+            return SVG_ERR_NO_MEM;
+        }
+        out = svg_put_rect_polygon(context, out, mapped_xs, mapped_ys, style, style_length);
+        result = svg_element_end(context, out);
+    }
+    return result;
+}
+
+// Draws a run of line segments through the current transform.
+static svg_return_t svg_lines_mapped(svg_context_ptr context,
+                                     const svg_coord_t *x1s, const svg_coord_t *y1s,
+                                     const svg_coord_t *x2s, const svg_coord_t *y2s,
+                                     size_t count, const char *style){
+    svg_coord_t mapped_x1s[SVG_TRANSFORM_CHUNK], mapped_y1s[SVG_TRANSFORM_CHUNK];
+    svg_coord_t mapped_x2s[SVG_TRANSFORM_CHUNK], mapped_y2s[SVG_TRANSFORM_CHUNK];
+    svg_return_t result = SVG_OK;
+    context->transformed = 0;
+    for(size_t first = 0; first < count && result == SVG_OK; first += SVG_TRANSFORM_CHUNK){
+        size_t chunk = count - first < SVG_TRANSFORM_CHUNK ? count - first : SVG_TRANSFORM_CHUNK;
+        svg_transform_columns(&context->matrix, x1s + first, y1s + first, mapped_x1s, mapped_y1s, chunk);
+        svg_transform_columns(&context->matrix, x2s + first, y2s + first, mapped_x2s, mapped_y2s, chunk);
+        result = svg_lines(context, mapped_x1s, mapped_y1s, mapped_x2s, mapped_y2s, chunk, style);
+    }
+    context->transformed = 1;
+    return result;
+}
+
+// Draws a circle.
+svg_return_t svg_circle(svg_context_ptr context,
+                        const svg_point_t *center,
+                        svg_real_t radius,
+                        const char *style){
+    if (!(context)) {
+        return SVG_ERR_NULL;
+    }
+    else if (context->path_open) {
+        return SVG_ERR_STATE;
+    }
+    else if (!(radius > 0)) {
+        return SVG_ERR_INVALID_ARG;
+    }
+    else if (center == NULL) {
+        return SVG_ERR_INVALID_ARG;
+    }
+    if(context->list){
+        return svg_list_circles(context->list, &center->x, &center->y, &radius, 1, style);
+    }
+    if(context->tiles){
+        return svg_tiles_circles(context->tiles, &center->x, &center->y, &radius, 1, style);
+    }
+    svg_point_t mapped;
+    if(context->transformed){
+        center = svg_map_point(context, center, &mapped);
+        radius *= svg_map_radius_scale(context);
+    }
+    // density maps count only the center, which even a singular transform maps
+    if(context->density_counts){
+        svg_density_count(context, center->x, center->y);
+        return SVG_OK;
+    }
+    // a singular transform flattens the circle to nothing
+    if(!(radius > 0)){
+        return SVG_OK;
+    }
+    if(svg_cull_circle(context, center->x, center->y, radius)){
+        return SVG_OK;
+    }
+    if(context->style_interning){
+        style = svg_style_auto(context, style);
+    }
+    size_t style_length = style ? strlen(style) : 0;
+    if(context->lod_tolerance > 0
+        && svg_lod_circle_covered(context, center->x, center->y, radius, style, style_length)){
+        return SVG_OK;
+    }
+    char *out = svg_element_begin(context, SVG_ELEMENT_MAX_LENGTH(3, style_length));
+    if(!out){
+        return SVG_ERR_NO_MEM;
+    }
+    out = svg_put_circle(context, out, center->x, center->y, radius, style, style_length);
+    return svg_element_end(context, out);
+}
+
+// Draws a run of circles.
+svg_return_t svg_circles(svg_context_ptr context,
+                         const svg_coord_t *xs,
+                         const svg_coord_t *ys,
+                         const svg_real_t *radii,
+                         size_t count,
+                         const char *style){
+    if (!(context)) {
+        return SVG_ERR_NULL;
+    }
+    else if (context->path_open) {
+        return SVG_ERR_STATE;
+    }
+    else if (count && (xs == NULL || ys == NULL || radii == NULL)) {
+        return SVG_ERR_INVALID_ARG;
+    }
+    if(context->list){
+        return svg_list_circles(context->list, xs, ys, radii, count, style);
+    }
+    if(context->tiles){
+        return svg_tiles_circles(context->tiles, xs, ys, radii, count, style);
+    }
+    for(size_t index = 0; index < count; index++){
+        if(!(radii[index] > 0)){
+            return SVG_ERR_INVALID_ARG;
+        }
+    }
+    if(context->transformed){
+        return svg_circles_mapped(context, xs, ys, radii, count, style);
+    }
+    if(context->density_counts){
+        for(size_t index = 0; index < count; index++){
+            svg_density_count(context, xs[index], ys[index]);
+        }
+        return SVG_OK;
+    }
+    int pending = context->style_interning;
+    size_t style_length = style ? strlen(style) : 0;
+    svg_return_t result = SVG_OK;
+    for(size_t index = 0; index < count && result == SVG_OK; index++){
+        if(svg_cull_circle(context, xs[index], ys[index], radii[index])){
+            continue;
+        }
+        // decimation compares the interned style, as svg_circle() does
+        svg_style_run(context, &style, &style_length, &pending);
+        if(context->lod_tolerance > 0
+            && svg_lod_circle_covered(context, xs[index], ys[index], radii[index], style, style_length)){
+            continue;
+        }
+        char *out = svg_element_begin(context, SVG_ELEMENT_MAX_LENGTH(3, style_length));
+        if(!out){
+            return SVG_ERR_NO_MEM;
+        }
+        out = svg_put_circle(context, out, xs[index], ys[index], radii[index], style, style_length);
+        result = svg_element_end(context, out);
+    }
+    return result;
+}
+
+// Draws a rectangle.
+svg_return_t svg_rect(svg_context_ptr context,
+                      const svg_point_t *top_left,
+                      const svg_size_t *size,
+                      const char* style){
+    if (!(context)) {
+        return SVG_ERR_NULL;
+    }
+    else if (context->path_open) {
+        return SVG_ERR_STATE;
+    }
+    else if (top_left == NULL || size == NULL) {
+        return SVG_ERR_INVALID_ARG;
+    }
+    if(context->list){
+        return svg_list_rects(context->list, &top_left->x, &top_left->y, &size->width, &size->height, 1, style);
+    }
+    if(context->tiles){
+        return svg_tiles_rects(context->tiles, &top_left->x, &top_left->y, &size->width, &size->height, 1, style);
+    }
+    svg_point_t corner;
+    svg_size_t mapped_size;
+    if(context->transformed){
+        if(context->matrix.b != 0 || context->matrix.c != 0){
+            return svg_rects_rotated(context, &top_left->x, &top_left->y, &size->width, &size->height, 1, style);
+        }
+        top_left = svg_map_point(context, top_left, &corner);
+        mapped_size = *size;
+        svg_map_rect_size(context, &corner.x, &corner.y, &mapped_size.width, &mapped_size.height);
+        size = &mapped_size;
+    }
+    if(svg_cull_rect(context, top_left->x, top_left->y, size->width, size->height)){
+        return SVG_OK;
+    }
+    if(context->style_interning){
+        style = svg_style_auto(context, style);
+    }
+    size_t style_length = style ? strlen(style) : 0;
+    char *out = svg_element_begin(context, SVG_ELEMENT_MAX_LENGTH(4, style_length));
+    if(!out){
+        return SVG_ERR_NO_MEM;
+    }
+    out = svg_put_rect(context, out, top_left->x, top_left->y, size->width, size->height, style, style_length);
+    return svg_element_end(context, out);
+}
+
+// Draws a run of rectangles.
+svg_return_t svg_rects(svg_context_ptr context,
+                       const svg_coord_t *xs,
+                       const svg_coord_t *ys,
+                       const svg_coord_t *widths,
+                       const svg_coord_t *heights,
+                       size_t count,
+                       const char *style){
+    if (!(context)) {
+        return SVG_ERR_NULL;
+    }
+    else if (context->path_open) {
+        return SVG_ERR_STATE;
+    }
+    else if (count && (xs == NULL || ys == NULL || widths == NULL || heights == NULL)) {
+        return SVG_ERR_INVALID_ARG;
+    }
+    if(context->list){
+        return svg_list_rects(context->list, xs, ys, widths, heights, count, style);
+    }
+    if(context->tiles){
+        return svg_tiles_rects(context->tiles, xs, ys, widths, heights, count, style);
+    }
+    if(context->transformed){
+        if(context->matrix.b != 0 || context->matrix.c != 0){
+            return svg_rects_rotated(context, xs, ys, widths, heights, count, style);
+        }
+        return svg_rects_mapped(context, xs, ys, widths, heights, count, style);
+    }
+    int pending = context->style_interning;
+    size_t style_length = style ? strlen(style) : 0;
+    svg_return_t result = SVG_OK;
+    for(size_t index = 0; index < count && result == SVG_OK; index++){
+        if(svg_cull_rect(context, xs[index], ys[index], widths[index], heights[index])){
+            continue;
+        }
+        svg_style_run(context, &style, &style_length, &pending);
+        char *out = svg_element_begin(context, SVG_ELEMENT_MAX_LENGTH(4, style_length));
+        if(!out){
+            return SVG_ERR_NO_MEM;
+        }
+        out = svg_put_rect(context, out, xs[index], ys[index], widths[index], heights[index], style, style_length);
+        result = svg_element_end(context, out);
+    }
+    return result;
+}
+
+// Draws a line segment.
+svg_return_t svg_line(svg_context_ptr context,
+                      const svg_point_t *start,
+                      const svg_point_t *end,
+                      const char* style){
+    if (!(context)) {
+        return SVG_ERR_NULL;
+    }
+    else if (context->path_open) {
+        return SVG_ERR_STATE;
+    }
+    else if (start == NULL || end == NULL) {
+        return SVG_ERR_INVALID_ARG;
+    }
+    if(context->list){
+        return svg_list_lines(context->list, &start->x, &start->y, &end->x, &end->y, 1, style);
+    }
+    if(context->tiles){
+        return svg_tiles_lines(context->tiles, &start->x, &start->y, &end->x, &end->y, 1, style);
+    }
+    svg_point_t mapped_start, mapped_end;
+    if(context->transformed){
+        start = svg_map_point(context, start, &mapped_start);
+        end = svg_map_point(context, end, &mapped_end);
+    }
+    if(svg_cull_line(context, start->x, start->y, end->x, end->y)){
+        return SVG_OK;
+    }
+    if(context->style_interning){
+        style = svg_style_auto(context, style);
+    }
+    size_t style_length = style ? strlen(style) : 0;
+    if(context->lod_tolerance > 0
+        && svg_lod_line_repeated(context, start->x, start->y, end->x, end->y, style, style_length)){
+        return SVG_OK;
+    }
+    char *out = svg_element_begin(context, SVG_ELEMENT_MAX_LENGTH(4, style_length));
+    if(!out){
+        return SVG_ERR_NO_MEM;
+    }
+    out = svg_put_line(context, out, start->x, start->y, end->x, end->y, style, style_length);
+    return svg_element_end(context, out);
+}
+
+// Draws a run of line segments.
+svg_return_t svg_lines(svg_context_ptr context,
+                       const svg_coord_t *x1s,
+                       const svg_coord_t *y1s,
+                       const svg_coord_t *x2s,
+                       const svg_coord_t *y2s,
+                       size_t count,
+                       const char *style){
+    if (!(context)) {
+        return SVG_ERR_NULL;
+    }
+    else if (context->path_open) {
+        return SVG_ERR_STATE;
+    }
+    else if (count && (x1s == NULL || y1s == NULL || x2s == NULL || y2s == NULL)) {
+        return SVG_ERR_INVALID_ARG;
+    }
+    if(context->list){
+        return svg_list_lines(context->list, x1s, y1s, x2s, y2s, count, style);
+    }
+    if(context->tiles){
+        return svg_tiles_lines(context->tiles, x1s, y1s, x2s, y2s, count, style);
+    }
+    if(context->transformed){
+        return svg_lines_mapped(context, x1s, y1s, x2s, y2s, count, style);
+    }
+    int pending = context->style_interning;
+    size_t style_length = style ? strlen(style) : 0;
+    svg_return_t result = SVG_OK;
+    for(size_t index = 0; index < count && result == SVG_OK; index++){
+        if(svg_cull_line(context, x1s[index], y1s[index], x2s[index], y2s[index])){
+            continue;
+        }
+        // decimation compares the interned style, as svg_line() does
+        svg_style_run(context, &style, &style_length, &pending);
+        if(context->lod_tolerance > 0
+            && svg_lod_line_repeated(context, x1s[index], y1s[index], x2s[index], y2s[index], style, style_length)){
+            continue;
+        }
+        char *out = svg_element_begin(context, SVG_ELEMENT_MAX_LENGTH(4, style_length));
+        if(!out){
+            return SVG_ERR_NO_MEM;
+        }
+        out = svg_put_line(context, out, x1s[index], y1s[index], x2s[index], y2s[index], style, style_length);
+        result = svg_element_end(context, out);
+    }
+    return result;
+}
+
+// Begins a streamed path.
+svg_return_t svg_path_begin(svg_context_ptr context,
+                            const char *style){
+    if (!(context)) {
+        return SVG_ERR_NULL;
+    }
+    else if (context->path_open || context->list || context->tiles) {
+        return SVG_ERR_STATE;
+    }
+    if(context->style_interning){
+        style = svg_style_auto(context, style);
+    }
+    size_t style_length = style ? strlen(style) : 0;
+    char *out = svg_element_begin(context, style_length + 32);
+    if(!out){
+        return SVG_ERR_NO_MEM;
+    }
+    out = SVG_PUT_LITERAL(out, "<path");
+    if(style){
+        out = svg_put_style_attribute(out, style, style_length);
+    }
+    out = SVG_PUT_LITERAL(out, " d=\"");
+    context->path_open = 1;
+    context->path_points = 0;
+    context->path_on_grid = 0;
+    context->path_relative = 0;
+    context->lod_order = 0;
+    context->lod_column_open = 0;
+    return svg_element_end(context, out);
+}
+
+// Writes one vertex of the open path in quantized mode and returns the new
+// end. Vertices are written as relative linetos between grid positions, so
+// no rounding error builds up, and vertices on the previous one's grid
+// position are left out.
+static char *svg_put_path_delta(svg_context_ptr context, char *out,
+                                svg_coord_t x, svg_coord_t y){
+    int64_t grid_x = 0, grid_y = 0;
+    int digits = context->quantize_digits;
+    int on_grid = svg_quantize(x, context->quantize_scale, &grid_x)
+        && svg_quantize(y, context->quantize_scale, &grid_y);
+    if(!on_grid || !context->path_on_grid){
+        *out++ = context->path_points++ ? 'L' : 'M';
+        out = svg_put_quantized(context, out, x);
+        *out++ = ',';
+        out = svg_put_quantized(context, out, y);
+        context->path_relative = 0;
+    }
+    else{
+        int64_t delta_x = grid_x - context->path_grid_x;
+        int64_t delta_y = grid_y - context->path_grid_y;
+        if(delta_x == 0 && delta_y == 0 && context->path_points > 1){
+            return out;
+        }
+        // a minus sign separates numbers by itself
+        if(!context->path_relative){
+            *out++ = 'l';
+            context->path_relative = 1;
+        }
+        else if(delta_x >= 0){
+            *out++ = ' ';
+        }
+        out = svg_put_grid(out, delta_x, digits);
+        if(delta_y >= 0){
+            *out++ = ',';
+        }
+        out = svg_put_grid(out, delta_y, digits);
+        context->path_points++;
+    }
+    context->path_on_grid = on_grid;
+    context->path_grid_x = grid_x;
+    context->path_grid_y = grid_y;
+    return out;
+}
+
+// Writes one path vertex and returns the new end.
+static inline char *svg_put_path_point(svg_context_ptr context, char *out,
+                                       svg_coord_t x, svg_coord_t y){
+    if(context->quantized){
+        return svg_put_path_delta(context, out, x, y);
+    }
+    // pairs after the initial moveto are implicit linetos
+    *out++ = context->path_points++ ? ' ' : 'M';
+    out = svg_put_real(context, out, x);
+    *out++ = ',';
+    return svg_put_real(context, out, y);
+}
+
+// Writes one vertex of the open path to the buffer.
+static svg_return_t svg_path_write(svg_context_ptr context, svg_coord_t x, svg_coord_t y){
+    if(svg_reserve(context, SVG_ELEMENT_MAX_LENGTH(2, 0)) != SVG_OK){
+        return SVG_ERR_NO_MEM;
+    }
+    char *out = svg_put_path_point(context, context->buffer + context->length, x, y);
+    return svg_element_end(context, out);
+}
+
+// Writes the vertices held back for the current column in their original order.
+static svg_return_t svg_path_write_column(svg_context_ptr context){
+    svg_lod_vertex_t kept[SVG_LOD_KEPT];
+    if(!context->lod_column_open){
+        return SVG_OK;
+    }
+    context->lod_column_open = 0;
+    memcpy(kept, context->lod_vertices, sizeof(kept));
+    for(int index = 1; index < SVG_LOD_KEPT; index++){
+        svg_lod_vertex_t vertex = kept[index];
+        int position = index;
+        while(position > 0 && kept[position - 1].order > vertex.order){
+            kept[position] = kept[position - 1];
+            position--;
+        }
+        kept[position] = vertex;
+    }
+    svg_return_t result = SVG_OK;
+    for(int index = 0; index < SVG_LOD_KEPT && result == SVG_OK; index++){
+        // one vertex can be both an extreme and an endpoint
+        if(index == 0 || kept[index].order != kept[index - 1].order){
+            result = svg_path_write(context, kept[index].point.x, kept[index].point.y);
+        }
+    }
+    return result;
+}
+
+// Adds a vertex to the open path, decimating it when level of detail is on.
+// Of all vertices in one tolerance wide column only the first, last, lowest
+// and highest are written, which keeps the drawn envelope intact.
+static svg_return_t svg_path_add(svg_context_ptr context, svg_coord_t x, svg_coord_t y){
+    if(context->lod_tolerance <= 0){
+        return svg_path_write(context, x, y);
+    }
+    double column = floor(x / context->lod_tolerance);
+    svg_lod_vertex_t vertex = {{x, y}, context->lod_order++};
+    if(context->lod_column_open && column == context->lod_column){
+        svg_lod_vertex_t *vertices = context->lod_vertices;
+        if(y < vertices[SVG_LOD_LOWEST].point.y){
+            vertices[SVG_LOD_LOWEST] = vertex;
+        }
+        if(y > vertices[SVG_LOD_HIGHEST].point.y){
+            vertices[SVG_LOD_HIGHEST] = vertex;
+        }
+        vertices[SVG_LOD_LAST] = vertex;
+        return SVG_OK;
+    }
+    svg_return_t result = svg_path_write_column(context);
+    if(result != SVG_OK){
+        return result;
+    }
+    if(!isfinite(column)){
+        return svg_path_write(context, x, y);
+    }
+    for(int index = 0; index < SVG_LOD_KEPT; index++){
+        context->lod_vertices[index] = vertex;
+    }
+    context->lod_column = column;
+    context->lod_column_open = 1;
+    return SVG_OK;
+}
+
+// Adds a vertex to the open path.
+svg_return_t svg_path_point(svg_context_ptr context,
+                            const svg_point_t *point){
+    if (!(context)) {
+        return SVG_ERR_NULL;
+    }
+    else if (!context->path_open) {
+        return SVG_ERR_STATE;
+    }
+    else if (point == NULL) {
+        return SVG_ERR_INVALID_ARG;
+    }
+    svg_point_t mapped;
+    if(context->transformed){
+        point = svg_map_point(context, point, &mapped);
+    }
+    return svg_path_add(context, point->x, point->y);
+}
+
+// Adds a run of vertices to the open path.
+svg_return_t svg_path_points(svg_context_ptr context,
+                             const svg_point_t *points,
+                             size_t count){
+    if (!(context)) {
+        return SVG_ERR_NULL;
+    }
+    else if (!context->path_open) {
+        return SVG_ERR_STATE;
+    }
+    else if (count && points == NULL) {
+        return SVG_ERR_INVALID_ARG;
+    }
+    svg_return_t result = SVG_OK;
+    if(context->transformed){
+        svg_point_t mapped[SVG_TRANSFORM_CHUNK];
+        for(size_t first = 0; first < count && result == SVG_OK; first += SVG_TRANSFORM_CHUNK){
+            size_t chunk = count - first < SVG_TRANSFORM_CHUNK ? count - first : SVG_TRANSFORM_CHUNK;
+            svg_transform_points_kernel(&context->matrix, points + first, mapped, chunk);
+            for(size_t index = 0; index < chunk && result == SVG_OK; index++){
+                result = svg_path_add(context, mapped[index].x, mapped[index].y);
+            }
+        }
+        return result;
+    }
+    for(size_t index = 0; index < count && result == SVG_OK; index++){
+        result = svg_path_add(context, points[index].x, points[index].y);
+    }
+    return result;
+}
+
+// Ends the open path.
+svg_return_t svg_path_end(svg_context_ptr context){
+    if (!(context)) {
+        return SVG_ERR_NULL;
+    }
+    else if (!context->path_open) {
+        return SVG_ERR_STATE;
+    }
+    svg_return_t result = svg_path_write_column(context);
+    if(result == SVG_OK){
+        result = svg_append(context, "\"/>\n", 4);
+    }
+    if(result != SVG_OK){
+        return result;
+    }
+    context->path_open = 0;
+    SVG_STAT_ADD(context, paths, 1);
+    SVG_STAT_ADD(context, path_points, context->path_points);
+    return svg_commit(context, context->length, SVG_OK);
+}
+
+// Sends one Chrome trace event for a group to the trace callback, with
+// the group's attributes, if any, escaped as a JSON string.
+static void svg_trace_event(svg_context_ptr context, char phase, const char *attrs){
+    char text[256];
+    double timestamp = (double)(svg_now_ns() - context->trace_origin) / 1000.0;
+    snprintf(text, sizeof(text), "%s{\"name\":\"group\",\"cat\":\"svg\",\"ph\":\"%c\",\"ts\":%.3f,"
+             "\"pid\":1,\"tid\":1,\"args\":{\"depth\":%d%s",
+             context->trace_started ? "" : "[\n", phase, timestamp, context->group_depth,
+             attrs ? ",\"attrs\":\"" : "");
+    context->trace_started = 1;
+    context->trace_fn(context->trace_user, text);
+    if(attrs){
+        size_t length = 0;
+        for(const char *in = attrs; *in; in++){
+            unsigned char ch = (unsigned char)*in;
+            if(length + 7 >= sizeof(text)){
+                text[length] = '\0';
+                context->trace_fn(context->trace_user, text);
+                length = 0;
+            }
+            if(ch == '"' || ch == '\\'){
+                text[length++] = '\\';
+                text[length++] = (char)ch;
+            }
+            else if(ch < 0x20){
+                length += (size_t)snprintf(text + length, 7, "\\u%04x", ch);
+            }
+            else{
+                text[length++] = (char)ch;
+            }
+        }
+        text[length] = '\0';
+        context->trace_fn(context->trace_user, text);
+    }
+    context->trace_fn(context->trace_user, attrs ? "\"}},\n" : "}},\n");
+}
+
+// Begins an SVG group.
+svg_return_t svg_group_begin(svg_context_ptr context,
+                             const char* attrs){
+    if (!(context)) {
+        return SVG_ERR_NULL;
+    }
+    else if (context->path_open) {
+        return SVG_ERR_STATE;
+    }
+    if(context->list){
+        return svg_list_group_begin(context->list, attrs);
+    }
+    if(context->tiles){
+        return svg_tiles_group_begin(context->tiles, attrs);
+    }
+    size_t mark = context->length;
+    svg_return_t result = svg_indent(context);
+    if(result == SVG_OK){
+        if(attrs){
+            result = svg_appendf(context, "<g %s>\n", attrs);
+        }
+        else{
+            result = svg_append(context, "<g>\n", 4);
+        }
+    }
+    if(result == SVG_OK){
+        context->group_depth++;
+        SVG_STAT_ADD(context, groups, 1);
+        if(context->trace_fn){
+            svg_trace_event(context, 'B', attrs);
+        }
+    }
+    return svg_commit(context, mark, result);
+}
+
+// Ends the current SVG group.
+svg_return_t svg_group_end(svg_context_ptr context){
+    if (!(context)) {
+        return SVG_ERR_NULL;
+    }
+    else if (context->path_open) {
+        return SVG_ERR_STATE;
+    }
+    if(context->list){
+        return svg_list_group_end(context->list);
+    }
+    if(context->tiles){
+        return svg_tiles_group_end(context->tiles);
+    }
+    else if (context->group_depth == context->group_base || context->group_depth == context->symbol_depth) {
+        return SVG_ERR_STATE;
+    }
+    size_t mark = context->length;
+    context->group_depth--;
+    svg_return_t result = svg_indent(context);
+    if(result == SVG_OK){
+        result = svg_append(context, "</g>\n", 5);
+    }
+    if(result != SVG_OK){
+        context->group_depth++;
+    }
+    else if(context->trace_fn){
+        svg_trace_event(context, 'E', NULL);
+    }
+    return svg_commit(context, mark, result);
+}
+
+// Begins the definition of a reusable symbol.
+svg_return_t svg_symbol_begin(svg_context_ptr context, size_t *id){
+    if (!(context)) {
+        return SVG_ERR_NULL;
+    }
+    else if (id == NULL) {
+        return SVG_ERR_INVALID_ARG;
+    }
+    else if (context->path_open || context->symbol_depth || context->shard_parent || context->list || context->tiles
+        || context->density_counts) {
+        return SVG_ERR_STATE;
+    }
+    size_t mark = context->length;
+    svg_return_t result = svg_indent(context);
+    if(result == SVG_OK){
+        result = svg_append(context, "<defs>\n", 7);
+    }
+    context->group_depth++;
+    if(result == SVG_OK){
+        result = svg_indent(context);
+    }
+    if(result == SVG_OK){
+        result = svg_appendf(context, "<g id=\"_s%zu\">\n", context->symbol_count);
+    }
+    context->group_depth++;
+    if(result != SVG_OK){
+        context->group_depth -= 2;
+    }
+    else{
+        context->symbol_depth = context->group_depth;
+        *id = context->symbol_count++;
+    }
+    return svg_commit(context, mark, result);
+}
+
+// Ends the definition of the open symbol.
+svg_return_t svg_symbol_end(svg_context_ptr context){
+    if (!(context)) {
+        return SVG_ERR_NULL;
+    }
+    else if (context->path_open || !context->symbol_depth || context->group_depth != context->symbol_depth) {
+        return SVG_ERR_STATE;
+    }
+    size_t mark = context->length;
+    context->group_depth--;
+    svg_return_t result = svg_indent(context);
+    if(result == SVG_OK){
+        result = svg_append(context, "</g>\n", 5);
+    }
+    context->group_depth--;
+    if(result == SVG_OK){
+        result = svg_indent(context);
+    }
+    if(result == SVG_OK){
+        result = svg_append(context, "</defs>\n", 8);
+    }
+    if(result != SVG_OK){
+        context->group_depth += 2;
+    }
+    else{
+        context->symbol_depth = 0;
+        SVG_STAT_ADD(context, symbols, 1);
+    }
+    return svg_commit(context, mark, result);
+}
+
+// Places an instance of a symbol.
+svg_return_t svg_use(svg_context_ptr context, size_t id, const svg_point_t *at){
+    if (!(context)) {
+        return SVG_ERR_NULL;
+    }
+    else if (context->path_open) {
+        return SVG_ERR_STATE;
+    }
+    else if (at == NULL || id >= context->symbol_count
+        || (context->symbol_depth && id == context->symbol_count - 1)) {
+        return SVG_ERR_INVALID_ARG;
+    }
+    svg_point_t mapped;
+    if(context->transformed){
+        at = svg_map_point(context, at, &mapped);
+    }
+    char *out = svg_element_begin(context, SVG_ELEMENT_MAX_LENGTH(2, 0) + 24);
+    if(!out){
+        return SVG_ERR_NO_MEM;
+    }
+    SVG_STAT_ADD(context, uses, 1);
+    out = SVG_PUT_LITERAL(out, "<use href=\"#_s");
+    out = svg_put_uint(out, id);
+    out = SVG_PUT_LITERAL(out, "\" x=\"");
+    out = svg_put_real(context, out, at->x);
+    out = SVG_PUT_LITERAL(out, "\" y=\"");
+    out = svg_put_real(context, out, at->y);
+    out = SVG_PUT_LITERAL(out, "\"/>\n");
+    return svg_element_end(context, out);
+}
+
+// Colormap used by svg_density_end when none is given, a viridis ramp.
+static const char *const SVG_DENSITY_DEFAULT_STYLES[] = {
+    "fill:#440154", "fill:#46327e", "fill:#365c8d", "fill:#277f8e",
+    "fill:#1fa187", "fill:#4ac16d", "fill:#a0da39", "fill:#fde725"
+};
+
+static const svg_colormap_t SVG_DENSITY_DEFAULT_COLORMAP = {
+    SVG_DENSITY_DEFAULT_STYLES,
+    sizeof(SVG_DENSITY_DEFAULT_STYLES) / sizeof(SVG_DENSITY_DEFAULT_STYLES[0]),
+    1
+};
+
+// Begins aggregating points into a density map.
+svg_return_t svg_density_begin(svg_context_ptr context, svg_px_t cell_px){
+    if (!(context)) {
+        return SVG_ERR_NULL;
+    }
+    else if (cell_px <= 0) {
+        return SVG_ERR_INVALID_ARG;
+    }
+    else if (context->density_counts || context->path_open || context->symbol_depth
+        || context->shard_parent || context->list || context->tiles || context->frame) {
+        return SVG_ERR_STATE;
+    }
+    size_t columns = ((size_t)context->width + (size_t)cell_px - 1) / (size_t)cell_px;
+    size_t rows = ((size_t)context->height + (size_t)cell_px - 1) / (size_t)cell_px;
+    if(columns * rows > SVG_DENSITY_MAX_CELLS){
+        return SVG_ERR_INVALID_ARG;
+    }
+    context->density_counts = (uint32_t *)svg_mem_calloc(context, columns * rows, sizeof(uint32_t));
+    if(!context->density_counts){
+        return SVG_ERR_NO_MEM;
+    }
+    context->density_cell = cell_px;
+    context->density_columns = columns;
+    context->density_rows = rows;
+    return SVG_OK;
+}
+
+// Counts a run of points in the open density map.
+svg_return_t svg_density_points(svg_context_ptr context, const svg_point_t *points, size_t count){
+    if (!(context)) {
+        return SVG_ERR_NULL;
+    }
+    else if (count && points == NULL) {
+        return SVG_ERR_INVALID_ARG;
+    }
+    else if (!context->density_counts) {
+        return SVG_ERR_STATE;
+    }
+    if(!context->transformed){
+        for(size_t index = 0; index < count; index++){
+            svg_density_count(context, points[index].x, points[index].y);
+        }
+        return SVG_OK;
+    }
+    svg_point_t mapped[SVG_TRANSFORM_CHUNK];
+    for(size_t first = 0; first < count; first += SVG_TRANSFORM_CHUNK){
+        size_t chunk = count - first < SVG_TRANSFORM_CHUNK ? count - first : SVG_TRANSFORM_CHUNK;
+        svg_transform_points_kernel(&context->matrix, points + first, mapped, chunk);
+        for(size_t index = 0; index < chunk; index++){
+            svg_density_count(context, mapped[index].x, mapped[index].y);
+        }
+    }
+    return SVG_OK;
+}
+
+// Ends the open density map and draws it.
+svg_return_t svg_density_end(svg_context_ptr context, const svg_colormap_t *colormap){
+    if (!(context)) {
+        return SVG_ERR_NULL;
+    }
+    else if (!context->density_counts || context->path_open || context->shard_parent) {
+        return SVG_ERR_STATE;
+    }
+    else if (colormap && (colormap->count == 0 || colormap->styles == NULL)) {
+        return SVG_ERR_INVALID_ARG;
+    }
+    if(!colormap){
+        colormap = &SVG_DENSITY_DEFAULT_COLORMAP;
+    }
+    uint32_t *counts = context->density_counts;
+    size_t cells = context->density_columns * context->density_rows;
+    context->density_counts = NULL;
+
+    // styles are resolved once per level rather than once per cell
+    size_t levels = colormap->count;
+    const char **styles = (const char **)svg_mem_alloc(context, levels * (sizeof(const char *) + sizeof(size_t)));
+    if(!styles){
+        svg_mem_free(context, counts);
+        return SVG_ERR_NO_MEM;
+    }
+    size_t *style_lengths = (size_t *)(styles + levels);
+    for(size_t level = 0; level < levels; level++){
+        styles[level] = context->style_interning ? svg_style_auto(context, colormap->styles[level]) : colormap->styles[level];
+        style_lengths[level] = styles[level] ? strlen(styles[level]) : 0;
+    }
+    uint32_t max = 0;
+    for(size_t index = 0; index < cells; index++){
+        max = counts[index] > max ? counts[index] : max;
+    }
+    double scale = colormap->logarithmic ? log1p((double)max) : (double)max;
+
+    svg_return_t result = SVG_OK;
+    svg_coord_t cell = context->density_cell;
+    for(size_t row = 0, index = 0; row < context->density_rows && result == SVG_OK; row++){
+        svg_coord_t y = (svg_coord_t)row * cell;
+        svg_coord_t height = fmin(cell, context->height - y);
+        for(size_t column = 0; column < context->density_columns && result == SVG_OK; column++, index++){
+            if(!counts[index]){
+                continue;
+            }
+            svg_coord_t x = (svg_coord_t)column * cell;
+            svg_coord_t width = fmin(cell, context->width - x);
+            if(svg_cull_rect(context, x, y, width, height)){
+                continue;
+            }
+            double share = (colormap->logarithmic ? log1p((double)counts[index]) : (double)counts[index]) / scale;
+            size_t level = (size_t)ceil(share * (double)levels) - 1;
+            level = level < levels ? level : levels - 1;
+            char *out = svg_element_begin(context, SVG_ELEMENT_MAX_LENGTH(4, style_lengths[level]));
+            if(!out){
+                result = SVG_ERR_NO_MEM;
+                break;
+            }
+            out = svg_put_rect(context, out, x, y, width, height, styles[level], style_lengths[level]);
+            result = svg_element_end(context, out);
+        }
+    }
+    svg_mem_free(context, styles);
+    svg_mem_free(context, counts);
+    return result;
+}
+
+// Returns the slot holding the entry for id, or the empty slot it would go in.
+static size_t svg_frame_slot(svg_frame_t *frame, const char *id, uint64_t hash){
+    size_t mask = frame->slot_count - 1;
+    size_t slot = (size_t)hash & mask;
+    while(frame->slots[slot]){
+        const svg_frame_entry_t *entry = &frame->entries[frame->slots[slot] - 1];
+        if(entry->hash == hash && strcmp(entry->id, id) == 0){
+            return slot;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+// Rebuilds the id table with slot_count slots. Entries that are neither
+// drawn nor committed are left out, so their ids start over when reused.
+static svg_return_t svg_frame_rehash(svg_context_ptr context, size_t slot_count){
+    svg_frame_t *frame = context->frame;
+    uint32_t *slots = (uint32_t *)svg_mem_calloc(context, slot_count, sizeof(uint32_t));
+    if(!slots){
+        return SVG_ERR_NO_MEM;
+    }
+    svg_mem_free(context, frame->slots);
+    frame->slots = slots;
+    frame->slot_count = slot_count;
+    for(size_t index = 0; index < frame->entry_count; index++){
+        const svg_frame_entry_t *entry = &frame->entries[index];
+        if(entry->text || entry->committed){
+            frame->slots[svg_frame_slot(frame, entry->id, entry->hash)] = (uint32_t)(index + 1);
+        }
+    }
+    return SVG_OK;
+}
+
+// Makes room for one more entry, one more slot use and one more dirty entry.
+static svg_return_t svg_frame_reserve(svg_context_ptr context){
+    svg_frame_t *frame = context->frame;
+    if(frame->entry_count == frame->entry_capacity){
+        size_t capacity = frame->entry_capacity ? frame->entry_capacity * 2 : 16;
+        svg_frame_entry_t *entries = (svg_frame_entry_t *)svg_mem_realloc(context, frame->entries, capacity * sizeof(svg_frame_entry_t));
+        if(!entries){
+            return SVG_ERR_NO_MEM;
+        }
+        frame->entries = entries;
+        frame->entry_capacity = capacity;
+    }
+    if(frame->dirty_count == frame->dirty_capacity){
+        size_t capacity = frame->dirty_capacity ? frame->dirty_capacity * 2 : 16;
+        size_t *dirty = (size_t *)svg_mem_realloc(context, frame->dirty, capacity * sizeof(size_t));
+        if(!dirty){
+            return SVG_ERR_NO_MEM;
+        }
+        frame->dirty = dirty;
+        frame->dirty_capacity = capacity;
+    }
+    if((frame->entry_count + 1) * 2 > frame->slot_count){
+        return svg_frame_rehash(context, frame->slot_count ? frame->slot_count * 2 : SVG_FRAME_INITIAL_SLOTS);
+    }
+    return SVG_OK;
+}
+
+// Lists an entry as changed by the open frame.
+static void svg_frame_mark(svg_frame_t *frame, size_t index){
+    if(!frame->entries[index].dirty){
+        frame->entries[index].dirty = 1;
+        frame->dirty[frame->dirty_count++] = index;
+    }
+}
+
+// Stores element under id, which the frame takes ownership of, adding the
+// id attribute after the element name.
+static svg_return_t svg_frame_store(svg_context_ptr context, char *id, const char *element, size_t element_length){
+    svg_frame_t *frame = context->frame;
+    svg_return_t result = svg_frame_reserve(context);
+    if(result != SVG_OK){
+        svg_mem_free(context, id);
+        return result;
+    }
+    size_t name_end = 0;
+    while(name_end < element_length && element[name_end] != '<'){
+        name_end++;
+    }
+    while(name_end < element_length && element[name_end] != ' '
+        && element[name_end] != '>' && element[name_end] != '/'){
+        name_end++;
+    }
+    size_t id_length = strlen(id);
+    size_t length = element_length + id_length + 6;
+    uint64_t hash = svg_hash(id, id_length);
+    size_t slot = svg_frame_slot(frame, id, hash);
+    size_t index = frame->slots[slot] ? frame->slots[slot] - 1 : frame->entry_count;
+    svg_frame_entry_t *entry = index < frame->entry_count ? &frame->entries[index] : NULL;
+    if(entry && !entry->text && !entry->committed){
+        // the id was removed before the client saw it, so the client
+        // will append it at the end like any new element
+        entry = NULL;
+        index = frame->entry_count;
+    }
+    if(entry && entry->text && entry->length == length
+        && memcmp(entry->text, element, name_end) == 0
+        && memcmp(entry->text + name_end + id_length + 6, element + name_end, element_length - name_end) == 0){
+        // drawn again unchanged
+        svg_mem_free(context, id);
+        return SVG_OK;
+    }
+    char *text = (char *)svg_mem_alloc(context, length + 1);
+    if(!text){
+        svg_mem_free(context, id);
+        return SVG_ERR_NO_MEM;
+    }
+    char *out = svg_put(text, element, name_end);
+    out = SVG_PUT_LITERAL(out, " id=\"");
+    out = svg_put(out, id, id_length);
+    *out++ = '"';
+    out = svg_put(out, element + name_end, element_length - name_end);
+    *out = '\0';
+    if(entry){
+        svg_mem_free(context, id);
+        if(!entry->text){
+            frame->live++;
+        }
+        svg_mem_free(context, entry->text);
+    }
+    else{
+        entry = &frame->entries[frame->entry_count++];
+        entry->id = id;
+        entry->hash = hash;
+        entry->committed = 0;
+        entry->dirty = 0;
+        frame->slots[slot] = (uint32_t)(index + 1);
+        frame->live++;
+    }
+    entry->text = text;
+    entry->length = length;
+    svg_frame_mark(frame, index);
+    return SVG_OK;
+}
+
+// Takes the top-level element formatted since the last one out of the
+// buffer and stores it under the pending id.
+static svg_return_t svg_frame_capture(svg_context_ptr context){
+    svg_frame_t *frame = context->frame;
+    if(context->length == frame->base){
+        return SVG_OK;
+    }
+    else if(!frame->open){
+        // nothing may be drawn between frames
+        context->length = frame->base;
+        context->buffer[frame->base] = '\0';
+        context->path_open = 0;
+        context->group_depth = context->group_base;
+        context->symbol_depth = 0;
+        return SVG_ERR_STATE;
+    }
+    else if(context->path_open || context->group_depth != context->group_base){
+        return SVG_OK;
+    }
+    char *id = frame->pending;
+    frame->pending = NULL;
+    svg_return_t result = id ? svg_frame_store(context, id, context->buffer + frame->base, context->length - frame->base)
+                             : SVG_ERR_STATE;
+    context->length = frame->base;
+    context->buffer[frame->base] = '\0';
+    return result;
+}
+
+// Begins a frame.
+svg_return_t svg_frame_begin(svg_context_ptr context){
+    if(!context){
+        return SVG_ERR_NULL;
+    }
+    else if(context->path_open || context->group_depth != context->group_base
+        || context->shard_parent || context->list || context->tiles || context->queue
+        || context->style_interning || context->lod_tolerance > 0 || context->cull_enabled
+        || context->density_counts){
+        return SVG_ERR_STATE;
+    }
+    if(!context->frame){
+        // frames write their own headers, so nothing may have been drawn
+        if(!context->header_buffered || context->length != context->header_end || context->flushed){
+            return SVG_ERR_STATE;
+        }
+        context->frame = (svg_frame_t *)svg_mem_calloc(context, 1, sizeof(svg_frame_t));
+        if(!context->frame){
+            return SVG_ERR_NO_MEM;
+        }
+        context->length = 0;
+        context->buffer[0] = '\0';
+        context->header_buffered = 0;
+        context->header_end = 0;
+    }
+    else if(context->frame->open){
+        return SVG_ERR_STATE;
+    }
+    context->frame->base = context->length;
+    context->frame->open = 1;
+    return SVG_OK;
+}
+
+// Sets the id of the next top-level element of a frame.
+svg_return_t svg_frame_id(svg_context_ptr context, const char *id){
+    if(!context){
+        return SVG_ERR_NULL;
+    }
+    else if(id == NULL || id[0] == '\0' || strpbrk(id, "\"<>&") != NULL){
+        return SVG_ERR_INVALID_ARG;
+    }
+    else if(!context->frame || !context->frame->open
+        || context->path_open || context->group_depth != context->group_base){
+        return SVG_ERR_STATE;
+    }
+    size_t length = strlen(id);
+    char *copy = (char *)svg_mem_alloc(context, length + 1);
+    if(!copy){
+        return SVG_ERR_NO_MEM;
+    }
+    memcpy(copy, id, length + 1);
+    svg_mem_free(context, context->frame->pending);
+    context->frame->pending = copy;
+    return SVG_OK;
+}
+
+// Removes an element from the scene.
+svg_return_t svg_frame_remove(svg_context_ptr context, const char *id){
+    if(!context){
+        return SVG_ERR_NULL;
+    }
+    else if(id == NULL){
+        return SVG_ERR_INVALID_ARG;
+    }
+    else if(!context->frame || !context->frame->open){
+        return SVG_ERR_STATE;
+    }
+    svg_frame_t *frame = context->frame;
+    svg_return_t result = svg_frame_reserve(context);
+    if(result != SVG_OK){
+        return result;
+    }
+    size_t slot = svg_frame_slot(frame, id, svg_hash(id, strlen(id)));
+    svg_frame_entry_t *entry = frame->slots[slot] ? &frame->entries[frame->slots[slot] - 1] : NULL;
+    if(!entry || !entry->text){
+        return SVG_ERR_INVALID_ARG;
+    }
+    svg_mem_free(context, entry->text);
+    entry->text = NULL;
+    entry->length = 0;
+    frame->live--;
+    svg_frame_mark(frame, (size_t)(entry - frame->entries));
+    return SVG_OK;
+}
+
+// Appends frame output, flushing whenever the buffer passes the threshold.
+static svg_return_t svg_frame_append(svg_context_ptr context, const char *text, size_t length){
+    svg_return_t result = svg_append(context, text, length);
+    if(result == SVG_OK && context->length >= context->flush_threshold){
+        result = svg_flush_buffer(context);
+    }
+    return result;
+}
+
+// Writes the buffered header, every element and the closing tag as one
+// call of a scatter-gather callback, without copying the elements.
+static svg_return_t svg_frame_write_spans(svg_context_ptr context){
+    svg_frame_t *frame = context->frame;
+    if(frame->span_capacity < frame->live + 2){
+        size_t capacity = frame->live + 2;
+        svg_span_t *spans = (svg_span_t *)svg_mem_realloc(context, frame->spans, capacity * sizeof(svg_span_t));
+        if(!spans){
+            return SVG_ERR_NO_MEM;
+        }
+        frame->spans = spans;
+        frame->span_capacity = capacity;
+    }
+    size_t count = 0, length = context->length;
+    frame->spans[count].data = context->buffer;
+    frame->spans[count++].length = context->length;
+    for(size_t index = 0; index < frame->entry_count; index++){
+        if(frame->entries[index].text){
+            frame->spans[count].data = frame->entries[index].text;
+            frame->spans[count++].length = frame->entries[index].length;
+            length += frame->entries[index].length;
+        }
+    }
+    frame->spans[count].data = "</svg>\n";
+    frame->spans[count++].length = 7;
+    SVG_STAT_ADD(context, flushes, 1);
+    svg_return_t result = svg_write_spans(context, frame->spans, count);
+    context->flushed += length + 7;
+    context->length = 0;
+    context->buffer[0] = '\0';
+    context->header_buffered = 0;
+    context->style_insert = 0;
+    frame->base = 0;
+    return result == SVG_OK ? SVG_OK : SVG_ERR_IO;
+}
+
+// Writes the whole scene as an SVG document.
+static svg_return_t svg_frame_write_full(svg_context_ptr context){
+    svg_frame_t *frame = context->frame;
+    svg_return_t result = svg_appendf(context,
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<svg width=\"%d\" height=\"%d\" xmlns=\"http://www.w3.org/2000/svg\">\n",
+        context->width, context->height);
+    if(result == SVG_OK && context->writev_fn && !context->async){
+        result = svg_frame_write_spans(context);
+        for(size_t index = 0; index < frame->entry_count; index++){
+            frame->entries[index].committed = frame->entries[index].text != NULL;
+        }
+        return result;
+    }
+    for(size_t index = 0; index < frame->entry_count && result == SVG_OK; index++){
+        svg_frame_entry_t *entry = &frame->entries[index];
+        if(entry->text){
+            result = svg_frame_append(context, entry->text, entry->length);
+        }
+    }
+    if(result == SVG_OK){
+        result = svg_frame_append(context, "</svg>\n", 7);
+    }
+    for(size_t index = 0; index < frame->entry_count; index++){
+        frame->entries[index].committed = frame->entries[index].text != NULL;
+    }
+    return result;
+}
+
+// Writes the changes since the previous frame as an <svg-diff> document.
+static svg_return_t svg_frame_write_diff(svg_context_ptr context){
+    svg_frame_t *frame = context->frame;
+    svg_return_t result = svg_appendf(context, "<svg-diff frame=\"%llu\" width=\"%d\" height=\"%d\">\n",
+                                      (unsigned long long)frame->number, context->width, context->height);
+    for(size_t index = 0; index < frame->dirty_count && result == SVG_OK; index++){
+        svg_frame_entry_t *entry = &frame->entries[frame->dirty[index]];
+        if(entry->committed && !entry->text){
+            result = svg_appendf(context, "<remove id=\"%s\"/>\n", entry->id);
+        }
+        else if(entry->committed){
+            result = svg_appendf(context, "<replace id=\"%s\">\n", entry->id);
+            if(result == SVG_OK){
+                result = svg_frame_append(context, entry->text, entry->length);
+            }
+            if(result == SVG_OK){
+                result = svg_append(context, "</replace>\n", 11);
+            }
+        }
+        else if(entry->text){
+            result = svg_append(context, "<add>\n", 6);
+            if(result == SVG_OK){
+                result = svg_frame_append(context, entry->text, entry->length);
+            }
+            if(result == SVG_OK){
+                result = svg_append(context, "</add>\n", 7);
+            }
+        }
+    }
+    if(result == SVG_OK){
+        result = svg_frame_append(context, "</svg-diff>\n", 12);
+    }
+    for(size_t index = 0; index < frame->dirty_count; index++){
+        svg_frame_entry_t *entry = &frame->entries[frame->dirty[index]];
+        entry->committed = entry->text != NULL;
+    }
+    return result;
+}
+
+// Drops entries that are neither drawn nor committed once they outnumber
+// the live ones, keeping the order of the rest.
+static svg_return_t svg_frame_compact(svg_context_ptr context){
+    svg_frame_t *frame = context->frame;
+    if(frame->entry_count - frame->live <= frame->live){
+        return SVG_OK;
+    }
+    size_t kept = 0;
+    for(size_t index = 0; index < frame->entry_count; index++){
+        svg_frame_entry_t *entry = &frame->entries[index];
+        if(entry->text){
+            frame->entries[kept++] = *entry;
+        }
+        else{
+            svg_mem_free(context, entry->id);
+        }
+    }
+    frame->entry_count = kept;
+    size_t slot_count = SVG_FRAME_INITIAL_SLOTS;
+    while(slot_count < kept * 2 + 2){
+        slot_count *= 2;
+    }
+    return svg_frame_rehash(context, slot_count);
+}
+
+// Ends a frame and writes it.
+svg_return_t svg_frame_end(svg_context_ptr context, int mode){
+    if(!context){
+        return SVG_ERR_NULL;
+    }
+    else if(mode != SVG_FRAME_DIFF && mode != SVG_FRAME_FULL){
+        return SVG_ERR_INVALID_ARG;
+    }
+    else if(!context->frame || !context->frame->open
+        || context->path_open || context->group_depth != context->group_base){
+        return SVG_ERR_STATE;
+    }
+    svg_frame_t *frame = context->frame;
+    frame->open = 0;
+    svg_mem_free(context, frame->pending);
+    frame->pending = NULL;
+    frame->number++;
+    svg_return_t result = mode == SVG_FRAME_FULL ? svg_frame_write_full(context)
+                                                 : svg_frame_write_diff(context);
+    for(size_t index = 0; index < frame->dirty_count; index++){
+        frame->entries[frame->dirty[index]].dirty = 0;
+    }
+    frame->dirty_count = 0;
+    svg_return_t compact_result = svg_frame_compact(context);
+    if(result == SVG_OK){
+        result = compact_result;
+    }
+    if(result == SVG_OK){
+        result = svg_flush_buffer(context);
+    }
+    else{
+        context->length = frame->base;
+        context->buffer[frame->base] = '\0';
+    }
+    frame->base = context->length;
+    return result;
 }
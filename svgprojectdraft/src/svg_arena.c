@@ -0,0 +1,212 @@
+/**
+ * @file svg_arena.c
+ * @brief Bump arena for SVG contexts.
+ *
+ * Allocates from large chunks by moving a pointer forward. Each block is
+ * preceded by its size so realloc can copy it.
+ */
+#include "svg_arena.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Alignment of every block, and size of the header in front of it.
+#define SVG_ARENA_ALIGNMENT     16
+// Chunk size used when svg_arena_create() is given zero.
+#define SVG_ARENA_DEFAULT_CHUNK ((size_t)256 << 10)
+
+#define SVG_ARENA_ROUND(size)   (((size) + SVG_ARENA_ALIGNMENT - 1) & ~(size_t)(SVG_ARENA_ALIGNMENT - 1))
+
+/**
+ * @brief One chunk of arena memory; blocks follow the padded header.
+ */
+typedef struct SVG_ARENA_CHUNK{
+    struct SVG_ARENA_CHUNK *next;
+    size_t size;                // bytes for blocks
+    size_t used;                // bytes taken by blocks and their headers
+} svg_arena_chunk_t;
+
+#define SVG_ARENA_CHUNK_HEADER  SVG_ARENA_ROUND(sizeof(svg_arena_chunk_t))
+
+/**
+ * @brief Opaque bump arena.
+ */
+struct SVG_ARENA{
+    svg_arena_chunk_t *chunks;  // newest first; only the newest is allocated from
+    size_t chunk_size;
+    svg_arena_usage_t usage;
+};
+
+// Returns the first byte of a chunk's blocks.
+static char *svg_arena_data(svg_arena_chunk_t *chunk){
+    return (char *)chunk + SVG_ARENA_CHUNK_HEADER;
+}
+
+// Allocates a chunk of at least size bytes from the C heap.
+static svg_arena_chunk_t *svg_arena_chunk_new(svg_arena_ptr arena, size_t size){
+    if(size < arena->chunk_size){
+        size = arena->chunk_size;
+    }
+    if(size > SIZE_MAX - SVG_ARENA_CHUNK_HEADER){
+        return NULL;
+    }
+    svg_arena_chunk_t *chunk = (svg_arena_chunk_t *)malloc(SVG_ARENA_CHUNK_HEADER + size);
+    if(!chunk){
+        return NULL;
+    }
+    chunk->size = size;
+    chunk->used = 0;
+    arena->usage.reserved += size;
+    arena->usage.heap_calls++;
+    return chunk;
+}
+
+// Returns every chunk to the C heap.
+static void svg_arena_release(svg_arena_ptr arena){
+    while(arena->chunks){
+        svg_arena_chunk_t *next = arena->chunks->next;
+        free(arena->chunks);
+        arena->chunks = next;
+        arena->usage.heap_calls++;
+    }
+    arena->usage.reserved = 0;
+}
+
+// Returns nonzero when block, of the given size, is the newest allocation.
+static int svg_arena_is_last(svg_arena_ptr arena, const char *block, size_t size){
+    svg_arena_chunk_t *chunk = arena->chunks;
+    return chunk && block + SVG_ARENA_ROUND(size) == svg_arena_data(chunk) + chunk->used;
+}
+
+// Allocator hook: takes size bytes from the newest chunk.
+static void *svg_arena_alloc(void *user, size_t size){
+    svg_arena_ptr arena = (svg_arena_ptr)user;
+    if(size > SIZE_MAX / 2){
+        return NULL;
+    }
+    size_t need = SVG_ARENA_ALIGNMENT + SVG_ARENA_ROUND(size);
+    svg_arena_chunk_t *chunk = arena->chunks;
+    if(!chunk || chunk->size - chunk->used < need){
+        // the rest of a full chunk stays unused until the next reset
+        chunk = svg_arena_chunk_new(arena, need);
+        if(!chunk){
+            return NULL;
+        }
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+    }
+    char *header = svg_arena_data(chunk) + chunk->used;
+    memcpy(header, &size, sizeof(size));
+    chunk->used += need;
+    arena->usage.used += need;
+    if(arena->usage.used > arena->usage.peak){
+        arena->usage.peak = arena->usage.used;
+    }
+    return header + SVG_ARENA_ALIGNMENT;
+}
+
+// Allocator hook: gives back the newest allocation, ignores any other.
+static void svg_arena_free(void *user, void *pointer){
+    svg_arena_ptr arena = (svg_arena_ptr)user;
+    char *block = (char *)pointer;
+    size_t size;
+    memcpy(&size, block - SVG_ARENA_ALIGNMENT, sizeof(size));
+    if(svg_arena_is_last(arena, block, size)){
+        size_t need = SVG_ARENA_ALIGNMENT + SVG_ARENA_ROUND(size);
+        arena->chunks->used -= need;
+        arena->usage.used -= need;
+    }
+}
+
+// Allocator hook: grows or shrinks the newest allocation in place and
+// copies any other.
+static void *svg_arena_realloc(void *user, void *pointer, size_t size){
+    svg_arena_ptr arena = (svg_arena_ptr)user;
+    if(!pointer){
+        return svg_arena_alloc(user, size);
+    }
+    char *block = (char *)pointer;
+    size_t old_size;
+    memcpy(&old_size, block - SVG_ARENA_ALIGNMENT, sizeof(old_size));
+    if(size <= SIZE_MAX / 2 && svg_arena_is_last(arena, block, old_size)){
+        svg_arena_chunk_t *chunk = arena->chunks;
+        size_t start = (size_t)(block - svg_arena_data(chunk));
+        if(chunk->size - start >= SVG_ARENA_ROUND(size)){
+            arena->usage.used = arena->usage.used - chunk->used + start + SVG_ARENA_ROUND(size);
+            chunk->used = start + SVG_ARENA_ROUND(size);
+            if(arena->usage.used > arena->usage.peak){
+                arena->usage.peak = arena->usage.used;
+            }
+            memcpy(block - SVG_ARENA_ALIGNMENT, &size, sizeof(size));
+            return block;
+        }
+    }
+    char *moved = (char *)svg_arena_alloc(user, size);
+    if(moved){
+        memcpy(moved, block, old_size < size ? old_size : size);
+    }
+    return moved;
+}
+
+// Creates an empty arena.
+svg_arena_ptr svg_arena_create(size_t chunk_size){
+    svg_arena_ptr arena = (svg_arena_ptr)calloc(1, sizeof(svg_arena_t));
+    if(!arena){
+        return NULL;
+    }
+    arena->chunk_size = chunk_size ? SVG_ARENA_ROUND(chunk_size) : SVG_ARENA_DEFAULT_CHUNK;
+    return arena;
+}
+
+// Fills in allocator hooks that allocate from an arena.
+svg_return_t svg_arena_allocator(svg_arena_ptr arena, svg_allocator_t *allocator){
+    if(!arena || !allocator){
+        return SVG_ERR_NULL;
+    }
+    allocator->alloc_fn = svg_arena_alloc;
+    allocator->realloc_fn = svg_arena_realloc;
+    allocator->free_fn = svg_arena_free;
+    allocator->user = arena;
+    allocator->thread_safe = 0;
+    return SVG_OK;
+}
+
+// Takes back everything allocated from an arena.
+svg_return_t svg_arena_reset(svg_arena_ptr arena){
+    if(!arena){
+        return SVG_ERR_NULL;
+    }
+    arena->usage.used = 0;
+    if(arena->chunks && arena->chunks->next){
+        // one chunk as large as all of them keeps the next run from growing
+        size_t reserved = arena->usage.reserved;
+        svg_arena_release(arena);
+        arena->chunks = svg_arena_chunk_new(arena, reserved);
+        if(arena->chunks){
+            arena->chunks->next = NULL;
+        }
+    }
+    else if(arena->chunks){
+        arena->chunks->used = 0;
+    }
+    return SVG_OK;
+}
+
+// Reports the memory use of an arena.
+svg_return_t svg_arena_get_usage(svg_arena_ptr arena, svg_arena_usage_t *usage){
+    if(!arena || !usage){
+        return SVG_ERR_NULL;
+    }
+    *usage = arena->usage;
+    return SVG_OK;
+}
+
+// Destroys an arena and returns its chunks to the C heap.
+svg_return_t svg_arena_destroy(svg_arena_ptr arena){
+    if(!arena){
+        return SVG_ERR_NULL;
+    }
+    svg_arena_release(arena);
+    free(arena);
+    return SVG_OK;
+}
@@ -0,0 +1,285 @@
+/**
+ * @file svg_file.c
+ * @brief File descriptor output sink.
+ *
+ * Writes SVG output through a raw file descriptor in large aligned chunks.
+ */
+#define _GNU_SOURCE
+#include "svg_sinks.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// Alignment of the staging buffer and chunk size, as O_DIRECT requires.
+#define SVG_FILE_ALIGNMENT      4096
+// Chunk size used when the options leave it at zero.
+#define SVG_FILE_DEFAULT_CHUNK  ((size_t)1 << 20)
+// Most spans gathered into one writev(), counting the staging buffer.
+#define SVG_FILE_MAX_SPANS      64
+
+/**
+ * @brief State of one file descriptor sink.
+ */
+typedef struct{
+    int fd;
+    int direct;                 // nonzero while O_DIRECT is in effect
+    svg_file_options_t options;
+    char *staging;              // aligned buffer of chunk_size bytes
+    size_t staged;              // bytes waiting in staging
+    size_t chunk_size;
+    off_t written;              // bytes written to the file so far
+    off_t flushing;             // end of the range whose writeback was started
+    off_t dropped;              // end of the range whose pages were dropped
+} svg_file_sink_t;
+
+// Starts writeback of everything written since the last call and drops
+// the pages of the range started the time before. Dirty pages cannot be
+// dropped, so that range is waited for first; it had a whole write to
+// finish, so the wait is usually short.
+static void svg_file_advise(svg_file_sink_t *sink){
+#ifdef SYNC_FILE_RANGE_WRITE
+    if(sink->flushing > sink->dropped
+       && sync_file_range(sink->fd, sink->dropped, sink->flushing - sink->dropped,
+                          SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER) == 0){
+        posix_fadvise(sink->fd, sink->dropped, sink->flushing - sink->dropped, POSIX_FADV_DONTNEED);
+        sink->dropped = sink->flushing;
+    }
+    if(sink->written > sink->flushing
+       && sync_file_range(sink->fd, sink->flushing, sink->written - sink->flushing, SYNC_FILE_RANGE_WRITE) == 0){
+        sink->flushing = sink->written;
+    }
+#else
+    (void)sink;
+#endif
+}
+
+
+// Writes the given spans completely, retrying after partial writes.
+static svg_return_t svg_file_write_spans(svg_file_sink_t *sink, struct iovec *spans, int count){
+    while(count > 0 && spans[0].iov_len == 0){
+        spans++;
+        count--;
+    }
+    while(count > 0){
+        ssize_t written = count == 1 ? write(sink->fd, spans[0].iov_base, spans[0].iov_len)
+                                     : writev(sink->fd, spans, count);
+        if(written < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return SVG_ERR_IO;
+        }
+        if(written == 0){
+            // no progress with bytes pending would otherwise retry forever
+            return SVG_ERR_IO;
+        }
+        sink->written += written;
+        if(sink->options.advise){
+            // the pages are not read again, so let the kernel drop them
+            svg_file_advise(sink);
+        }
+        while(count > 0 && (size_t)written >= spans[0].iov_len){
+            written -= (ssize_t)spans[0].iov_len;
+            spans++;
+            count--;
+        }
+        if(count > 0){
+            spans[0].iov_base = (char *)spans[0].iov_base + written;
+            spans[0].iov_len -= (size_t)written;
+        }
+    }
+    return SVG_OK;
+}
+
+// Writes everything staged.
+static svg_return_t svg_file_drain(svg_file_sink_t *sink){
+    struct iovec span = {sink->staging, sink->staged};
+    sink->staged = 0;
+    return span.iov_len ? svg_file_write_spans(sink, &span, 1) : SVG_OK;
+}
+
+// Opens a file descriptor sink.
+svg_user_context_ptr svg_file_open(const char *path, const svg_file_options_t *options){
+    static const svg_file_options_t defaults = {0, 0, 0, 0, 0};
+    if(path == NULL){
+        return NULL;
+    }
+    svg_file_sink_t *sink = (svg_file_sink_t *)calloc(1, sizeof(svg_file_sink_t));
+    if(!sink){
+        return NULL;
+    }
+    sink->options = options ? *options : defaults;
+    sink->chunk_size = sink->options.chunk_size ? sink->options.chunk_size : SVG_FILE_DEFAULT_CHUNK;
+    sink->chunk_size = (sink->chunk_size + SVG_FILE_ALIGNMENT - 1) / SVG_FILE_ALIGNMENT * SVG_FILE_ALIGNMENT;
+    if(posix_memalign((void **)&sink->staging, SVG_FILE_ALIGNMENT, sink->chunk_size) != 0){
+        free(sink);
+        return NULL;
+    }
+
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    sink->fd = -1;
+#ifdef O_DIRECT
+    if(sink->options.direct_io){
+        // not every file system supports O_DIRECT, so fall back quietly
+        sink->fd = open(path, flags | O_DIRECT, 0666);
+        sink->direct = sink->fd >= 0;
+    }
+#endif
+    if(sink->fd < 0){
+        sink->fd = open(path, flags, 0666);
+    }
+    if(sink->fd < 0){
+        free(sink->staging);
+        free(sink);
+        return NULL;
+    }
+    if(sink->options.advise){
+        posix_fadvise(sink->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+    return sink;
+}
+
+// Write callback of the file descriptor sink.
+svg_return_t svg_file_write(svg_user_context_ptr user, const char *text){
+    if(!text){
+        return SVG_ERR_NULL;
+    }
+    return svg_file_write_n(user, text, strlen(text));
+}
+
+// Length-aware write callback of the file descriptor sink.
+svg_return_t svg_file_write_n(svg_user_context_ptr user, const char *text, size_t length){
+    svg_file_sink_t *sink = (svg_file_sink_t *)user;
+    if(!sink || !text){
+        return SVG_ERR_NULL;
+    }
+    if(!sink->direct && sink->staged + length > sink->chunk_size){
+        // O_DIRECT needs aligned memory; anywhere else large text is
+        // written from where it is instead of being copied
+        if(sink->options.use_writev && sink->staged){
+            struct iovec spans[2] = {{sink->staging, sink->staged}, {(char *)text, length}};
+            sink->staged = 0;
+            return svg_file_write_spans(sink, spans, 2);
+        }
+        svg_return_t result = svg_file_drain(sink);
+        if(result != SVG_OK || length < sink->chunk_size){
+            if(result == SVG_OK){
+                memcpy(sink->staging, text, length);
+                sink->staged = length;
+            }
+            return result;
+        }
+        struct iovec span = {(char *)text, length};
+        return svg_file_write_spans(sink, &span, 1);
+    }
+    while(length){
+        size_t piece = sink->chunk_size - sink->staged;
+        if(piece > length){
+            piece = length;
+        }
+        memcpy(sink->staging + sink->staged, text, piece);
+        sink->staged += piece;
+        text += piece;
+        length -= piece;
+        if(sink->staged == sink->chunk_size){
+            svg_return_t result = svg_file_drain(sink);
+            if(result != SVG_OK){
+                return result;
+            }
+        }
+    }
+    return SVG_OK;
+}
+
+// Scatter-gather write callback of the file descriptor sink.
+svg_return_t svg_file_writev(svg_user_context_ptr user, const svg_span_t *spans, size_t count){
+    svg_file_sink_t *sink = (svg_file_sink_t *)user;
+    if(!sink || (!spans && count)){
+        return SVG_ERR_NULL;
+    }
+    size_t total = 0;
+    for(size_t index = 0; index < count; index++){
+        total += spans[index].length;
+    }
+    if(sink->options.use_writev && !sink->direct && sink->staged + total > sink->chunk_size
+       && count < SVG_FILE_MAX_SPANS){
+        // staged data and every span go out in a single writev()
+        struct iovec vector[SVG_FILE_MAX_SPANS];
+        int used = 0;
+        if(sink->staged){
+            vector[used].iov_base = sink->staging;
+            vector[used++].iov_len = sink->staged;
+        }
+        for(size_t index = 0; index < count; index++){
+            if(spans[index].length){
+                vector[used].iov_base = (void *)spans[index].data;
+                vector[used++].iov_len = spans[index].length;
+            }
+        }
+        sink->staged = 0;
+        return svg_file_write_spans(sink, vector, used);
+    }
+    svg_return_t result = SVG_OK;
+    for(size_t index = 0; index < count && result == SVG_OK; index++){
+        result = svg_file_write_n(user, spans[index].data, spans[index].length);
+    }
+    return result;
+}
+
+// Cleanup callback of the file descriptor sink.
+svg_return_t svg_file_cleanup(svg_user_context_ptr user){
+    svg_file_sink_t *sink = (svg_file_sink_t *)user;
+    if(!sink){
+        return SVG_ERR_NULL;
+    }
+    svg_return_t result = SVG_OK;
+#ifdef O_DIRECT
+    if(sink->direct && sink->staged){
+        // the tail is not a whole number of blocks, so finish without O_DIRECT
+        int flags = fcntl(sink->fd, F_GETFL);
+        if(flags < 0 || fcntl(sink->fd, F_SETFL, flags & ~O_DIRECT) < 0){
+            result = SVG_ERR_IO;
+        }
+    }
+#endif
+    if(result == SVG_OK){
+        result = svg_file_drain(sink);
+    }
+    if(sink->options.sync_on_close && fsync(sink->fd) != 0){
+        result = SVG_ERR_IO;
+    }
+    if(close(sink->fd) != 0){
+        result = SVG_ERR_IO;
+    }
+    free(sink->staging);
+    free(sink);
+    return result;
+}
+
+// Creates an SVG context that writes a file through a raw descriptor.
+svg_context_ptr svg_create_file(const char *path,
+                                svg_px_t width,
+                                svg_px_t height,
+                                const svg_file_options_t *options){
+    if(width <= 0 || height <= 0){
+        return NULL;
+    }
+    svg_user_context_ptr sink = svg_file_open(path, options);
+    if(!sink){
+        return NULL;
+    }
+    svg_create_options_t create = {0};
+    create.writev_fn = svg_file_writev;
+    create.cleanup_fn = svg_file_cleanup;
+    create.user = sink;
+    create.width = width;
+    create.height = height;
+    svg_context_ptr context = svg_create_ex(&create);
+    if(!context){
+        svg_file_cleanup(sink);
+    }
+    return context;
+}
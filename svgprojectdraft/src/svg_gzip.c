@@ -0,0 +1,141 @@
+/**
+ * @file svg_gzip.c
+ * @brief Streaming gzip (.svgz) output sink.
+ *
+ * Deflates SVG output incrementally with zlib as it is written.
+ */
+#include "svg_sinks.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <zlib.h>
+
+// Size of the compressed output staged before each fwrite.
+#define SVG_GZIP_OUTPUT_SIZE    65536
+// zlib window bits, plus 16 for a gzip header and trailer.
+#define SVG_GZIP_WINDOW_BITS    (15 + 16)
+// zlib memory level; 8 is the zlib default.
+#define SVG_GZIP_MEMORY_LEVEL   8
+
+/**
+ * @brief State of one gzip sink.
+ */
+typedef struct{
+    FILE *file;
+    z_stream stream;
+    unsigned char output[SVG_GZIP_OUTPUT_SIZE];
+} svg_gzip_sink_t;
+
+
+// Deflates the pending input with the given flush mode and writes out
+// every full output buffer.
+static svg_return_t svg_gzip_deflate(svg_gzip_sink_t *sink, int flush){
+    int status;
+    do{
+        sink->stream.next_out = sink->output;
+        sink->stream.avail_out = SVG_GZIP_OUTPUT_SIZE;
+        status = deflate(&sink->stream, flush);
+        if(status == Z_STREAM_ERROR){
+            return SVG_ERR_IO;
+        }
+        size_t produced = SVG_GZIP_OUTPUT_SIZE - sink->stream.avail_out;
+        if(produced && fwrite(sink->output, 1, produced, sink->file) != produced){
+            return SVG_ERR_IO;
+        }
+    } while(sink->stream.avail_out == 0 || (flush == Z_FINISH && status != Z_STREAM_END));
+    return SVG_OK;
+}
+
+// Opens a gzip compressing sink.
+svg_user_context_ptr svg_gzip_open(const char *path, int level){
+    if(path == NULL || level < SVG_GZIP_DEFAULT_LEVEL || level > 9){
+        return NULL;
+    }
+    svg_gzip_sink_t *sink = (svg_gzip_sink_t *)calloc(1, sizeof(svg_gzip_sink_t));
+    if(!sink){
+        return NULL;
+    }
+    if(deflateInit2(&sink->stream, level, Z_DEFLATED, SVG_GZIP_WINDOW_BITS,
+                    SVG_GZIP_MEMORY_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK){
+        free(sink);
+        return NULL;
+    }
+    sink->file = fopen(path, "wb");
+    if(!sink->file){
+        deflateEnd(&sink->stream);
+        free(sink);
+        return NULL;
+    }
+    return sink;
+}
+
+// Write callback of the gzip sink.
+svg_return_t svg_gzip_write(svg_user_context_ptr user, const char *text){
+    if(!text){
+        return SVG_ERR_NULL;
+    }
+    return svg_gzip_write_n(user, text, strlen(text));
+}
+
+// Length-aware write callback of the gzip sink.
+svg_return_t svg_gzip_write_n(svg_user_context_ptr user, const char *text, size_t length){
+    svg_gzip_sink_t *sink = (svg_gzip_sink_t *)user;
+    if(!sink || !text){
+        return SVG_ERR_NULL;
+    }
+    while(length){
+        // avail_in is an unsigned int, so very large text goes in slices
+        uInt slice = length > 0x40000000u ? 0x40000000u : (uInt)length;
+        sink->stream.next_in = (Bytef *)text;
+        sink->stream.avail_in = slice;
+        svg_return_t result = svg_gzip_deflate(sink, Z_NO_FLUSH);
+        if(result != SVG_OK){
+            return result;
+        }
+        text += slice;
+        length -= slice;
+    }
+    return SVG_OK;
+}
+
+// Cleanup callback of the gzip sink.
+svg_return_t svg_gzip_cleanup(svg_user_context_ptr user){
+    svg_gzip_sink_t *sink = (svg_gzip_sink_t *)user;
+    if(!sink){
+        return SVG_ERR_NULL;
+    }
+    sink->stream.next_in = NULL;
+    sink->stream.avail_in = 0;
+    svg_return_t result = svg_gzip_deflate(sink, Z_FINISH);
+    deflateEnd(&sink->stream);
+    if(fclose(sink->file) != 0){
+        result = SVG_ERR_IO;
+    }
+    free(sink);
+    return result;
+}
+
+// Creates an SVG context that writes a gzip compressed file.
+svg_context_ptr svg_create_svgz(const char *path,
+                                svg_px_t width,
+                                svg_px_t height,
+                                int level){
+    if(width <= 0 || height <= 0){
+        return NULL;
+    }
+    svg_user_context_ptr sink = svg_gzip_open(path, level);
+    if(!sink){
+        return NULL;
+    }
+    svg_create_options_t create = {0};
+    create.write_n_fn = svg_gzip_write_n;
+    create.cleanup_fn = svg_gzip_cleanup;
+    create.user = sink;
+    create.width = width;
+    create.height = height;
+    svg_context_ptr context = svg_create_ex(&create);
+    if(!context){
+        svg_gzip_cleanup(sink);
+    }
+    return context;
+}
@@ -0,0 +1,1247 @@
+/**
+ * @file svg_list.c
+ * @brief Retained display lists.
+ *
+ * Records drawing calls as runs over per-attribute coordinate arrays and
+ * replays them through the batch drawing functions.
+ */
+#include "svg_list.h"
+#include <ctype.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Kinds of recorded operations; the element kinds come first.
+enum{
+    SVG_LIST_CIRCLES = 0,
+    SVG_LIST_RECTS,
+    SVG_LIST_LINES,
+    SVG_LIST_ELEMENT_KINDS,
+    SVG_LIST_GROUP_BEGIN = SVG_LIST_ELEMENT_KINDS,
+    SVG_LIST_GROUP_END,
+    SVG_LIST_KINDS
+};
+
+// Number of coordinate arrays of each element kind.
+static const int SVG_LIST_COLUMNS[SVG_LIST_ELEMENT_KINDS] = {3, 4, 4};
+
+// Initial number of slots in the string hash table.
+#define SVG_LIST_INITIAL_SLOTS  64
+// Identifies a display list file.
+static const char SVG_LIST_MAGIC[8] = "SVGLIST";
+// Written in native byte order to recognize files from other machines.
+#define SVG_LIST_BYTE_ORDER     0x01020304u
+#define SVG_LIST_VERSION        1u
+
+// A run of operations of one kind that share one string.
+typedef struct{
+    uint32_t kind;
+    uint32_t string;        // string index + 1, 0 for NULL
+    uint32_t count;         // elements in the run, 1 for group operations
+} svg_list_op_t;
+
+// Coordinates of one element kind, one array per attribute.
+typedef struct{
+    svg_real_t *columns[4];
+    size_t count;
+    size_t capacity;
+} svg_list_columns_t;
+
+// Header of a display list file. The arrays follow in the order of the
+// fields that count them, coordinates first so every array stays aligned.
+typedef struct{
+    char magic[8];
+    uint32_t byte_order;
+    uint32_t version;
+    uint64_t op_count;
+    uint64_t element_counts[SVG_LIST_ELEMENT_KINDS];
+    uint64_t string_count;
+    uint64_t arena_length;
+} svg_list_header_t;
+
+/**
+ * @brief Retained display list.
+ */
+struct SVG_LIST{
+    svg_list_op_t *ops;
+    size_t op_count;
+    size_t op_capacity;
+    svg_list_columns_t elements[SVG_LIST_ELEMENT_KINDS];
+    char *arena;            // interned strings, each NUL terminated
+    size_t arena_length;
+    size_t arena_capacity;
+    uint64_t *strings;      // arena offset of each interned string
+    size_t string_count;
+    size_t string_capacity;
+    uint32_t *slots;        // open addressing table of string index + 1
+    size_t slot_count;
+    int group_depth;        // recorded groups still open
+    void *mapping;          // file mapping of a loaded list, NULL otherwise
+    size_t mapping_length;
+    svg_allocator_t allocator;  // source of all memory the list owns
+};
+
+// Allocator of lists created without one: the C heap.
+static void *svg_list_heap_alloc(void *user, size_t size){
+    (void)user;
+    return malloc(size);
+}
+
+static void *svg_list_heap_realloc(void *user, void *pointer, size_t size){
+    (void)user;
+    return realloc(pointer, size);
+}
+
+static void svg_list_heap_free(void *user, void *pointer){
+    (void)user;
+    free(pointer);
+}
+
+static const svg_allocator_t svg_list_heap_allocator = {
+    svg_list_heap_alloc, svg_list_heap_realloc, svg_list_heap_free, NULL, 1
+};
+
+// Allocates size bytes from the list's allocator.
+static void *svg_list_alloc(svg_list_ptr list, size_t size){
+    return list->allocator.alloc_fn(list->allocator.user, size);
+}
+
+// Allocates count zeroed elements of size bytes from the list's allocator.
+static void *svg_list_calloc(svg_list_ptr list, size_t count, size_t size){
+    if(size && count > SIZE_MAX / size){
+        return NULL;
+    }
+    void *pointer = svg_list_alloc(list, count * size);
+    if(pointer){
+        memset(pointer, 0, count * size);
+    }
+    return pointer;
+}
+
+// Resizes memory from the list's allocator; NULL allocates.
+static void *svg_list_realloc(svg_list_ptr list, void *pointer, size_t size){
+    return list->allocator.realloc_fn(list->allocator.user, pointer, size);
+}
+
+// Returns memory to the list's allocator; NULL is ignored.
+static void svg_list_free(svg_list_ptr list, void *pointer){
+    if(pointer){
+        list->allocator.free_fn(list->allocator.user, pointer);
+    }
+}
+
+// Grows an array to hold at least required items of the given size.
+static int svg_list_grow(svg_list_ptr list, void **items, size_t *capacity, size_t required, size_t size){
+    if(required <= *capacity){
+        return 1;
+    }
+    size_t grown = *capacity ? *capacity : 64;
+    while(grown < required){
+        grown *= 2;
+    }
+    void *resized = svg_list_realloc(list, *items, grown * size);
+    if(!resized){
+        return 0;
+    }
+    *items = resized;
+    *capacity = grown;
+    return 1;
+}
+
+// Returns the 64-bit FNV-1a hash of length bytes of text.
+static uint64_t svg_list_hash(const char *text, size_t length){
+    uint64_t hash = 14695981039346656037ull;
+    for(size_t index = 0; index < length; index++){
+        hash ^= (unsigned char)text[index];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Rebuilds the string hash table with the given number of slots.
+static int svg_list_rehash(svg_list_ptr list, size_t slot_count){
+    uint32_t *slots = (uint32_t *)svg_list_calloc(list, slot_count, sizeof(uint32_t));
+    if(!slots){
+        return 0;
+    }
+    for(size_t index = 0; index < list->string_count; index++){
+        const char *text = list->arena + list->strings[index];
+        size_t slot = svg_list_hash(text, strlen(text)) & (slot_count - 1);
+        while(slots[slot]){
+            slot = (slot + 1) & (slot_count - 1);
+        }
+        slots[slot] = (uint32_t)index + 1;
+    }
+    svg_list_free(list, list->slots);
+    list->slots = slots;
+    list->slot_count = slot_count;
+    return 1;
+}
+
+// Interns a string and returns its index + 1, 0 for NULL, or -1 if out
+// of memory.
+static int64_t svg_list_intern(svg_list_ptr list, const char *text){
+    if(!text){
+        return 0;
+    }
+    if(list->string_count * 2 >= list->slot_count
+        && !svg_list_rehash(list, list->slot_count ? list->slot_count * 2 : SVG_LIST_INITIAL_SLOTS)){
+        return -1;
+    }
+    size_t length = strlen(text);
+    size_t slot = svg_list_hash(text, length) & (list->slot_count - 1);
+    while(list->slots[slot]){
+        uint32_t index = list->slots[slot];
+        if(strcmp(list->arena + list->strings[index - 1], text) == 0){
+            return index;
+        }
+        slot = (slot + 1) & (list->slot_count - 1);
+    }
+    if(list->string_count >= UINT32_MAX - 1
+        || !svg_list_grow(list, (void **)&list->arena, &list->arena_capacity, list->arena_length + length + 1, 1)
+        || !svg_list_grow(list, (void **)&list->strings, &list->string_capacity, list->string_count + 1, sizeof(uint64_t))){
+        return -1;
+    }
+    memcpy(list->arena + list->arena_length, text, length + 1);
+    list->strings[list->string_count++] = list->arena_length;
+    list->arena_length += length + 1;
+    list->slots[slot] = (uint32_t)list->string_count;
+    return (int64_t)list->string_count;
+}
+
+// Appends an operation, extending the last run when it has the same kind
+// and string.
+static svg_return_t svg_list_op(svg_list_ptr list, uint32_t kind, const char *text, size_t count){
+    int64_t string;
+    const svg_list_op_t *previous = list->op_count ? &list->ops[list->op_count - 1] : NULL;
+    if(previous && previous->kind == kind && text && previous->string
+        && strcmp(list->arena + list->strings[previous->string - 1], text) == 0){
+        // runs usually repeat the last style, which needs no hashing
+        string = previous->string;
+    }
+    else{
+        string = svg_list_intern(list, text);
+    }
+    if(string < 0){
+        return SVG_ERR_NO_MEM;
+    }
+    while(count){
+        svg_list_op_t *last = list->op_count ? &list->ops[list->op_count - 1] : NULL;
+        size_t added;
+        if(kind < SVG_LIST_ELEMENT_KINDS && last && last->kind == kind
+            && last->string == (uint32_t)string && last->count < UINT32_MAX){
+            added = count < UINT32_MAX - last->count ? count : UINT32_MAX - last->count;
+            last->count += (uint32_t)added;
+        }
+        else{
+            if(!svg_list_grow(list, (void **)&list->ops, &list->op_capacity, list->op_count + 1, sizeof(svg_list_op_t))){
+                return SVG_ERR_NO_MEM;
+            }
+            added = count < UINT32_MAX ? count : UINT32_MAX;
+            list->ops[list->op_count].kind = kind;
+            list->ops[list->op_count].string = (uint32_t)string;
+            list->ops[list->op_count].count = (uint32_t)added;
+            list->op_count++;
+        }
+        count -= added;
+    }
+    return SVG_OK;
+}
+
+// Appends count elements of one kind from the given attribute arrays.
+static svg_return_t svg_list_elements(svg_list_ptr list, uint32_t kind, const svg_real_t *const *columns,
+                                      size_t count, const char *style){
+    // a handle only means something to the context that issued it, and
+    // the list may be replayed anywhere
+    style = svg_style_text(style);
+    svg_list_columns_t *elements = &list->elements[kind];
+    if(elements->count + count > elements->capacity){
+        size_t capacity = elements->capacity ? elements->capacity : 256;
+        while(capacity < elements->count + count){
+            capacity *= 2;
+        }
+        for(int column = 0; column < SVG_LIST_COLUMNS[kind]; column++){
+            svg_real_t *resized = (svg_real_t *)svg_list_realloc(list, elements->columns[column],
+                                                                  capacity * sizeof(svg_real_t));
+            if(!resized){
+                return SVG_ERR_NO_MEM;
+            }
+            elements->columns[column] = resized;
+        }
+        elements->capacity = capacity;
+    }
+    svg_return_t result = svg_list_op(list, kind, style, count);
+    if(result != SVG_OK){
+        return result;
+    }
+    for(int column = 0; column < SVG_LIST_COLUMNS[kind]; column++){
+        memcpy(elements->columns[column] + elements->count, columns[column], count * sizeof(svg_real_t));
+    }
+    elements->count += count;
+    return SVG_OK;
+}
+
+// Creates an empty display list.
+svg_list_ptr svg_list_create(void){
+    return svg_list_create_ex(NULL);
+}
+
+// Creates an empty display list that allocates with the given hooks.
+svg_list_ptr svg_list_create_ex(const svg_allocator_t *allocator){
+    int hooks = allocator ? (allocator->alloc_fn != NULL) + (allocator->realloc_fn != NULL)
+                            + (allocator->free_fn != NULL) : 0;
+    if(hooks != 0 && hooks != 3){
+        return NULL;
+    }
+    allocator = hooks ? allocator : &svg_list_heap_allocator;
+    svg_list_ptr list = (svg_list_ptr)allocator->alloc_fn(allocator->user, sizeof(svg_list_t));
+    if(list){
+        memset(list, 0, sizeof(svg_list_t));
+        list->allocator = *allocator;
+    }
+    return list;
+}
+
+// Destroys a display list.
+svg_return_t svg_list_destroy(svg_list_ptr list){
+    if(!list){
+        return SVG_ERR_NULL;
+    }
+    if(list->mapping){
+        munmap(list->mapping, list->mapping_length);
+    }
+    else{
+        for(int kind = 0; kind < SVG_LIST_ELEMENT_KINDS; kind++){
+            for(int column = 0; column < SVG_LIST_COLUMNS[kind]; column++){
+                svg_list_free(list, list->elements[kind].columns[column]);
+            }
+        }
+        svg_list_free(list, list->ops);
+        svg_list_free(list, list->arena);
+        svg_list_free(list, list->strings);
+    }
+    svg_list_free(list, list->slots);
+    svg_allocator_t allocator = list->allocator;
+    allocator.free_fn(allocator.user, list);
+    return SVG_OK;
+}
+
+// Records a run of circles.
+svg_return_t svg_list_circles(svg_list_ptr list,
+                              const svg_coord_t *xs,
+                              const svg_coord_t *ys,
+                              const svg_real_t *radii,
+                              size_t count,
+                              const char *style){
+    if(!list){
+        return SVG_ERR_NULL;
+    }
+    else if(list->mapping){
+        return SVG_ERR_STATE;
+    }
+    else if(count && (xs == NULL || ys == NULL || radii == NULL)){
+        return SVG_ERR_INVALID_ARG;
+    }
+    for(size_t index = 0; index < count; index++){
+        if(!(radii[index] > 0)){
+            return SVG_ERR_INVALID_ARG;
+        }
+    }
+    const svg_real_t *columns[] = {xs, ys, radii};
+    return count ? svg_list_elements(list, SVG_LIST_CIRCLES, columns, count, style) : SVG_OK;
+}
+
+// Records a run of rectangles.
+svg_return_t svg_list_rects(svg_list_ptr list,
+                            const svg_coord_t *xs,
+                            const svg_coord_t *ys,
+                            const svg_coord_t *widths,
+                            const svg_coord_t *heights,
+                            size_t count,
+                            const char *style){
+    if(!list){
+        return SVG_ERR_NULL;
+    }
+    else if(list->mapping){
+        return SVG_ERR_STATE;
+    }
+    else if(count && (xs == NULL || ys == NULL || widths == NULL || heights == NULL)){
+        return SVG_ERR_INVALID_ARG;
+    }
+    const svg_real_t *columns[] = {xs, ys, widths, heights};
+    return count ? svg_list_elements(list, SVG_LIST_RECTS, columns, count, style) : SVG_OK;
+}
+
+// Records a run of line segments.
+svg_return_t svg_list_lines(svg_list_ptr list,
+                            const svg_coord_t *x1s,
+                            const svg_coord_t *y1s,
+                            const svg_coord_t *x2s,
+                            const svg_coord_t *y2s,
+                            size_t count,
+                            const char *style){
+    if(!list){
+        return SVG_ERR_NULL;
+    }
+    else if(list->mapping){
+        return SVG_ERR_STATE;
+    }
+    else if(count && (x1s == NULL || y1s == NULL || x2s == NULL || y2s == NULL)){
+        return SVG_ERR_INVALID_ARG;
+    }
+    const svg_real_t *columns[] = {x1s, y1s, x2s, y2s};
+    return count ? svg_list_elements(list, SVG_LIST_LINES, columns, count, style) : SVG_OK;
+}
+
+// Records the start of a group.
+svg_return_t svg_list_group_begin(svg_list_ptr list, const char *attrs){
+    if(!list){
+        return SVG_ERR_NULL;
+    }
+    else if(list->mapping){
+        return SVG_ERR_STATE;
+    }
+    svg_return_t result = svg_list_op(list, SVG_LIST_GROUP_BEGIN, attrs, 1);
+    if(result == SVG_OK){
+        list->group_depth++;
+    }
+    return result;
+}
+
+// Records the end of the current group.
+svg_return_t svg_list_group_end(svg_list_ptr list){
+    if(!list){
+        return SVG_ERR_NULL;
+    }
+    else if(list->mapping || list->group_depth == 0){
+        return SVG_ERR_STATE;
+    }
+    svg_return_t result = svg_list_op(list, SVG_LIST_GROUP_END, NULL, 1);
+    if(result == SVG_OK){
+        list->group_depth--;
+    }
+    return result;
+}
+
+// Replays a display list into a context.
+svg_return_t svg_list_replay(svg_list_ptr list, svg_context_ptr context){
+    if(!list || !context){
+        return SVG_ERR_NULL;
+    }
+    size_t cursors[SVG_LIST_ELEMENT_KINDS] = {0, 0, 0};
+    svg_return_t result = SVG_OK;
+    for(size_t index = 0; index < list->op_count && result == SVG_OK; index++){
+        const svg_list_op_t *op = &list->ops[index];
+        const char *string = op->string ? list->arena + list->strings[op->string - 1] : NULL;
+        if(op->kind < SVG_LIST_ELEMENT_KINDS){
+            svg_real_t *const *columns = list->elements[op->kind].columns;
+            size_t first = cursors[op->kind];
+            cursors[op->kind] += op->count;
+            if(op->kind == SVG_LIST_CIRCLES){
+                result = svg_circles(context, columns[0] + first, columns[1] + first, columns[2] + first, op->count, string);
+            }
+            else if(op->kind == SVG_LIST_RECTS){
+                result = svg_rects(context, columns[0] + first, columns[1] + first,
+                                   columns[2] + first, columns[3] + first, op->count, string);
+            }
+            else{
+                result = svg_lines(context, columns[0] + first, columns[1] + first,
+                                   columns[2] + first, columns[3] + first, op->count, string);
+            }
+        }
+        else if(op->kind == SVG_LIST_GROUP_BEGIN){
+            result = svg_group_begin(context, string);
+        }
+        else{
+            result = svg_group_end(context);
+        }
+    }
+    return result;
+}
+
+// First character of a style handle from svg_style_register.
+#define SVG_LIST_HANDLE_MARK    '\x1f'
+// Largest coordinate a covering rectangle may have, which keeps grid
+// cell numbers well inside an int64_t.
+#define SVG_LIST_GRID_LIMIT     1099511627776.0
+// Exponent of the smallest grid cells; smaller rectangles share them.
+#define SVG_LIST_GRID_MIN_LEVEL (-20)
+// Number of grid cell sizes, enough for rectangles up to twice the limit.
+#define SVG_LIST_GRID_LEVELS    64
+
+// An element visited by svg_list_optimize.
+typedef struct{
+    uint32_t kind;
+    uint32_t string;
+    size_t index;           // position in the columns of its kind
+    size_t scope;           // op index + 1 of the enclosing group begin, 0 at the top
+} svg_list_item_t;
+
+// Why svg_list_optimize drops an element.
+enum{
+    SVG_LIST_KEEP = 0,
+    SVG_LIST_DUPLICATE,
+    SVG_LIST_OCCLUDED
+};
+
+// How a style takes part in occlusion.
+typedef struct{
+    int opaque;             // nonzero for a solid fill without transparency
+    double margin;          // reach of the stroke past the geometry, negative if unknown
+} svg_list_paint_t;
+
+// A rectangle that hides what lies inside it.
+typedef struct{
+    svg_real_t left;
+    svg_real_t top;
+    svg_real_t right;
+    svg_real_t bottom;
+} svg_list_cover_t;
+
+// A grid cell of one size, holding a chain of covering rectangles.
+typedef struct{
+    int64_t column;
+    int64_t row;
+    size_t scope;
+    int level;
+    size_t head;            // node index + 1 of the first rectangle, 0 for an empty slot
+} svg_list_cell_t;
+
+// Links a covering rectangle into a cell.
+typedef struct{
+    size_t cover;
+    size_t next;            // node index + 1, 0 at the end of the chain
+} svg_list_node_t;
+
+// Covering rectangles found so far, filed by size and position.
+typedef struct{
+    svg_list_cover_t *covers;
+    size_t cover_count;
+    size_t cover_capacity;
+    svg_list_node_t *nodes;
+    size_t node_count;
+    size_t node_capacity;
+    svg_list_cell_t *cells;     // open addressing table
+    size_t cell_count;
+    size_t slot_count;
+    unsigned char levels[SVG_LIST_GRID_LEVELS];
+} svg_list_grid_t;
+
+// Splits the next "name: value" declaration off a style, trimming both.
+// Returns 1 for a declaration, 0 at the end and -1 if it is malformed.
+static int svg_list_declaration(const char **cursor, const char **name, size_t *name_length,
+                                const char **value, size_t *value_length){
+    const char *text = *cursor;
+    while(*text == ' ' || *text == ';' || *text == '\t' || *text == '\n'){
+        text++;
+    }
+    if(*text == '\0'){
+        return 0;
+    }
+    const char *end = strchr(text, ';');
+    end = end ? end : text + strlen(text);
+    *cursor = end;
+    const char *colon = (const char *)memchr(text, ':', (size_t)(end - text));
+    if(!colon){
+        return -1;
+    }
+    *name = text;
+    *name_length = (size_t)(colon - text);
+    while(*name_length && ((*name)[*name_length - 1] == ' ' || (*name)[*name_length - 1] == '\t')){
+        (*name_length)--;
+    }
+    *value = colon + 1;
+    while(*value < end && (**value == ' ' || **value == '\t')){
+        (*value)++;
+    }
+    *value_length = (size_t)(end - *value);
+    while(*value_length && ((*value)[*value_length - 1] == ' ' || (*value)[*value_length - 1] == '\t'
+        || (*value)[*value_length - 1] == '\n')){
+        (*value_length)--;
+    }
+    return 1;
+}
+
+// Returns nonzero when text of the given length is literal.
+static int svg_list_is(const char *text, size_t length, const char *literal){
+    return strlen(literal) == length && strncmp(text, literal, length) == 0;
+}
+
+// Returns nonzero when a fill value is a color without transparency.
+static int svg_list_solid(const char *value, size_t length){
+    static const char *const keywords[] = {
+        "none", "transparent", "currentcolor", "inherit", "initial", "unset", "revert",
+        "context-fill", "context-stroke"
+    };
+    if(length && value[0] == '#'){
+        for(size_t index = 1; index < length; index++){
+            if(!isxdigit((unsigned char)value[index])){
+                return 0;
+            }
+        }
+        return length == 4 || length == 7;
+    }
+    if(length > 5 && strncmp(value, "rgb(", 4) == 0 && value[length - 1] == ')'){
+        size_t commas = 0;
+        for(size_t index = 4; index < length - 1; index++){
+            if(value[index] == '/' || value[index] == '(' || value[index] == ')'){
+                return 0;
+            }
+            commas += value[index] == ',';
+        }
+        return commas == 2;
+    }
+    char lowered[32];
+    if(length == 0 || length >= sizeof(lowered)){
+        return 0;
+    }
+    for(size_t index = 0; index < length; index++){
+        if(!isalpha((unsigned char)value[index])){
+            return 0;
+        }
+        lowered[index] = (char)tolower((unsigned char)value[index]);
+    }
+    for(size_t index = 0; index < sizeof(keywords) / sizeof(keywords[0]); index++){
+        if(svg_list_is(lowered, length, keywords[index])){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Works out whether a style fills opaquely and how far its stroke reaches.
+// Styles with declarations outside the fill and stroke properties, or
+// style handles whose rules are not known here, have an unknown margin.
+static void svg_list_paint(const char *style, svg_list_paint_t *paint){
+    static const char *const ignored[] = {
+        "fill-rule", "stroke-opacity", "stroke-linecap", "stroke-linejoin",
+        "stroke-miterlimit", "stroke-dasharray", "stroke-dashoffset"
+    };
+    paint->opaque = 0;
+    paint->margin = 0;
+    if(!style){
+        return;
+    }
+    else if(style[0] == SVG_LIST_HANDLE_MARK){
+        paint->margin = -1;
+        return;
+    }
+    int known = 1, fill = 0, translucent = 0, stroke = 0, status;
+    double width = 1;
+    const char *cursor = style, *name, *value;
+    size_t name_length, value_length;
+    while(known && (status = svg_list_declaration(&cursor, &name, &name_length, &value, &value_length)) != 0){
+        if(status < 0){
+            known = 0;
+        }
+        else if(svg_list_is(name, name_length, "fill")){
+            fill = svg_list_solid(value, value_length);
+        }
+        else if(svg_list_is(name, name_length, "opacity") || svg_list_is(name, name_length, "fill-opacity")){
+            translucent = 1;
+        }
+        else if(svg_list_is(name, name_length, "stroke")){
+            stroke = !svg_list_is(value, value_length, "none");
+        }
+        else if(svg_list_is(name, name_length, "stroke-width")){
+            char number[64];
+            char *end;
+            if(value_length >= sizeof(number)){
+                known = 0;
+                continue;
+            }
+            memcpy(number, value, value_length);
+            number[value_length] = '\0';
+            width = strtod(number, &end);
+            known = end != number && (*end == '\0' || strcmp(end, "px") == 0) && width >= 0 && isfinite(width);
+        }
+        else{
+            int listed = 0;
+            for(size_t index = 0; index < sizeof(ignored) / sizeof(ignored[0]) && !listed; index++){
+                listed = svg_list_is(name, name_length, ignored[index]);
+            }
+            known = listed;
+        }
+    }
+    paint->opaque = known && fill && !translucent;
+    // a square cap or mitred corner reaches at most width / sqrt(2) past the geometry
+    paint->margin = !known ? -1 : stroke ? 0.75 * width : 0;
+}
+
+// Returns nonzero when a group's attributes change nothing its elements
+// inherit, so occlusion inside it can be judged from their own styles.
+static int svg_list_plain_group(const char *attrs){
+    static const char *const allowed[] = {"id", "transform", "opacity", "clip-path"};
+    if(!attrs){
+        return 1;
+    }
+    const char *text = attrs;
+    for(;;){
+        while(*text == ' ' || *text == '\t' || *text == '\n'){
+            text++;
+        }
+        if(*text == '\0'){
+            return 1;
+        }
+        const char *equals = strchr(text, '=');
+        if(!equals || (equals[1] != '"' && equals[1] != '\'')){
+            return 0;
+        }
+        int listed = 0;
+        for(size_t index = 0; index < sizeof(allowed) / sizeof(allowed[0]) && !listed; index++){
+            listed = svg_list_is(text, (size_t)(equals - text), allowed[index]);
+        }
+        const char *close = strchr(equals + 2, equals[1]);
+        if(!listed || !close){
+            return 0;
+        }
+        text = close + 1;
+    }
+}
+
+// Returns a hash of an element's kind, style, group and coordinates.
+static uint64_t svg_list_item_hash(svg_list_ptr list, const svg_list_item_t *item){
+    uint64_t hash = ((uint64_t)item->kind << 32 | item->string) * 0x9e3779b97f4a7c15ull ^ item->scope;
+    for(int column = 0; column < SVG_LIST_COLUMNS[item->kind]; column++){
+        uint64_t bits;
+        memcpy(&bits, &list->elements[item->kind].columns[column][item->index], sizeof(bits));
+        hash = (hash ^ bits) * 0x9e3779b97f4a7c15ull;
+        hash ^= hash >> 29;
+    }
+    return hash;
+}
+
+// Returns nonzero when two elements would be written identically.
+static int svg_list_item_same(svg_list_ptr list, const svg_list_item_t *first, const svg_list_item_t *second){
+    if(first->kind != second->kind || first->string != second->string || first->scope != second->scope){
+        return 0;
+    }
+    for(int column = 0; column < SVG_LIST_COLUMNS[first->kind]; column++){
+        const svg_real_t *values = list->elements[first->kind].columns[column];
+        if(memcmp(&values[first->index], &values[second->index], sizeof(svg_real_t)) != 0){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Marks every element that a later identical element repeats.
+static svg_return_t svg_list_mark_duplicates(svg_list_ptr list, const svg_list_item_t *items,
+                                             size_t count, unsigned char *drops, size_t *dropped){
+    size_t slot_count = 64;
+    while(slot_count < 2 * count){
+        slot_count *= 2;
+    }
+    size_t *slots = (size_t *)svg_list_calloc(list, slot_count, sizeof(size_t));
+    if(!slots){
+        return SVG_ERR_NO_MEM;
+    }
+    // walking backwards keeps the last copy, which is the one on top
+    for(size_t item = count; item-- > 0;){
+        size_t slot = svg_list_item_hash(list, &items[item]) & (slot_count - 1);
+        while(slots[slot] && !svg_list_item_same(list, &items[slots[slot] - 1], &items[item])){
+            slot = (slot + 1) & (slot_count - 1);
+        }
+        if(slots[slot]){
+            drops[item] = SVG_LIST_DUPLICATE;
+            (*dropped)++;
+        }
+        else{
+            slots[slot] = item + 1;
+        }
+    }
+    svg_list_free(list, slots);
+    return SVG_OK;
+}
+
+// Returns the slot holding a grid cell, or the empty slot it would go in.
+static size_t svg_list_grid_slot(const svg_list_grid_t *grid, int level, int64_t column, int64_t row, size_t scope){
+    uint64_t hash = ((uint64_t)column * 0x9e3779b97f4a7c15ull) ^ ((uint64_t)row * 0xc2b2ae3d27d4eb4full)
+        ^ ((uint64_t)scope << 7) ^ (uint64_t)(level - SVG_LIST_GRID_MIN_LEVEL);
+    hash ^= hash >> 31;
+    size_t slot = hash & (grid->slot_count - 1);
+    for(;;){
+        const svg_list_cell_t *cell = &grid->cells[slot];
+        if(!cell->head || (cell->level == level && cell->column == column && cell->row == row && cell->scope == scope)){
+            return slot;
+        }
+        slot = (slot + 1) & (grid->slot_count - 1);
+    }
+}
+
+// Doubles the number of grid cell slots.
+static int svg_list_grid_rehash(svg_list_ptr list, svg_list_grid_t *grid){
+    svg_list_cell_t *old = grid->cells;
+    size_t old_count = grid->slot_count;
+    grid->slot_count = old_count ? 2 * old_count : 1024;
+    grid->cells = (svg_list_cell_t *)svg_list_calloc(list, grid->slot_count, sizeof(svg_list_cell_t));
+    if(!grid->cells){
+        grid->cells = old;
+        grid->slot_count = old_count;
+        return 0;
+    }
+    for(size_t index = 0; index < old_count; index++){
+        if(old[index].head){
+            grid->cells[svg_list_grid_slot(grid, old[index].level, old[index].column, old[index].row, old[index].scope)] = old[index];
+        }
+    }
+    svg_list_free(list, old);
+    return 1;
+}
+
+// Files a covering rectangle in the cells it overlaps on the level of
+// the smallest power of two at least its larger side, which is at most
+// two cells either way. Rectangles too large or too far out are skipped.
+static int svg_list_grid_insert(svg_list_ptr list, svg_list_grid_t *grid, const svg_list_cover_t *cover, size_t scope){
+    if(!(cover->left >= -SVG_LIST_GRID_LIMIT && cover->right <= SVG_LIST_GRID_LIMIT
+        && cover->top >= -SVG_LIST_GRID_LIMIT && cover->bottom <= SVG_LIST_GRID_LIMIT)){
+        return 1;
+    }
+    int level;
+    frexp(fmax(cover->right - cover->left, cover->bottom - cover->top), &level);
+    level = level < SVG_LIST_GRID_MIN_LEVEL ? SVG_LIST_GRID_MIN_LEVEL : level;
+    int64_t left = (int64_t)floor(ldexp(cover->left, -level)), right = (int64_t)floor(ldexp(cover->right, -level));
+    int64_t top = (int64_t)floor(ldexp(cover->top, -level)), bottom = (int64_t)floor(ldexp(cover->bottom, -level));
+    if(!svg_list_grow(list, (void **)&grid->covers, &grid->cover_capacity, grid->cover_count + 1, sizeof(svg_list_cover_t))
+        || !svg_list_grow(list, (void **)&grid->nodes, &grid->node_capacity, grid->node_count + 4, sizeof(svg_list_node_t))){
+        return 0;
+    }
+    grid->covers[grid->cover_count] = *cover;
+    for(int64_t row = top; row <= bottom; row++){
+        for(int64_t column = left; column <= right; column++){
+            if((grid->cell_count + 1) * 2 > grid->slot_count && !svg_list_grid_rehash(list, grid)){
+                return 0;
+            }
+            svg_list_cell_t *cell = &grid->cells[svg_list_grid_slot(grid, level, column, row, scope)];
+            if(!cell->head){
+                cell->level = level;
+                cell->column = column;
+                cell->row = row;
+                cell->scope = scope;
+                grid->cell_count++;
+            }
+            grid->nodes[grid->node_count].cover = grid->cover_count;
+            grid->nodes[grid->node_count].next = cell->head;
+            cell->head = ++grid->node_count;
+        }
+    }
+    grid->cover_count++;
+    grid->levels[level - SVG_LIST_GRID_MIN_LEVEL] = 1;
+    return 1;
+}
+
+// Returns nonzero when a filed rectangle of the same group contains the
+// box. Such a rectangle overlaps the cell holding the box's corner on
+// its own level, so one cell per level is searched.
+static int svg_list_grid_covers(const svg_list_grid_t *grid, const svg_list_cover_t *box, size_t scope){
+    if(!grid->cover_count || !(fabs(box->left) <= SVG_LIST_GRID_LIMIT && fabs(box->top) <= SVG_LIST_GRID_LIMIT)){
+        return 0;
+    }
+    for(int index = 0; index < SVG_LIST_GRID_LEVELS; index++){
+        if(!grid->levels[index]){
+            continue;
+        }
+        int level = index + SVG_LIST_GRID_MIN_LEVEL;
+        int64_t column = (int64_t)floor(ldexp(box->left, -level)), row = (int64_t)floor(ldexp(box->top, -level));
+        for(size_t node = grid->cells[svg_list_grid_slot(grid, level, column, row, scope)].head; node;
+            node = grid->nodes[node - 1].next){
+            const svg_list_cover_t *cover = &grid->covers[grid->nodes[node - 1].cover];
+            if(cover->left <= box->left && cover->top <= box->top
+                && box->right <= cover->right && box->bottom <= cover->bottom){
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Returns the bounding box of an element grown by margin, or zero if its
+// coordinates are not all finite.
+static int svg_list_item_box(svg_list_ptr list, const svg_list_item_t *item, double margin, svg_list_cover_t *box){
+    svg_real_t values[4];
+    for(int column = 0; column < SVG_LIST_COLUMNS[item->kind]; column++){
+        values[column] = list->elements[item->kind].columns[column][item->index];
+        if(!isfinite(values[column])){
+            return 0;
+        }
+    }
+    if(item->kind == SVG_LIST_CIRCLES){
+        svg_real_t radius = values[2];
+        values[2] = values[0] + radius;
+        values[3] = values[1] + radius;
+        values[0] -= radius;
+        values[1] -= radius;
+    }
+    else if(item->kind == SVG_LIST_RECTS){
+        values[2] += values[0];
+        values[3] += values[1];
+    }
+    box->left = fmin(values[0], values[2]) - margin;
+    box->right = fmax(values[0], values[2]) + margin;
+    box->top = fmin(values[1], values[3]) - margin;
+    box->bottom = fmax(values[1], values[3]) + margin;
+    return 1;
+}
+
+// Marks every element inside a later opaque rectangle of its group.
+static svg_return_t svg_list_mark_occluded(svg_list_ptr list, const svg_list_item_t *items, size_t count,
+                                           const unsigned char *plain, unsigned char *drops, size_t *dropped){
+    svg_list_paint_t *paints = (svg_list_paint_t *)svg_list_alloc(list, (list->string_count + 1) * sizeof(svg_list_paint_t));
+    if(!paints){
+        return SVG_ERR_NO_MEM;
+    }
+    svg_list_paint(NULL, &paints[0]);
+    for(size_t index = 0; index < list->string_count; index++){
+        svg_list_paint(list->arena + list->strings[index], &paints[index + 1]);
+    }
+    svg_list_grid_t grid;
+    memset(&grid, 0, sizeof(grid));
+    svg_return_t result = SVG_OK;
+    // later elements paint over earlier ones, so covers are collected back to front
+    for(size_t item = count; item-- > 0 && result == SVG_OK;){
+        const svg_list_paint_t *paint = &paints[items[item].string];
+        svg_list_cover_t box;
+        if(drops[item] || !plain[items[item].scope] || paint->margin < 0
+            || !svg_list_item_box(list, &items[item], paint->margin, &box)){
+            continue;
+        }
+        if(svg_list_grid_covers(&grid, &box, items[item].scope)){
+            drops[item] = SVG_LIST_OCCLUDED;
+            (*dropped)++;
+        }
+        else if(items[item].kind == SVG_LIST_RECTS && paint->opaque){
+            const svg_real_t *const *columns = (const svg_real_t *const *)list->elements[SVG_LIST_RECTS].columns;
+            svg_list_cover_t cover = {
+                columns[0][items[item].index], columns[1][items[item].index],
+                columns[0][items[item].index] + columns[2][items[item].index],
+                columns[1][items[item].index] + columns[3][items[item].index]
+            };
+            // a rectangle without area draws nothing
+            if(cover.right > cover.left && cover.bottom > cover.top && !svg_list_grid_insert(list, &grid, &cover, items[item].scope)){
+                result = SVG_ERR_NO_MEM;
+            }
+        }
+    }
+    svg_list_free(list, grid.covers);
+    svg_list_free(list, grid.nodes);
+    svg_list_free(list, grid.cells);
+    svg_list_free(list, paints);
+    return result;
+}
+
+// Measures the output bytes of the marked elements with the given
+// precision. Only they are drawn, into a measuring context whose length
+// is compared with that of an empty one; each element is written whole
+// wherever it sits, so only its indentation depends on its group.
+static svg_return_t svg_list_measure_drops(svg_list_ptr list, const unsigned char *drops,
+                                           int precision, size_t *bytes){
+    svg_context_ptr context = svg_create_measure(1, 1);
+    svg_context_ptr empty = svg_create_measure(1, 1);
+    svg_return_t result = context && empty ? svg_set_precision(context, precision) : SVG_ERR_NO_MEM;
+    size_t cursors[SVG_LIST_ELEMENT_KINDS] = {0, 0, 0};
+    size_t item = 0, depth = 0, indent = 0;
+    for(size_t index = 0; index < list->op_count && result == SVG_OK; index++){
+        const svg_list_op_t *op = &list->ops[index];
+        if(op->kind == SVG_LIST_GROUP_BEGIN){
+            depth++;
+            continue;
+        }
+        else if(op->kind == SVG_LIST_GROUP_END){
+            depth--;
+            continue;
+        }
+        const char *string = op->string ? list->arena + list->strings[op->string - 1] : NULL;
+        svg_real_t *const *columns = list->elements[op->kind].columns;
+        for(uint32_t element = 0; element < op->count && result == SVG_OK; element++, item++){
+            size_t at = cursors[op->kind]++;
+            if(!drops[item]){
+                continue;
+            }
+            // the measuring context writes every element at the top level
+            indent += 2 * depth;
+            if(op->kind == SVG_LIST_CIRCLES){
+                result = svg_circles(context, columns[0] + at, columns[1] + at, columns[2] + at, 1, string);
+            }
+            else if(op->kind == SVG_LIST_RECTS){
+                result = svg_rects(context, columns[0] + at, columns[1] + at, columns[2] + at, columns[3] + at, 1, string);
+            }
+            else{
+                result = svg_lines(context, columns[0] + at, columns[1] + at, columns[2] + at, columns[3] + at, 1, string);
+            }
+        }
+    }
+    size_t length = 0, base = 0;
+    svg_return_t measured = context ? svg_measure(context, &length) : SVG_ERR_NO_MEM;
+    svg_return_t measured_empty = empty ? svg_measure(empty, &base) : SVG_ERR_NO_MEM;
+    if(result == SVG_OK){
+        result = measured != SVG_OK ? measured : measured_empty;
+    }
+    *bytes = result == SVG_OK ? length - base + indent : 0;
+    return result;
+}
+
+// Removes the marked elements, merging runs that become adjacent.
+static void svg_list_compact(svg_list_ptr list, const unsigned char *drops){
+    size_t reads[SVG_LIST_ELEMENT_KINDS] = {0, 0, 0};
+    size_t writes[SVG_LIST_ELEMENT_KINDS] = {0, 0, 0};
+    size_t item = 0, op_count = 0;
+    for(size_t index = 0; index < list->op_count; index++){
+        svg_list_op_t op = list->ops[index];
+        if(op.kind < SVG_LIST_ELEMENT_KINDS){
+            svg_list_columns_t *elements = &list->elements[op.kind];
+            uint32_t kept = 0;
+            for(uint32_t element = 0; element < op.count; element++, item++, reads[op.kind]++){
+                if(drops[item]){
+                    continue;
+                }
+                for(int column = 0; column < SVG_LIST_COLUMNS[op.kind]; column++){
+                    elements->columns[column][writes[op.kind]] = elements->columns[column][reads[op.kind]];
+                }
+                writes[op.kind]++;
+                kept++;
+            }
+            if(!kept){
+                continue;
+            }
+            op.count = kept;
+            svg_list_op_t *last = op_count ? &list->ops[op_count - 1] : NULL;
+            if(last && last->kind == op.kind && last->string == op.string && last->count <= UINT32_MAX - kept){
+                last->count += kept;
+                continue;
+            }
+        }
+        list->ops[op_count++] = op;
+    }
+    list->op_count = op_count;
+    for(int kind = 0; kind < SVG_LIST_ELEMENT_KINDS; kind++){
+        list->elements[kind].count = writes[kind];
+    }
+}
+
+// Removes elements that cannot change the drawing.
+svg_return_t svg_list_optimize(svg_list_ptr list, int precision, svg_list_savings_t *savings){
+    if(!list){
+        return SVG_ERR_NULL;
+    }
+    else if(list->mapping){
+        return SVG_ERR_STATE;
+    }
+    else if(savings && (precision < SVG_PRECISION_DEFAULT || precision > SVG_PRECISION_MAX)){
+        return SVG_ERR_INVALID_ARG;
+    }
+    size_t count = 0;
+    for(int kind = 0; kind < SVG_LIST_ELEMENT_KINDS; kind++){
+        count += list->elements[kind].count;
+    }
+    svg_list_item_t *items = (svg_list_item_t *)svg_list_calloc(list, count ? count : 1, sizeof(svg_list_item_t));
+    unsigned char *drops = (unsigned char *)svg_list_calloc(list, count ? count : 1, 1);
+    unsigned char *plain = (unsigned char *)svg_list_alloc(list, list->op_count + 1);
+    size_t *scopes = (size_t *)svg_list_calloc(list, list->op_count + 1, sizeof(size_t));
+    if(!items || !drops || !plain || !scopes){
+        svg_list_free(list, items);
+        svg_list_free(list, drops);
+        svg_list_free(list, plain);
+        svg_list_free(list, scopes);
+        return SVG_ERR_NO_MEM;
+    }
+    // number each element and note the group it sits directly in
+    size_t cursors[SVG_LIST_ELEMENT_KINDS] = {0, 0, 0};
+    size_t depth = 0, item = 0;
+    scopes[0] = 0;
+    plain[0] = 1;
+    for(size_t index = 0; index < list->op_count; index++){
+        const svg_list_op_t *op = &list->ops[index];
+        if(op->kind == SVG_LIST_GROUP_BEGIN){
+            const char *attrs = op->string ? list->arena + list->strings[op->string - 1] : NULL;
+            plain[index + 1] = plain[scopes[depth]] && svg_list_plain_group(attrs);
+            scopes[++depth] = index + 1;
+        }
+        else if(op->kind == SVG_LIST_GROUP_END){
+            depth--;
+        }
+        else{
+            for(uint32_t element = 0; element < op->count; element++, item++){
+                items[item].kind = op->kind;
+                items[item].string = op->string;
+                items[item].index = cursors[op->kind]++;
+                items[item].scope = scopes[depth];
+            }
+        }
+    }
+    svg_list_free(list, scopes);
+    size_t duplicates = 0, occluded = 0, bytes = 0;
+    svg_return_t result = svg_list_mark_duplicates(list, items, count, drops, &duplicates);
+    if(result == SVG_OK){
+        result = svg_list_mark_occluded(list, items, count, plain, drops, &occluded);
+    }
+    // the dropped elements are measured before compacting moves them
+    if(result == SVG_OK && savings && duplicates + occluded){
+        result = svg_list_measure_drops(list, drops, precision, &bytes);
+    }
+    if(result == SVG_OK && duplicates + occluded){
+        svg_list_compact(list, drops);
+    }
+    svg_list_free(list, items);
+    svg_list_free(list, drops);
+    svg_list_free(list, plain);
+    if(result == SVG_OK && savings){
+        savings->duplicates = duplicates;
+        savings->occluded = occluded;
+        savings->bytes = bytes;
+    }
+    return result;
+}
+
+// Saves a display list to a file.
+svg_return_t svg_list_save(svg_list_ptr list, const char *path){
+    if(!list || !path){
+        return SVG_ERR_NULL;
+    }
+    svg_list_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SVG_LIST_MAGIC, sizeof(header.magic));
+    header.byte_order = SVG_LIST_BYTE_ORDER;
+    header.version = SVG_LIST_VERSION;
+    header.op_count = list->op_count;
+    for(int kind = 0; kind < SVG_LIST_ELEMENT_KINDS; kind++){
+        header.element_counts[kind] = list->elements[kind].count;
+    }
+    header.string_count = list->string_count;
+    header.arena_length = list->arena_length;
+
+    FILE *file = fopen(path, "wb");
+    if(!file){
+        return SVG_ERR_IO;
+    }
+    int written = fwrite(&header, sizeof(header), 1, file) == 1;
+    for(int kind = 0; kind < SVG_LIST_ELEMENT_KINDS && written; kind++){
+        size_t count = list->elements[kind].count;
+        for(int column = 0; column < SVG_LIST_COLUMNS[kind] && written; column++){
+            written = fwrite(list->elements[kind].columns[column], sizeof(svg_real_t), count, file) == count;
+        }
+    }
+    written = written
+        && fwrite(list->strings, sizeof(uint64_t), list->string_count, file) == list->string_count
+        && fwrite(list->ops, sizeof(svg_list_op_t), list->op_count, file) == list->op_count
+        && fwrite(list->arena, 1, list->arena_length, file) == list->arena_length;
+    if(fclose(file) != 0){
+        written = 0;
+    }
+    return written ? SVG_OK : SVG_ERR_IO;
+}
+
+// Points a list's arrays into a mapped file and checks that replaying it
+// stays in bounds; returns zero if the file is not a valid list.
+static int svg_list_map(svg_list_ptr list, const unsigned char *data, size_t length){
+    svg_list_header_t header;
+    if(length < sizeof(header)){
+        return 0;
+    }
+    memcpy(&header, data, sizeof(header));
+    if(memcmp(header.magic, SVG_LIST_MAGIC, sizeof(header.magic)) != 0
+        || header.byte_order != SVG_LIST_BYTE_ORDER || header.version != SVG_LIST_VERSION){
+        return 0;
+    }
+    // each count is checked against the file size before it is multiplied
+    size_t offset = sizeof(header);
+    for(int kind = 0; kind < SVG_LIST_ELEMENT_KINDS; kind++){
+        svg_list_columns_t *elements = &list->elements[kind];
+        if(header.element_counts[kind] > (length - offset) / sizeof(svg_real_t) / SVG_LIST_COLUMNS[kind]){
+            return 0;
+        }
+        elements->count = header.element_counts[kind];
+        for(int column = 0; column < SVG_LIST_COLUMNS[kind]; column++){
+            elements->columns[column] = (svg_real_t *)(data + offset);
+            offset += elements->count * sizeof(svg_real_t);
+        }
+    }
+    if(header.string_count > (length - offset) / sizeof(uint64_t)){
+        return 0;
+    }
+    list->strings = (uint64_t *)(data + offset);
+    list->string_count = header.string_count;
+    offset += list->string_count * sizeof(uint64_t);
+    if(header.op_count > (length - offset) / sizeof(svg_list_op_t)){
+        return 0;
+    }
+    list->ops = (svg_list_op_t *)(data + offset);
+    list->op_count = header.op_count;
+    offset += list->op_count * sizeof(svg_list_op_t);
+    if(header.arena_length != length - offset){
+        return 0;
+    }
+    list->arena = (char *)(data + offset);
+    list->arena_length = header.arena_length;
+
+    // every string ends inside the arena because the arena ends with a NUL
+    if(list->arena_length && list->arena[list->arena_length - 1] != '\0'){
+        return 0;
+    }
+    for(size_t index = 0; index < list->string_count; index++){
+        if(list->strings[index] >= list->arena_length){
+            return 0;
+        }
+    }
+    uint64_t totals[SVG_LIST_ELEMENT_KINDS] = {0, 0, 0};
+    int64_t depth = 0;
+    for(size_t index = 0; index < list->op_count; index++){
+        const svg_list_op_t *op = &list->ops[index];
+        if(op->kind >= SVG_LIST_KINDS || op->string > list->string_count || op->count == 0){
+            return 0;
+        }
+        if(op->kind < SVG_LIST_ELEMENT_KINDS){
+            totals[op->kind] += op->count;
+        }
+        else if(op->kind == SVG_LIST_GROUP_BEGIN){
+            depth++;
+        }
+        else if(--depth < 0){
+            return 0;
+        }
+    }
+    for(int kind = 0; kind < SVG_LIST_ELEMENT_KINDS; kind++){
+        if(totals[kind] != list->elements[kind].count){
+            return 0;
+        }
+    }
+    list->group_depth = (int)depth;
+    return 1;
+}
+
+// Loads a display list saved by svg_list_save.
+svg_list_ptr svg_list_load(const char *path){
+    if(!path){
+        return NULL;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0){
+        return NULL;
+    }
+    struct stat status;
+    void *mapping = MAP_FAILED;
+    if(fstat(fd, &status) == 0 && status.st_size > 0){
+        mapping = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if(mapping == MAP_FAILED){
+        return NULL;
+    }
+    svg_list_ptr list = svg_list_create();
+    if(!list || !svg_list_map(list, (const unsigned char *)mapping, (size_t)status.st_size)){
+        munmap(mapping, (size_t)status.st_size);
+        // the arrays point into the mapping, so only the list itself is freed
+        if(list){
+            svg_list_free(list, list);
+        }
+        return NULL;
+    }
+    list->mapping = mapping;
+    list->mapping_length = (size_t)status.st_size;
+    return list;
+}
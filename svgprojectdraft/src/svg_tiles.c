@@ -0,0 +1,800 @@
+/**
+ * @file svg_tiles.c
+ * @brief Tiled output for very large canvases.
+ *
+ * Every tile is an ordinary SVG context created on first use whose write
+ * callback passes output to the tile's writer: the drawing thread itself,
+ * or one of a fixed set of threads with a bounded queue each.
+ */
+#include "svg_tiles.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Buffers queued to one writer thread before the drawing thread waits.
+#define SVG_TILES_QUEUE_LIMIT   8
+// Tile files each writer keeps open.
+#define SVG_TILES_OPEN_FILES    32
+// Room for "/tile_<column>_<row>.svg" after the directory.
+#define SVG_TILES_NAME_LENGTH   64
+
+typedef struct svg_tile svg_tile_t;
+
+// A tile's output waiting for its writer thread.
+typedef struct{
+    svg_tile_t *tile;
+    char *data;
+    size_t length;
+} svg_tiles_job_t;
+
+// A tile file held open by a writer.
+typedef struct{
+    svg_tile_t *tile;       // NULL for a free slot
+    FILE *file;
+    uint64_t last_use;
+} svg_tiles_file_t;
+
+// Writes the output of the tiles it owns, on a thread of its own when
+// the tile set has writer threads.
+typedef struct{
+    svg_tiles_ptr tiles;
+    pthread_t thread;
+    int started;                    // nonzero once thread runs
+    pthread_mutex_t lock;
+    pthread_cond_t queued;          // signalled when a job is queued or stop is set
+    pthread_cond_t taken;           // signalled when a job is finished
+    svg_tiles_job_t queue[SVG_TILES_QUEUE_LIMIT];
+    size_t queue_head;
+    size_t queue_count;
+    int stop;                       // nonzero once the thread should exit when idle
+    svg_return_t error;             // first failure writing any of its tiles
+    svg_tiles_file_t files[SVG_TILES_OPEN_FILES];
+    uint64_t clock;                 // file uses so far, orders files for eviction
+} svg_tiles_writer_t;
+
+// A tile drawn into at least once.
+struct svg_tile{
+    svg_tiles_ptr tiles;
+    svg_context_ptr context;
+    size_t column;
+    size_t row;
+    svg_tiles_writer_t *writer;
+    size_t open_depth;      // groups of the tile set's stack open in this tile
+    int file_started;       // nonzero once the tile's file was created; writer only
+};
+
+/**
+ * @brief Opaque tile set.
+ */
+struct SVG_TILES{
+    svg_tiles_options_t options;
+    svg_allocator_t allocator;      // source of all memory the tile set owns
+    char *directory;                // copy of options.directory
+    size_t columns;
+    size_t rows;
+    svg_tile_t **grid;              // columns * rows, NULL for tiles never drawn into
+    svg_tile_t **used;              // tiles in the order they were created
+    size_t used_count;
+    size_t used_capacity;
+    char **groups;                  // attributes of the open groups, NULL entries for none
+    size_t group_depth;
+    size_t group_capacity;
+    svg_tile_t **grouped;           // tiles with at least one group open
+    size_t grouped_count;
+    size_t grouped_capacity;
+    svg_tiles_writer_t *writers;
+    size_t writer_count;
+};
+
+// Allocator of tile sets created without one: the C heap.
+static void *svg_tiles_heap_alloc(void *user, size_t size){
+    (void)user;
+    return malloc(size);
+}
+
+static void *svg_tiles_heap_realloc(void *user, void *pointer, size_t size){
+    (void)user;
+    return realloc(pointer, size);
+}
+
+static void svg_tiles_heap_free(void *user, void *pointer){
+    (void)user;
+    free(pointer);
+}
+
+static const svg_allocator_t svg_tiles_heap_allocator = {
+    svg_tiles_heap_alloc, svg_tiles_heap_realloc, svg_tiles_heap_free, NULL, 1
+};
+
+// Allocates size bytes from the tile set's allocator.
+static void *svg_tiles_alloc(svg_tiles_ptr tiles, size_t size){
+    return tiles->allocator.alloc_fn(tiles->allocator.user, size);
+}
+
+// Allocates count zeroed elements of size bytes from the tile set's allocator.
+static void *svg_tiles_calloc(svg_tiles_ptr tiles, size_t count, size_t size){
+    if(size && count > SIZE_MAX / size){
+        return NULL;
+    }
+    void *pointer = svg_tiles_alloc(tiles, count * size);
+    if(pointer){
+        memset(pointer, 0, count * size);
+    }
+    return pointer;
+}
+
+// Resizes memory from the tile set's allocator; NULL allocates.
+static void *svg_tiles_realloc(svg_tiles_ptr tiles, void *pointer, size_t size){
+    return tiles->allocator.realloc_fn(tiles->allocator.user, pointer, size);
+}
+
+// Returns memory to the tile set's allocator; NULL is ignored.
+static void svg_tiles_free(svg_tiles_ptr tiles, void *pointer){
+    if(pointer){
+        tiles->allocator.free_fn(tiles->allocator.user, pointer);
+    }
+}
+
+// Returns the tile file a writer holds open, opening it when needed.
+static FILE *svg_tiles_file(svg_tiles_writer_t *writer, svg_tile_t *tile){
+    svg_tiles_file_t *slot = &writer->files[0];
+    writer->clock++;
+    for(size_t index = 0; index < SVG_TILES_OPEN_FILES; index++){
+        svg_tiles_file_t *candidate = &writer->files[index];
+        if(candidate->tile == tile){
+            candidate->last_use = writer->clock;
+            return candidate->file;
+        }
+        if(slot->tile && (!candidate->tile || candidate->last_use < slot->last_use)){
+            slot = candidate;
+        }
+    }
+    // the least recently used file is closed and reopened for appending
+    // the next time its tile writes
+    if(slot->tile && fclose(slot->file) != 0){
+        slot->tile = NULL;
+        return NULL;
+    }
+    slot->tile = NULL;
+    svg_tiles_ptr tiles = writer->tiles;
+    size_t path_length = strlen(tiles->directory) + SVG_TILES_NAME_LENGTH;
+    char *path = (char *)svg_tiles_alloc(tiles, path_length);
+    if(!path){
+        return NULL;
+    }
+    snprintf(path, path_length, "%s/tile_%zu_%zu.svg", tiles->directory, tile->column, tile->row);
+    slot->file = fopen(path, tile->file_started ? "ab" : "wb");
+    svg_tiles_free(tiles, path);
+    if(!slot->file){
+        return NULL;
+    }
+    tile->file_started = 1;
+    slot->tile = tile;
+    slot->last_use = writer->clock;
+    return slot->file;
+}
+
+// Index write callback of the directory sink.
+static svg_return_t svg_tiles_file_put(svg_user_context_ptr user, const char *text){
+    return fputs(text, (FILE *)user) >= 0 ? SVG_OK : SVG_ERR_IO;
+}
+
+// Passes output of a tile to its destination.
+static svg_return_t svg_tiles_emit(svg_tiles_writer_t *writer, svg_tile_t *tile, const char *data, size_t length){
+    svg_tiles_ptr tiles = writer->tiles;
+    if(tiles->options.write_fn){
+        return tiles->options.write_fn(tiles->options.user, tile->column, tile->row, data, length);
+    }
+    FILE *file = svg_tiles_file(writer, tile);
+    if(!file || fwrite(data, 1, length, file) != length){
+        return SVG_ERR_IO;
+    }
+    return SVG_OK;
+}
+
+// Body of a writer thread: writes queued jobs in order until stopped.
+static void *svg_tiles_writer_main(void *argument){
+    svg_tiles_writer_t *writer = (svg_tiles_writer_t *)argument;
+    pthread_mutex_lock(&writer->lock);
+    for(;;){
+        while(!writer->queue_count && !writer->stop){
+            pthread_cond_wait(&writer->queued, &writer->lock);
+        }
+        if(!writer->queue_count){
+            break;
+        }
+        svg_tiles_job_t job = writer->queue[writer->queue_head];
+        writer->queue_head = (writer->queue_head + 1) % SVG_TILES_QUEUE_LIMIT;
+        writer->queue_count--;
+        int failed = writer->error != SVG_OK;
+        pthread_mutex_unlock(&writer->lock);
+
+        // after a failure the rest of the writer's output is dropped
+        svg_return_t result = failed ? SVG_OK : svg_tiles_emit(writer, job.tile, job.data, job.length);
+        svg_tiles_free(writer->tiles, job.data);
+
+        pthread_mutex_lock(&writer->lock);
+        if(result != SVG_OK){
+            writer->error = SVG_ERR_IO;
+        }
+        pthread_cond_broadcast(&writer->taken);
+    }
+    pthread_mutex_unlock(&writer->lock);
+    return NULL;
+}
+
+// Write callback of every tile context.
+static svg_return_t svg_tiles_write(svg_user_context_ptr user, const char *data, size_t length){
+    svg_tile_t *tile = (svg_tile_t *)user;
+    svg_tiles_writer_t *writer = tile->writer;
+    if(!writer->started){
+        svg_return_t result = writer->error == SVG_OK ? svg_tiles_emit(writer, tile, data, length) : SVG_ERR_IO;
+        if(result != SVG_OK && writer->error == SVG_OK){
+            writer->error = SVG_ERR_IO;
+        }
+        return result;
+    }
+    // the context reuses its buffer once this returns
+    char *copy = (char *)svg_tiles_alloc(writer->tiles, length ? length : 1);
+    if(!copy){
+        return SVG_ERR_NO_MEM;
+    }
+    memcpy(copy, data, length);
+    pthread_mutex_lock(&writer->lock);
+    while(writer->queue_count == SVG_TILES_QUEUE_LIMIT && writer->error == SVG_OK){
+        pthread_cond_wait(&writer->taken, &writer->lock);
+    }
+    svg_return_t result = writer->error;
+    if(result == SVG_OK){
+        svg_tiles_job_t *job = &writer->queue[(writer->queue_head + writer->queue_count) % SVG_TILES_QUEUE_LIMIT];
+        job->tile = tile;
+        job->data = copy;
+        job->length = length;
+        writer->queue_count++;
+        pthread_cond_signal(&writer->queued);
+    }
+    pthread_mutex_unlock(&writer->lock);
+    if(result != SVG_OK){
+        svg_tiles_free(writer->tiles, copy);
+    }
+    return result;
+}
+
+// Stops a writer thread after its queue is empty and closes its files.
+static svg_return_t svg_tiles_writer_stop(svg_tiles_writer_t *writer){
+    if(writer->started){
+        pthread_mutex_lock(&writer->lock);
+        writer->stop = 1;
+        pthread_cond_signal(&writer->queued);
+        pthread_mutex_unlock(&writer->lock);
+        pthread_join(writer->thread, NULL);
+        writer->started = 0;
+    }
+    for(size_t index = 0; index < SVG_TILES_OPEN_FILES; index++){
+        if(writer->files[index].tile && fclose(writer->files[index].file) != 0 && writer->error == SVG_OK){
+            writer->error = SVG_ERR_IO;
+        }
+        writer->files[index].tile = NULL;
+    }
+    return writer->error;
+}
+
+// Copies a NUL terminated string, keeping NULL.
+static char *svg_tiles_copy(svg_tiles_ptr tiles, const char *text){
+    if(!text){
+        return NULL;
+    }
+    size_t length = strlen(text);
+    char *copy = (char *)svg_tiles_alloc(tiles, length + 1);
+    if(copy){
+        memcpy(copy, text, length + 1);
+    }
+    return copy;
+}
+
+// Appends a tile to a growable array of tiles.
+static svg_return_t svg_tiles_push(svg_tiles_ptr tiles, svg_tile_t ***array, size_t *count, size_t *capacity, svg_tile_t *tile){
+    if(*count == *capacity){
+        size_t grown = *capacity ? *capacity * 2 : 64;
+        svg_tile_t **items = (svg_tile_t **)svg_tiles_realloc(tiles, *array, grown * sizeof(svg_tile_t *));
+        if(!items){
+            return SVG_ERR_NO_MEM;
+        }
+        *array = items;
+        *capacity = grown;
+    }
+    (*array)[(*count)++] = tile;
+    return SVG_OK;
+}
+
+// Creates a tile set.
+svg_tiles_ptr svg_tiles_create(const svg_tiles_options_t *options){
+    if(!options || options->width <= 0 || options->height <= 0 || options->tile_width <= 0
+        || options->tile_height <= 0 || !(options->margin >= 0) || options->threads < 0
+        || (options->write_fn != NULL) == (options->directory != NULL)){
+        return NULL;
+    }
+    int hooks = (options->allocator.alloc_fn != NULL) + (options->allocator.realloc_fn != NULL)
+              + (options->allocator.free_fn != NULL);
+    // writer threads free the buffers the drawing thread allocates
+    if((hooks != 0 && hooks != 3) || (hooks && options->threads && !options->allocator.thread_safe)){
+        return NULL;
+    }
+    const svg_allocator_t *allocator = hooks ? &options->allocator : &svg_tiles_heap_allocator;
+    svg_tiles_ptr tiles = (svg_tiles_ptr)allocator->alloc_fn(allocator->user, sizeof(svg_tiles_t));
+    if(!tiles){
+        return NULL;
+    }
+    memset(tiles, 0, sizeof(svg_tiles_t));
+    tiles->allocator = *allocator;
+    tiles->options = *options;
+    if(!tiles->options.tile_buffer){
+        tiles->options.tile_buffer = SVG_TILES_DEFAULT_BUFFER;
+    }
+    tiles->columns = ((size_t)options->width + (size_t)options->tile_width - 1) / (size_t)options->tile_width;
+    tiles->rows = ((size_t)options->height + (size_t)options->tile_height - 1) / (size_t)options->tile_height;
+    tiles->grid = (svg_tile_t **)svg_tiles_calloc(tiles, tiles->columns * tiles->rows, sizeof(svg_tile_t *));
+    tiles->writer_count = options->threads ? (size_t)options->threads : 1;
+    tiles->writers = (svg_tiles_writer_t *)svg_tiles_calloc(tiles, tiles->writer_count, sizeof(svg_tiles_writer_t));
+    tiles->directory = svg_tiles_copy(tiles, options->directory);
+    if(!tiles->grid || !tiles->writers || (options->directory && !tiles->directory)){
+        svg_tiles_destroy(tiles);
+        return NULL;
+    }
+    for(size_t index = 0; index < tiles->writer_count; index++){
+        svg_tiles_writer_t *writer = &tiles->writers[index];
+        writer->tiles = tiles;
+        if(!options->threads){
+            continue;
+        }
+        pthread_mutex_init(&writer->lock, NULL);
+        pthread_cond_init(&writer->queued, NULL);
+        pthread_cond_init(&writer->taken, NULL);
+        if(pthread_create(&writer->thread, NULL, svg_tiles_writer_main, writer) != 0){
+            pthread_mutex_destroy(&writer->lock);
+            pthread_cond_destroy(&writer->queued);
+            pthread_cond_destroy(&writer->taken);
+            tiles->writer_count = index;
+            svg_tiles_destroy(tiles);
+            return NULL;
+        }
+        writer->started = 1;
+    }
+    return tiles;
+}
+
+// Finishes every tile and destroys a tile set.
+svg_return_t svg_tiles_destroy(svg_tiles_ptr tiles){
+    if(!tiles){
+        return SVG_ERR_NULL;
+    }
+    svg_return_t result = SVG_OK;
+    for(size_t index = 0; index < tiles->used_count; index++){
+        svg_return_t tile_result = svg_destroy(tiles->used[index]->context);
+        if(result == SVG_OK){
+            result = tile_result;
+        }
+    }
+    for(size_t index = 0; tiles->writers && index < tiles->writer_count; index++){
+        svg_tiles_writer_t *writer = &tiles->writers[index];
+        int threaded = writer->started;
+        svg_return_t writer_result = svg_tiles_writer_stop(writer);
+        if(result == SVG_OK){
+            result = writer_result;
+        }
+        if(threaded){
+            pthread_mutex_destroy(&writer->lock);
+            pthread_cond_destroy(&writer->queued);
+            pthread_cond_destroy(&writer->taken);
+        }
+    }
+    if(tiles->directory && tiles->grid && result == SVG_OK){
+        size_t path_length = strlen(tiles->directory) + SVG_TILES_NAME_LENGTH;
+        char *path = (char *)svg_tiles_alloc(tiles, path_length);
+        FILE *file = NULL;
+        if(path){
+            snprintf(path, path_length, "%s/index.svg", tiles->directory);
+            file = fopen(path, "wb");
+            svg_tiles_free(tiles, path);
+        }
+        result = file ? svg_tiles_index(tiles, svg_tiles_file_put, file) : SVG_ERR_IO;
+        if(file && fclose(file) != 0 && result == SVG_OK){
+            result = SVG_ERR_IO;
+        }
+    }
+    for(size_t index = 0; index < tiles->used_count; index++){
+        svg_tiles_free(tiles, tiles->used[index]);
+    }
+    for(size_t index = 0; index < tiles->group_depth; index++){
+        svg_tiles_free(tiles, tiles->groups[index]);
+    }
+    svg_tiles_free(tiles, tiles->used);
+    svg_tiles_free(tiles, tiles->grouped);
+    svg_tiles_free(tiles, tiles->groups);
+    svg_tiles_free(tiles, tiles->grid);
+    svg_tiles_free(tiles, tiles->writers);
+    svg_tiles_free(tiles, tiles->directory);
+    svg_allocator_t allocator = tiles->allocator;
+    allocator.free_fn(allocator.user, tiles);
+    return result;
+}
+
+// Returns a tile, creating its document when it is first drawn into, with
+// every group of the tile set open.
+static svg_tile_t *svg_tiles_enter(svg_tiles_ptr tiles, size_t column, size_t row, svg_return_t *result){
+    size_t slot = row * tiles->columns + column;
+    svg_tile_t *tile = tiles->grid[slot];
+    if(!tile){
+        tile = (svg_tile_t *)svg_tiles_calloc(tiles, 1, sizeof(svg_tile_t));
+        if(!tile){
+            *result = SVG_ERR_NO_MEM;
+            return NULL;
+        }
+        tile->tiles = tiles;
+        tile->column = column;
+        tile->row = row;
+        tile->writer = &tiles->writers[slot % tiles->writer_count];
+        svg_px_t left = (svg_px_t)(column * (size_t)tiles->options.tile_width);
+        svg_px_t top = (svg_px_t)(row * (size_t)tiles->options.tile_height);
+        svg_create_options_t options = {0};
+        options.write_n_fn = svg_tiles_write;
+        options.user = tile;
+        options.allocator = tiles->allocator;
+        options.width = tiles->options.width - left < tiles->options.tile_width
+            ? tiles->options.width - left : tiles->options.tile_width;
+        options.height = tiles->options.height - top < tiles->options.tile_height
+            ? tiles->options.height - top : tiles->options.tile_height;
+        tile->context = svg_create_ex(&options);
+        if(!tile->context || svg_tiles_push(tiles, &tiles->used, &tiles->used_count, &tiles->used_capacity, tile) != SVG_OK){
+            if(tile->context){
+                svg_destroy(tile->context);
+            }
+            svg_tiles_free(tiles, tile);
+            *result = SVG_ERR_NO_MEM;
+            return NULL;
+        }
+        svg_set_flush_threshold(tile->context, tiles->options.tile_buffer);
+        tiles->grid[slot] = tile;
+    }
+    while(tile->open_depth < tiles->group_depth){
+        if(!tile->open_depth
+            && svg_tiles_push(tiles, &tiles->grouped, &tiles->grouped_count, &tiles->grouped_capacity, tile) != SVG_OK){
+            *result = SVG_ERR_NO_MEM;
+            return NULL;
+        }
+        *result = svg_group_begin(tile->context, tiles->groups[tile->open_depth]);
+        if(*result != SVG_OK){
+            return NULL;
+        }
+        tile->open_depth++;
+    }
+    return tile;
+}
+
+// Finds the tiles of one axis that the range [low, high] touches on a
+// canvas of the given extent. Returns zero when it touches none.
+static int svg_tiles_span(double low, double high, svg_px_t extent, svg_px_t tile_size, size_t count,
+                          size_t *first, size_t *last){
+    // comparisons are false for NaN, which touches nothing
+    if(!(high >= 0) || !(low < extent) || !(low <= high)){
+        return 0;
+    }
+    *first = low <= 0 ? 0 : (size_t)(low / tile_size);
+    double end = high / tile_size;
+    *last = end >= (double)(count - 1) ? count - 1 : (size_t)end;
+    return 1;
+}
+
+// Clips the segment (x1, y1)-(x2, y2) to a rectangle by Liang-Barsky.
+// Returns zero when no part of it lies inside.
+static int svg_tiles_clip_line(double *x1, double *y1, double *x2, double *y2,
+                               double left, double top, double right, double bottom){
+    double dx = *x2 - *x1;
+    double dy = *y2 - *y1;
+    double p[4] = {-dx, dx, -dy, dy};
+    double q[4] = {*x1 - left, right - *x1, *y1 - top, bottom - *y1};
+    double enter = 0, leave = 1;
+    for(int edge = 0; edge < 4; edge++){
+        if(p[edge] == 0){
+            if(q[edge] < 0){
+                return 0;
+            }
+            continue;
+        }
+        double t = q[edge] / p[edge];
+        if(p[edge] < 0){
+            if(t > enter){
+                enter = t;
+            }
+        }
+        else if(t < leave){
+            leave = t;
+        }
+    }
+    if(enter > leave){
+        return 0;
+    }
+    double start_x = *x1, start_y = *y1;
+    *x1 = start_x + enter * dx;
+    *y1 = start_y + enter * dy;
+    *x2 = start_x + leave * dx;
+    *y2 = start_y + leave * dy;
+    return 1;
+}
+
+// Draws a run of circles into the tiles they touch.
+svg_return_t svg_tiles_circles(svg_tiles_ptr tiles,
+                               const svg_coord_t *xs,
+                               const svg_coord_t *ys,
+                               const svg_real_t *radii,
+                               size_t count,
+                               const char *style){
+    if(!tiles){
+        return SVG_ERR_NULL;
+    }
+    else if(count && (xs == NULL || ys == NULL || radii == NULL)){
+        return SVG_ERR_INVALID_ARG;
+    }
+    for(size_t index = 0; index < count; index++){
+        if(!(radii[index] > 0)){
+            return SVG_ERR_INVALID_ARG;
+        }
+    }
+    double tile_width = tiles->options.tile_width;
+    double tile_height = tiles->options.tile_height;
+    svg_real_t margin = tiles->options.margin;
+    svg_return_t result = SVG_OK;
+    for(size_t index = 0; index < count && result == SVG_OK; index++){
+        svg_real_t reach = radii[index] + margin;
+        size_t first_column, last_column, first_row, last_row;
+        if(!svg_tiles_span(xs[index] - reach, xs[index] + reach, tiles->options.width, tiles->options.tile_width, tiles->columns, &first_column, &last_column)
+            || !svg_tiles_span(ys[index] - reach, ys[index] + reach, tiles->options.height, tiles->options.tile_height, tiles->rows, &first_row, &last_row)){
+            continue;
+        }
+        for(size_t row = first_row; row <= last_row && result == SVG_OK; row++){
+            double top = row * tile_height;
+            double dy = ys[index] < top ? top - ys[index]
+                : ys[index] > top + tile_height ? ys[index] - top - tile_height : 0;
+            for(size_t column = first_column; column <= last_column && result == SVG_OK; column++){
+                // a circle is repeated whole; the tile's canvas cuts it
+                double left = column * tile_width;
+                double dx = xs[index] < left ? left - xs[index]
+                    : xs[index] > left + tile_width ? xs[index] - left - tile_width : 0;
+                if(dx * dx + dy * dy > reach * reach){
+                    continue;
+                }
+                svg_tile_t *tile = svg_tiles_enter(tiles, column, row, &result);
+                if(tile){
+                    svg_point_t center = {xs[index] - left, ys[index] - top};
+                    result = svg_circle(tile->context, &center, radii[index], style);
+                }
+            }
+        }
+    }
+    return result;
+}
+
+// Draws a run of rectangles, clipped to each tile they touch.
+svg_return_t svg_tiles_rects(svg_tiles_ptr tiles,
+                             const svg_coord_t *xs,
+                             const svg_coord_t *ys,
+                             const svg_coord_t *widths,
+                             const svg_coord_t *heights,
+                             size_t count,
+                             const char *style){
+    if(!tiles){
+        return SVG_ERR_NULL;
+    }
+    else if(count && (xs == NULL || ys == NULL || widths == NULL || heights == NULL)){
+        return SVG_ERR_INVALID_ARG;
+    }
+    for(size_t index = 0; index < count; index++){
+        if(!(widths[index] >= 0 && heights[index] >= 0)){
+            return SVG_ERR_INVALID_ARG;
+        }
+    }
+    double tile_width = tiles->options.tile_width;
+    double tile_height = tiles->options.tile_height;
+    svg_real_t margin = tiles->options.margin;
+    svg_return_t result = SVG_OK;
+    for(size_t index = 0; index < count && result == SVG_OK; index++){
+        svg_real_t right = xs[index] + widths[index];
+        svg_real_t bottom = ys[index] + heights[index];
+        size_t first_column, last_column, first_row, last_row;
+        if(!svg_tiles_span(xs[index] - margin, right + margin, tiles->options.width, tiles->options.tile_width, tiles->columns, &first_column, &last_column)
+            || !svg_tiles_span(ys[index] - margin, bottom + margin, tiles->options.height, tiles->options.tile_height, tiles->rows, &first_row, &last_row)){
+            continue;
+        }
+        for(size_t row = first_row; row <= last_row && result == SVG_OK; row++){
+            double top = row * tile_height;
+            double clip_top = fmax(ys[index], top - margin);
+            double clip_bottom = fmin(bottom, top + tile_height + margin);
+            // a rectangle with area only keeps parts with area
+            if(clip_bottom < clip_top || (clip_bottom == clip_top && heights[index] > 0)){
+                continue;
+            }
+            for(size_t column = first_column; column <= last_column && result == SVG_OK; column++){
+                double left = column * tile_width;
+                double clip_left = fmax(xs[index], left - margin);
+                double clip_right = fmin(right, left + tile_width + margin);
+                if(clip_right < clip_left || (clip_right == clip_left && widths[index] > 0)){
+                    continue;
+                }
+                svg_tile_t *tile = svg_tiles_enter(tiles, column, row, &result);
+                if(tile){
+                    svg_point_t corner = {clip_left - left, clip_top - top};
+                    svg_size_t size = {clip_right - clip_left, clip_bottom - clip_top};
+                    result = svg_rect(tile->context, &corner, &size, style);
+                }
+            }
+        }
+    }
+    return result;
+}
+
+// Draws a run of line segments, clipped to each tile they cross.
+svg_return_t svg_tiles_lines(svg_tiles_ptr tiles,
+                             const svg_coord_t *x1s,
+                             const svg_coord_t *y1s,
+                             const svg_coord_t *x2s,
+                             const svg_coord_t *y2s,
+                             size_t count,
+                             const char *style){
+    if(!tiles){
+        return SVG_ERR_NULL;
+    }
+    else if(count && (x1s == NULL || y1s == NULL || x2s == NULL || y2s == NULL)){
+        return SVG_ERR_INVALID_ARG;
+    }
+    double tile_width = tiles->options.tile_width;
+    double tile_height = tiles->options.tile_height;
+    svg_real_t margin = tiles->options.margin;
+    svg_return_t result = SVG_OK;
+    for(size_t index = 0; index < count && result == SVG_OK; index++){
+        size_t first_column, last_column;
+        if(!svg_tiles_span(fmin(x1s[index], x2s[index]) - margin, fmax(x1s[index], x2s[index]) + margin,
+                           tiles->options.width, tiles->options.tile_width, tiles->columns, &first_column, &last_column)){
+            continue;
+        }
+        for(size_t column = first_column; column <= last_column && result == SVG_OK; column++){
+            // only the rows the segment crosses within this column are visited
+            double left = column * tile_width;
+            double x1 = x1s[index], y1 = y1s[index], x2 = x2s[index], y2 = y2s[index];
+            size_t first_row, last_row;
+            if(!svg_tiles_clip_line(&x1, &y1, &x2, &y2, left - margin, -HUGE_VAL, left + tile_width + margin, HUGE_VAL)
+                || !svg_tiles_span(fmin(y1, y2) - margin, fmax(y1, y2) + margin,
+                                   tiles->options.height, tiles->options.tile_height, tiles->rows, &first_row, &last_row)){
+                continue;
+            }
+            for(size_t row = first_row; row <= last_row && result == SVG_OK; row++){
+                double top = row * tile_height;
+                double cx1 = x1, cy1 = y1, cx2 = x2, cy2 = y2;
+                if(!svg_tiles_clip_line(&cx1, &cy1, &cx2, &cy2, left - margin, top - margin,
+                                        left + tile_width + margin, top + tile_height + margin)){
+                    continue;
+                }
+                svg_tile_t *tile = svg_tiles_enter(tiles, column, row, &result);
+                if(tile){
+                    svg_point_t start = {cx1 - left, cy1 - top};
+                    svg_point_t end = {cx2 - left, cy2 - top};
+                    result = svg_line(tile->context, &start, &end, style);
+                }
+            }
+        }
+    }
+    return result;
+}
+
+// Begins a group in every tile.
+svg_return_t svg_tiles_group_begin(svg_tiles_ptr tiles, const char *attrs){
+    if(!tiles){
+        return SVG_ERR_NULL;
+    }
+    if(tiles->group_depth == tiles->group_capacity){
+        size_t capacity = tiles->group_capacity ? tiles->group_capacity * 2 : 16;
+        char **groups = (char **)svg_tiles_realloc(tiles, tiles->groups, capacity * sizeof(char *));
+        if(!groups){
+            return SVG_ERR_NO_MEM;
+        }
+        tiles->groups = groups;
+        tiles->group_capacity = capacity;
+    }
+    char *copy = svg_tiles_copy(tiles, attrs);
+    if(attrs && !copy){
+        return SVG_ERR_NO_MEM;
+    }
+    // tiles open the group lazily in svg_tiles_enter
+    tiles->groups[tiles->group_depth++] = copy;
+    return SVG_OK;
+}
+
+// Ends the current group in every tile that opened it.
+svg_return_t svg_tiles_group_end(svg_tiles_ptr tiles){
+    if(!tiles){
+        return SVG_ERR_NULL;
+    }
+    else if(!tiles->group_depth){
+        return SVG_ERR_STATE;
+    }
+    tiles->group_depth--;
+    svg_tiles_free(tiles, tiles->groups[tiles->group_depth]);
+    svg_return_t result = SVG_OK;
+    size_t kept = 0;
+    for(size_t index = 0; index < tiles->grouped_count; index++){
+        svg_tile_t *tile = tiles->grouped[index];
+        if(tile->open_depth > tiles->group_depth){
+            svg_return_t tile_result = svg_group_end(tile->context);
+            if(result == SVG_OK){
+                result = tile_result;
+            }
+            tile->open_depth--;
+        }
+        if(tile->open_depth){
+            tiles->grouped[kept++] = tile;
+        }
+    }
+    tiles->grouped_count = kept;
+    return result;
+}
+
+// Writes an index document that places the tiles on the canvas.
+svg_return_t svg_tiles_index(svg_tiles_ptr tiles, svg_write_fn write_fn, svg_user_context_ptr user){
+    if(!tiles || !write_fn){
+        return SVG_ERR_NULL;
+    }
+    char text[256];
+    snprintf(text, sizeof(text),
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<svg width=\"%d\" height=\"%d\" xmlns=\"http://www.w3.org/2000/svg\">\n",
+        tiles->options.width, tiles->options.height);
+    svg_return_t result = write_fn(user, text);
+    for(size_t slot = 0; slot < tiles->columns * tiles->rows && result == SVG_OK; slot++){
+        svg_tile_t *tile = tiles->grid[slot];
+        if(!tile){
+            continue;
+        }
+        svg_px_t left = (svg_px_t)(tile->column * (size_t)tiles->options.tile_width);
+        svg_px_t top = (svg_px_t)(tile->row * (size_t)tiles->options.tile_height);
+        svg_px_t width = tiles->options.width - left < tiles->options.tile_width
+            ? tiles->options.width - left : tiles->options.tile_width;
+        svg_px_t height = tiles->options.height - top < tiles->options.tile_height
+            ? tiles->options.height - top : tiles->options.tile_height;
+        snprintf(text, sizeof(text),
+            "  <image href=\"tile_%zu_%zu.svg\" x=\"%d\" y=\"%d\" width=\"%d\" height=\"%d\" />\n",
+            tile->column, tile->row, left, top, width, height);
+        result = write_fn(user, text);
+    }
+    if(result == SVG_OK){
+        result = write_fn(user, "</svg>\n");
+    }
+    return result;
+}
+
+// Reports the size of the tile grid and how many tiles were drawn.
+svg_return_t svg_tiles_get_grid(svg_tiles_ptr tiles, size_t *columns, size_t *rows, size_t *used){
+    if(!tiles){
+        return SVG_ERR_NULL;
+    }
+    if(columns){
+        *columns = tiles->columns;
+    }
+    if(rows){
+        *rows = tiles->rows;
+    }
+    if(used){
+        *used = tiles->used_count;
+    }
+    return SVG_OK;
+}
+
+// Reports the canvas size of a tile set.
+svg_return_t svg_tiles_get_canvas(svg_tiles_ptr tiles, svg_px_t *width, svg_px_t *height){
+    if(!tiles || !width || !height){
+        return SVG_ERR_NULL;
+    }
+    *width = tiles->options.width;
+    *height = tiles->options.height;
+    return SVG_OK;
+}
@@ -1,7 +1,23 @@
 #include "svg.h"
+#include "svg_arena.h"
+#include "svg_list.h"
+#include "svg_sinks.h"
+#include "svg_tiles.h"
 #include <gtest/gtest.h>
+#include <zlib.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <random>
 #include <string>
+#include <thread>
 #include <vector>
+#include <sys/stat.h>
 
 // Helper structure to capture written SVG strings
 struct STestOutput{
@@ -133,11 +149,13 @@ TEST_F(SVGTest, Line){
 // --- GROUPING TEST ---
 TEST_F(SVGTest, Grouping){
 /**/
-    svg_context_ptr context = svg_create(write_callback, cleanup_callback, &DOutput, 0, 0);
     svg_return_t svg_grouping = svg_group_begin(
-                            context, // context
+                            DContext, // context
                             "stroke:green; stroke-width:2"); // attributes
     EXPECT_EQ(svg_grouping, SVG_OK); 
+    EXPECT_EQ(svg_group_end(DContext), SVG_OK);
+    // closing a group that was never opened
+    EXPECT_EQ(svg_group_end(DContext), SVG_ERR_STATE);
 }
 
 // --- EDGE CASES ---
@@ -150,6 +168,9 @@ TEST_F(SVGTest, ZeroDimensions){
     svg_size_t rect_size = {0, 0};
     EXPECT_EQ(svg_circle(context,&center,0,"fill:none; stroke:green; stroke-width:2"),
         SVG_ERR_INVALID_ARG);
+    // negative and NaN radii are rejected the same way
+    EXPECT_EQ(svg_circle(context,&center,-1,NULL), SVG_ERR_INVALID_ARG);
+    EXPECT_EQ(svg_circle(context,&center,NAN,NULL), SVG_ERR_INVALID_ARG);
     EXPECT_EQ(svg_create(write_callback, cleanup_callback, &DOutput, 0, 0),
         nullptr);
     EXPECT_EQ(svg_line(context,&start,&middle,"stroke:green; stroke-width:2"),
@@ -187,6 +208,8 @@ TEST_F(SVGTest, DestroyEdgeCases){
     svg_context_ptr context = svg_create(write_callback, cleanup_callback, &DOutput, 100, 100);
     svg_return_t destroyed_context = svg_destroy(context);
     EXPECT_EQ(destroyed_context, SVG_OK);
+    // a destroyed context must not be touched again, so only NULL is checked
+    context = nullptr;
     EXPECT_EQ(svg_destroy(context), SVG_ERR_NULL);
 }
 
@@ -202,6 +225,2842 @@ svg_return_t write_error_callback(svg_user_context_ptr user, const char* text){
 
 // --- IO Errors ---
 TEST_F(SVGTest, IOErrorTest){
-    svg_return_t io_error_test = write_error_callback(NULL, "test");
+    int FailureCount = 0;
+    svg_return_t io_error_test = write_error_callback(&FailureCount, "test");
     EXPECT_EQ(io_error_test, SVG_ERR_IO);
-}
\ No newline at end of file
+
+    // the first flush succeeds, every later one fails
+    FailureCount = 1;
+    svg_point_t center = {50,50};
+    svg_context_ptr context = svg_create(write_error_callback, NULL, &FailureCount, 100, 100);
+    ASSERT_NE(context, nullptr);
+    EXPECT_EQ(svg_flush(context), SVG_OK);
+    EXPECT_EQ(svg_circle(context,&center,45,NULL), SVG_OK);
+    EXPECT_EQ(svg_flush(context), SVG_ERR_IO);
+    EXPECT_EQ(svg_destroy(context), SVG_ERR_IO);
+}
+
+// --- OUTPUT BUFFERING ---
+TEST_F(SVGTest, BufferedUntilFlush){
+    svg_point_t center = {50,50};
+    size_t Writes = DOutput.DLines.size();
+    EXPECT_EQ(svg_circle(DContext,&center,45,"fill:none"), SVG_OK);
+    EXPECT_EQ(svg_group_begin(DContext,"id=\"a\""), SVG_OK);
+    EXPECT_EQ(svg_group_end(DContext), SVG_OK);
+    // nothing reaches write_fn until the buffer is flushed
+    EXPECT_EQ(DOutput.DLines.size(), Writes);
+    EXPECT_EQ(svg_flush(DContext), SVG_OK);
+    ASSERT_EQ(DOutput.DLines.size(), Writes + 1);
+    EXPECT_EQ(DOutput.DLines.back(),
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<svg width=\"100\" height=\"100\" xmlns=\"http://www.w3.org/2000/svg\">\n"
+        "  <circle cx=\"50.000000\" cy=\"50.000000\" r=\"45.000000\" style=\"fill:none\"/>\n"
+        "  <g id=\"a\">\n"
+        "  </g>\n");
+    // flushing an empty buffer does not call write_fn
+    EXPECT_EQ(svg_flush(DContext), SVG_OK);
+    EXPECT_EQ(DOutput.DLines.size(), Writes + 1);
+    EXPECT_EQ(svg_flush(NULL), SVG_ERR_NULL);
+}
+
+TEST_F(SVGTest, FlushThreshold){
+    svg_point_t start = {15,55}, end = {80,30};
+    EXPECT_EQ(svg_set_flush_threshold(NULL, 0), SVG_ERR_NULL);
+    // lowering the threshold flushes the pending header right away
+    EXPECT_EQ(svg_set_flush_threshold(DContext, 0), SVG_OK);
+    size_t Writes = DOutput.DLines.size();
+    EXPECT_EQ(svg_line(DContext,&start,&end,NULL), SVG_OK);
+    EXPECT_EQ(svg_line(DContext,&start,&end,NULL), SVG_OK);
+    EXPECT_EQ(DOutput.DLines.size(), Writes + 2);
+    EXPECT_EQ(DOutput.DLines.back(),
+        "  <line x1=\"15.000000\" y1=\"55.000000\" x2=\"80.000000\" y2=\"30.000000\"/>\n");
+
+    EXPECT_EQ(svg_set_flush_threshold(DContext, 4096), SVG_OK);
+    Writes = DOutput.DLines.size();
+    for(int Index = 0; Index < 1000; Index++){
+        EXPECT_EQ(svg_line(DContext,&start,&end,NULL), SVG_OK);
+    }
+    EXPECT_GT(DOutput.DLines.size(), Writes);
+    EXPECT_LT(DOutput.DLines.size(), Writes + 100);
+}
+
+TEST_F(SVGTest, LargeElementGrowsBuffer){
+    svg_point_t center = {50,50};
+    std::string Style(100000, 'x');
+    EXPECT_EQ(svg_circle(DContext,&center,45,Style.c_str()), SVG_OK);
+    EXPECT_EQ(svg_flush(DContext), SVG_OK);
+    EXPECT_NE(DOutput.DLines.back().find(Style), std::string::npos);
+}
+
+TEST_F(SVGTest, DestroyClosesDocument){
+    STestOutput Output;
+    svg_point_t center = {50,50};
+    svg_point_t start = {15,55}, middle = {35,75}, end = {80,30};
+    svg_context_ptr context = svg_create(write_callback, cleanup_callback, &Output, 100, 100);
+    ASSERT_NE(context, nullptr);
+    EXPECT_EQ(svg_circle(context,&center,45,"fill:none; stroke:green; stroke-width:2"), SVG_OK);
+    EXPECT_EQ(svg_line(context,&start,&middle,"stroke:green; stroke-width:2"), SVG_OK);
+    EXPECT_EQ(svg_line(context,&middle,&end,"stroke:green; stroke-width:2"), SVG_OK);
+    EXPECT_EQ(svg_group_begin(context,NULL), SVG_OK);
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+    EXPECT_TRUE(Output.DDestroyed);
+    EXPECT_EQ(Output.DLines.size(), 1u);
+    EXPECT_EQ(Output.JoinOutput(),
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<svg width=\"100\" height=\"100\" xmlns=\"http://www.w3.org/2000/svg\">\n"
+        "  <circle cx=\"50.000000\" cy=\"50.000000\" r=\"45.000000\" style=\"fill:none; stroke:green; stroke-width:2\"/>\n"
+        "  <line x1=\"15.000000\" y1=\"55.000000\" x2=\"35.000000\" y2=\"75.000000\" style=\"stroke:green; stroke-width:2\"/>\n"
+        "  <line x1=\"35.000000\" y1=\"75.000000\" x2=\"80.000000\" y2=\"30.000000\" style=\"stroke:green; stroke-width:2\"/>\n"
+        "  <g>\n"
+        "  </g>\n"
+        "</svg>\n");
+}
+
+// --- NUMBER FORMATTING ---
+std::string FormatReal(svg_real_t value, int precision){
+    char Buffer[SVG_REAL_BUFFER_SIZE];
+    size_t Length = svg_format_real(Buffer, value, precision);
+    EXPECT_EQ(Length, std::strlen(Buffer));
+    return std::string(Buffer, Length);
+}
+
+std::string FormatPrintf(const char *format, int precision, svg_real_t value){
+    char Buffer[SVG_REAL_BUFFER_SIZE];
+    snprintf(Buffer, sizeof(Buffer), format, precision, value);
+    return Buffer;
+}
+
+TEST(SVGFormatTest, FixedPrecision){
+    EXPECT_EQ(FormatReal(50, 2), "50");
+    EXPECT_EQ(FormatReal(12.5, 2), "12.5");
+    EXPECT_EQ(FormatReal(-0.126, 2), "-0.13");
+    // exact ties round like printf
+    EXPECT_EQ(FormatReal(-0.125, 2), "-0.12");
+    EXPECT_EQ(FormatReal(-0.001, 2), "0");
+    EXPECT_EQ(FormatReal(-0.0, 3), "0");
+    EXPECT_EQ(FormatReal(0.999, 2), "1");
+    EXPECT_EQ(FormatReal(1234567.891, 0), "1234568");
+    EXPECT_EQ(FormatReal(1e20, 1), "100000000000000000000");
+}
+
+TEST(SVGFormatTest, DefaultMatchesPrintf){
+    const svg_real_t Values[] = {0, -0.0, 50, 45, 1e-7, -1e-7, 0.5, 2.5, 1e300, -123456.7890125};
+    for(svg_real_t Value : Values){
+        EXPECT_EQ(FormatReal(Value, SVG_PRECISION_DEFAULT), FormatPrintf("%.*lf", 6, Value));
+    }
+    std::mt19937_64 Generator(36);
+    std::uniform_real_distribution<double> Mantissa(-1.0, 1.0);
+    std::uniform_int_distribution<int> Exponent(-8, 12);
+    for(int Index = 0; Index < 100000; Index++){
+        svg_real_t Value = Mantissa(Generator) * std::pow(10.0, Exponent(Generator));
+        ASSERT_EQ(FormatReal(Value, SVG_PRECISION_DEFAULT), FormatPrintf("%.*lf", 6, Value));
+    }
+}
+
+TEST(SVGFormatTest, TrimmedMatchesPrintf){
+    std::mt19937_64 Generator(37);
+    std::uniform_real_distribution<double> Coordinate(-5000.0, 5000.0);
+    for(int Index = 0; Index < 100000; Index++){
+        svg_real_t Value = Coordinate(Generator);
+        int Precision = Index % (SVG_PRECISION_MAX + 1);
+        std::string Expected = FormatPrintf("%.*f", Precision, Value);
+        if(Expected.find('.') != std::string::npos){
+            Expected.erase(Expected.find_last_not_of('0') + 1);
+            if(Expected.back() == '.'){
+                Expected.pop_back();
+            }
+        }
+        if(Expected == "-0"){
+            Expected = "0";
+        }
+        ASSERT_EQ(FormatReal(Value, Precision), Expected) << Precision;
+    }
+}
+
+TEST(SVGFormatTest, ShortestRoundTrips){
+    EXPECT_EQ(FormatReal(50, SVG_PRECISION_SHORTEST), "50");
+    EXPECT_EQ(FormatReal(-0.0, SVG_PRECISION_SHORTEST), "0");
+    EXPECT_EQ(FormatReal(0.1, SVG_PRECISION_SHORTEST), "0.1");
+    EXPECT_EQ(FormatReal(-2.75, SVG_PRECISION_SHORTEST), "-2.75");
+    EXPECT_EQ(FormatReal(0.1 + 0.2, SVG_PRECISION_SHORTEST), "0.30000000000000004");
+    std::mt19937_64 Generator(38);
+    std::uniform_real_distribution<double> Coordinate(-1e7, 1e7);
+    for(int Index = 0; Index < 100000; Index++){
+        svg_real_t Value = Coordinate(Generator);
+        if(Index % 2){
+            Value = std::round(Value * 100) / 100;
+        }
+        std::string Text = FormatReal(Value, SVG_PRECISION_SHORTEST);
+        ASSERT_EQ(std::strtod(Text.c_str(), nullptr), Value) << Text;
+        ASSERT_LE(Text.size(), FormatPrintf("%.*g", 17, Value).size()) << Text;
+    }
+}
+
+TEST_F(SVGTest, Precision){
+    svg_point_t center = {50,50.25};
+    EXPECT_EQ(svg_set_precision(NULL, 2), SVG_ERR_NULL);
+    EXPECT_EQ(svg_set_precision(DContext, SVG_PRECISION_MAX + 1), SVG_ERR_INVALID_ARG);
+    EXPECT_EQ(svg_set_precision(DContext, -3), SVG_ERR_INVALID_ARG);
+    EXPECT_EQ(svg_set_precision(DContext, 1), SVG_OK);
+    EXPECT_EQ(svg_set_flush_threshold(DContext, 0), SVG_OK);
+    EXPECT_EQ(svg_circle(DContext,&center,45,"fill:none"), SVG_OK);
+    EXPECT_EQ(DOutput.DLines.back(), "  <circle cx=\"50\" cy=\"50.2\" r=\"45\" style=\"fill:none\"/>\n");
+    EXPECT_EQ(svg_set_precision(DContext, SVG_PRECISION_SHORTEST), SVG_OK);
+    EXPECT_EQ(svg_circle(DContext,&center,45,NULL), SVG_OK);
+    EXPECT_EQ(DOutput.DLines.back(), "  <circle cx=\"50\" cy=\"50.25\" r=\"45\"/>\n");
+}
+
+// --- BATCHED PRIMITIVES ---
+TEST(SVGBatchTest, MatchesSingleElementCalls){
+    const svg_coord_t Xs[] = {15, 35, 80, 50.5};
+    const svg_coord_t Ys[] = {55, 75, 30, 0};
+    const svg_coord_t Widths[] = {35, 1, 2, 3.25};
+    const svg_coord_t Heights[] = {75, 4, 5, 6};
+    const size_t Count = 4;
+    STestOutput Single, Batch;
+    svg_context_ptr SingleContext = svg_create(write_callback, NULL, &Single, 100, 100);
+    svg_context_ptr BatchContext = svg_create(write_callback, NULL, &Batch, 100, 100);
+    ASSERT_NE(SingleContext, nullptr);
+    ASSERT_NE(BatchContext, nullptr);
+
+    for(size_t Index = 0; Index < Count; Index++){
+        svg_point_t Center = {Xs[Index], Ys[Index]};
+        EXPECT_EQ(svg_circle(SingleContext,&Center,Widths[Index],"fill:red"), SVG_OK);
+    }
+    for(size_t Index = 0; Index < Count; Index++){
+        svg_point_t TopLeft = {Xs[Index], Ys[Index]};
+        svg_size_t Size = {Widths[Index], Heights[Index]};
+        EXPECT_EQ(svg_rect(SingleContext,&TopLeft,&Size,NULL), SVG_OK);
+    }
+    for(size_t Index = 0; Index < Count; Index++){
+        svg_point_t Start = {Xs[Index], Ys[Index]}, End = {Widths[Index], Heights[Index]};
+        EXPECT_EQ(svg_line(SingleContext,&Start,&End,"stroke:green"), SVG_OK);
+    }
+    EXPECT_EQ(svg_circles(BatchContext,Xs,Ys,Widths,Count,"fill:red"), SVG_OK);
+    EXPECT_EQ(svg_rects(BatchContext,Xs,Ys,Widths,Heights,Count,NULL), SVG_OK);
+    EXPECT_EQ(svg_lines(BatchContext,Xs,Ys,Widths,Heights,Count,"stroke:green"), SVG_OK);
+
+    EXPECT_EQ(svg_destroy(SingleContext), SVG_OK);
+    EXPECT_EQ(svg_destroy(BatchContext), SVG_OK);
+    EXPECT_EQ(Batch.JoinOutput(), Single.JoinOutput());
+}
+
+TEST_F(SVGTest, BatchInvalidArguments){
+    const svg_coord_t Xs[] = {1, 2}, Ys[] = {3, 4}, Radii[] = {5, 0};
+    EXPECT_EQ(svg_circles(NULL,Xs,Ys,Radii,2,NULL), SVG_ERR_NULL);
+    EXPECT_EQ(svg_rects(NULL,Xs,Ys,Xs,Ys,2,NULL), SVG_ERR_NULL);
+    EXPECT_EQ(svg_lines(NULL,Xs,Ys,Xs,Ys,2,NULL), SVG_ERR_NULL);
+    EXPECT_EQ(svg_circles(DContext,Xs,NULL,Radii,2,NULL), SVG_ERR_INVALID_ARG);
+    EXPECT_EQ(svg_rects(DContext,Xs,Ys,NULL,Ys,2,NULL), SVG_ERR_INVALID_ARG);
+    EXPECT_EQ(svg_lines(DContext,Xs,Ys,Xs,NULL,2,NULL), SVG_ERR_INVALID_ARG);
+    // empty runs need no arrays
+    EXPECT_EQ(svg_circles(DContext,NULL,NULL,NULL,0,NULL), SVG_OK);
+    // an invalid radius rejects the whole run before anything is written
+    EXPECT_EQ(svg_set_flush_threshold(DContext, 0), SVG_OK);
+    size_t Writes = DOutput.DLines.size();
+    EXPECT_EQ(svg_circles(DContext,Xs,Ys,Radii,2,NULL), SVG_ERR_INVALID_ARG);
+    EXPECT_EQ(DOutput.DLines.size(), Writes);
+}
+
+// --- STREAMED PATHS ---
+TEST_F(SVGTest, Path){
+    svg_point_t start = {15,55}, middle = {35,75}, end = {80,30};
+    svg_point_t points[] = {middle, end};
+    EXPECT_EQ(svg_set_precision(DContext, SVG_PRECISION_SHORTEST), SVG_OK);
+    EXPECT_EQ(svg_path_point(DContext, &start), SVG_ERR_STATE);
+    EXPECT_EQ(svg_path_end(DContext), SVG_ERR_STATE);
+    EXPECT_EQ(svg_path_begin(DContext, "fill:none; stroke:green"), SVG_OK);
+    EXPECT_EQ(svg_path_begin(DContext, NULL), SVG_ERR_STATE);
+    // other elements cannot be nested in a path
+    EXPECT_EQ(svg_line(DContext, &start, &end, NULL), SVG_ERR_STATE);
+    EXPECT_EQ(svg_group_begin(DContext, NULL), SVG_ERR_STATE);
+    EXPECT_EQ(svg_path_point(DContext, NULL), SVG_ERR_INVALID_ARG);
+    EXPECT_EQ(svg_path_point(DContext, &start), SVG_OK);
+    EXPECT_EQ(svg_path_points(DContext, points, 2), SVG_OK);
+    EXPECT_EQ(svg_path_end(DContext), SVG_OK);
+    EXPECT_EQ(svg_path_begin(DContext, NULL), SVG_OK);
+    EXPECT_EQ(svg_path_points(DContext, points, 2), SVG_OK);
+    EXPECT_EQ(svg_flush(DContext), SVG_OK);
+    EXPECT_NE(DOutput.DLines.back().find(
+        "  <path style=\"fill:none; stroke:green\" d=\"M15,55 35,75 80,30\"/>\n"
+        "  <path d=\"M35,75 80,30"), std::string::npos);
+    EXPECT_EQ(svg_path_points(NULL, points, 2), SVG_ERR_NULL);
+    // destroying the context closes the open path
+    EXPECT_EQ(svg_destroy(DContext), SVG_OK);
+    DContext = nullptr;
+    EXPECT_EQ(DOutput.DLines.back(), "\"/>\n</svg>\n");
+}
+
+TEST(SVGPathTest, StreamsAcrossFlushes){
+    STestOutput Output;
+    svg_context_ptr context = svg_create(write_callback, NULL, &Output, 100, 100);
+    ASSERT_NE(context, nullptr);
+    EXPECT_EQ(svg_set_precision(context, 0), SVG_OK);
+    EXPECT_EQ(svg_set_flush_threshold(context, 64), SVG_OK);
+    EXPECT_EQ(svg_path_begin(context, NULL), SVG_OK);
+    std::string Expected = "M";
+    for(int Index = 0; Index < 1000; Index++){
+        svg_point_t Point = {(svg_coord_t)Index, (svg_coord_t)(Index % 7)};
+        EXPECT_EQ(svg_path_point(context, &Point), SVG_OK);
+        Expected += (Index ? " " : "") + std::to_string(Index) + "," + std::to_string(Index % 7);
+    }
+    EXPECT_EQ(svg_path_end(context), SVG_OK);
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+    EXPECT_GT(Output.DLines.size(), 10u);
+    EXPECT_NE(Output.JoinOutput().find("  <path d=\"" + Expected + "\"/>\n</svg>\n"), std::string::npos);
+}
+
+// --- LEVEL OF DETAIL ---
+size_t CountPathVertices(const std::string &output){
+    size_t Start = output.find(" d=\"M");
+    size_t End = output.find('"', Start + 4);
+    if(Start == std::string::npos || End == std::string::npos){
+        return 0;
+    }
+    return std::count(output.begin() + Start, output.begin() + End, ',');
+}
+
+TEST(SVGLodTest, PathKeepsColumnEnvelope){
+    STestOutput Output;
+    svg_context_ptr context = svg_create(write_callback, NULL, &Output, 100, 100);
+    ASSERT_NE(context, nullptr);
+    EXPECT_EQ(svg_set_lod(NULL, 1), SVG_ERR_NULL);
+    EXPECT_EQ(svg_set_lod(context, -1), SVG_ERR_INVALID_ARG);
+    EXPECT_EQ(svg_set_lod(context, 1), SVG_OK);
+    EXPECT_EQ(svg_set_precision(context, SVG_PRECISION_SHORTEST), SVG_OK);
+    EXPECT_EQ(svg_path_begin(context, NULL), SVG_OK);
+    EXPECT_EQ(svg_set_lod(context, 2), SVG_ERR_STATE);
+    const int Samples = 100000;
+    for(int Index = 0; Index < Samples; Index++){
+        svg_point_t Point = {Index * 100.0 / Samples, 50 + 40 * std::sin(Index * 0.01)};
+        EXPECT_EQ(svg_path_point(context, &Point), SVG_OK);
+    }
+    svg_point_t Spike = {99.5, 0};
+    svg_point_t Last = {99.75, 60};
+    EXPECT_EQ(svg_path_point(context, &Spike), SVG_OK);
+    EXPECT_EQ(svg_path_point(context, &Last), SVG_OK);
+    EXPECT_EQ(svg_path_end(context), SVG_OK);
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+    std::string Result = Output.JoinOutput();
+    EXPECT_LE(CountPathVertices(Result), 4u * 100);
+    EXPECT_GE(CountPathVertices(Result), 2u * 100);
+    // the first vertex, the spike and the last vertex all survive
+    EXPECT_NE(Result.find("d=\"M0,50 "), std::string::npos);
+    EXPECT_NE(Result.find(" 99.5,0 "), std::string::npos);
+    EXPECT_NE(Result.find(" 99.75,60\"/>"), std::string::npos);
+}
+
+TEST(SVGLodTest, CollapsesCoveredCircles){
+    STestOutput Output;
+    svg_context_ptr context = svg_create(write_callback, NULL, &Output, 100, 100);
+    ASSERT_NE(context, nullptr);
+    EXPECT_EQ(svg_set_lod(context, 1), SVG_OK);
+    std::vector<svg_coord_t> Xs, Ys, Radii;
+    for(int Index = 0; Index < 1000; Index++){
+        Xs.push_back(10 + (Index % 10) * 0.05);
+        Ys.push_back(20 + (Index / 100) * 0.05);
+        Radii.push_back(2);
+    }
+    // 1000 circles inside one cell collapse into one
+    EXPECT_EQ(svg_circles(context, Xs.data(), Ys.data(), Radii.data(), Xs.size(), "fill:red"), SVG_OK);
+    svg_point_t Center = {10.5, 20.5};
+    EXPECT_EQ(svg_circle(context, &Center, 2, "fill:red"), SVG_OK);
+    // a different style, radius or cell is drawn
+    EXPECT_EQ(svg_circle(context, &Center, 2, "fill:blue"), SVG_OK);
+    EXPECT_EQ(svg_circle(context, &Center, 4, "fill:blue"), SVG_OK);
+    Center.x = 11.5;
+    EXPECT_EQ(svg_circle(context, &Center, 4, "fill:blue"), SVG_OK);
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+    std::string Result = Output.JoinOutput();
+    size_t Circles = 0;
+    for(size_t Position = Result.find("<circle"); Position != std::string::npos; Position = Result.find("<circle", Position + 1)){
+        Circles++;
+    }
+    EXPECT_EQ(Circles, 4u);
+}
+
+TEST(SVGLodTest, DropsRepeatedLines){
+    STestOutput Output;
+    svg_context_ptr context = svg_create(write_callback, NULL, &Output, 100, 100);
+    ASSERT_NE(context, nullptr);
+    svg_point_t start = {15,55}, end = {80,30};
+    svg_point_t nearby_start = {15.2,55.3}, nearby_end = {80.9,30.1};
+    EXPECT_EQ(svg_set_lod(context, 1), SVG_OK);
+    EXPECT_EQ(svg_line(context, &start, &end, NULL), SVG_OK);
+    EXPECT_EQ(svg_line(context, &nearby_start, &nearby_end, NULL), SVG_OK);
+    EXPECT_EQ(svg_line(context, &nearby_start, &nearby_end, "stroke:red"), SVG_OK);
+    EXPECT_EQ(svg_set_lod(context, 0), SVG_OK);
+    EXPECT_EQ(svg_line(context, &start, &end, NULL), SVG_OK);
+    EXPECT_EQ(svg_line(context, &start, &end, NULL), SVG_OK);
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+    std::string Result = Output.JoinOutput();
+    size_t Lines = 0;
+    for(size_t Position = Result.find("<line"); Position != std::string::npos; Position = Result.find("<line", Position + 1)){
+        Lines++;
+    }
+    EXPECT_EQ(Lines, 4u);
+}
+
+TEST(SVGLodTest, DecimatesInterleavedSeries){
+    STestOutput Output;
+    svg_context_ptr context = svg_create(write_callback, NULL, &Output, 100, 100);
+    ASSERT_NE(context, nullptr);
+    EXPECT_EQ(svg_set_lod(context, 1), SVG_OK);
+    // two series alternate point by point over the same ten cells
+    const char *Styles[] = {"fill:red", "fill:blue"};
+    for(int Index = 0; Index < 1000; Index++){
+        svg_point_t Center = {10 + (Index / 2 % 10) + 0.001 * (Index % 97), 20.5};
+        EXPECT_EQ(svg_circle(context, &Center, 2, Styles[Index % 2]), SVG_OK);
+        svg_point_t Start = {30.5, 40.5 + Index % 3}, End = {70.5, 60.5};
+        // a line drawn backwards is the same line
+        if(Index % 4 == 3){
+            std::swap(Start, End);
+        }
+        EXPECT_EQ(svg_line(context, &Start, &End, Styles[Index % 2]), SVG_OK);
+    }
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+    std::string Result = Output.JoinOutput();
+    size_t Circles = 0, Lines = 0;
+    for(size_t Position = Result.find("<circle"); Position != std::string::npos; Position = Result.find("<circle", Position + 1)){
+        Circles++;
+    }
+    for(size_t Position = Result.find("<line"); Position != std::string::npos; Position = Result.find("<line", Position + 1)){
+        Lines++;
+    }
+    // one circle per series and cell, one line per series and start cell
+    EXPECT_EQ(Circles, 2u * 10);
+    EXPECT_EQ(Lines, 2u * 3);
+}
+
+// --- VIEWPORT CULLING ---
+TEST_F(SVGTest, Culling){
+    svg_cull_counts_t Counts;
+    svg_point_t inside = {50,50}, outside = {150,50}, far = {300,300}, edge = {-3,50};
+    svg_size_t unit = {10,10}, back = {-60,10};
+    EXPECT_EQ(svg_set_culling(NULL, 1, 0), SVG_ERR_NULL);
+    EXPECT_EQ(svg_set_culling(DContext, 1, -1), SVG_ERR_INVALID_ARG);
+    EXPECT_EQ(svg_get_cull_counts(DContext, NULL), SVG_ERR_INVALID_ARG);
+    // nothing is culled until culling is turned on
+    EXPECT_EQ(svg_circle(DContext, &outside, 5, NULL), SVG_OK);
+    EXPECT_EQ(svg_set_culling(DContext, 1, 2), SVG_OK);
+    EXPECT_EQ(svg_set_flush_threshold(DContext, 0), SVG_OK);
+    size_t Writes = DOutput.DLines.size();
+    EXPECT_EQ(svg_circle(DContext, &outside, 5, NULL), SVG_OK);
+    EXPECT_EQ(svg_rect(DContext, &outside, &unit, NULL), SVG_OK);
+    EXPECT_EQ(svg_line(DContext, &outside, &far, NULL), SVG_OK);
+    EXPECT_EQ(DOutput.DLines.size(), Writes);
+    // the margin keeps primitives whose stroke may still reach the canvas
+    EXPECT_EQ(svg_circle(DContext, &edge, 2, NULL), SVG_OK);
+    // a rectangle with negative width extends to the left of its corner
+    EXPECT_EQ(svg_rect(DContext, &outside, &back, NULL), SVG_OK);
+    EXPECT_EQ(svg_line(DContext, &inside, &far, NULL), SVG_OK);
+    EXPECT_EQ(DOutput.DLines.size(), Writes + 3);
+    const svg_coord_t Xs[] = {50, 500, 600}, Ys[] = {50, 50, 50}, Radii[] = {1, 1, 1};
+    EXPECT_EQ(svg_circles(DContext, Xs, Ys, Radii, 3, NULL), SVG_OK);
+    EXPECT_EQ(svg_get_cull_counts(DContext, &Counts), SVG_OK);
+    EXPECT_EQ(Counts.circles, 3u);
+    EXPECT_EQ(Counts.rects, 1u);
+    EXPECT_EQ(Counts.lines, 1u);
+
+    // a viewport zoomed onto the far corner culls the canvas instead
+    svg_point_t corner = {250,250};
+    svg_size_t corner_size = {100,100};
+    EXPECT_EQ(svg_set_viewport(DContext, &corner, NULL), SVG_ERR_INVALID_ARG);
+    EXPECT_EQ(svg_set_viewport(DContext, &corner, &corner_size), SVG_OK);
+    Writes = DOutput.DLines.size();
+    EXPECT_EQ(svg_circle(DContext, &inside, 5, NULL), SVG_OK);
+    EXPECT_EQ(svg_circle(DContext, &far, 5, NULL), SVG_OK);
+    EXPECT_EQ(DOutput.DLines.size(), Writes + 1);
+    EXPECT_EQ(svg_set_viewport(DContext, NULL, NULL), SVG_OK);
+    EXPECT_EQ(svg_circle(DContext, &inside, 5, NULL), SVG_OK);
+    EXPECT_EQ(DOutput.DLines.size(), Writes + 2);
+}
+
+// --- STYLE INTERNING ---
+TEST(SVGStyleTest, RegisteredStylesBecomeClasses){
+    STestOutput Output;
+    svg_point_t center = {50,50}, start = {15,55}, end = {80,30};
+    const char *Green = nullptr, *Again = nullptr, *Red = nullptr;
+    svg_context_ptr context = svg_create(write_callback, NULL, &Output, 100, 100);
+    ASSERT_NE(context, nullptr);
+    EXPECT_EQ(svg_style_register(NULL, "fill:none", &Green), SVG_ERR_NULL);
+    EXPECT_EQ(svg_style_register(context, NULL, &Green), SVG_ERR_INVALID_ARG);
+    EXPECT_EQ(svg_style_register(context, "fill:none", NULL), SVG_ERR_INVALID_ARG);
+    EXPECT_EQ(svg_style_register(context, "fill:none; stroke:green", &Green), SVG_OK);
+    EXPECT_EQ(svg_circle(context, &center, 45, Green), SVG_OK);
+    EXPECT_EQ(svg_style_register(context, "fill:none; stroke:green", &Again), SVG_OK);
+    EXPECT_EQ(Again, Green);
+    EXPECT_EQ(svg_style_register(context, "stroke:red", &Red), SVG_OK);
+    EXPECT_EQ(svg_line(context, &start, &end, Red), SVG_OK);
+    EXPECT_EQ(svg_path_begin(context, Green), SVG_OK);
+    EXPECT_EQ(svg_path_point(context, &start), SVG_OK);
+    EXPECT_EQ(svg_path_end(context), SVG_OK);
+    // a handle is not a valid style to register
+    EXPECT_EQ(svg_style_register(context, Red, &Again), SVG_ERR_INVALID_ARG);
+    EXPECT_EQ(svg_flush(context), SVG_OK);
+    // once the header is out, new rules are written where they are registered
+    EXPECT_EQ(svg_style_register(context, "fill:blue", &Again), SVG_OK);
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+    EXPECT_EQ(Output.JoinOutput(),
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<svg width=\"100\" height=\"100\" xmlns=\"http://www.w3.org/2000/svg\">\n"
+        "  <style>\n"
+        "    .s0{fill:none; stroke:green}\n"
+        "    .s1{stroke:red}\n"
+        "  </style>\n"
+        "  <circle cx=\"50.000000\" cy=\"50.000000\" r=\"45.000000\" class=\"s0\"/>\n"
+        "  <line x1=\"15.000000\" y1=\"55.000000\" x2=\"80.000000\" y2=\"30.000000\" class=\"s1\"/>\n"
+        "  <path class=\"s0\" d=\"M15.000000,55.000000\"/>\n"
+        "  <style>.s2{fill:blue}</style>\n"
+        "</svg>\n");
+}
+
+TEST(SVGStyleTest, AutomaticInterning){
+    STestOutput Output;
+    svg_context_ptr context = svg_create(write_callback, NULL, &Output, 100, 100);
+    ASSERT_NE(context, nullptr);
+    EXPECT_EQ(svg_set_style_interning(NULL, 1), SVG_ERR_NULL);
+    EXPECT_EQ(svg_set_style_interning(context, 1), SVG_OK);
+    EXPECT_EQ(svg_set_precision(context, 0), SVG_OK);
+    std::string Style;
+    for(int Index = 0; Index < 200; Index++){
+        // a reused buffer with changing contents must not be confused
+        Style = "fill:#" + std::to_string(100000 + Index % 100);
+        svg_point_t Center = {(svg_coord_t)Index, 1};
+        EXPECT_EQ(svg_circle(context, &Center, 1, Style.c_str()), SVG_OK);
+    }
+    EXPECT_EQ(svg_circle(context, nullptr, 1, "x"), SVG_ERR_INVALID_ARG);
+    svg_point_t Center = {1, 1};
+    EXPECT_EQ(svg_circle(context, &Center, 1, NULL), SVG_OK);
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+    std::string Result = Output.JoinOutput();
+    EXPECT_EQ(Result.find("style=\""), std::string::npos);
+    EXPECT_NE(Result.find("    .s99{fill:#100099}\n  </style>\n"), std::string::npos);
+    EXPECT_EQ(Result.find(".s100"), std::string::npos);
+    EXPECT_NE(Result.find("<circle cx=\"150\" cy=\"1\" r=\"1\" class=\"s50\"/>"), std::string::npos);
+    EXPECT_NE(Result.find("<circle cx=\"1\" cy=\"1\" r=\"1\"/>\n</svg>"), std::string::npos);
+}
+
+// Draws runs that are culled entirely next to runs that are drawn, one
+// element at a time or as batches.
+std::string DrawInternedRuns(bool batched){
+    STestOutput Output;
+    svg_context_ptr context = svg_create(write_callback, NULL, &Output, 100, 100);
+    EXPECT_EQ(svg_set_style_interning(context, 1), SVG_OK);
+    EXPECT_EQ(svg_set_culling(context, 1, 0), SVG_OK);
+    EXPECT_EQ(svg_set_lod(context, 1), SVG_OK);
+    svg_coord_t Xs[] = {500, 20, 520}, Ys[] = {500, 20, 520}, Sizes[] = {5, 5, 5};
+    svg_coord_t Far[] = {500, 600, 700};
+    const char *Styles[] = {"fill:red", "fill:blue"};
+    for(int Run = 0; Run < 2; Run++){
+        // the first run is drawn entirely outside the canvas
+        const svg_coord_t *RunXs = Run ? Xs : Far;
+        if(batched){
+            EXPECT_EQ(svg_circles(context, RunXs, Ys, Sizes, 3, Styles[Run]), SVG_OK);
+            EXPECT_EQ(svg_rects(context, RunXs, Ys, Sizes, Sizes, 3, Styles[Run]), SVG_OK);
+            EXPECT_EQ(svg_lines(context, RunXs, Ys, RunXs, Sizes, 3, Styles[Run]), SVG_OK);
+            continue;
+        }
+        for(int Index = 0; Index < 3; Index++){
+            svg_point_t Center = {RunXs[Index], Ys[Index]}, End = {RunXs[Index], Sizes[Index]};
+            svg_size_t Size = {Sizes[Index], Sizes[Index]};
+            EXPECT_EQ(svg_circle(context, &Center, Sizes[Index], Styles[Run]), SVG_OK);
+            EXPECT_EQ(svg_rect(context, &Center, &Size, Styles[Run]), SVG_OK);
+            EXPECT_EQ(svg_line(context, &Center, &End, Styles[Run]), SVG_OK);
+        }
+    }
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+    return Output.JoinOutput();
+}
+
+TEST(SVGStyleTest, BatchesInternOnlyDrawnRuns){
+    std::string Single = DrawInternedRuns(false);
+    EXPECT_EQ(DrawInternedRuns(true), Single);
+    EXPECT_EQ(Single.find("fill:red"), std::string::npos);
+    EXPECT_NE(Single.find(".s0{fill:blue}"), std::string::npos);
+}
+
+// --- GZIP SINK ---
+// Draws the checkmark scene plus enough elements to span several flushes.
+void DrawScene(svg_context_ptr context){
+    svg_point_t center = {50,50};
+    svg_point_t start = {15,55}, middle = {35,75}, end = {80,30};
+    EXPECT_EQ(svg_circle(context,&center,45,"fill:none; stroke:green; stroke-width:2"), SVG_OK);
+    EXPECT_EQ(svg_line(context,&start,&middle,"stroke:green; stroke-width:2"), SVG_OK);
+    EXPECT_EQ(svg_line(context,&middle,&end,"stroke:green; stroke-width:2"), SVG_OK);
+    for(int Index = 0; Index < 20000; Index++){
+        svg_point_t Point = {(svg_coord_t)(Index % 100), (svg_coord_t)(Index / 200)};
+        EXPECT_EQ(svg_circle(context,&Point,1,"fill:red"), SVG_OK);
+    }
+}
+
+// Reads a whole gzip file back.
+std::string ReadGzip(const char *path){
+    std::string Result;
+    gzFile File = gzopen(path, "rb");
+    if(!File){
+        return Result;
+    }
+    char Chunk[4096];
+    int Length;
+    while((Length = gzread(File, Chunk, sizeof(Chunk))) > 0){
+        Result.append(Chunk, Length);
+    }
+    gzclose(File);
+    return Result;
+}
+
+TEST(SVGGzipTest, MatchesPlainOutput){
+    const char *Path = "testbin/gzip_test.svgz";
+    STestOutput Plain;
+    svg_context_ptr context = svg_create(write_callback, NULL, &Plain, 100, 100);
+    ASSERT_NE(context, nullptr);
+    DrawScene(context);
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+
+    context = svg_create_svgz(Path, 100, 100, 6);
+    ASSERT_NE(context, nullptr);
+    DrawScene(context);
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+    EXPECT_EQ(ReadGzip(Path), Plain.JoinOutput());
+    std::remove(Path);
+}
+
+TEST(SVGGzipTest, InvalidArguments){
+    EXPECT_EQ(svg_gzip_open(NULL, 6), nullptr);
+    EXPECT_EQ(svg_gzip_open("testbin/gzip_test.svgz", 10), nullptr);
+    EXPECT_EQ(svg_gzip_open("no/such/directory/out.svgz", 6), nullptr);
+    EXPECT_EQ(svg_create_svgz("testbin/gzip_test.svgz", 0, 100, 6), nullptr);
+    EXPECT_EQ(svg_gzip_write(NULL, "text"), SVG_ERR_NULL);
+    EXPECT_EQ(svg_gzip_cleanup(NULL), SVG_ERR_NULL);
+}
+
+// --- FILE DESCRIPTOR SINK ---
+// Reads a whole file back.
+std::string ReadFile(const char *path){
+    std::string Result;
+    FILE *File = std::fopen(path, "rb");
+    if(!File){
+        return Result;
+    }
+    char Chunk[4096];
+    size_t Length;
+    while((Length = std::fread(Chunk, 1, sizeof(Chunk), File)) > 0){
+        Result.append(Chunk, Length);
+    }
+    std::fclose(File);
+    return Result;
+}
+
+TEST(SVGFileTest, MatchesPlainOutput){
+    const char *Path = "testbin/file_test.svg";
+    STestOutput Plain;
+    svg_context_ptr context = svg_create(write_callback, NULL, &Plain, 100, 100);
+    ASSERT_NE(context, nullptr);
+    DrawScene(context);
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+
+    // small chunks and a large flush threshold exercise staging, writev
+    // and writing fragments larger than a chunk straight from the buffer
+    const size_t Thresholds[] = {0, 1 << 20};
+    for(int Options = 0; Options < 32; Options++){
+        for(size_t Threshold : Thresholds){
+            svg_file_options_t FileOptions = {(Options & 1) ? 0 : (size_t)5000,
+                                              (Options >> 1) & 1, (Options >> 2) & 1,
+                                              (Options >> 3) & 1, (Options >> 4) & 1};
+            context = svg_create_file(Path, 100, 100, &FileOptions);
+            ASSERT_NE(context, nullptr);
+            if(Threshold){
+                EXPECT_EQ(svg_set_flush_threshold(context, Threshold), SVG_OK);
+            }
+            DrawScene(context);
+            EXPECT_EQ(svg_destroy(context), SVG_OK);
+            EXPECT_EQ(ReadFile(Path), Plain.JoinOutput()) << "options " << Options;
+        }
+    }
+    context = svg_create_file(Path, 100, 100, NULL);
+    ASSERT_NE(context, nullptr);
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+    std::string Empty = ReadFile(Path);
+    EXPECT_EQ(Empty.substr(Empty.size() - 7), "</svg>\n");
+    std::remove(Path);
+}
+
+TEST(SVGFileTest, InvalidArguments){
+    EXPECT_EQ(svg_file_open(NULL, NULL), nullptr);
+    EXPECT_EQ(svg_file_open("no/such/directory/out.svg", NULL), nullptr);
+    EXPECT_EQ(svg_create_file("testbin/file_test.svg", 100, 0, NULL), nullptr);
+    EXPECT_EQ(svg_file_write(NULL, "text"), SVG_ERR_NULL);
+    EXPECT_EQ(svg_file_cleanup(NULL), SVG_ERR_NULL);
+}
+
+// --- MEMORY AND MEASURING CONTEXTS ---
+TEST(SVGMemoryTest, DetachMatchesPlainOutput){
+    STestOutput Plain;
+    svg_context_ptr context = svg_create(write_callback, NULL, &Plain, 100, 100);
+    ASSERT_NE(context, nullptr);
+    DrawScene(context);
+    EXPECT_EQ(svg_group_begin(context, "fill:blue"), SVG_OK);
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+
+    context = svg_create_memory(100, 100);
+    ASSERT_NE(context, nullptr);
+    DrawScene(context);
+    EXPECT_EQ(svg_group_begin(context, "fill:blue"), SVG_OK);
+    EXPECT_EQ(svg_flush(context), SVG_OK);
+    char *Buffer = nullptr;
+    size_t Length = 0;
+    EXPECT_EQ(svg_detach_buffer(context, &Buffer, &Length), SVG_OK);
+    ASSERT_NE(Buffer, nullptr);
+    EXPECT_EQ(std::string(Buffer), Plain.JoinOutput());
+    EXPECT_EQ(Length, Plain.JoinOutput().size());
+    std::free(Buffer);
+}
+
+TEST(SVGMemoryTest, InvalidArguments){
+    STestOutput Output;
+    char *Buffer = nullptr;
+    EXPECT_EQ(svg_create_memory(0, 100), nullptr);
+    EXPECT_EQ(svg_create_measure(100, 0), nullptr);
+    EXPECT_EQ(svg_detach_buffer(NULL, &Buffer, NULL), SVG_ERR_NULL);
+    svg_context_ptr context = svg_create(write_callback, NULL, &Output, 100, 100);
+    ASSERT_NE(context, nullptr);
+    EXPECT_EQ(svg_detach_buffer(context, &Buffer, NULL), SVG_ERR_STATE);
+    EXPECT_EQ(svg_measure(context, NULL), SVG_ERR_NULL);
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+    EXPECT_EQ(svg_measure(NULL, NULL), SVG_ERR_NULL);
+
+    // a memory context can also be discarded
+    context = svg_create_memory(100, 100);
+    ASSERT_NE(context, nullptr);
+    EXPECT_EQ(svg_detach_buffer(context, NULL, NULL), SVG_ERR_NULL);
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+}
+
+TEST(SVGMemoryTest, MeasureIsExact){
+    STestOutput Plain;
+    svg_context_ptr context = svg_create(write_callback, NULL, &Plain, 100, 100);
+    ASSERT_NE(context, nullptr);
+    EXPECT_EQ(svg_set_lod(context, 1), SVG_OK);
+    DrawScene(context);
+    EXPECT_EQ(svg_path_begin(context, "stroke:red"), SVG_OK);
+    for(int Index = 0; Index < 1000; Index++){
+        svg_point_t Point = {Index * 0.01, (svg_coord_t)(Index % 7)};
+        EXPECT_EQ(svg_path_point(context, &Point), SVG_OK);
+    }
+    size_t PlainLength = 0;
+    EXPECT_EQ(svg_measure(context, &PlainLength), SVG_OK);
+    EXPECT_EQ(PlainLength, Plain.JoinOutput().size());
+
+    context = svg_create_measure(100, 100);
+    ASSERT_NE(context, nullptr);
+    EXPECT_EQ(svg_set_lod(context, 1), SVG_OK);
+    DrawScene(context);
+    EXPECT_EQ(svg_path_begin(context, "stroke:red"), SVG_OK);
+    for(int Index = 0; Index < 1000; Index++){
+        svg_point_t Point = {Index * 0.01, (svg_coord_t)(Index % 7)};
+        EXPECT_EQ(svg_path_point(context, &Point), SVG_OK);
+    }
+    size_t Length = 0;
+    EXPECT_EQ(svg_measure(context, &Length), SVG_OK);
+    EXPECT_EQ(Length, PlainLength);
+}
+
+// --- ASYNCHRONOUS WRITING ---
+TEST(SVGAsyncTest, MatchesPlainOutput){
+    STestOutput Plain;
+    svg_context_ptr context = svg_create(write_callback, NULL, &Plain, 100, 100);
+    ASSERT_NE(context, nullptr);
+    DrawScene(context);
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+
+    const size_t BufferCounts[] = {2, 3, 16};
+    for(size_t Buffers : BufferCounts){
+        STestOutput Output;
+        context = svg_create(write_callback, NULL, &Output, 100, 100);
+        ASSERT_NE(context, nullptr);
+        EXPECT_EQ(svg_set_flush_threshold(context, 1000), SVG_OK);
+        EXPECT_EQ(svg_set_async(context, Buffers), SVG_OK);
+        DrawScene(context);
+        EXPECT_EQ(svg_destroy(context), SVG_OK);
+        EXPECT_EQ(Output.JoinOutput(), Plain.JoinOutput()) << Buffers << " buffers";
+    }
+}
+
+TEST(SVGAsyncTest, SwitchingModesKeepsOrder){
+    STestOutput Output;
+    svg_point_t Center = {1, 1};
+    svg_context_ptr context = svg_create(write_callback, NULL, &Output, 100, 100);
+    ASSERT_NE(context, nullptr);
+    EXPECT_EQ(svg_set_flush_threshold(context, 0), SVG_OK);
+    EXPECT_EQ(svg_set_async(context, 2), SVG_OK);
+    EXPECT_EQ(svg_circle(context, &Center, 1, NULL), SVG_OK);
+    EXPECT_EQ(svg_set_async(context, 4), SVG_OK);
+    Center.x = 2;
+    EXPECT_EQ(svg_circle(context, &Center, 1, NULL), SVG_OK);
+    // svg_flush waits for the writer thread
+    EXPECT_EQ(svg_flush(context), SVG_OK);
+    EXPECT_NE(Output.JoinOutput().find("cx=\"2."), std::string::npos);
+    EXPECT_EQ(svg_set_async(context, 0), SVG_OK);
+    Center.x = 3;
+    EXPECT_EQ(svg_circle(context, &Center, 1, NULL), SVG_OK);
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+    std::string Result = Output.JoinOutput();
+    size_t First = Result.find("cx=\"1.");
+    size_t Second = Result.find("cx=\"2.");
+    size_t Third = Result.find("cx=\"3.");
+    EXPECT_LT(First, Second);
+    EXPECT_LT(Second, Third);
+    EXPECT_NE(Third, std::string::npos);
+}
+
+TEST(SVGAsyncTest, DeferredIOError){
+    // the header write succeeds, every later one fails
+    int FailureCount = 1;
+    svg_context_ptr context = svg_create(write_error_callback, NULL, &FailureCount, 100, 100);
+    ASSERT_NE(context, nullptr);
+    EXPECT_EQ(svg_set_async(context, 3), SVG_OK);
+    EXPECT_EQ(svg_flush(context), SVG_OK);
+    EXPECT_EQ(svg_set_flush_threshold(context, 0), SVG_OK);
+    svg_point_t Center = {50, 50};
+    EXPECT_EQ(svg_circle(context, &Center, 45, NULL), SVG_OK);
+    EXPECT_EQ(svg_destroy(context), SVG_ERR_IO);
+
+    FailureCount = 1;
+    context = svg_create(write_error_callback, NULL, &FailureCount, 100, 100);
+    ASSERT_NE(context, nullptr);
+    EXPECT_EQ(svg_set_async(context, 2), SVG_OK);
+    EXPECT_EQ(svg_flush(context), SVG_OK);
+    EXPECT_EQ(svg_circle(context, &Center, 45, NULL), SVG_OK);
+    EXPECT_EQ(svg_flush(context), SVG_ERR_IO);
+    EXPECT_EQ(svg_destroy(context), SVG_ERR_IO);
+}
+
+TEST(SVGAsyncTest, InvalidArguments){
+    EXPECT_EQ(svg_set_async(NULL, 2), SVG_ERR_NULL);
+    svg_context_ptr context = svg_create_memory(100, 100);
+    ASSERT_NE(context, nullptr);
+    EXPECT_EQ(svg_set_async(context, 2), SVG_ERR_STATE);
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+
+    STestOutput Output;
+    context = svg_create(write_callback, NULL, &Output, 100, 100);
+    ASSERT_NE(context, nullptr);
+    EXPECT_EQ(svg_set_async(context, 1), SVG_ERR_INVALID_ARG);
+    EXPECT_EQ(svg_set_async(context, 0), SVG_OK);
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+}
+
+// --- LENGTH-AWARE AND SCATTER-GATHER CALLBACKS ---
+// Output captured through the svg_create_ex() callbacks.
+struct SSpanOutput{
+    std::string DText;
+    size_t DCalls = 0;
+    size_t DSpans = 0;
+};
+
+svg_return_t write_n_callback(svg_user_context_ptr user, const char *data, size_t length){
+    SSpanOutput *OutPtr = static_cast<SSpanOutput *>(user);
+    OutPtr->DText.append(data, length);
+    OutPtr->DCalls++;
+    OutPtr->DSpans++;
+    return SVG_OK;
+}
+
+svg_return_t writev_callback(svg_user_context_ptr user, const svg_span_t *spans, size_t count){
+    SSpanOutput *OutPtr = static_cast<SSpanOutput *>(user);
+    for(size_t Index = 0; Index < count; Index++){
+        OutPtr->DText.append(spans[Index].data, spans[Index].length);
+    }
+    OutPtr->DCalls++;
+    OutPtr->DSpans += count;
+    return SVG_OK;
+}
+
+TEST(SVGWriteTest, MatchesPlainOutput){
+    STestOutput Plain;
+    svg_context_ptr context = svg_create(write_callback, NULL, &Plain, 100, 100);
+    ASSERT_NE(context, nullptr);
+    DrawScene(context);
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+
+    const size_t BufferCounts[] = {0, 2, 16};
+    for(int Vectored = 0; Vectored < 2; Vectored++){
+        for(size_t Buffers : BufferCounts){
+            SSpanOutput Output;
+            svg_create_options_t Options = {};
+            if(Vectored){
+                Options.writev_fn = writev_callback;
+            }
+            else{
+                Options.write_n_fn = write_n_callback;
+            }
+            Options.user = &Output;
+            Options.width = 100;
+            Options.height = 100;
+            context = svg_create_ex(&Options);
+            ASSERT_NE(context, nullptr);
+            EXPECT_EQ(svg_set_flush_threshold(context, 1000), SVG_OK);
+            EXPECT_EQ(svg_set_async(context, Buffers), SVG_OK);
+            DrawScene(context);
+            EXPECT_EQ(svg_destroy(context), SVG_OK);
+            EXPECT_EQ(Output.DText, Plain.JoinOutput()) << Vectored << " " << Buffers << " buffers";
+            // the writer thread may take several buffers per call
+            EXPECT_LE(Output.DCalls, Output.DSpans);
+        }
+    }
+}
+
+TEST(SVGWriteTest, InvalidOptions){
+    STestOutput Output;
+    svg_create_options_t Options = {};
+    EXPECT_EQ(svg_create_ex(NULL), nullptr);
+    Options.width = 100;
+    Options.height = 100;
+    Options.user = &Output;
+    EXPECT_EQ(svg_create_ex(&Options), nullptr);
+    Options.write_fn = write_callback;
+    Options.writev_fn = writev_callback;
+    EXPECT_EQ(svg_create_ex(&Options), nullptr);
+    Options.writev_fn = NULL;
+    Options.height = 0;
+    EXPECT_EQ(svg_create_ex(&Options), nullptr);
+    Options.height = 100;
+    Options.cleanup_fn = cleanup_callback;
+    svg_context_ptr context = svg_create_ex(&Options);
+    ASSERT_NE(context, nullptr);
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+    EXPECT_TRUE(Output.DDestroyed);
+    EXPECT_EQ(Output.JoinOutput().substr(Output.JoinOutput().size() - 7), "</svg>\n");
+}
+
+// --- ALLOCATORS ---
+// The test binary is linked with --wrap for the C heap functions, so
+// every call the library makes to them passes through here.
+static std::atomic<bool> CountingHeap(false);
+static std::atomic<size_t> HeapCalls(0);
+
+extern "C"{
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *pointer, size_t size);
+void __real_free(void *pointer);
+
+void *__wrap_malloc(size_t size){
+    if(CountingHeap){
+        HeapCalls++;
+    }
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size){
+    if(CountingHeap){
+        HeapCalls++;
+    }
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *pointer, size_t size){
+    if(CountingHeap){
+        HeapCalls++;
+    }
+    return __real_realloc(pointer, size);
+}
+
+void __wrap_free(void *pointer){
+    if(CountingHeap && pointer){
+        HeapCalls++;
+    }
+    __real_free(pointer);
+}
+}
+
+// Sink that hashes its output without allocating.
+struct SHashOutput{
+    uint64_t DHash = 14695981039346656037ull;
+    size_t DLength = 0;
+};
+
+svg_return_t hash_write_n(svg_user_context_ptr user, const char *data, size_t length){
+    SHashOutput *OutPtr = static_cast<SHashOutput *>(user);
+    for(size_t Index = 0; Index < length; Index++){
+        OutPtr->DHash = (OutPtr->DHash ^ (unsigned char)data[Index]) * 1099511628211ull;
+    }
+    OutPtr->DLength += length;
+    return SVG_OK;
+}
+
+// Draws a document that uses most of what a context allocates.
+static void DrawAllocatingScene(svg_context_ptr context, int Variant){
+    svg_point_t Points[64];
+    for(int Index = 0; Index < 64; Index++){
+        Points[Index] = {(svg_coord_t)(Index + Variant % 7), (svg_coord_t)((Index * 37) % 100)};
+    }
+    svg_matrix_t Shift = {1, 0, 0, 1, 2, 3};
+    EXPECT_EQ(svg_set_style_interning(context, 1), SVG_OK);
+    EXPECT_EQ(svg_set_lod(context, 0.5), SVG_OK);
+    EXPECT_EQ(svg_group_begin(context, "class=\"points\""), SVG_OK);
+    EXPECT_EQ(svg_transform_push(context, &Shift), SVG_OK);
+    for(int Index = 0; Index < 64; Index++){
+        EXPECT_EQ(svg_circle(context, &Points[Index], 1, (Index & 1) ? "fill:red" : "fill:blue"), SVG_OK);
+    }
+    EXPECT_EQ(svg_transform_pop(context), SVG_OK);
+    EXPECT_EQ(svg_group_end(context), SVG_OK);
+    EXPECT_EQ(svg_path_begin(context, "stroke:black"), SVG_OK);
+    EXPECT_EQ(svg_path_points(context, Points, 64), SVG_OK);
+    EXPECT_EQ(svg_path_end(context), SVG_OK);
+    EXPECT_EQ(svg_density_begin(context, 10), SVG_OK);
+    EXPECT_EQ(svg_density_points(context, Points, 64), SVG_OK);
+    EXPECT_EQ(svg_density_end(context, NULL), SVG_OK);
+    for(int Index = 0; Index < 2000; Index++){
+        svg_point_t Center = {(svg_coord_t)(Index % 100), (svg_coord_t)(Index / 20)};
+        EXPECT_EQ(svg_circle(context, &Center, 2, "fill:green"), SVG_OK);
+    }
+}
+
+TEST(SVGArenaTest, DocumentsMakeNoHeapCalls){
+    svg_arena_ptr Arena = svg_arena_create(4096);
+    ASSERT_NE(Arena, nullptr);
+    svg_create_options_t Options = {};
+    Options.write_n_fn = hash_write_n;
+    Options.width = 100;
+    Options.height = 100;
+    ASSERT_EQ(svg_arena_allocator(Arena, &Options.allocator), SVG_OK);
+
+    SHashOutput Reference;
+    svg_create_options_t HeapOptions = Options;
+    HeapOptions.allocator = svg_allocator_t{};
+    HeapOptions.user = &Reference;
+    svg_context_ptr context = svg_create_ex(&HeapOptions);
+    ASSERT_NE(context, nullptr);
+    DrawAllocatingScene(context, 0);
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+
+    // the first document grows the arena, the rest reuse it
+    size_t Calls = 0;
+    for(int Document = 0; Document < 1000; Document++){
+        SHashOutput Output;
+        Options.user = &Output;
+        HeapCalls = 0;
+        CountingHeap = Document > 0;
+        context = svg_create_ex(&Options);
+        ASSERT_NE(context, nullptr);
+        DrawAllocatingScene(context, Document * 7);
+        EXPECT_EQ(svg_destroy(context), SVG_OK);
+        EXPECT_EQ(svg_arena_reset(Arena), SVG_OK);
+        CountingHeap = false;
+        Calls += HeapCalls;
+        EXPECT_EQ(Output.DHash, Reference.DHash) << "document " << Document;
+        EXPECT_EQ(Output.DLength, Reference.DLength);
+    }
+    EXPECT_EQ(Calls, 0u);
+
+    // the arena is not thread-safe, so its contexts have no shards or producers
+    context = svg_create_ex(&Options);
+    ASSERT_NE(context, nullptr);
+    EXPECT_EQ(svg_shard_create(context), nullptr);
+    EXPECT_EQ(svg_producer_create(context), nullptr);
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+    EXPECT_EQ(svg_arena_reset(Arena), SVG_OK);
+
+    svg_arena_usage_t Usage;
+    EXPECT_EQ(svg_arena_get_usage(Arena, &Usage), SVG_OK);
+    EXPECT_EQ(Usage.used, 0u);
+    EXPECT_GE(Usage.reserved, Usage.peak);
+    EXPECT_GT(Usage.peak, 0u);
+    EXPECT_EQ(svg_arena_destroy(Arena), SVG_OK);
+}
+
+// Allocator hooks that count live allocations, calling the C heap past
+// the wrappers.
+static void *counting_alloc(void *user, size_t size){
+    ++*static_cast<long *>(user);
+    return __real_malloc(size);
+}
+
+static void *counting_realloc(void *user, void *pointer, size_t size){
+    if(!pointer){
+        ++*static_cast<long *>(user);
+    }
+    return __real_realloc(pointer, size);
+}
+
+static void counting_free(void *user, void *pointer){
+    --*static_cast<long *>(user);
+    __real_free(pointer);
+}
+
+TEST(SVGArenaTest, AllocatorSeesEveryAllocation){
+    long Live = 0;
+    SHashOutput Output, Reference;
+    svg_create_options_t Options = {};
+    Options.write_n_fn = hash_write_n;
+    Options.user = &Reference;
+    Options.width = 100;
+    Options.height = 100;
+    svg_context_ptr context = svg_create_ex(&Options);
+    ASSERT_NE(context, nullptr);
+    DrawAllocatingScene(context, 1);
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+
+    Options.user = &Output;
+    // hooks not marked thread-safe keep shards and producers away
+    Options.allocator = {counting_alloc, counting_realloc, counting_free, &Live, 0};
+    context = svg_create_ex(&Options);
+    ASSERT_NE(context, nullptr);
+    EXPECT_EQ(svg_shard_create(context), nullptr);
+    EXPECT_EQ(svg_producer_create(context), nullptr);
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+    EXPECT_EQ(Live, 0);
+
+    Options.allocator.thread_safe = 1;
+    context = svg_create_ex(&Options);
+    ASSERT_NE(context, nullptr);
+    HeapCalls = 0;
+    CountingHeap = true;
+    // shards take their parent's hooks
+    svg_context_ptr Shard = svg_shard_create(context);
+    ASSERT_NE(Shard, nullptr);
+    svg_point_t Center = {5, 5};
+    EXPECT_EQ(svg_circle(Shard, &Center, 1, NULL), SVG_OK);
+    EXPECT_EQ(svg_shard_commit(context, Shard), SVG_OK);
+    DrawAllocatingScene(context, 1);
+    CountingHeap = false;
+    // only the hooks touch the heap
+    EXPECT_EQ(HeapCalls.load(), 0u);
+    EXPECT_GT(Live, 0);
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+    EXPECT_EQ(Live, 0);
+    EXPECT_GT(Output.DLength, Reference.DLength);
+
+    // the hooks come as a set
+    Options.allocator.free_fn = NULL;
+    EXPECT_EQ(svg_create_ex(&Options), nullptr);
+    svg_arena_usage_t Usage;
+    EXPECT_EQ(svg_arena_allocator(NULL, &Options.allocator), SVG_ERR_NULL);
+    EXPECT_EQ(svg_arena_get_usage(NULL, &Usage), SVG_ERR_NULL);
+    EXPECT_EQ(svg_arena_reset(NULL), SVG_ERR_NULL);
+    EXPECT_EQ(svg_arena_destroy(NULL), SVG_ERR_NULL);
+}
+
+// --- SHARDS ---
+// Draws one slice of a scene that mixes element kinds.
+void DrawSlice(svg_context_ptr context, int first, int last){
+    for(int Index = first; Index < last; Index++){
+        svg_point_t Point = {Index * 0.37, (Index % 113) * 1.5};
+        svg_size_t Size = {2, 3};
+        EXPECT_EQ(svg_circle(context, &Point, 1 + Index % 5, "fill:red"), SVG_OK);
+        EXPECT_EQ(svg_rect(context, &Point, &Size, NULL), SVG_OK);
+        if(Index % 100 == 0){
+            EXPECT_EQ(svg_group_begin(context, "id=\"slice\""), SVG_OK);
+            EXPECT_EQ(svg_line(context, &Point, &Point, "stroke:blue"), SVG_OK);
+            EXPECT_EQ(svg_group_end(context), SVG_OK);
+        }
+    }
+}
+
+TEST(SVGShardTest, MatchesSerialOutput){
+    const int Elements = 20000, ShardCount = 4;
+    const size_t Thresholds[] = {0, 65536};
+    for(size_t Threshold : Thresholds){
+        STestOutput Serial;
+        svg_context_ptr context = svg_create(write_callback, NULL, &Serial, 1000, 100);
+        ASSERT_NE(context, nullptr);
+        EXPECT_EQ(svg_set_flush_threshold(context, Threshold), SVG_OK);
+        EXPECT_EQ(svg_set_precision(context, 2), SVG_OK);
+        EXPECT_EQ(svg_set_culling(context, 1, 0), SVG_OK);
+        EXPECT_EQ(svg_group_begin(context, "id=\"data\""), SVG_OK);
+        DrawSlice(context, 0, Elements);
+        svg_cull_counts_t SerialCulled;
+        EXPECT_EQ(svg_get_cull_counts(context, &SerialCulled), SVG_OK);
+        EXPECT_EQ(svg_destroy(context), SVG_OK);
+
+        STestOutput Sharded;
+        context = svg_create(write_callback, NULL, &Sharded, 1000, 100);
+        ASSERT_NE(context, nullptr);
+        EXPECT_EQ(svg_set_flush_threshold(context, Threshold), SVG_OK);
+        EXPECT_EQ(svg_set_precision(context, 2), SVG_OK);
+        EXPECT_EQ(svg_set_culling(context, 1, 0), SVG_OK);
+        EXPECT_EQ(svg_group_begin(context, "id=\"data\""), SVG_OK);
+        svg_context_ptr Shards[ShardCount];
+        std::vector<std::thread> Threads;
+        for(int Index = 0; Index < ShardCount; Index++){
+            Shards[Index] = svg_shard_create(context);
+            ASSERT_NE(Shards[Index], nullptr);
+            Threads.emplace_back(DrawSlice, Shards[Index], Index * Elements / ShardCount, (Index + 1) * Elements / ShardCount);
+        }
+        for(int Index = 0; Index < ShardCount; Index++){
+            Threads[Index].join();
+            EXPECT_EQ(svg_shard_commit(context, Shards[Index]), SVG_OK);
+        }
+        svg_cull_counts_t ShardedCulled;
+        EXPECT_EQ(svg_get_cull_counts(context, &ShardedCulled), SVG_OK);
+        EXPECT_EQ(svg_destroy(context), SVG_OK);
+        EXPECT_EQ(Sharded.JoinOutput(), Serial.JoinOutput());
+        EXPECT_GT(ShardedCulled.circles, 0u);
+        EXPECT_EQ(ShardedCulled.circles, SerialCulled.circles);
+        EXPECT_EQ(ShardedCulled.rects, SerialCulled.rects);
+    }
+}
+
+TEST(SVGShardTest, MemoryParent){
+    svg_context_ptr context = svg_create_memory(100, 100);
+    ASSERT_NE(context, nullptr);
+    svg_context_ptr Shard = svg_shard_create(context);
+    ASSERT_NE(Shard, nullptr);
+    svg_point_t Center = {5, 5};
+    EXPECT_EQ(svg_circle(Shard, &Center, 1, NULL), SVG_OK);
+    EXPECT_EQ(svg_shard_commit(context, Shard), SVG_OK);
+    char *Buffer = nullptr;
+    EXPECT_EQ(svg_detach_buffer(context, &Buffer, NULL), SVG_OK);
+    ASSERT_NE(Buffer, nullptr);
+    EXPECT_NE(std::string(Buffer).find("\">\n  <circle cx=\"5.000000\""), std::string::npos);
+    std::free(Buffer);
+}
+
+TEST(SVGShardTest, InvalidUse){
+    STestOutput Output;
+    svg_context_ptr context = svg_create(write_callback, NULL, &Output, 100, 100);
+    svg_context_ptr Other = svg_create(write_callback, NULL, &Output, 100, 100);
+    ASSERT_NE(context, nullptr);
+    ASSERT_NE(Other, nullptr);
+    EXPECT_EQ(svg_shard_create(NULL), nullptr);
+    EXPECT_EQ(svg_set_lod(context, 1), SVG_OK);
+    EXPECT_EQ(svg_shard_create(context), nullptr);
+    EXPECT_EQ(svg_set_lod(context, 0), SVG_OK);
+    EXPECT_EQ(svg_set_style_interning(context, 1), SVG_OK);
+    EXPECT_EQ(svg_shard_create(context), nullptr);
+    EXPECT_EQ(svg_set_style_interning(context, 0), SVG_OK);
+
+    svg_context_ptr Shard = svg_shard_create(context);
+    ASSERT_NE(Shard, nullptr);
+    const char *Handle = nullptr;
+    EXPECT_EQ(svg_style_register(Shard, "fill:red", &Handle), SVG_ERR_STATE);
+    EXPECT_EQ(svg_set_style_interning(Shard, 1), SVG_ERR_STATE);
+    EXPECT_EQ(svg_group_end(Shard), SVG_ERR_STATE);
+    EXPECT_EQ(svg_shard_commit(NULL, Shard), SVG_ERR_NULL);
+    EXPECT_EQ(svg_shard_commit(Other, Shard), SVG_ERR_INVALID_ARG);
+    EXPECT_EQ(svg_group_begin(Shard, NULL), SVG_OK);
+    EXPECT_EQ(svg_shard_commit(context, Shard), SVG_ERR_STATE);
+    EXPECT_EQ(svg_group_end(Shard), SVG_OK);
+    char *Buffer = nullptr;
+    EXPECT_EQ(svg_detach_buffer(Shard, &Buffer, NULL), SVG_ERR_STATE);
+    EXPECT_EQ(svg_shard_commit(context, Shard), SVG_OK);
+    EXPECT_EQ(svg_destroy(Other), SVG_OK);
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+}
+
+// --- PRODUCERS ---
+// Draws layers of circles tagged with the producer's index.
+void ProduceLayers(svg_context_ptr producer, int index, int layers, int circles){
+    std::string Id = "id=\"p" + std::to_string(index) + "\"";
+    for(int Layer = 0; Layer < layers; Layer++){
+        EXPECT_EQ(svg_group_begin(producer, Id.c_str()), SVG_OK);
+        for(int Circle = 0; Circle < circles; Circle++){
+            svg_point_t Center = {(svg_coord_t)index, (svg_coord_t)(Layer * circles + Circle)};
+            EXPECT_EQ(svg_circle(producer, &Center, 1, NULL), SVG_OK);
+        }
+        EXPECT_EQ(svg_group_end(producer), SVG_OK);
+        svg_point_t Loose = {(svg_coord_t)index, (svg_coord_t)Layer};
+        EXPECT_EQ(svg_circle(producer, &Loose, 2, NULL), SVG_OK);
+    }
+    EXPECT_EQ(svg_destroy(producer), SVG_OK);
+}
+
+TEST(SVGProducerTest, OrderingContract){
+    const int ProducerCount = 4, Layers = 50, Circles = 40;
+    STestOutput Output;
+    svg_context_ptr context = svg_create(write_callback, NULL, &Output, 100, 100);
+    ASSERT_NE(context, nullptr);
+    EXPECT_EQ(svg_set_flush_threshold(context, 500), SVG_OK);
+    EXPECT_EQ(svg_set_precision(context, 0), SVG_OK);
+    std::vector<std::thread> Threads;
+    for(int Index = 0; Index < ProducerCount; Index++){
+        svg_context_ptr Producer = svg_producer_create(context);
+        ASSERT_NE(Producer, nullptr);
+        Threads.emplace_back(ProduceLayers, Producer, Index, Layers, Circles);
+    }
+    // the consumer drains while the producers run
+    for(int Drain = 0; Drain < 100; Drain++){
+        EXPECT_EQ(svg_flush(context), SVG_OK);
+        std::this_thread::yield();
+    }
+    for(auto &Thread : Threads){
+        Thread.join();
+    }
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+
+    // every group holds its own producer's circles, in drawing order
+    std::string Result = Output.JoinOutput();
+    int NextLayer[ProducerCount] = {0};
+    int NextLoose[ProducerCount] = {0};
+    size_t Position = 0;
+    int Groups = 0;
+    while((Position = Result.find("\n  <", Position)) != std::string::npos){
+        Position += 4;
+        int Index, Y, Radius;
+        if(std::sscanf(Result.c_str() + Position, "g id=\"p%d\">", &Index) == 1){
+            Groups++;
+            for(int Circle = 0; Circle < Circles; Circle++){
+                Position = Result.find("\n    <circle", Position);
+                ASSERT_NE(Position, std::string::npos);
+                Position += 5;
+                int CircleIndex;
+                ASSERT_EQ(std::sscanf(Result.c_str() + Position, "<circle cx=\"%d\" cy=\"%d\" r=\"%d\"", &CircleIndex, &Y, &Radius), 3);
+                EXPECT_EQ(CircleIndex, Index);
+                EXPECT_EQ(Y, NextLayer[Index] * Circles + Circle);
+            }
+            NextLayer[Index]++;
+            EXPECT_EQ(Result.compare(Result.find('\n', Position), 8, "\n  </g>\n"), 0);
+        }
+        else if(std::sscanf(Result.c_str() + Position, "circle cx=\"%d\" cy=\"%d\" r=\"%d\"", &Index, &Y, &Radius) == 3){
+            EXPECT_EQ(Radius, 2);
+            EXPECT_EQ(Y, NextLoose[Index]++);
+            EXPECT_EQ(NextLoose[Index], NextLayer[Index]);
+        }
+    }
+    EXPECT_EQ(Groups, ProducerCount * Layers);
+    for(int Index = 0; Index < ProducerCount; Index++){
+        EXPECT_EQ(NextLayer[Index], Layers);
+        EXPECT_EQ(NextLoose[Index], Layers);
+    }
+    EXPECT_EQ(Result.substr(Result.size() - 7), "</svg>\n");
+}
+
+TEST(SVGProducerTest, InvalidUse){
+    STestOutput Output;
+    EXPECT_EQ(svg_producer_create(NULL), nullptr);
+    svg_context_ptr context = svg_create(write_callback, NULL, &Output, 100, 100);
+    ASSERT_NE(context, nullptr);
+    svg_context_ptr Producer = svg_producer_create(context);
+    ASSERT_NE(Producer, nullptr);
+    EXPECT_EQ(svg_producer_create(Producer), nullptr);
+    EXPECT_EQ(svg_shard_commit(context, Producer), SVG_ERR_INVALID_ARG);
+    EXPECT_EQ(svg_set_async(Producer, 2), SVG_ERR_STATE);
+    // an open group is closed when the producer is destroyed
+    EXPECT_EQ(svg_group_begin(Producer, NULL), SVG_OK);
+    EXPECT_EQ(svg_destroy(Producer), SVG_OK);
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+    EXPECT_NE(Output.JoinOutput().find("  <g>\n  </g>\n</svg>\n"), std::string::npos);
+}
+
+// --- DISPLAY LISTS ---
+// Draws DrawScene and DrawSlice into a context with the given precision.
+std::string DrawDirect(int precision){
+    STestOutput Output;
+    svg_context_ptr context = svg_create(write_callback, NULL, &Output, 1000, 100);
+    EXPECT_EQ(svg_set_precision(context, precision), SVG_OK);
+    DrawScene(context);
+    DrawSlice(context, 0, 1000);
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+    return Output.JoinOutput();
+}
+
+// Replays a list into a context with the given precision.
+std::string Replay(svg_list_ptr list, int precision){
+    STestOutput Output;
+    svg_context_ptr context = svg_create(write_callback, NULL, &Output, 1000, 100);
+    EXPECT_EQ(svg_set_precision(context, precision), SVG_OK);
+    EXPECT_EQ(svg_list_replay(list, context), SVG_OK);
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+    return Output.JoinOutput();
+}
+
+TEST(SVGListTest, ReplayMatchesDirectDrawing){
+    svg_list_ptr List = svg_list_create();
+    ASSERT_NE(List, nullptr);
+    svg_context_ptr context = svg_create_recording(List, 1000, 100);
+    ASSERT_NE(context, nullptr);
+    DrawScene(context);
+    DrawSlice(context, 0, 1000);
+    EXPECT_EQ(svg_path_begin(context, NULL), SVG_ERR_STATE);
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+
+    EXPECT_EQ(Replay(List, SVG_PRECISION_DEFAULT), DrawDirect(SVG_PRECISION_DEFAULT));
+    EXPECT_EQ(Replay(List, 1), DrawDirect(1));
+
+    const char *Path = "testbin/list_test.svgl";
+    EXPECT_EQ(svg_list_save(List, Path), SVG_OK);
+    EXPECT_EQ(svg_list_destroy(List), SVG_OK);
+    List = svg_list_load(Path);
+    ASSERT_NE(List, nullptr);
+    EXPECT_EQ(Replay(List, 2), DrawDirect(2));
+    svg_coord_t Value = 1;
+    EXPECT_EQ(svg_list_circles(List, &Value, &Value, &Value, 1, NULL), SVG_ERR_STATE);
+    EXPECT_EQ(svg_list_group_begin(List, NULL), SVG_ERR_STATE);
+    // a loaded list saves back to the same bytes
+    const char *Copy = "testbin/list_copy.svgl";
+    EXPECT_EQ(svg_list_save(List, Copy), SVG_OK);
+    EXPECT_EQ(ReadFile(Copy), ReadFile(Path));
+    EXPECT_EQ(svg_list_destroy(List), SVG_OK);
+    std::remove(Copy);
+    std::remove(Path);
+}
+
+TEST(SVGListTest, RecordsHandlesAsStyleText){
+    svg_context_ptr Owner = svg_create_memory(100, 100);
+    ASSERT_NE(Owner, nullptr);
+    const char *Handle = nullptr, *Raw = "fill:red";
+    ASSERT_EQ(svg_style_register(Owner, "fill:blue", &Handle), SVG_OK);
+    EXPECT_STREQ(svg_style_text(Handle), "fill:blue");
+    EXPECT_EQ(svg_style_text(Raw), Raw);
+    EXPECT_EQ(svg_style_text(NULL), nullptr);
+    svg_list_ptr List = svg_list_create();
+    ASSERT_NE(List, nullptr);
+    svg_coord_t Xs[] = {1, 2}, Ys[] = {3, 4}, Radii[] = {1, 1};
+    EXPECT_EQ(svg_list_circles(List, Xs, Ys, Radii, 1, Handle), SVG_OK);
+    EXPECT_EQ(svg_list_circles(List, Xs + 1, Ys + 1, Radii + 1, 1, "fill:blue"), SVG_OK);
+    // the handle dies with its context, but the list keeps the text
+    EXPECT_EQ(svg_destroy(Owner), SVG_OK);
+
+    STestOutput Output;
+    svg_context_ptr context = svg_create(write_callback, NULL, &Output, 100, 100);
+    ASSERT_NE(context, nullptr);
+    EXPECT_EQ(svg_set_precision(context, 0), SVG_OK);
+    EXPECT_EQ(svg_list_replay(List, context), SVG_OK);
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+    EXPECT_NE(Output.JoinOutput().find("  <circle cx=\"1\" cy=\"3\" r=\"1\" style=\"fill:blue\"/>\n"
+                                       "  <circle cx=\"2\" cy=\"4\" r=\"1\" style=\"fill:blue\"/>\n"),
+              std::string::npos) << Output.JoinOutput();
+    EXPECT_EQ(svg_list_destroy(List), SVG_OK);
+}
+
+TEST(SVGListTest, GroupsAndRuns){
+    svg_list_ptr List = svg_list_create();
+    ASSERT_NE(List, nullptr);
+    svg_coord_t Xs[] = {1, 2, 3}, Ys[] = {4, 5, 6}, Radii[] = {1, 1, 0};
+    EXPECT_EQ(svg_list_group_end(List), SVG_ERR_STATE);
+    EXPECT_EQ(svg_list_circles(List, Xs, Ys, Radii, 3, NULL), SVG_ERR_INVALID_ARG);
+    EXPECT_EQ(svg_list_circles(List, NULL, Ys, Radii, 2, NULL), SVG_ERR_INVALID_ARG);
+    EXPECT_EQ(svg_list_group_begin(List, "id=\"layer\""), SVG_OK);
+    EXPECT_EQ(svg_list_circles(List, Xs, Ys, Radii, 2, "fill:red"), SVG_OK);
+    EXPECT_EQ(svg_list_circles(List, Xs, Ys, Radii, 1, NULL), SVG_OK);
+    EXPECT_EQ(svg_list_lines(List, Xs, Ys, Ys, Xs, 3, "stroke:red"), SVG_OK);
+    EXPECT_EQ(svg_list_group_end(List), SVG_OK);
+    EXPECT_EQ(svg_list_rects(List, Xs, Ys, Xs, Ys, 3, NULL), SVG_OK);
+    // a group left open stays open until the context closes it
+    EXPECT_EQ(svg_list_group_begin(List, NULL), SVG_OK);
+
+    STestOutput Output;
+    svg_context_ptr context = svg_create(write_callback, NULL, &Output, 100, 100);
+    ASSERT_NE(context, nullptr);
+    EXPECT_EQ(svg_set_precision(context, 0), SVG_OK);
+    EXPECT_EQ(svg_list_replay(List, context), SVG_OK);
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+    std::string Result = Output.JoinOutput();
+    EXPECT_NE(Result.find("  <g id=\"layer\">\n"
+                          "    <circle cx=\"1\" cy=\"4\" r=\"1\" style=\"fill:red\"/>\n"
+                          "    <circle cx=\"2\" cy=\"5\" r=\"1\" style=\"fill:red\"/>\n"
+                          "    <circle cx=\"1\" cy=\"4\" r=\"1\"/>\n"
+                          "    <line x1=\"1\" y1=\"4\" x2=\"4\" y2=\"1\" style=\"stroke:red\"/>\n"), std::string::npos);
+    EXPECT_NE(Result.find("  </g>\n  <rect x=\"1\" y=\"4\" width=\"1\" height=\"4\"/>\n"), std::string::npos);
+    EXPECT_NE(Result.find("  <rect x=\"3\" y=\"6\" width=\"3\" height=\"6\"/>\n  <g>\n  </g>\n</svg>\n"), std::string::npos);
+    EXPECT_EQ(svg_list_destroy(List), SVG_OK);
+}
+
+TEST(SVGListTest, AllocatesWithHooks){
+    long Live = 0;
+    svg_allocator_t Allocator = {counting_alloc, counting_realloc, counting_free, &Live, 0};
+    HeapCalls = 0;
+    CountingHeap = true;
+    svg_list_ptr List = svg_list_create_ex(&Allocator);
+    CountingHeap = false;
+    ASSERT_NE(List, nullptr);
+    std::vector<svg_coord_t> Xs(1000, 5), Ys(1000, 5), Sizes(1000, 10);
+    CountingHeap = true;
+    EXPECT_EQ(svg_list_group_begin(List, "id=\"layer\""), SVG_OK);
+    EXPECT_EQ(svg_list_circles(List, Xs.data(), Ys.data(), Sizes.data(), Xs.size(), "fill:red"), SVG_OK);
+    EXPECT_EQ(svg_list_rects(List, Xs.data(), Ys.data(), Sizes.data(), Sizes.data(), Xs.size(), "fill:blue"), SVG_OK);
+    EXPECT_EQ(svg_list_group_end(List), SVG_OK);
+    EXPECT_EQ(svg_list_optimize(List, 2, NULL), SVG_OK);
+    CountingHeap = false;
+    EXPECT_EQ(HeapCalls.load(), 0u);
+    EXPECT_GT(Live, 0);
+    EXPECT_EQ(svg_list_destroy(List), SVG_OK);
+    EXPECT_EQ(Live, 0);
+
+    // the hooks come as a set
+    Allocator.realloc_fn = NULL;
+    EXPECT_EQ(svg_list_create_ex(&Allocator), nullptr);
+    List = svg_list_create_ex(NULL);
+    ASSERT_NE(List, nullptr);
+    EXPECT_EQ(svg_list_destroy(List), SVG_OK);
+}
+
+TEST(SVGListTest, RejectsInvalidFiles){
+    const char *Path = "testbin/list_test.svgl";
+    svg_list_ptr List = svg_list_create();
+    ASSERT_NE(List, nullptr);
+    svg_coord_t Value = 1;
+    EXPECT_EQ(svg_list_circles(List, &Value, &Value, &Value, 1, "fill:red"), SVG_OK);
+    EXPECT_EQ(svg_list_save(List, Path), SVG_OK);
+    EXPECT_EQ(svg_list_destroy(List), SVG_OK);
+    std::string Saved = ReadFile(Path);
+
+    // every truncation, and a file with a corrupted run, is rejected
+    for(size_t Length = 0; Length < Saved.size(); Length++){
+        FILE *File = std::fopen(Path, "wb");
+        ASSERT_NE(File, nullptr);
+        std::fwrite(Saved.data(), 1, Length, File);
+        std::fclose(File);
+        EXPECT_EQ(svg_list_load(Path), nullptr) << Length << " bytes";
+    }
+    std::string Corrupt = Saved;
+    Corrupt[64 + 3 * sizeof(svg_real_t) + sizeof(uint64_t) + 8] = 2;
+    FILE *File = std::fopen(Path, "wb");
+    ASSERT_NE(File, nullptr);
+    std::fwrite(Corrupt.data(), 1, Corrupt.size(), File);
+    std::fclose(File);
+    EXPECT_EQ(svg_list_load(Path), nullptr);
+    std::remove(Path);
+
+    EXPECT_EQ(svg_list_load("no/such/file.svgl"), nullptr);
+    EXPECT_EQ(svg_list_load(NULL), nullptr);
+    EXPECT_EQ(svg_list_destroy(NULL), SVG_ERR_NULL);
+    EXPECT_EQ(svg_list_replay(NULL, NULL), SVG_ERR_NULL);
+    EXPECT_EQ(svg_create_recording(NULL, 100, 100), nullptr);
+}
+
+TEST(SVGListTest, OptimizeDropsDuplicates){
+    svg_list_ptr List = svg_list_create();
+    ASSERT_NE(List, nullptr);
+    svg_coord_t One = 1, Five = 5, Zero = 0;
+    EXPECT_EQ(svg_list_circles(List, &One, &One, &One, 1, "fill:red"), SVG_OK);
+    EXPECT_EQ(svg_list_circles(List, &Five, &Five, &One, 1, "fill:blue"), SVG_OK);
+    EXPECT_EQ(svg_list_circles(List, &One, &One, &One, 1, "fill:red"), SVG_OK);
+    EXPECT_EQ(svg_list_circles(List, &One, &One, &One, 1, "fill:blue"), SVG_OK);
+    // the same line in two groups is kept in both
+    for(int Group = 0; Group < 2; Group++){
+        EXPECT_EQ(svg_list_group_begin(List, "id=\"a\""), SVG_OK);
+        EXPECT_EQ(svg_list_lines(List, &Zero, &Zero, &One, &One, 1, "stroke:red"), SVG_OK);
+        EXPECT_EQ(svg_list_group_end(List), SVG_OK);
+    }
+    svg_list_savings_t Savings;
+    EXPECT_EQ(svg_list_optimize(List, 0, &Savings), SVG_OK);
+    EXPECT_EQ(Savings.duplicates, 1u);
+    EXPECT_EQ(Savings.occluded, 0u);
+    EXPECT_EQ(Savings.bytes, std::strlen("  <circle cx=\"1\" cy=\"1\" r=\"1\" style=\"fill:red\"/>\n"));
+    std::string Result = Replay(List, 0);
+    EXPECT_NE(Result.find("\">\n"
+                          "  <circle cx=\"5\" cy=\"5\" r=\"1\" style=\"fill:blue\"/>\n"
+                          "  <circle cx=\"1\" cy=\"1\" r=\"1\" style=\"fill:red\"/>\n"
+                          "  <circle cx=\"1\" cy=\"1\" r=\"1\" style=\"fill:blue\"/>\n"
+                          "  <g id=\"a\">\n"
+                          "    <line x1=\"0\" y1=\"0\" x2=\"1\" y2=\"1\" style=\"stroke:red\"/>\n"
+                          "  </g>\n"
+                          "  <g id=\"a\">\n"), std::string::npos);
+    EXPECT_EQ(svg_list_destroy(List), SVG_OK);
+}
+
+// Records a scene with elements hidden under opaque rectangles, leaving
+// out the hidden ones unless all is set.
+static void DrawOccluded(svg_list_ptr list, bool all){
+    auto Circle = [list](svg_coord_t x, svg_coord_t y, svg_real_t r, const char *style){
+        EXPECT_EQ(svg_list_circles(list, &x, &y, &r, 1, style), SVG_OK);
+    };
+    auto Rect = [list](svg_coord_t x, svg_coord_t y, svg_coord_t w, svg_coord_t h, const char *style){
+        EXPECT_EQ(svg_list_rects(list, &x, &y, &w, &h, 1, style), SVG_OK);
+    };
+    if(all){
+        Circle(50, 50, 5, NULL);
+        Circle(50, 50, 5, "stroke:black; stroke-width:40");
+    }
+    Circle(50, 50, 5, "stroke:black; stroke-width:80px");
+    Circle(95, 50, 10, NULL);
+    Rect(20, 20, 10, 10, "fill:red; filter:url(#f)");
+    if(all){
+        svg_coord_t X1 = 20, Y1 = 20, X2 = 30, Y2 = 30;
+        EXPECT_EQ(svg_list_lines(list, &X1, &Y1, &X2, &Y2, 1, "stroke:red"), SVG_OK);
+    }
+    Rect(0, 0, 100, 100, "fill:white; fill-opacity:0.5");
+    if(all){
+        Rect(30, 30, 10, 10, "fill:rgba(0,0,0,0.5)");
+    }
+    // translucent rectangles hide nothing
+    Circle(200, 200, 1, NULL);
+    Rect(195, 195, 10, 10, "fill:rgba(0,0,0,0.5)");
+    Rect(10, 10, 80, 80, "fill: #fff; stroke: none");
+    Circle(50, 50, 1, NULL);
+    EXPECT_EQ(svg_list_group_begin(list, "class=\"x\""), SVG_OK);
+    Circle(50, 50, 1, NULL);
+    Rect(10, 10, 80, 80, "fill:#fff");
+    EXPECT_EQ(svg_list_group_end(list), SVG_OK);
+    EXPECT_EQ(svg_list_group_begin(list, "id=\"ok\" transform=\"scale(2)\""), SVG_OK);
+    if(all){
+        Circle(50, 50, 1, NULL);
+    }
+    Rect(10, 10, 80, 80, "fill:white");
+    EXPECT_EQ(svg_list_group_end(list), SVG_OK);
+}
+
+TEST(SVGListTest, OptimizeDropsOccluded){
+    svg_list_ptr List = svg_list_create();
+    svg_list_ptr Expected = svg_list_create();
+    ASSERT_NE(List, nullptr);
+    ASSERT_NE(Expected, nullptr);
+    DrawOccluded(List, true);
+    DrawOccluded(Expected, false);
+    std::string Before = Replay(List, 1);
+    svg_list_savings_t Savings;
+    EXPECT_EQ(svg_list_optimize(List, 1, &Savings), SVG_OK);
+    EXPECT_EQ(Savings.duplicates, 0u);
+    EXPECT_EQ(Savings.occluded, 5u);
+    std::string After = Replay(List, 1);
+    EXPECT_EQ(After, Replay(Expected, 1));
+    EXPECT_EQ(Savings.bytes, Before.size() - After.size());
+    // a second pass finds nothing more
+    EXPECT_EQ(svg_list_optimize(List, 1, NULL), SVG_OK);
+    EXPECT_EQ(Replay(List, 1), After);
+
+    EXPECT_EQ(svg_list_optimize(NULL, 0, NULL), SVG_ERR_NULL);
+    EXPECT_EQ(svg_list_optimize(List, SVG_PRECISION_MAX + 1, &Savings), SVG_ERR_INVALID_ARG);
+    const char *Path = "testbin/list_optimize.svgl";
+    EXPECT_EQ(svg_list_save(List, Path), SVG_OK);
+    svg_list_ptr Loaded = svg_list_load(Path);
+    ASSERT_NE(Loaded, nullptr);
+    EXPECT_EQ(svg_list_optimize(Loaded, 0, NULL), SVG_ERR_STATE);
+    EXPECT_EQ(svg_list_destroy(Loaded), SVG_OK);
+    std::remove(Path);
+    EXPECT_EQ(svg_list_destroy(List), SVG_OK);
+    EXPECT_EQ(svg_list_destroy(Expected), SVG_OK);
+}
+
+// Returns the output written since the last call and forgets it.
+static std::string TakeOutput(STestOutput &output){
+    std::string Result = output.JoinOutput();
+    output.DLines.clear();
+    return Result;
+}
+
+// Applies an <svg-diff> document to a client's (id, element) list.
+static void ApplyDiff(std::vector<std::pair<std::string, std::string>> &scene, const std::string &diff){
+    size_t Position = diff.find('\n') + 1;
+    while(diff.compare(Position, 11, "</svg-diff>") != 0){
+        size_t LineEnd = diff.find('\n', Position) + 1;
+        std::string Line = diff.substr(Position, LineEnd - Position);
+        std::string Id;
+        if(Line != "<add>\n"){
+            size_t IdStart = Line.find("id=\"") + 4;
+            Id = Line.substr(IdStart, Line.find('"', IdStart) - IdStart);
+        }
+        if(Line.compare(0, 7, "<remove") == 0){
+            for(auto It = scene.begin(); It != scene.end(); ++It){
+                if(It->first == Id){
+                    scene.erase(It);
+                    break;
+                }
+            }
+            Position = LineEnd;
+            continue;
+        }
+        std::string Close = Id.empty() ? "</add>\n" : "</replace>\n";
+        size_t TextEnd = diff.find(Close, LineEnd);
+        std::string Text = diff.substr(LineEnd, TextEnd - LineEnd);
+        if(Id.empty()){
+            size_t IdStart = Text.find("id=\"") + 4;
+            scene.emplace_back(Text.substr(IdStart, Text.find('"', IdStart) - IdStart), Text);
+        }
+        else{
+            for(auto &Element : scene){
+                if(Element.first == Id){
+                    Element.second = Text;
+                }
+            }
+        }
+        Position = TextEnd + Close.size();
+    }
+}
+
+// Draws frame number Frame of a scene where points move, appear and vanish.
+static void DrawFrame(svg_context_ptr context, int Frame, int Mode){
+    ASSERT_EQ(svg_frame_begin(context), SVG_OK);
+    for(int Index = 0; Index < 40; Index++){
+        std::string Id = "p" + std::to_string(Index);
+        if(Index % 10 == Frame % 10){
+            svg_frame_remove(context, Id.c_str());
+            continue;
+        }
+        // most points only change every few frames
+        svg_point_t Center = {(svg_coord_t)(Index * 2 + (Frame + Index) / 8), (svg_coord_t)Index};
+        ASSERT_EQ(svg_frame_id(context, Id.c_str()), SVG_OK);
+        ASSERT_EQ(svg_circle(context, &Center, 1, NULL), SVG_OK);
+    }
+    svg_coord_t Xs[] = {0, 10, (svg_coord_t)Frame}, Ys[] = {0, 10, 20};
+    ASSERT_EQ(svg_frame_id(context, "series"), SVG_OK);
+    ASSERT_EQ(svg_group_begin(context, "class=\"series\""), SVG_OK);
+    ASSERT_EQ(svg_lines(context, Xs, Ys, Ys, Xs, 3, NULL), SVG_OK);
+    ASSERT_EQ(svg_group_end(context), SVG_OK);
+    ASSERT_EQ(svg_frame_end(context, Mode), SVG_OK);
+}
+
+TEST(SVGFrameTest, DiffsRebuildFullFrames){
+    STestOutput DiffOutput, FullOutput;
+    svg_context_ptr Diffs = svg_create(write_callback, NULL, &DiffOutput, 100, 100);
+    svg_context_ptr Fulls = svg_create(write_callback, NULL, &FullOutput, 100, 100);
+    ASSERT_NE(Diffs, nullptr);
+    ASSERT_NE(Fulls, nullptr);
+    EXPECT_EQ(svg_set_precision(Diffs, 0), SVG_OK);
+    EXPECT_EQ(svg_set_precision(Fulls, 0), SVG_OK);
+
+    std::vector<std::pair<std::string, std::string>> Scene;
+    DrawFrame(Diffs, 0, SVG_FRAME_FULL);
+    DrawFrame(Fulls, 0, SVG_FRAME_FULL);
+    std::string First = TakeOutput(DiffOutput);
+    EXPECT_EQ(First, TakeOutput(FullOutput));
+    EXPECT_EQ(First.compare(0, 5, "<?xml"), 0);
+    EXPECT_NE(First.find("  <circle id=\"p1\" cx=\"2\" cy=\"1\" r=\"1\"/>\n"), std::string::npos);
+    EXPECT_NE(First.find("  <g id=\"series\" class=\"series\">\n    <line "), std::string::npos);
+    for(int Index = 1; Index < 40; Index++){
+        if(Index % 10){
+            std::string Id = "p" + std::to_string(Index);
+            size_t Start = First.find("  <circle id=\"" + Id + "\"");
+            Scene.emplace_back(Id, First.substr(Start, First.find('\n', Start) + 1 - Start));
+        }
+    }
+    size_t Start = First.find("  <g id=");
+    Scene.emplace_back("series", First.substr(Start, First.find("</svg>") - Start));
+
+    for(int Frame = 1; Frame < 30; Frame++){
+        DrawFrame(Diffs, Frame, SVG_FRAME_DIFF);
+        DrawFrame(Fulls, Frame, SVG_FRAME_FULL);
+        std::string Diff = TakeOutput(DiffOutput);
+        std::string Header = "<svg-diff frame=\"" + std::to_string(Frame + 1) + "\" width=";
+        EXPECT_EQ(Diff.compare(0, Header.size(), Header), 0);
+        // a few points change per frame, so the diff stays small
+        EXPECT_LT(Diff.size() * 2, FullOutput.JoinOutput().size());
+        ApplyDiff(Scene, Diff);
+        std::string Rebuilt = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                              "<svg width=\"100\" height=\"100\" xmlns=\"http://www.w3.org/2000/svg\">\n";
+        for(const auto &Element : Scene){
+            Rebuilt += Element.second;
+        }
+        Rebuilt += "</svg>\n";
+        EXPECT_EQ(Rebuilt, TakeOutput(FullOutput)) << "frame " << Frame;
+    }
+    // an unfinished frame is dropped
+    EXPECT_EQ(svg_frame_begin(Diffs), SVG_OK);
+    EXPECT_EQ(svg_destroy(Diffs), SVG_OK);
+    EXPECT_EQ(svg_destroy(Fulls), SVG_OK);
+    EXPECT_TRUE(DiffOutput.DLines.empty());
+    EXPECT_TRUE(FullOutput.DLines.empty());
+}
+
+TEST(SVGFrameTest, ChangesAndUnchangedRedraws){
+    svg_context_ptr context = svg_create_memory(100, 100);
+    ASSERT_NE(context, nullptr);
+    EXPECT_EQ(svg_set_precision(context, 0), SVG_OK);
+    svg_point_t Center = {5, 5};
+    svg_size_t Small = {2, 2}, Large = {3, 3};
+    EXPECT_EQ(svg_frame_begin(context), SVG_OK);
+    EXPECT_EQ(svg_frame_id(context, "a"), SVG_OK);
+    EXPECT_EQ(svg_circle(context, &Center, 1, NULL), SVG_OK);
+    EXPECT_EQ(svg_frame_id(context, "b"), SVG_OK);
+    EXPECT_EQ(svg_rect(context, &Center, &Small, "fill:red"), SVG_OK);
+    EXPECT_EQ(svg_frame_end(context, SVG_FRAME_DIFF), SVG_OK);
+
+    EXPECT_EQ(svg_frame_begin(context), SVG_OK);
+    // drawn again unchanged, then removed and added back in one frame
+    EXPECT_EQ(svg_frame_id(context, "a"), SVG_OK);
+    EXPECT_EQ(svg_circle(context, &Center, 1, NULL), SVG_OK);
+    EXPECT_EQ(svg_frame_remove(context, "b"), SVG_OK);
+    EXPECT_EQ(svg_frame_id(context, "b"), SVG_OK);
+    EXPECT_EQ(svg_rect(context, &Center, &Large, NULL), SVG_OK);
+    // added and removed before any frame held it
+    EXPECT_EQ(svg_frame_id(context, "c"), SVG_OK);
+    EXPECT_EQ(svg_circle(context, &Center, 2, NULL), SVG_OK);
+    EXPECT_EQ(svg_frame_remove(context, "c"), SVG_OK);
+    EXPECT_EQ(svg_frame_end(context, SVG_FRAME_DIFF), SVG_OK);
+
+    EXPECT_EQ(svg_frame_begin(context), SVG_OK);
+    EXPECT_EQ(svg_frame_remove(context, "a"), SVG_OK);
+    EXPECT_EQ(svg_frame_id(context, "c"), SVG_OK);
+    EXPECT_EQ(svg_circle(context, &Center, 2, NULL), SVG_OK);
+    EXPECT_EQ(svg_frame_end(context, SVG_FRAME_DIFF), SVG_OK);
+    EXPECT_EQ(svg_frame_begin(context), SVG_OK);
+    EXPECT_EQ(svg_frame_end(context, SVG_FRAME_FULL), SVG_OK);
+
+    char *Buffer = nullptr;
+    size_t Length = 0;
+    EXPECT_EQ(svg_detach_buffer(context, &Buffer, &Length), SVG_OK);
+    ASSERT_NE(Buffer, nullptr);
+    EXPECT_EQ(std::string(Buffer, Length),
+        "<svg-diff frame=\"1\" width=\"100\" height=\"100\">\n"
+        "<add>\n  <circle id=\"a\" cx=\"5\" cy=\"5\" r=\"1\"/>\n</add>\n"
+        "<add>\n  <rect id=\"b\" x=\"5\" y=\"5\" width=\"2\" height=\"2\" style=\"fill:red\"/>\n</add>\n"
+        "</svg-diff>\n"
+        "<svg-diff frame=\"2\" width=\"100\" height=\"100\">\n"
+        "<replace id=\"b\">\n  <rect id=\"b\" x=\"5\" y=\"5\" width=\"3\" height=\"3\"/>\n</replace>\n"
+        "</svg-diff>\n"
+        "<svg-diff frame=\"3\" width=\"100\" height=\"100\">\n"
+        "<remove id=\"a\"/>\n"
+        "<add>\n  <circle id=\"c\" cx=\"5\" cy=\"5\" r=\"2\"/>\n</add>\n"
+        "</svg-diff>\n"
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<svg width=\"100\" height=\"100\" xmlns=\"http://www.w3.org/2000/svg\">\n"
+        "  <rect id=\"b\" x=\"5\" y=\"5\" width=\"3\" height=\"3\"/>\n"
+        "  <circle id=\"c\" cx=\"5\" cy=\"5\" r=\"2\"/>\n"
+        "</svg>\n");
+    free(Buffer);
+}
+
+TEST(SVGFrameTest, InvalidUse){
+    svg_point_t Center = {5, 5};
+    STestOutput Output;
+    svg_context_ptr context = svg_create(write_callback, NULL, &Output, 100, 100);
+    ASSERT_NE(context, nullptr);
+    EXPECT_EQ(svg_frame_begin(NULL), SVG_ERR_NULL);
+    EXPECT_EQ(svg_frame_id(context, "a"), SVG_ERR_STATE);
+    EXPECT_EQ(svg_frame_end(context, SVG_FRAME_FULL), SVG_ERR_STATE);
+    EXPECT_EQ(svg_set_culling(context, 1, 0), SVG_OK);
+    EXPECT_EQ(svg_frame_begin(context), SVG_ERR_STATE);
+    EXPECT_EQ(svg_set_culling(context, 0, 0), SVG_OK);
+    EXPECT_EQ(svg_frame_begin(context), SVG_OK);
+    EXPECT_EQ(svg_frame_begin(context), SVG_ERR_STATE);
+    EXPECT_EQ(svg_set_culling(context, 1, 0), SVG_ERR_STATE);
+    EXPECT_EQ(svg_set_lod(context, 1), SVG_ERR_STATE);
+    EXPECT_EQ(svg_set_style_interning(context, 1), SVG_ERR_STATE);
+    EXPECT_EQ(svg_shard_create(context), nullptr);
+    EXPECT_EQ(svg_frame_id(context, "a\"b"), SVG_ERR_INVALID_ARG);
+    EXPECT_EQ(svg_frame_id(context, ""), SVG_ERR_INVALID_ARG);
+    EXPECT_EQ(svg_frame_remove(context, "a"), SVG_ERR_INVALID_ARG);
+    EXPECT_EQ(svg_frame_end(context, 2), SVG_ERR_INVALID_ARG);
+    // top-level elements need an id, nested ones do not
+    EXPECT_EQ(svg_circle(context, &Center, 1, NULL), SVG_ERR_STATE);
+    EXPECT_EQ(svg_frame_id(context, "g"), SVG_OK);
+    EXPECT_EQ(svg_group_begin(context, NULL), SVG_OK);
+    EXPECT_EQ(svg_frame_id(context, "a"), SVG_ERR_STATE);
+    EXPECT_EQ(svg_frame_end(context, SVG_FRAME_FULL), SVG_ERR_STATE);
+    EXPECT_EQ(svg_circle(context, &Center, 1, NULL), SVG_OK);
+    EXPECT_EQ(svg_flush(context), SVG_OK);
+    EXPECT_TRUE(Output.DLines.empty());
+    EXPECT_EQ(svg_group_end(context), SVG_OK);
+    EXPECT_EQ(svg_frame_end(context, SVG_FRAME_FULL), SVG_OK);
+    // nothing is drawn between frames
+    EXPECT_EQ(svg_group_begin(context, NULL), SVG_ERR_STATE);
+    EXPECT_EQ(svg_path_begin(context, NULL), SVG_ERR_STATE);
+    EXPECT_EQ(svg_circle(context, &Center, 1, NULL), SVG_ERR_STATE);
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+    EXPECT_EQ(Output.JoinOutput(),
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<svg width=\"100\" height=\"100\" xmlns=\"http://www.w3.org/2000/svg\">\n"
+        "  <g id=\"g\">\n    <circle cx=\"5.000000\" cy=\"5.000000\" r=\"1.000000\"/>\n  </g>\n"
+        "</svg>\n");
+
+    // frames need a context that has not drawn anything
+    context = svg_create_memory(100, 100);
+    ASSERT_NE(context, nullptr);
+    EXPECT_EQ(svg_circle(context, &Center, 1, NULL), SVG_OK);
+    EXPECT_EQ(svg_frame_begin(context), SVG_ERR_STATE);
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+}
+
+TEST(SVGFrameTest, FullFramesAsSpans){
+    STestOutput Plain;
+    SSpanOutput Output;
+    svg_context_ptr Reference = svg_create(write_callback, NULL, &Plain, 100, 100);
+    svg_create_options_t Options = {};
+    Options.writev_fn = writev_callback;
+    Options.user = &Output;
+    Options.width = 100;
+    Options.height = 100;
+    svg_context_ptr context = svg_create_ex(&Options);
+    ASSERT_NE(Reference, nullptr);
+    ASSERT_NE(context, nullptr);
+    for(int Frame = 0; Frame < 5; Frame++){
+        DrawFrame(Reference, Frame, SVG_FRAME_FULL);
+        DrawFrame(context, Frame, SVG_FRAME_FULL);
+        // the header, every element and the closing tag in one call
+        EXPECT_EQ(Output.DCalls, (size_t)Frame + 1);
+        EXPECT_EQ(Output.DText, TakeOutput(Plain)) << "frame " << Frame;
+        Output.DText.clear();
+    }
+    EXPECT_GT(Output.DSpans, Output.DCalls * 30);
+    // diffs still go through the buffer
+    DrawFrame(Reference, 5, SVG_FRAME_DIFF);
+    DrawFrame(context, 5, SVG_FRAME_DIFF);
+    EXPECT_EQ(Output.DText, TakeOutput(Plain));
+    EXPECT_EQ(svg_destroy(Reference), SVG_OK);
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+}
+
+TEST(SVGSymbolTest, DefinesAndPlacesSymbols){
+    STestOutput Output;
+    svg_context_ptr context = svg_create(write_callback, NULL, &Output, 100, 100);
+    ASSERT_NE(context, nullptr);
+    EXPECT_EQ(svg_set_precision(context, 0), SVG_OK);
+    EXPECT_EQ(svg_set_culling(context, 1, 0), SVG_OK);
+    EXPECT_EQ(svg_set_lod(context, 10), SVG_OK);
+    svg_point_t Origin = {0, 0}, Left = {-3, 0}, Right = {3, 0}, At = {50, 60};
+    size_t Cross = 99, Dot = 99;
+    EXPECT_EQ(svg_symbol_begin(context, &Cross), SVG_OK);
+    EXPECT_EQ(Cross, 0u);
+    EXPECT_EQ(svg_symbol_begin(context, &Dot), SVG_ERR_STATE);
+    EXPECT_EQ(svg_use(context, Cross, &At), SVG_ERR_INVALID_ARG);
+    // symbol content sits around the origin, outside the viewport, and
+    // repeats itself, yet is neither culled nor decimated
+    EXPECT_EQ(svg_line(context, &Left, &Right, "stroke:red"), SVG_OK);
+    EXPECT_EQ(svg_line(context, &Left, &Right, "stroke:red"), SVG_OK);
+    EXPECT_EQ(svg_group_begin(context, NULL), SVG_OK);
+    EXPECT_EQ(svg_symbol_end(context), SVG_ERR_STATE);
+    EXPECT_EQ(svg_circle(context, &Left, 1, NULL), SVG_OK);
+    EXPECT_EQ(svg_group_end(context), SVG_OK);
+    EXPECT_EQ(svg_group_end(context), SVG_ERR_STATE);
+    EXPECT_EQ(svg_symbol_end(context), SVG_OK);
+    EXPECT_EQ(svg_symbol_end(context), SVG_ERR_STATE);
+    EXPECT_EQ(svg_use(context, Cross, &At), SVG_OK);
+    EXPECT_EQ(svg_use(context, Cross, &Origin), SVG_OK);
+    EXPECT_EQ(svg_use(context, 1, &At), SVG_ERR_INVALID_ARG);
+    EXPECT_EQ(svg_use(context, Cross, NULL), SVG_ERR_INVALID_ARG);
+
+    EXPECT_EQ(svg_group_begin(context, NULL), SVG_OK);
+    EXPECT_EQ(svg_symbol_begin(context, &Dot), SVG_OK);
+    EXPECT_EQ(Dot, 1u);
+    EXPECT_EQ(svg_circle(context, &Origin, 2, NULL), SVG_OK);
+    // left open, the symbol is closed before the group on destroy
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+    EXPECT_EQ(Output.JoinOutput(),
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<svg width=\"100\" height=\"100\" xmlns=\"http://www.w3.org/2000/svg\">\n"
+        "  <defs>\n"
+        "    <g id=\"_s0\">\n"
+        "      <line x1=\"-3\" y1=\"0\" x2=\"3\" y2=\"0\" style=\"stroke:red\"/>\n"
+        "      <line x1=\"-3\" y1=\"0\" x2=\"3\" y2=\"0\" style=\"stroke:red\"/>\n"
+        "      <g>\n"
+        "        <circle cx=\"-3\" cy=\"0\" r=\"1\"/>\n"
+        "      </g>\n"
+        "    </g>\n"
+        "  </defs>\n"
+        "  <use href=\"#_s0\" x=\"50\" y=\"60\"/>\n"
+        "  <use href=\"#_s0\" x=\"0\" y=\"0\"/>\n"
+        "  <g>\n"
+        "    <defs>\n"
+        "      <g id=\"_s1\">\n"
+        "        <circle cx=\"0\" cy=\"0\" r=\"2\"/>\n"
+        "      </g>\n"
+        "    </defs>\n"
+        "  </g>\n"
+        "</svg>\n");
+}
+
+TEST(SVGSymbolTest, InvalidUse){
+    svg_point_t At = {1, 2};
+    size_t Id;
+    EXPECT_EQ(svg_symbol_begin(NULL, &Id), SVG_ERR_NULL);
+    EXPECT_EQ(svg_symbol_end(NULL), SVG_ERR_NULL);
+    EXPECT_EQ(svg_use(NULL, 0, &At), SVG_ERR_NULL);
+
+    svg_context_ptr context = svg_create_memory(100, 100);
+    ASSERT_NE(context, nullptr);
+    EXPECT_EQ(svg_symbol_begin(context, NULL), SVG_ERR_INVALID_ARG);
+    EXPECT_EQ(svg_path_begin(context, NULL), SVG_OK);
+    EXPECT_EQ(svg_symbol_begin(context, &Id), SVG_ERR_STATE);
+    EXPECT_EQ(svg_path_end(context), SVG_OK);
+    EXPECT_EQ(svg_symbol_begin(context, &Id), SVG_OK);
+    EXPECT_EQ(svg_shard_create(context), nullptr);
+    EXPECT_EQ(svg_symbol_end(context), SVG_OK);
+    svg_context_ptr Shard = svg_shard_create(context);
+    ASSERT_NE(Shard, nullptr);
+    EXPECT_EQ(svg_symbol_begin(Shard, &Id), SVG_ERR_STATE);
+    EXPECT_EQ(svg_use(Shard, Id, &At), SVG_OK);
+    EXPECT_EQ(svg_shard_commit(context, Shard), SVG_OK);
+
+    char *Buffer = nullptr;
+    EXPECT_EQ(svg_detach_buffer(context, &Buffer, NULL), SVG_OK);
+    ASSERT_NE(Buffer, nullptr);
+    EXPECT_NE(std::string(Buffer).find("  <use href=\"#_s0\" x=\"1.000000\" y=\"2.000000\"/>\n</svg>\n"), std::string::npos);
+    free(Buffer);
+}
+
+// Maps a point the way the library documents it.
+static svg_point_t MapPoint(const svg_matrix_t &matrix, svg_coord_t x, svg_coord_t y){
+    svg_point_t Point = {matrix.a * x + matrix.c * y + matrix.e, matrix.b * x + matrix.d * y + matrix.f};
+    return Point;
+}
+
+TEST(SVGTransformTest, KernelMatchesScalar){
+    svg_matrix_t Matrix = {1.5, -0.25, 0.75, 2.5, 10.125, -3.5};
+    std::vector<svg_point_t> Points(1001), Result(1001);
+    for(size_t Index = 0; Index < Points.size(); Index++){
+        Points[Index].x = std::sin((double)Index) * 1000;
+        Points[Index].y = std::cos((double)Index * 0.37) * 1e-3;
+    }
+    for(size_t Count : {0, 1, 2, 3, 4, 5, 7, 1001}){
+        EXPECT_EQ(svg_transform_points(&Matrix, Points.data(), Result.data(), Count), SVG_OK);
+        for(size_t Index = 0; Index < Count; Index++){
+            svg_point_t Expected = MapPoint(Matrix, Points[Index].x, Points[Index].y);
+            ASSERT_EQ(Result[Index].x, Expected.x) << Count << " " << Index;
+            ASSERT_EQ(Result[Index].y, Expected.y) << Count << " " << Index;
+        }
+    }
+    std::vector<svg_point_t> InPlace = Points;
+    EXPECT_EQ(svg_transform_points(&Matrix, InPlace.data(), InPlace.data(), InPlace.size()), SVG_OK);
+    EXPECT_EQ(std::memcmp(InPlace.data(), Result.data(), InPlace.size() * sizeof(svg_point_t)), 0);
+    EXPECT_EQ(svg_transform_points(NULL, Points.data(), Result.data(), 1), SVG_ERR_NULL);
+    EXPECT_EQ(svg_transform_points(&Matrix, NULL, Result.data(), 1), SVG_ERR_NULL);
+    EXPECT_EQ(svg_transform_points(&Matrix, NULL, NULL, 0), SVG_OK);
+}
+
+// Draws a data space scene, either through a context transform or by
+// mapping every coordinate first.
+static std::string DrawTransformed(bool UseTransform){
+    // data x in [0, 100] and y in [0, 10] onto a 500 by 200 canvas, y up
+    svg_matrix_t Scale = {5, 0, 0, -20, 0, 0}, Offset = {1, 0, 0, 1, 0, -10};
+    svg_matrix_t Matrix = {5, 0, 0, -20, 0, 200};
+    STestOutput Output;
+    svg_context_ptr context = svg_create(write_callback, NULL, &Output, 500, 200);
+    EXPECT_EQ(svg_set_precision(context, 3), SVG_OK);
+    EXPECT_EQ(svg_set_culling(context, 1, 0), SVG_OK);
+    const size_t Count = 700;
+    // radii scale by the square root of the determinant, 10 here
+    svg_real_t Radius = UseTransform ? 1 : 10;
+    std::vector<svg_coord_t> Xs(Count), Ys(Count), X2s(Count), Y2s(Count), Radii(Count, 2 * Radius), Sizes(Count, 1);
+    std::vector<svg_point_t> Points(Count);
+    for(size_t Index = 0; Index < Count; Index++){
+        // some points fall outside the data range and are culled
+        Xs[Index] = (svg_coord_t)Index * 0.17 - 5;
+        Ys[Index] = std::sin((double)Index) * 6 + 5;
+        X2s[Index] = Xs[Index] + 1;
+        Y2s[Index] = Ys[Index] - 1;
+        Points[Index].x = Xs[Index];
+        Points[Index].y = Ys[Index];
+    }
+    if(UseTransform){
+        EXPECT_EQ(svg_transform_push(context, &Scale), SVG_OK);
+        EXPECT_EQ(svg_transform_push(context, &Offset), SVG_OK);
+    }
+    else{
+        for(size_t Index = 0; Index < Count; Index++){
+            svg_point_t Start = MapPoint(Matrix, Xs[Index], Ys[Index]);
+            svg_point_t End = MapPoint(Matrix, X2s[Index], Y2s[Index]);
+            Points[Index] = Start;
+            // rectangles are flipped by the y axis
+            Xs[Index] = Start.x;
+            Ys[Index] = Start.y;
+            X2s[Index] = End.x;
+            Y2s[Index] = End.y;
+        }
+    }
+    std::vector<svg_coord_t> RectXs = Xs, RectYs = Ys, Widths = Sizes, Heights = Sizes;
+    if(!UseTransform){
+        for(size_t Index = 0; Index < Count; Index++){
+            Widths[Index] = 5;
+            Heights[Index] = 20;
+            RectYs[Index] -= 20;
+        }
+    }
+    EXPECT_EQ(svg_circles(context, Xs.data(), Ys.data(), Radii.data(), Count, NULL), SVG_OK);
+    EXPECT_EQ(svg_lines(context, Xs.data(), Ys.data(), X2s.data(), Y2s.data(), Count, NULL), SVG_OK);
+    EXPECT_EQ(svg_rects(context, RectXs.data(), RectYs.data(), Widths.data(), Heights.data(), Count, NULL), SVG_OK);
+    svg_point_t Center = {Xs[3], Ys[3]}, End = {X2s[3], Y2s[3]}, Corner = {RectXs[3], RectYs[3]};
+    svg_size_t Size = {Widths[3], Heights[3]};
+    EXPECT_EQ(svg_circle(context, &Center, Radius, NULL), SVG_OK);
+    EXPECT_EQ(svg_line(context, &Center, &End, NULL), SVG_OK);
+    EXPECT_EQ(svg_rect(context, &Corner, &Size, NULL), SVG_OK);
+    EXPECT_EQ(svg_path_begin(context, NULL), SVG_OK);
+    EXPECT_EQ(svg_path_point(context, &End), SVG_OK);
+    EXPECT_EQ(svg_path_points(context, Points.data(), Count), SVG_OK);
+    EXPECT_EQ(svg_path_end(context), SVG_OK);
+    svg_cull_counts_t Culled;
+    EXPECT_EQ(svg_get_cull_counts(context, &Culled), SVG_OK);
+    EXPECT_GT(Culled.circles, 0u);
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+    return Output.JoinOutput() + std::to_string(Culled.circles) + " " + std::to_string(Culled.lines)
+        + " " + std::to_string(Culled.rects);
+}
+
+TEST(SVGTransformTest, MapsBeforeFormattingAndCulling){
+    EXPECT_EQ(DrawTransformed(true), DrawTransformed(false));
+}
+
+TEST(SVGTransformTest, StackAndInvalidUse){
+    svg_matrix_t Shift = {1, 0, 0, 1, 10, 20}, Double = {2, 0, 0, 2, 0, 0};
+    svg_matrix_t Rotate = {0, 1, -1, 0, 0, 0}, Invalid = {1, 0, 0, NAN, 0, 0};
+    svg_point_t Point = {1, 1};
+    svg_size_t Size = {1, 1};
+    size_t Symbol;
+    svg_context_ptr context = svg_create_memory(100, 100);
+    ASSERT_NE(context, nullptr);
+    EXPECT_EQ(svg_set_precision(context, 0), SVG_OK);
+    EXPECT_EQ(svg_transform_push(NULL, &Shift), SVG_ERR_NULL);
+    EXPECT_EQ(svg_transform_push(context, NULL), SVG_ERR_INVALID_ARG);
+    EXPECT_EQ(svg_transform_push(context, &Invalid), SVG_ERR_INVALID_ARG);
+    EXPECT_EQ(svg_transform_pop(context), SVG_ERR_STATE);
+    EXPECT_EQ(svg_symbol_begin(context, &Symbol), SVG_OK);
+    EXPECT_EQ(svg_symbol_end(context), SVG_OK);
+
+    // shifting then doubling maps (1, 1) to (12, 22)
+    EXPECT_EQ(svg_transform_push(context, &Shift), SVG_OK);
+    EXPECT_EQ(svg_transform_push(context, &Double), SVG_OK);
+    EXPECT_EQ(svg_circle(context, &Point, 1, NULL), SVG_OK);
+    EXPECT_EQ(svg_use(context, Symbol, &Point), SVG_OK);
+    svg_context_ptr Shard = svg_shard_create(context);
+    ASSERT_NE(Shard, nullptr);
+    EXPECT_EQ(svg_transform_pop(Shard), SVG_ERR_STATE);
+    EXPECT_EQ(svg_circle(Shard, &Point, 1, NULL), SVG_OK);
+    EXPECT_EQ(svg_shard_commit(context, Shard), SVG_OK);
+    EXPECT_EQ(svg_transform_pop(context), SVG_OK);
+    EXPECT_EQ(svg_circle(context, &Point, 1, NULL), SVG_OK);
+    EXPECT_EQ(svg_transform_push(context, &Rotate), SVG_OK);
+    EXPECT_EQ(svg_line(context, &Point, &Point, NULL), SVG_OK);
+    EXPECT_EQ(svg_rect(context, &Point, &Size, NULL), SVG_OK);
+    EXPECT_EQ(svg_rects(context, &Point.x, &Point.y, &Size.width, &Size.height, 1, NULL), SVG_OK);
+    EXPECT_EQ(svg_path_begin(context, NULL), SVG_OK);
+    EXPECT_EQ(svg_transform_push(context, &Shift), SVG_ERR_STATE);
+    EXPECT_EQ(svg_transform_pop(context), SVG_ERR_STATE);
+    EXPECT_EQ(svg_path_end(context), SVG_OK);
+    EXPECT_EQ(svg_transform_pop(context), SVG_OK);
+    EXPECT_EQ(svg_transform_pop(context), SVG_OK);
+    EXPECT_EQ(svg_circle(context, &Point, 1, NULL), SVG_OK);
+
+    char *Buffer = nullptr;
+    EXPECT_EQ(svg_detach_buffer(context, &Buffer, NULL), SVG_OK);
+    ASSERT_NE(Buffer, nullptr);
+    std::string Result(Buffer);
+    free(Buffer);
+    EXPECT_NE(Result.find("  <circle cx=\"12\" cy=\"22\" r=\"2\"/>\n"
+                          "  <use href=\"#_s0\" x=\"12\" y=\"22\"/>\n"
+                          "  <circle cx=\"12\" cy=\"22\" r=\"2\"/>\n"
+                          "  <circle cx=\"11\" cy=\"21\" r=\"1\"/>\n"
+                          "  <line x1=\"9\" y1=\"21\" x2=\"9\" y2=\"21\"/>\n"
+                          "  <polygon points=\"9,21 9,22 8,22 8,21\"/>\n"
+                          "  <polygon points=\"9,21 9,22 8,22 8,21\"/>\n"
+                          "  <path d=\"\"/>\n"
+                          "  <circle cx=\"1\" cy=\"1\" r=\"1\"/>\n"), std::string::npos) << Result;
+
+    svg_list_ptr List = svg_list_create();
+    ASSERT_NE(List, nullptr);
+    context = svg_create_recording(List, 100, 100);
+    ASSERT_NE(context, nullptr);
+    EXPECT_EQ(svg_transform_push(context, &Shift), SVG_ERR_STATE);
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+    EXPECT_EQ(svg_list_destroy(List), SVG_OK);
+}
+
+TEST(SVGTransformTest, ScalesRadiiByDeterminant){
+    // stretching x by 4 quadruples areas, so radii double
+    svg_matrix_t Stretch = {4, 0, 0, 1, 0, 0}, Flatten = {1, 0, 0, 0, 0, 0};
+    svg_point_t Point = {1, 1};
+    svg_coord_t Xs[2] = {1, 2}, Ys[2] = {1, 2};
+    svg_real_t Radii[2] = {1, 3};
+    svg_context_ptr context = svg_create_memory(100, 100);
+    ASSERT_NE(context, nullptr);
+    EXPECT_EQ(svg_set_precision(context, 0), SVG_OK);
+    EXPECT_EQ(svg_transform_push(context, &Stretch), SVG_OK);
+    EXPECT_EQ(svg_circle(context, &Point, 1, NULL), SVG_OK);
+    EXPECT_EQ(svg_circles(context, Xs, Ys, Radii, 2, NULL), SVG_OK);
+    // a singular transform draws nothing rather than failing
+    EXPECT_EQ(svg_transform_push(context, &Flatten), SVG_OK);
+    EXPECT_EQ(svg_circle(context, &Point, 1, NULL), SVG_OK);
+    EXPECT_EQ(svg_circles(context, Xs, Ys, Radii, 2, NULL), SVG_OK);
+
+    char *Buffer = nullptr;
+    EXPECT_EQ(svg_detach_buffer(context, &Buffer, NULL), SVG_OK);
+    ASSERT_NE(Buffer, nullptr);
+    std::string Result(Buffer);
+    free(Buffer);
+    EXPECT_NE(Result.find("  <circle cx=\"4\" cy=\"1\" r=\"2\"/>\n"
+                          "  <circle cx=\"4\" cy=\"1\" r=\"2\"/>\n"
+                          "  <circle cx=\"8\" cy=\"2\" r=\"6\"/>\n"
+                          "</svg>"), std::string::npos) << Result;
+}
+
+// Reads a number written in quantized mode as a count of grid steps.
+static int64_t ParseGrid(const char *&text, int digits){
+    bool Negative = *text == '-';
+    if(Negative){
+        text++;
+    }
+    int64_t Grid = 0;
+    int Fraction = -1;
+    while(std::isdigit((unsigned char)*text) || (*text == '.' && Fraction < 0)){
+        if(*text == '.'){
+            Fraction = 0;
+        }
+        else{
+            Grid = Grid * 10 + (*text - '0');
+            Fraction += Fraction >= 0;
+        }
+        text++;
+    }
+    for(int Digit = Fraction < 0 ? 0 : Fraction; Digit < digits; Digit++){
+        Grid *= 10;
+    }
+    return Negative ? -Grid : Grid;
+}
+
+// Returns whether grid steps of 10^-digits are within half a step of value,
+// deciding exactly.
+static bool WithinHalfStep(double value, int64_t grid, int digits){
+    double Scale = std::pow(10.0, digits);
+    double Product = value * Scale;
+    double Error = std::fma(value, Scale, -Product);
+    double Distance = Product - (double)grid;
+    if(std::fabs(Distance) > 1){
+        return false;
+    }
+    return Distance >= 0 ? (Distance - 0.5) + Error <= 0 : (Distance + 0.5) + Error >= 0;
+}
+
+// Values spread over many magnitudes, plus values next to grid ties.
+static std::vector<double> QuantizeValues(int digits){
+    std::mt19937_64 Random(1234 + digits);
+    std::uniform_real_distribution<double> Spread(-1e4, 1e4);
+    std::uniform_int_distribution<int> Steps(-100000, 100000);
+    double Step = std::pow(10.0, -digits);
+    std::vector<double> Values = {0, -0.0, 0.5, 1.5, 2.5, -2.5, 0.145, 2.675, 1.005, 1e-9, -1e-9};
+    for(int Index = 0; Index < 3000; Index++){
+        Values.push_back(Spread(Random));
+        double Tie = (Steps(Random) + 0.5) * Step;
+        Values.push_back(Tie);
+        Values.push_back(std::nextafter(Tie, INFINITY));
+        Values.push_back(std::nextafter(Tie, -INFINITY));
+    }
+    return Values;
+}
+
+TEST(SVGQuantizeTest, ElementsWithinHalfStep){
+    for(int Digits = 0; Digits <= 4; Digits++){
+        std::vector<double> Values = QuantizeValues(Digits);
+        std::vector<double> Radii(Values.size(), 1);
+        svg_context_ptr context = svg_create_memory(100, 100);
+        ASSERT_NE(context, nullptr);
+        EXPECT_EQ(svg_set_quantization(context, 1, Digits), SVG_OK);
+        EXPECT_EQ(svg_circles(context, Values.data(), Values.data(), Radii.data(), Values.size(), NULL), SVG_OK);
+        char *Buffer = nullptr;
+        EXPECT_EQ(svg_detach_buffer(context, &Buffer, NULL), SVG_OK);
+        ASSERT_NE(Buffer, nullptr);
+        const char *Text = Buffer;
+        for(double Value : Values){
+            Text = std::strstr(Text, "cx=\"") + 4;
+            int64_t Grid = ParseGrid(Text, Digits);
+            ASSERT_TRUE(WithinHalfStep(Value, Grid, Digits)) << Value << " digits " << Digits;
+            // numbers are plain decimals: no exponent, no "-0", no trailing zeros
+            ASSERT_EQ(*Text, '"');
+            if(Grid == 0){
+                ASSERT_EQ(std::string(Text - 1, 2), "0\"");
+            }
+            else if(std::memchr(Text - 8, '.', 8)){
+                ASSERT_NE(Text[-1], '0');
+            }
+        }
+        free(Buffer);
+    }
+}
+
+TEST(SVGQuantizeTest, PathDeltasWithinHalfStep){
+    for(int Digits = 0; Digits <= 3; Digits++){
+        std::vector<double> Values = QuantizeValues(Digits);
+        std::vector<svg_point_t> Points;
+        double Walk = 0;
+        for(size_t Index = 0; Index < Values.size(); Index++){
+            // a long walk, so any error carried between deltas would show
+            Walk += Values[Index] * 1e-3;
+            svg_point_t Point = {Walk, Values[Index]};
+            Points.push_back(Point);
+        }
+        svg_context_ptr context = svg_create_memory(100, 100);
+        ASSERT_NE(context, nullptr);
+        EXPECT_EQ(svg_set_quantization(context, 1, Digits), SVG_OK);
+        EXPECT_EQ(svg_path_begin(context, NULL), SVG_OK);
+        EXPECT_EQ(svg_set_quantization(context, 0, Digits), SVG_ERR_STATE);
+        EXPECT_EQ(svg_path_points(context, Points.data(), Points.size()), SVG_OK);
+        EXPECT_EQ(svg_path_end(context), SVG_OK);
+        char *Buffer = nullptr;
+        EXPECT_EQ(svg_detach_buffer(context, &Buffer, NULL), SVG_OK);
+        ASSERT_NE(Buffer, nullptr);
+        const char *Text = std::strstr(Buffer, "d=\"M") + 4;
+        std::vector<std::pair<int64_t, int64_t>> Written;
+        int64_t X = ParseGrid(Text, Digits);
+        ASSERT_EQ(*Text++, ',');
+        int64_t Y = ParseGrid(Text, Digits);
+        Written.emplace_back(X, Y);
+        ASSERT_EQ(*Text++, 'l');
+        while(*Text != '"'){
+            if(*Text == ' '){
+                Text++;
+            }
+            X += ParseGrid(Text, Digits);
+            if(*Text == ','){
+                Text++;
+            }
+            Y += ParseGrid(Text, Digits);
+            Written.emplace_back(X, Y);
+        }
+        free(Buffer);
+        // every vertex was written, or left out for sitting on the last one
+        size_t Next = 0;
+        for(const svg_point_t &Point : Points){
+            if(Next < Written.size() && WithinHalfStep(Point.x, Written[Next].first, Digits)
+                && WithinHalfStep(Point.y, Written[Next].second, Digits)){
+                Next++;
+                continue;
+            }
+            ASSERT_GT(Next, 0u);
+            ASSERT_TRUE(WithinHalfStep(Point.x, Written[Next - 1].first, Digits));
+            ASSERT_TRUE(WithinHalfStep(Point.y, Written[Next - 1].second, Digits));
+        }
+        EXPECT_EQ(Next, Written.size());
+        EXPECT_LT(Written.size(), Points.size());
+    }
+}
+
+TEST(SVGQuantizeTest, Format){
+    EXPECT_EQ(svg_set_quantization(NULL, 1, 1), SVG_ERR_NULL);
+    svg_context_ptr context = svg_create_memory(100, 100);
+    ASSERT_NE(context, nullptr);
+    EXPECT_EQ(svg_set_quantization(context, 1, -1), SVG_ERR_INVALID_ARG);
+    EXPECT_EQ(svg_set_quantization(context, 1, SVG_PRECISION_MAX + 1), SVG_ERR_INVALID_ARG);
+    EXPECT_EQ(svg_set_quantization(context, 1, 1), SVG_OK);
+    svg_point_t Center = {1.25, -0.004};
+    EXPECT_EQ(svg_circle(context, &Center, 2, NULL), SVG_OK);
+    svg_point_t Huge = {1e300, NAN};
+    EXPECT_EQ(svg_circle(context, &Huge, 0.26, NULL), SVG_OK);
+    svg_point_t Points[] = {{0, 0}, {0.26, 0}, {0.26, 0.01}, {1, -1}, {NAN, 2}, {1, 2}, {1.5, 2}};
+    EXPECT_EQ(svg_path_begin(context, NULL), SVG_OK);
+    EXPECT_EQ(svg_path_points(context, Points, 7), SVG_OK);
+    EXPECT_EQ(svg_path_end(context), SVG_OK);
+    EXPECT_EQ(svg_set_quantization(context, 0, 0), SVG_OK);
+    EXPECT_EQ(svg_circle(context, &Center, 2, NULL), SVG_OK);
+    char *Buffer = nullptr;
+    EXPECT_EQ(svg_detach_buffer(context, &Buffer, NULL), SVG_OK);
+    ASSERT_NE(Buffer, nullptr);
+    std::string Result(Buffer);
+    free(Buffer);
+    char Expected[SVG_REAL_BUFFER_SIZE];
+    svg_format_real(Expected, 1e300, 1);
+    EXPECT_NE(Result.find("  <circle cx=\"1.2\" cy=\"0\" r=\"2\"/>\n"
+                          "  <circle cx=\"" + std::string(Expected) + "\" cy=\"nan\" r=\"0.3\"/>\n"
+                          "  <path d=\"M0,0l0.3,0 0.7-1Lnan,2L1,2l0.5,0\"/>\n"
+                          "  <circle cx=\"1.250000\" cy=\"-0.004000\" r=\"2.000000\"/>\n"), std::string::npos) << Result;
+}
+
+// --- DENSITY ---
+TEST(SVGDensityTest, BinsPointsIntoCells){
+    svg_context_ptr context = svg_create_memory(25, 20);
+    ASSERT_NE(context, nullptr);
+    EXPECT_EQ(svg_density_begin(context, 10), SVG_OK);
+    // four points in the first cell, one in the cut corner cell, one outside
+    svg_point_t Points[] = {{1, 1}, {9, 9}, {0, 0}, {24.5, 19.5}, {25, 5}, {NAN, 1}};
+    EXPECT_EQ(svg_density_points(context, Points, 6), SVG_OK);
+    svg_point_t Center = {5, 5};
+    EXPECT_EQ(svg_circle(context, &Center, 3, "fill:red"), SVG_OK);
+    // a translation moves (2, 2) into the middle cell of the top row
+    svg_matrix_t Shift = {1, 0, 0, 1, 10, 0};
+    EXPECT_EQ(svg_transform_push(context, &Shift), SVG_OK);
+    svg_coord_t Xs[] = {2, 3}, Ys[] = {2, 3}, Radii[] = {1, 1};
+    EXPECT_EQ(svg_circles(context, Xs, Ys, Radii, 2, NULL), SVG_OK);
+    const char *Styles[] = {"fill:#ccc", "fill:#888", "fill:#000"};
+    svg_colormap_t Colormap = {Styles, 3, 0};
+    EXPECT_EQ(svg_density_end(context, &Colormap), SVG_OK);
+
+    char *Buffer = nullptr;
+    EXPECT_EQ(svg_detach_buffer(context, &Buffer, NULL), SVG_OK);
+    ASSERT_NE(Buffer, nullptr);
+    EXPECT_STREQ(Buffer,
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<svg width=\"25\" height=\"20\" xmlns=\"http://www.w3.org/2000/svg\">\n"
+        "  <rect x=\"0.000000\" y=\"0.000000\" width=\"10.000000\" height=\"10.000000\" style=\"fill:#000\"/>\n"
+        "  <rect x=\"10.000000\" y=\"0.000000\" width=\"10.000000\" height=\"10.000000\" style=\"fill:#888\"/>\n"
+        "  <rect x=\"20.000000\" y=\"10.000000\" width=\"5.000000\" height=\"10.000000\" style=\"fill:#ccc\"/>\n"
+        "</svg>\n");
+    free(Buffer);
+}
+
+TEST(SVGDensityTest, CountsCentersUnderSingularTransforms){
+    svg_context_ptr context = svg_create_memory(20, 10);
+    ASSERT_NE(context, nullptr);
+    EXPECT_EQ(svg_set_precision(context, 0), SVG_OK);
+    EXPECT_EQ(svg_density_begin(context, 10), SVG_OK);
+    // flattening onto y = 5 leaves no circle to draw, but every center lands on the canvas
+    svg_matrix_t Flatten = {1, 0, 0, 0, 0, 5};
+    EXPECT_EQ(svg_transform_push(context, &Flatten), SVG_OK);
+    svg_point_t Center = {2, 50};
+    EXPECT_EQ(svg_circle(context, &Center, 1, NULL), SVG_OK);
+    svg_coord_t Xs[] = {12, 13}, Ys[] = {70, 80}, Radii[] = {1, 1};
+    EXPECT_EQ(svg_circles(context, Xs, Ys, Radii, 2, NULL), SVG_OK);
+    EXPECT_EQ(svg_transform_pop(context), SVG_OK);
+    const char *Styles[] = {"fill:#888", "fill:#000"};
+    svg_colormap_t Colormap = {Styles, 2, 0};
+    EXPECT_EQ(svg_density_end(context, &Colormap), SVG_OK);
+
+    char *Buffer = nullptr;
+    EXPECT_EQ(svg_detach_buffer(context, &Buffer, NULL), SVG_OK);
+    ASSERT_NE(Buffer, nullptr);
+    std::string Result(Buffer);
+    free(Buffer);
+    EXPECT_NE(Result.find("  <rect x=\"0\" y=\"0\" width=\"10\" height=\"10\" style=\"fill:#888\"/>\n"
+                          "  <rect x=\"10\" y=\"0\" width=\"10\" height=\"10\" style=\"fill:#000\"/>\n"
+                          "</svg>"), std::string::npos) << Result;
+}
+
+// Measures a density map of count uniformly scattered points.
+static size_t MeasureDensity(size_t count){
+    svg_context_ptr context = svg_create_measure(400, 300);
+    EXPECT_NE(context, nullptr);
+    EXPECT_EQ(svg_set_precision(context, 0), SVG_OK);
+    EXPECT_EQ(svg_density_begin(context, 20), SVG_OK);
+    std::mt19937 Generator(7);
+    std::uniform_real_distribution<double> X(0, 400), Y(0, 300);
+    std::vector<svg_point_t> Points(count);
+    for(auto &Point : Points){
+        Point = {X(Generator), Y(Generator)};
+    }
+    EXPECT_EQ(svg_density_points(context, Points.data(), Points.size()), SVG_OK);
+    EXPECT_EQ(svg_density_end(context, NULL), SVG_OK);
+    size_t Length = 0;
+    EXPECT_EQ(svg_measure(context, &Length), SVG_OK);
+    return Length;
+}
+
+TEST(SVGDensityTest, SizeFollowsCanvasNotPoints){
+    // every cell is filled either way and the default styles are all one length
+    EXPECT_EQ(MeasureDensity(20000), MeasureDensity(2000000));
+}
+
+TEST(SVGDensityTest, ShardsMergeCounts){
+    const int ShardCount = 4, PerShard = 25000;
+    auto Scatter = [](svg_context_ptr context, int first, int count){
+        for(int Index = first; Index < first + count; Index++){
+            svg_point_t Point = {(svg_coord_t)(Index % 97), (svg_coord_t)((Index * 31) % 89)};
+            EXPECT_EQ(svg_circle(context, &Point, 1, NULL), SVG_OK);
+        }
+    };
+    svg_context_ptr Serial = svg_create_memory(100, 90);
+    svg_context_ptr Parallel = svg_create_memory(100, 90);
+    ASSERT_NE(Serial, nullptr);
+    ASSERT_NE(Parallel, nullptr);
+    EXPECT_EQ(svg_density_begin(Serial, 3), SVG_OK);
+    EXPECT_EQ(svg_density_begin(Parallel, 3), SVG_OK);
+    Scatter(Serial, 0, ShardCount * PerShard);
+    EXPECT_EQ(svg_producer_create(Parallel), nullptr);
+    svg_context_ptr Shards[ShardCount];
+    std::vector<std::thread> Threads;
+    for(int Index = 0; Index < ShardCount; Index++){
+        Shards[Index] = svg_shard_create(Parallel);
+        ASSERT_NE(Shards[Index], nullptr);
+        Threads.emplace_back(Scatter, Shards[Index], Index * PerShard, PerShard);
+    }
+    for(int Index = 0; Index < ShardCount; Index++){
+        Threads[Index].join();
+        EXPECT_EQ(svg_shard_commit(Parallel, Shards[Index]), SVG_OK);
+    }
+    EXPECT_EQ(svg_density_end(Serial, NULL), SVG_OK);
+    EXPECT_EQ(svg_density_end(Parallel, NULL), SVG_OK);
+    char *SerialBuffer = nullptr, *ParallelBuffer = nullptr;
+    EXPECT_EQ(svg_detach_buffer(Serial, &SerialBuffer, NULL), SVG_OK);
+    EXPECT_EQ(svg_detach_buffer(Parallel, &ParallelBuffer, NULL), SVG_OK);
+    ASSERT_NE(SerialBuffer, nullptr);
+    ASSERT_NE(ParallelBuffer, nullptr);
+    EXPECT_NE(std::string(SerialBuffer).find("<rect"), std::string::npos);
+    EXPECT_STREQ(ParallelBuffer, SerialBuffer);
+    free(SerialBuffer);
+    free(ParallelBuffer);
+}
+
+TEST(SVGDensityTest, InvalidUse){
+    svg_point_t Point = {1, 1};
+    EXPECT_EQ(svg_density_begin(NULL, 1), SVG_ERR_NULL);
+    EXPECT_EQ(svg_density_points(NULL, &Point, 1), SVG_ERR_NULL);
+    EXPECT_EQ(svg_density_end(NULL, NULL), SVG_ERR_NULL);
+
+    svg_context_ptr context = svg_create_memory(100, 100);
+    ASSERT_NE(context, nullptr);
+    EXPECT_EQ(svg_density_begin(context, 0), SVG_ERR_INVALID_ARG);
+    EXPECT_EQ(svg_density_points(context, &Point, 1), SVG_ERR_STATE);
+    EXPECT_EQ(svg_density_end(context, NULL), SVG_ERR_STATE);
+    EXPECT_EQ(svg_density_begin(context, 10), SVG_OK);
+    EXPECT_EQ(svg_density_begin(context, 10), SVG_ERR_STATE);
+    EXPECT_EQ(svg_density_points(context, NULL, 1), SVG_ERR_INVALID_ARG);
+    size_t Id;
+    EXPECT_EQ(svg_symbol_begin(context, &Id), SVG_ERR_STATE);
+    EXPECT_EQ(svg_frame_begin(context), SVG_ERR_STATE);
+    svg_colormap_t Empty = {NULL, 0, 0};
+    EXPECT_EQ(svg_density_end(context, &Empty), SVG_ERR_INVALID_ARG);
+
+    // a shard of a map that has ended cannot be committed
+    svg_context_ptr Shard = svg_shard_create(context);
+    ASSERT_NE(Shard, nullptr);
+    EXPECT_EQ(svg_density_points(Shard, &Point, 1), SVG_OK);
+    EXPECT_EQ(svg_density_end(Shard, NULL), SVG_ERR_STATE);
+    EXPECT_EQ(svg_density_end(context, NULL), SVG_OK);
+    EXPECT_EQ(svg_shard_commit(context, Shard), SVG_ERR_STATE);
+    EXPECT_EQ(svg_destroy(Shard), SVG_OK);
+
+    // an open map is dropped when the context is destroyed
+    EXPECT_EQ(svg_density_begin(context, 10), SVG_OK);
+    EXPECT_EQ(svg_density_points(context, &Point, 1), SVG_OK);
+    char *Buffer = nullptr;
+    EXPECT_EQ(svg_detach_buffer(context, &Buffer, NULL), SVG_OK);
+    ASSERT_NE(Buffer, nullptr);
+    EXPECT_EQ(std::string(Buffer).find("<rect"), std::string::npos);
+    free(Buffer);
+}
+
+// --- STATISTICS ---
+TEST(SVGStatsTest, CountsElementsAndWrites){
+    STestOutput Output;
+    svg_context_ptr context = svg_create(write_callback, NULL, &Output, 100, 100);
+    ASSERT_NE(context, nullptr);
+    svg_stats_t Stats;
+    svg_point_t Center = {5, 5}, End = {9, 9}, Outside = {500, 500};
+    svg_size_t Size = {2, 2};
+    // nothing is collected until statistics are on
+    EXPECT_EQ(svg_circle(context, &Center, 1, NULL), SVG_OK);
+    EXPECT_EQ(svg_get_stats(context, &Stats), SVG_OK);
+    EXPECT_EQ(Stats.circles, 0u);
+
+    EXPECT_EQ(svg_set_stats(context, 1), SVG_OK);
+    EXPECT_EQ(svg_set_culling(context, 1, 0), SVG_OK);
+    EXPECT_EQ(svg_set_flush_threshold(context, 0), SVG_OK);
+    EXPECT_EQ(svg_group_begin(context, NULL), SVG_OK);
+    EXPECT_EQ(svg_circle(context, &Center, 1, NULL), SVG_OK);
+    EXPECT_EQ(svg_circle(context, &Outside, 1, NULL), SVG_OK);
+    EXPECT_EQ(svg_rect(context, &Center, &Size, NULL), SVG_OK);
+    EXPECT_EQ(svg_line(context, &Center, &End, NULL), SVG_OK);
+    EXPECT_EQ(svg_group_end(context), SVG_OK);
+    svg_point_t Points[] = {{1, 1}, {2, 3}, {4, 1}};
+    EXPECT_EQ(svg_path_begin(context, NULL), SVG_OK);
+    EXPECT_EQ(svg_path_points(context, Points, 3), SVG_OK);
+    EXPECT_EQ(svg_path_end(context), SVG_OK);
+    size_t Id;
+    EXPECT_EQ(svg_symbol_begin(context, &Id), SVG_OK);
+    EXPECT_EQ(svg_circle(context, &Center, 1, NULL), SVG_OK);
+    EXPECT_EQ(svg_symbol_end(context), SVG_OK);
+    EXPECT_EQ(svg_use(context, Id, &End), SVG_OK);
+
+    svg_context_ptr Shard = svg_shard_create(context);
+    ASSERT_NE(Shard, nullptr);
+    EXPECT_EQ(svg_circle(Shard, &End, 1, NULL), SVG_OK);
+    EXPECT_EQ(svg_shard_commit(context, Shard), SVG_OK);
+
+    EXPECT_EQ(svg_get_stats(context, &Stats), SVG_OK);
+    EXPECT_EQ(Stats.circles, 3u);
+    EXPECT_EQ(Stats.rects, 1u);
+    EXPECT_EQ(Stats.lines, 1u);
+    EXPECT_EQ(Stats.paths, 1u);
+    EXPECT_EQ(Stats.path_points, 3u);
+    EXPECT_EQ(Stats.groups, 1u);
+    EXPECT_EQ(Stats.symbols, 1u);
+    EXPECT_EQ(Stats.uses, 1u);
+    EXPECT_EQ(Stats.write_errors, 0u);
+    // a zero threshold writes every element as it is finished
+    EXPECT_EQ(Stats.writes, Output.DLines.size());
+    EXPECT_EQ(Stats.flushes, Stats.writes);
+    EXPECT_EQ(Stats.bytes_out, Output.JoinOutput().size());
+    uint64_t Timed = 0;
+    for(uint64_t Calls : Stats.write_latency){
+        Timed += Calls;
+    }
+    EXPECT_EQ(Timed, Stats.writes);
+
+    // turning statistics off and on again clears them
+    EXPECT_EQ(svg_set_stats(context, 0), SVG_OK);
+    EXPECT_EQ(svg_get_stats(context, &Stats), SVG_OK);
+    EXPECT_EQ(Stats.writes, 0u);
+    EXPECT_EQ(svg_set_stats(context, 1), SVG_OK);
+    EXPECT_EQ(svg_get_stats(context, &Stats), SVG_OK);
+    EXPECT_EQ(Stats.circles, 0u);
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+
+    // failed writes are counted, also from the writer thread
+    int FailureCount = 1;
+    context = svg_create(write_error_callback, NULL, &FailureCount, 100, 100);
+    ASSERT_NE(context, nullptr);
+    EXPECT_EQ(svg_set_stats(context, 1), SVG_OK);
+    EXPECT_EQ(svg_set_async(context, 2), SVG_OK);
+    EXPECT_EQ(svg_flush(context), SVG_OK);
+    EXPECT_EQ(svg_circle(context, &Center, 1, NULL), SVG_OK);
+    EXPECT_EQ(svg_flush(context), SVG_ERR_IO);
+    EXPECT_EQ(svg_get_stats(context, &Stats), SVG_OK);
+    EXPECT_EQ(Stats.writes, 2u);
+    EXPECT_EQ(Stats.write_errors, 1u);
+    EXPECT_EQ(svg_destroy(context), SVG_ERR_IO);
+
+    EXPECT_EQ(svg_set_stats(NULL, 1), SVG_ERR_NULL);
+    EXPECT_EQ(svg_get_stats(NULL, &Stats), SVG_ERR_NULL);
+    EXPECT_EQ(svg_set_trace(NULL, write_callback, NULL), SVG_ERR_NULL);
+}
+
+TEST(SVGStatsTest, TracesGroupSpans){
+    STestOutput Output, Trace;
+    svg_context_ptr context = svg_create(write_callback, NULL, &Output, 100, 100);
+    ASSERT_NE(context, nullptr);
+    EXPECT_EQ(svg_set_trace(context, write_callback, &Trace), SVG_OK);
+    EXPECT_EQ(svg_group_begin(context, "id=\"outer\" class=\"a\\b\""), SVG_OK);
+    EXPECT_EQ(svg_group_begin(context, NULL), SVG_OK);
+    EXPECT_EQ(svg_group_end(context), SVG_OK);
+    EXPECT_EQ(svg_group_end(context), SVG_OK);
+    EXPECT_EQ(svg_set_trace(context, NULL, NULL), SVG_OK);
+    EXPECT_EQ(svg_group_begin(context, NULL), SVG_OK);
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+
+    std::string Text = Trace.JoinOutput();
+    EXPECT_EQ(Text.compare(0, 2, "[\n"), 0);
+    EXPECT_NE(Text.find("\"ph\":\"B\""), std::string::npos);
+    EXPECT_NE(Text.find("\"args\":{\"depth\":1,\"attrs\":\"id=\\\"outer\\\" class=\\\"a\\\\b\\\"\"}},\n"),
+              std::string::npos);
+    size_t Begins = 0, Ends = 0;
+    for(size_t Position = 0; (Position = Text.find("\"ph\":\"", Position)) != std::string::npos; Position++){
+        Begins += Text[Position + 6] == 'B';
+        Ends += Text[Position + 6] == 'E';
+    }
+    EXPECT_EQ(Begins, 2u);
+    EXPECT_EQ(Ends, 2u);
+    // every event is a line of its own ending in a comma
+    size_t Lines = 0;
+    for(char Character : Text){
+        Lines += Character == '\n';
+    }
+    EXPECT_EQ(Lines, 5u);
+    EXPECT_EQ(Text.substr(Text.size() - 2), ",\n");
+}
+
+// Output of every tile of a tile set, keyed by column and row
+struct STileOutput{
+    std::mutex DLock;
+    std::map<std::pair<size_t, size_t>, std::string> DTiles;
+};
+
+// Callback to capture tile output; writer threads may call it at once
+svg_return_t tile_write_callback(svg_user_context_ptr user, size_t column, size_t row, const char *data, size_t length){
+    STileOutput *OutPtr = static_cast<STileOutput *>(user);
+    std::lock_guard<std::mutex> Guard(OutPtr->DLock);
+    OutPtr->DTiles[{column, row}].append(data, length);
+    return SVG_OK;
+}
+
+TEST(SVGTilesTest, RoutesAndClipsAcrossTiles){
+    STileOutput Output;
+    svg_tiles_options_t Options = {};
+    Options.width = 250;
+    Options.height = 100;
+    Options.tile_width = 100;
+    Options.tile_height = 100;
+    Options.write_fn = tile_write_callback;
+    Options.user = &Output;
+    svg_tiles_ptr Tiles = svg_tiles_create(&Options);
+    ASSERT_NE(Tiles, nullptr);
+    svg_context_ptr context = svg_create_tiling(Tiles);
+    ASSERT_NE(context, nullptr);
+    size_t Columns, Rows, Used;
+    EXPECT_EQ(svg_tiles_get_grid(Tiles, &Columns, &Rows, &Used), SVG_OK);
+    EXPECT_EQ(Columns, 3u);
+    EXPECT_EQ(Rows, 1u);
+    svg_px_t Width, Height;
+    EXPECT_EQ(svg_tiles_get_canvas(Tiles, &Width, &Height), SVG_OK);
+    EXPECT_EQ(Width, 250);
+    EXPECT_EQ(Height, 100);
+
+    svg_point_t Corner = {50, 10}, Center = {100, 50}, Near = {20, 20}, Start = {10, 60}, End = {190, 80};
+    svg_size_t Size = {100, 20};
+    EXPECT_EQ(svg_rect(context, &Corner, &Size, NULL), SVG_OK);
+    EXPECT_EQ(svg_circle(context, &Center, 5, NULL), SVG_OK);
+    EXPECT_EQ(svg_circle(context, &Near, 5, NULL), SVG_OK);
+    EXPECT_EQ(svg_group_begin(context, "id=\"late\""), SVG_OK);
+    EXPECT_EQ(svg_line(context, &Start, &End, NULL), SVG_OK);
+    EXPECT_EQ(svg_group_end(context), SVG_OK);
+    EXPECT_EQ(svg_group_end(context), SVG_ERR_STATE);
+    EXPECT_EQ(svg_path_begin(context, NULL), SVG_ERR_STATE);
+    EXPECT_EQ(svg_shard_create(context), nullptr);
+    EXPECT_EQ(svg_destroy(context), SVG_OK);
+
+    STestOutput Index;
+    EXPECT_EQ(svg_tiles_index(Tiles, write_callback, &Index), SVG_OK);
+    EXPECT_EQ(svg_tiles_get_grid(Tiles, NULL, NULL, &Used), SVG_OK);
+    EXPECT_EQ(Used, 2u);
+    EXPECT_EQ(svg_tiles_destroy(Tiles), SVG_OK);
+
+    // each tile is a document of its own in tile coordinates
+    ASSERT_EQ(Output.DTiles.size(), 2u);
+    EXPECT_EQ((Output.DTiles[{0, 0}]),
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<svg width=\"100\" height=\"100\" xmlns=\"http://www.w3.org/2000/svg\">\n"
+        "  <rect x=\"50.000000\" y=\"10.000000\" width=\"50.000000\" height=\"20.000000\"/>\n"
+        "  <circle cx=\"100.000000\" cy=\"50.000000\" r=\"5.000000\"/>\n"
+        "  <circle cx=\"20.000000\" cy=\"20.000000\" r=\"5.000000\"/>\n"
+        "  <g id=\"late\">\n"
+        "    <line x1=\"10.000000\" y1=\"60.000000\" x2=\"100.000000\" y2=\"70.000000\"/>\n"
+        "  </g>\n"
+        "</svg>\n");
+    EXPECT_EQ((Output.DTiles[{1, 0}]),
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<svg width=\"100\" height=\"100\" xmlns=\"http://www.w3.org/2000/svg\">\n"
+        "  <rect x=\"0.000000\" y=\"10.000000\" width=\"50.000000\" height=\"20.000000\"/>\n"
+        "  <circle cx=\"0.000000\" cy=\"50.000000\" r=\"5.000000\"/>\n"
+        "  <g id=\"late\">\n"
+        "    <line x1=\"0.000000\" y1=\"70.000000\" x2=\"90.000000\" y2=\"80.000000\"/>\n"
+        "  </g>\n"
+        "</svg>\n");
+    EXPECT_EQ(Index.JoinOutput(),
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<svg width=\"250\" height=\"100\" xmlns=\"http://www.w3.org/2000/svg\">\n"
+        "  <image href=\"tile_0_0.svg\" x=\"0\" y=\"0\" width=\"100\" height=\"100\" />\n"
+        "  <image href=\"tile_1_0.svg\" x=\"100\" y=\"0\" width=\"100\" height=\"100\" />\n"
+        "</svg>\n");
+
+    // sizes are checked before any rectangle is drawn
+    Tiles = svg_tiles_create(&Options);
+    ASSERT_NE(Tiles, nullptr);
+    svg_coord_t Xs[2] = {10, 20}, Ys[2] = {10, 20}, Widths[2] = {5, -5}, Heights[2] = {5, 5};
+    EXPECT_EQ(svg_tiles_rects(Tiles, Xs, Ys, Widths, Heights, 2, NULL), SVG_ERR_INVALID_ARG);
+    Widths[1] = 5;
+    Heights[1] = NAN;
+    EXPECT_EQ(svg_tiles_rects(Tiles, Xs, Ys, Widths, Heights, 2, NULL), SVG_ERR_INVALID_ARG);
+    EXPECT_EQ(svg_tiles_get_grid(Tiles, NULL, NULL, &Used), SVG_OK);
+    EXPECT_EQ(Used, 0u);
+    EXPECT_EQ(svg_tiles_destroy(Tiles), SVG_OK);
+
+    EXPECT_EQ(svg_tiles_create(NULL), nullptr);
+    Options.directory = "testbin";
+    EXPECT_EQ(svg_tiles_create(&Options), nullptr);
+    Options.directory = NULL;
+    Options.tile_width = 0;
+    EXPECT_EQ(svg_tiles_create(&Options), nullptr);
+    EXPECT_EQ(svg_create_tiling(NULL), nullptr);
+    EXPECT_EQ(svg_tiles_group_end(NULL), SVG_ERR_NULL);
+    EXPECT_EQ(svg_tiles_destroy(NULL), SVG_ERR_NULL);
+}
+
+// Draws a scene spread over a 1000x1000 canvas with elements crossing tiles
+static svg_return_t DrawTiledScene(svg_tiles_ptr tiles){
+    std::mt19937 Generator(7);
+    std::uniform_real_distribution<double> Position(-20, 1020), Extent(1, 150);
+    std::vector<svg_coord_t> Xs(500), Ys(500), Widths(500), Heights(500);
+    for(size_t Index = 0; Index < Xs.size(); Index++){
+        Xs[Index] = Position(Generator);
+        Ys[Index] = Position(Generator);
+        Widths[Index] = Extent(Generator);
+        Heights[Index] = Extent(Generator);
+    }
+    svg_return_t Result = SVG_OK;
+    for(int Layer = 0; Layer < 8 && Result == SVG_OK; Layer++){
+        Result = svg_tiles_group_begin(tiles, Layer % 2 ? "class=\"odd\"" : NULL);
+        if(Result == SVG_OK){
+            Result = svg_tiles_circles(tiles, Xs.data(), Ys.data(), Widths.data(), Xs.size(), "fill:red");
+        }
+        if(Result == SVG_OK){
+            Result = svg_tiles_rects(tiles, Ys.data(), Xs.data(), Widths.data(), Heights.data(), Xs.size(), NULL);
+        }
+        if(Result == SVG_OK){
+            Result = svg_tiles_lines(tiles, Xs.data(), Ys.data(), Ys.data(), Xs.data(), Xs.size(), "stroke:blue");
+        }
+        if(Result == SVG_OK){
+            Result = svg_tiles_group_end(tiles);
+        }
+    }
+    return Result;
+}
+
+TEST(SVGTilesTest, ThreadedMatchesSerial){
+    STileOutput Serial, Threaded;
+    svg_tiles_options_t Options = {};
+    Options.width = 1000;
+    Options.height = 1000;
+    Options.tile_width = 128;
+    Options.tile_height = 128;
+    Options.margin = 2;
+    Options.write_fn = tile_write_callback;
+    Options.tile_buffer = 256;
+    Options.user = &Serial;
+    svg_tiles_ptr Tiles = svg_tiles_create(&Options);
+    ASSERT_NE(Tiles, nullptr);
+    EXPECT_EQ(DrawTiledScene(Tiles), SVG_OK);
+    EXPECT_EQ(svg_tiles_destroy(Tiles), SVG_OK);
+
+    Options.user = &Threaded;
+    Options.threads = 4;
+    Tiles = svg_tiles_create(&Options);
+    ASSERT_NE(Tiles, nullptr);
+    EXPECT_EQ(DrawTiledScene(Tiles), SVG_OK);
+    EXPECT_EQ(svg_tiles_destroy(Tiles), SVG_OK);
+
+    EXPECT_EQ(Serial.DTiles.size(), 64u);
+    EXPECT_TRUE(Serial.DTiles == Threaded.DTiles);
+    // every piece of a clipped element stays within its tile and margin
+    for(const auto &Tile : Serial.DTiles){
+        const std::string &Text = Tile.second;
+        EXPECT_EQ(Text.substr(Text.size() - 7), "</svg>\n");
+        for(size_t Position = 0; (Position = Text.find("<line x1=\"", Position)) != std::string::npos; Position++){
+            double X1, Y1, X2, Y2;
+            ASSERT_EQ(std::sscanf(Text.c_str() + Position, "<line x1=\"%lf\" y1=\"%lf\" x2=\"%lf\" y2=\"%lf\"",
+                                  &X1, &Y1, &X2, &Y2), 4);
+            for(double Value : {X1, Y1, X2, Y2}){
+                EXPECT_GE(Value, -2.000001);
+                EXPECT_LE(Value, 130.000001);
+            }
+        }
+    }
+}
+
+TEST(SVGTilesTest, DirectoryReopensFiles){
+    STileOutput Expected;
+    svg_tiles_options_t Options = {};
+    Options.width = 1000;
+    Options.height = 1000;
+    Options.tile_width = 100;
+    Options.tile_height = 100;
+    Options.tile_buffer = 64;
+    Options.write_fn = tile_write_callback;
+    Options.user = &Expected;
+    svg_tiles_ptr Tiles = svg_tiles_create(&Options);
+    ASSERT_NE(Tiles, nullptr);
+    EXPECT_EQ(DrawTiledScene(Tiles), SVG_OK);
+    EXPECT_EQ(svg_tiles_destroy(Tiles), SVG_OK);
+
+    // a hundred tiles written in small pieces outnumber the open files
+    mkdir("testbin/tiles", 0755);
+    Options.write_fn = NULL;
+    Options.user = NULL;
+    Options.directory = "testbin/tiles";
+    Options.threads = 2;
+    Tiles = svg_tiles_create(&Options);
+    ASSERT_NE(Tiles, nullptr);
+    EXPECT_EQ(DrawTiledScene(Tiles), SVG_OK);
+    EXPECT_EQ(svg_tiles_destroy(Tiles), SVG_OK);
+
+    ASSERT_EQ(Expected.DTiles.size(), 100u);
+    std::string Index = ReadFile("testbin/tiles/index.svg");
+    for(const auto &Tile : Expected.DTiles){
+        std::string Name = "tile_" + std::to_string(Tile.first.first) + "_" + std::to_string(Tile.first.second) + ".svg";
+        std::string Path = "testbin/tiles/" + Name;
+        EXPECT_EQ(ReadFile(Path.c_str()), Tile.second) << Name;
+        EXPECT_NE(Index.find("href=\"" + Name + "\""), std::string::npos) << Name;
+        std::remove(Path.c_str());
+    }
+    std::remove("testbin/tiles/index.svg");
+
+    // a writer thread's failure reaches the drawing thread with its next write
+    Options.directory = "no/such/directory";
+    Tiles = svg_tiles_create(&Options);
+    ASSERT_NE(Tiles, nullptr);
+    svg_return_t Drawn = DrawTiledScene(Tiles);
+    EXPECT_TRUE(Drawn == SVG_OK || Drawn == SVG_ERR_IO);
+    EXPECT_EQ(svg_tiles_destroy(Tiles), SVG_ERR_IO);
+}
+
+TEST(SVGTilesTest, AllocatesWithHooks){
+    long Live = 0;
+    STileOutput Output;
+    svg_tiles_options_t Options = {};
+    Options.width = 1000;
+    Options.height = 1000;
+    Options.tile_width = 100;
+    Options.tile_height = 100;
+    Options.tile_buffer = 64;
+    Options.write_fn = tile_write_callback;
+    Options.user = &Output;
+    Options.allocator = {counting_alloc, counting_realloc, counting_free, &Live, 0};
+    // writer threads would call hooks not marked thread-safe
+    Options.threads = 2;
+    EXPECT_EQ(svg_tiles_create(&Options), nullptr);
+    Options.threads = 0;
+    svg_tiles_ptr Tiles = svg_tiles_create(&Options);
+    ASSERT_NE(Tiles, nullptr);
+    HeapCalls = 0;
+    CountingHeap = true;
+    svg_return_t Drawn = DrawTiledScene(Tiles);
+    CountingHeap = false;
+    EXPECT_EQ(Drawn, SVG_OK);
+    // tiles and their contexts take memory from the hooks only
+    EXPECT_EQ(HeapCalls.load(), 0u);
+    EXPECT_GT(Live, 0);
+    EXPECT_EQ(svg_tiles_destroy(Tiles), SVG_OK);
+    EXPECT_EQ(Live, 0);
+    EXPECT_EQ(Output.DTiles.size(), 100u);
+}